@@ -188,6 +188,11 @@ UA_StatusCode UA_EXPORT UA_Client_disconnect(UA_Client *client);
 /* Renew the underlying secure channel */
 UA_StatusCode UA_EXPORT UA_Client_manuallyRenewSecureChannel(UA_Client *client);
 
+/* Open a new connection and SecureChannel to the endpoint of the last
+ * connection and re-activate the existing session on it. Subscriptions of the
+ * session are retained. Fails if no session was established before. */
+UA_StatusCode UA_EXPORT UA_Client_reconnect(UA_Client *client);
+
 /**
  * .. _client-services:
  *
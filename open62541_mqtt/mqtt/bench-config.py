@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+# This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+# See http://creativecommons.org/publicdomain/zero/1.0/ for more information.
+
+"""Config load benchmark : node-maps of growing size through 'opcua-mqtt-bridge --check'.
+
+    ./bench-config.py ./opcua-mqtt-bridge [--nodes 1000,10000,100000] [--groups 100] [--runs 5]
+
+prints per size the file size, the median load time reported by the bridge
+and the wall time of the whole process (exec, load, exit) with its peak RSS.
+"""
+
+import argparse
+import json
+import os
+import re
+import resource
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+SERVER = {
+    "opcuaServer": {
+        "EndpointURL": "opc.tcp://localhost:16664",
+        "publishIntervalUs": 100000,
+        "asycRequestSupported": False,
+        "method": "poll",
+    },
+    "mqttBrocker": {"enable": False, "ip": "127.0.0.1", "port": 1883, "topicBase": "topic"},
+    "amqpRabbit": {"enable": False, "ip": "127.0.0.1", "port": 5671, "topicBase": "topic"},
+    "tcpSever": {"enable": False, "ip": "127.0.0.1", "port": 5555, "sampleIntervalUs": 100, "singleshot": True},
+}
+
+
+def node_map(nodes, groups):
+    per = max(1, nodes // groups)
+    out = []
+    for g in range((nodes + per - 1) // per):
+        count = min(per, nodes - g * per)
+        out.append({
+            "name": "g%d" % g,
+            "enable": True,
+            "method": "poll",
+            "intervalUSec": 1000000,
+            "topic": "line/%d" % g,
+            "mqtt": True,
+            "format": "json",
+            "nodes": [{"id": "ns=2;s=plc.g%d.tag%d" % (g, k), "topic": "tag%d" % k, "alias": ""} for k in range(count)],
+        })
+    return out
+
+
+def run(bridge, path):
+    before = resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss
+    start = time.monotonic()
+    p = subprocess.run([bridge, "--check", "-c", path], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    wall = (time.monotonic() - start) * 1000.0
+    rss = max(before, resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss)
+
+    m = re.search(r"\[config\] .* loaded in ([0-9.]+) ms", p.stdout)
+    if p.returncode != 0 or not m:
+        sys.exit("%s failed :\n%s" % (path, p.stdout[-2000:]))
+    return float(m.group(1)), wall, rss
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("bridge")
+    ap.add_argument("--nodes", default="1000,10000,100000")
+    ap.add_argument("--groups", type=int, default=100)
+    ap.add_argument("--runs", type=int, default=5)
+    args = ap.parse_args()
+
+    bridge = os.path.abspath(args.bridge)
+    print("%8s %10s %12s %12s %10s" % ("nodes", "file MB", "load ms", "process ms", "rss MB"))
+
+    with tempfile.TemporaryDirectory() as tmp:
+        for nodes in [int(n) for n in args.nodes.split(",")]:
+            path = os.path.join(tmp, "bench-%d.json" % nodes)
+            with open(path, "w") as f:
+                json.dump({
+                    "device-configuration": {"Device": {"deviceID": "bench"}},
+                    "server-configuration": SERVER,
+                    "node-map": node_map(nodes, args.groups),
+                }, f, indent=1)
+
+            results = [run(bridge, path) for _ in range(args.runs)]
+            print("%8d %10.1f %12.1f %12.1f %10.1f" % (
+                nodes,
+                os.path.getsize(path) / 1e6,
+                statistics.median(r[0] for r in results),
+                statistics.median(r[1] for r in results),
+                max(r[2] for r in results) / 1024.0))
+
+
+if __name__ == "__main__":
+    main()
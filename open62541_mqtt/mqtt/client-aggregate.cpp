@@ -0,0 +1,218 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "client-aggregate.h"
+
+static const struct {
+	unsigned int aggregate;
+	const char* name;
+} aggregates[] = {
+	{ UAMQ_AGG_MIN, "min" },
+	{ UAMQ_AGG_MAX, "max" },
+	{ UAMQ_AGG_MEAN, "mean" },
+	{ UAMQ_AGG_COUNT, "count" },
+	{ UAMQ_AGG_FIRST, "first" },
+	{ UAMQ_AGG_LAST, "last" },
+	{ UAMQ_AGG_STDDEV, "stddev" },
+};
+
+unsigned int getAggregate(const char* name)
+{
+	for (size_t i = 0; i < sizeof(aggregates) / sizeof(aggregates[0]); i++) {
+		if(!strcmp(name, aggregates[i].name)) {
+			return aggregates[i].aggregate;
+		}
+	}
+
+	/* "avg" as in UA_LeptonItem */
+	if(!strcmp(name, "avg")) {
+		return UAMQ_AGG_MEAN;
+	}
+
+	return 0;
+}
+
+const char* getAggregateName(unsigned int aggregate)
+{
+	for (size_t i = 0; i < sizeof(aggregates) / sizeof(aggregates[0]); i++) {
+		if(aggregates[i].aggregate == aggregate) {
+			return aggregates[i].name;
+		}
+	}
+
+	return "";
+}
+
+void agg_ring_init(AggRing* r, size_t capacity)
+{
+	if(capacity < 16) {
+		capacity = 16;
+	}
+
+	r->values = (double*)malloc(capacity * sizeof(double));
+	r->times = (int64_t*)malloc(capacity * sizeof(int64_t));
+	r->capacity = capacity;
+	r->head = 0;
+	r->size = 0;
+}
+
+void agg_ring_free(AggRing* r)
+{
+	free(r->values);
+	free(r->times);
+	r->values = NULL;
+	r->times = NULL;
+	r->capacity = r->head = r->size = 0;
+}
+
+/* the window is longer than expected (slow reads catching up, a short
+ * interval), double the ring and unwrap it so head is 0 again. */
+static void agg_ring_grow(AggRing* r)
+{
+	size_t capacity = r->capacity * 2;
+	double* values = (double*)malloc(capacity * sizeof(double));
+	int64_t* times = (int64_t*)malloc(capacity * sizeof(int64_t));
+
+	size_t first = r->capacity - r->head;
+	if(first > r->size) {
+		first = r->size;
+	}
+
+	memcpy(values, r->values + r->head, first * sizeof(double));
+	memcpy(values + first, r->values, (r->size - first) * sizeof(double));
+	memcpy(times, r->times + r->head, first * sizeof(int64_t));
+	memcpy(times + first, r->times, (r->size - first) * sizeof(int64_t));
+
+	free(r->values);
+	free(r->times);
+
+	r->values = values;
+	r->times = times;
+	r->capacity = capacity;
+	r->head = 0;
+}
+
+void agg_ring_push(AggRing* r, int64_t t, double v)
+{
+	if(r->size == r->capacity) {
+		agg_ring_grow(r);
+	}
+
+	size_t tail = (r->head + r->size) % r->capacity;
+	r->values[tail] = v;
+	r->times[tail] = t;
+	r->size++;
+}
+
+/* drop the samples taken at or before 'upto', they left the window */
+void agg_ring_evict(AggRing* r, int64_t upto)
+{
+	while(r->size && r->times[r->head] <= upto) {
+		r->head = (r->head + 1) % r->capacity;
+		r->size--;
+	}
+}
+
+/* four independent lanes keep the loop free of a serial dependency so the
+ * compiler can map it on SSE/NEON registers without -ffast-math. */
+static void reduce_span(const double* v, size_t n, double* mn, double* mx, double* sum)
+{
+	double l0 = *mn, l1 = *mn, l2 = *mn, l3 = *mn;
+	double h0 = *mx, h1 = *mx, h2 = *mx, h3 = *mx;
+	double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		l0 = v[i] < l0 ? v[i] : l0;
+		l1 = v[i + 1] < l1 ? v[i + 1] : l1;
+		l2 = v[i + 2] < l2 ? v[i + 2] : l2;
+		l3 = v[i + 3] < l3 ? v[i + 3] : l3;
+		h0 = v[i] > h0 ? v[i] : h0;
+		h1 = v[i + 1] > h1 ? v[i + 1] : h1;
+		h2 = v[i + 2] > h2 ? v[i + 2] : h2;
+		h3 = v[i + 3] > h3 ? v[i + 3] : h3;
+		s0 += v[i];
+		s1 += v[i + 1];
+		s2 += v[i + 2];
+		s3 += v[i + 3];
+	}
+	for (; i < n; i++) {
+		l0 = v[i] < l0 ? v[i] : l0;
+		h0 = v[i] > h0 ? v[i] : h0;
+		s0 += v[i];
+	}
+
+	l0 = l0 < l1 ? l0 : l1;
+	l2 = l2 < l3 ? l2 : l3;
+	*mn = l0 < l2 ? l0 : l2;
+	h0 = h0 > h1 ? h0 : h1;
+	h2 = h2 > h3 ? h2 : h3;
+	*mx = h0 > h2 ? h0 : h2;
+	*sum += (s0 + s1) + (s2 + s3);
+}
+
+static double deviation_span(const double* v, size_t n, double mean)
+{
+	double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		double d0 = v[i] - mean, d1 = v[i + 1] - mean;
+		double d2 = v[i + 2] - mean, d3 = v[i + 3] - mean;
+		s0 += d0 * d0;
+		s1 += d1 * d1;
+		s2 += d2 * d2;
+		s3 += d3 * d3;
+	}
+	for (; i < n; i++) {
+		double d = v[i] - mean;
+		s0 += d * d;
+	}
+
+	return (s0 + s1) + (s2 + s3);
+}
+
+/* reduce the samples taken at or before 'upto'. returns the sample count,
+ * 0 leaves 'out' untouched. stddev is the population one (two pass). */
+int agg_ring_reduce(const AggRing* r, int64_t upto, AggResult* out)
+{
+	size_t n = r->size;
+
+	/* samples are pushed in arrival order, the ones after 'upto' sit at the tail */
+	while(n && r->times[(r->head + n - 1) % r->capacity] > upto) {
+		n--;
+	}
+	if(!n) {
+		return 0;
+	}
+
+	/* the window is at most two contiguous spans of the ring */
+	const double* a = r->values + r->head;
+	size_t na = r->capacity - r->head;
+	if(na > n) {
+		na = n;
+	}
+	const double* b = r->values;
+	size_t nb = n - na;
+
+	double mn = a[0], mx = a[0], sum = 0;
+	reduce_span(a, na, &mn, &mx, &sum);
+	reduce_span(b, nb, &mn, &mx, &sum);
+
+	double mean = sum / (double)n;
+	double dev = deviation_span(a, na, mean) + deviation_span(b, nb, mean);
+
+	out->count = n;
+	out->min = mn;
+	out->max = mx;
+	out->mean = mean;
+	out->stddev = sqrt(dev / (double)n);
+	out->first = a[0];
+	out->last = r->values[(r->head + n - 1) % r->capacity];
+
+	return (int)n;
+}
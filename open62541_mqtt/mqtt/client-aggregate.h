@@ -0,0 +1,55 @@
+#ifndef OPCUA_MQTT_BRIDGE_AGGREGATE_H_
+#define OPCUA_MQTT_BRIDGE_AGGREGATE_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define UAMQ_AGG_MIN     0x01
+#define UAMQ_AGG_MAX     0x02
+#define UAMQ_AGG_MEAN    0x04
+#define UAMQ_AGG_COUNT   0x08
+#define UAMQ_AGG_FIRST   0x10
+#define UAMQ_AGG_LAST    0x20
+#define UAMQ_AGG_STDDEV  0x40
+#define UAMQ_AGG_ALL     0x7f
+
+/* per node samples of a poll group, oldest at 'head'. values and times are
+ * kept in separate arrays so the reductions run over plain double spans. */
+typedef struct {
+	double* values;
+	int64_t* times;
+	size_t capacity;
+	size_t head;
+	size_t size;
+} AggRing;
+
+typedef struct {
+	size_t count;
+	double min;
+	double max;
+	double mean;
+	double stddev;
+	double first;
+	double last;
+} AggResult;
+
+unsigned int getAggregate(const char* name);
+const char* getAggregateName(unsigned int aggregate);
+
+void agg_ring_init(AggRing* r, size_t capacity);
+void agg_ring_free(AggRing* r);
+void agg_ring_push(AggRing* r, int64_t t, double v);
+void agg_ring_evict(AggRing* r, int64_t upto);
+int agg_ring_reduce(const AggRing* r, int64_t upto, AggResult* out);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_AGGREGATE_H_ */
@@ -42,12 +42,14 @@
 #include <string.h>
 
 #include <stdint.h>
+#include <sys/socket.h>
 #include <amqp_ssl_socket.h>
 #include <amqp_framing.h>
 
 #include "utils.h"
 
 #include "client-common.h"
+#include "client-sink.h"
 
 extern UAMQ_Configuration* g_config;
 extern int beStop;
@@ -121,123 +123,121 @@ static void send_batch(amqp_connection_state_t conn,
   }
 }
 
-int amqp_main(int argc, char const *const *argv)
+/* sink plugin : the sink thread owns the connection, built with -DUAMQ_ENABLE_AMQP=ON */
+static bool amqp_sink_enabled(void)
 {
-  if(!g_config->amqpEnable) {
-    return 0;
-  }
+  return g_config->amqpEnable;
+}
 
-  char const *hostname;
-  int port, status;
-  int rate_limit;
-  int message_count;
+static int amqp_sink_open(void)
+{
   amqp_socket_t *socket;
-  //to blogal --> amqp_connection_state_t conn;
-
-  fprintf(stdout, "[amqp] start...\n");
-
-
-  hostname = g_config->mqttBrockerIP;
-  port = g_config->mqttBrockerPORT;
-
-  rate_limit = g_config->uaPublishIntervalUsecs;
-  message_count = 2;
+  amqp_rpc_reply_t reply;
 
-  do {
-    conn = amqp_new_connection();
+  fprintf(stdout, "[amqp] open %s:%d\n", g_config->amqpIP, g_config->amqpPORT);
 
-    socket = amqp_ssl_socket_new(conn);
-    if (!socket) {
-      sleep(3);
-      continue;
-    }
-  } while(!beStop && !socket);
-
-  bC = false;
+  conn = amqp_new_connection();
+  socket = amqp_ssl_socket_new(conn);
+  if (!socket) {
+    amqp_destroy_connection(conn);
+    return -1;
+  }
 
   amqp_ssl_socket_set_verify_peer(socket, 0);
   amqp_ssl_socket_set_verify_hostname(socket, 0);
 
-  // if (argc > 5) {
-  //   int nextarg = 6;
-  //   status = amqp_ssl_socket_set_cacert(socket, argv[5]);
-  //   if (status) {
-  //     die("setting CA certificate");
-  //   }
-  //   if (argc > nextarg && !strcmp("verifypeer", argv[nextarg])) {
-  //     amqp_ssl_socket_set_verify_peer(socket, 1);
-  //     nextarg++;
-  //   }
-  //   if (argc > nextarg && !strcmp("verifyhostname", argv[nextarg])) {
-  //     amqp_ssl_socket_set_verify_hostname(socket, 1);
-  //     nextarg++;
-  //   }
-  //   if (argc > nextarg + 1) {
-  //     status =
-  //         amqp_ssl_socket_set_key(socket, argv[nextarg + 1], argv[nextarg]);
-  //     if (status) {
-  //       die("setting client cert");
-  //     }
-  //   }
-  // }
-
-  status = amqp_socket_open(socket, hostname, port);
-  if (status) {
-    die("opening SSL/TLS connection");
+  if (amqp_socket_open(socket, g_config->amqpIP, g_config->amqpPORT)) {
+    amqp_destroy_connection(conn);
+    return -1;
   }
 
-  die_on_amqp_error(amqp_login(conn, "/", 0, 131072, 0, AMQP_SASL_METHOD_PLAIN, "guest", "guest"),
-                    "Logging in");
+  reply = amqp_login(conn, "/", 0, 131072, 0, AMQP_SASL_METHOD_PLAIN, "guest", "guest");
+  if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
+    amqp_destroy_connection(conn);
+    return -1;
+  }
 
   amqp_channel_open(conn, 1);
-  die_on_amqp_error(amqp_get_rpc_reply(conn), "Opening channel");
-
-  //send_batch(conn, "test queue", rate_limit, message_count);
-  bC = true;
-  while(!beStop) {
-      sleep(2);
+  reply = amqp_get_rpc_reply(conn);
+  if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
+    amqp_connection_close(conn, AMQP_REPLY_SUCCESS);
+    amqp_destroy_connection(conn);
+    return -1;
   }
 
-  die_on_amqp_error(amqp_channel_close(conn, 1, AMQP_REPLY_SUCCESS), "Closing channel");
-  die_on_amqp_error(amqp_connection_close(conn, AMQP_REPLY_SUCCESS), "Closing connection");
-  die_on_error(amqp_destroy_connection(conn), "Ending connection");
-
-  fprintf(stdout, "[amqp] stopped.\n");
+  bC = true;
 
   return 0;
 }
 
-int amqp_publish(const char* mode, char* topic, const char* value) 
+int amqp_publish(const SinkMessage* msg) 
 {
-  if(!bC) return 0;
+  if(!bC) return -1;
+
+  if(msg->binary) {
+	printf("[amqp] publish (%s) %s\t(%d bytes)\n", msg->mode, msg->topic, (int)msg->len);
+  } else {
+	printf("[amqp] publish (%s) %s\t%s\n", msg->mode, msg->topic, msg->data);
+  }
 
-	printf("[amqp] publish (%s) %s\t%s\n", mode, topic, value);
-  
+  /* amq.topic routes on dots, 'a/b/c' becomes 'a.b.c' like the rabbitmq mqtt plugin */
+  char key[256];
+  snprintf(key, sizeof(key), "%s", msg->topic);
+  for (char* c = key; *c; c++) {
+    if (*c == '/') *c = '.';
+  }
 
   amqp_bytes_t message_bytes;
 
-  message_bytes.len = sizeof(value);
+  message_bytes.len = msg->len;
 
 #pragma GCC diagnostic push  // require GCC 4.6
 #pragma GCC diagnostic ignored "-Wcast-qual"
-	message_bytes.bytes = (char*)value;
+	message_bytes.bytes = (char*)msg->data;
 #pragma GCC diagnostic pop 
-  
 
-  amqp_basic_publish(conn,
+  int rc = amqp_basic_publish(conn,
     1,
-    amqp_cstring_bytes(""),
-    amqp_cstring_bytes(""),
+    amqp_cstring_bytes("amq.topic"),
+    amqp_cstring_bytes(key),
     0,
     0,
     NULL,
     message_bytes);
 
-  return 0;
+  return rc == AMQP_STATUS_OK ? 0 : -1;
+}
+
+static int amqp_sink_send(const SinkMessage* msg)
+{
+  return amqp_publish(msg);
 }
 
-void* amqp_run(void* param)
+static void amqp_sink_close(void)
 {
-	return (void*)amqp_main(0, 0);
+  if(!bC) return;
+
+  bC = false;
+  amqp_channel_close(conn, 1, AMQP_REPLY_SUCCESS);
+  amqp_connection_close(conn, AMQP_REPLY_SUCCESS);
+  amqp_destroy_connection(conn);
+
+  fprintf(stdout, "[amqp] closed.\n");
+}
+
+static void amqp_sink_abort(void)
+{
+  if(!bC) return;
+
+  shutdown(amqp_get_sockfd(conn), SHUT_RDWR);
 }
 
+const SinkOps amqpSink = {
+  "amqp",
+  amqp_sink_enabled,
+  amqp_sink_open,
+  amqp_sink_send,
+  NULL,
+  amqp_sink_close,
+  amqp_sink_abort
+};
@@ -0,0 +1,539 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_client.h"
+# include "ua_client_highlevel.h"
+# include "ua_nodeids.h"
+# include "ua_network_tcp.h"
+# include "ua_config_standard.h"
+#else
+# include "open62541.h"
+# include <string.h>
+# include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+using namespace std;
+
+#include "client-common.h"
+#include "client-nodemap.h"
+#include "client-cache.h"
+#include "client-thread.h"
+#include "client-watchdog.h"
+#include "json.h"
+
+extern int beStop;
+
+extern map<int, Group>* gmap;
+extern UAMQ_Configuration* g_config;
+
+int64_t epoch(void);
+
+/* query connections served at once, the others wait in the listen backlog */
+#define CACHE_CLIENTS_MAX 64
+#define CACHE_REQUEST_MAX 1024
+/* slots come in blocks that never move, a reload adds blocks under running writers */
+#define CACHE_BLOCK 1024
+#define CACHE_BLOCKS 1024
+
+typedef struct {
+	string path;	/* '<group topic>/<node topic>', as under the command topic */
+	Group* group;
+	Node* node;
+	bool live;	/* false once a reload removed its group */
+} CacheEntry;
+
+typedef struct {
+	int fd;
+	string in;
+} CacheClient;
+
+static vector<CacheEntry> entries;
+static CacheSlot* blocks[CACHE_BLOCKS];
+static map<string, int> paths;	/* path -> entry, ordered for prefix queries */
+static vector<int> freed;	/* entries of removed groups, the next added nodes take them */
+static pthread_mutex_t entriesLock = PTHREAD_MUTEX_INITIALIZER;	/* entries and paths : queries and reloads */
+static bool cacheOn = false;
+
+static CacheSlot* slot_at(int k)
+{
+	return &blocks[k / CACHE_BLOCK][k % CACHE_BLOCK];
+}
+
+/* a reused slot starts over, a query in between sees no value */
+static void slot_reset(CacheSlot* s)
+{
+	s->seq++;
+	__sync_synchronize();
+
+	s->type = UAMQ_CACHE_NONE;
+	s->status = UA_STATUSCODE_BADWAITINGFORINITIALDATA;
+	s->source = 0;
+	s->server = 0;
+	s->time = 0;
+	s->value.u = 0;
+	s->text[0] = '\0';
+
+	__sync_synchronize();
+	s->seq++;
+}
+
+/* caller holds entriesLock */
+static void cache_add(Group* p)
+{
+	map<int, Node>::iterator n;
+	for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
+		Node* d = (Node*)&n->second;
+		int k;
+
+		if(!freed.empty()) {
+			k = freed.back();
+			freed.pop_back();
+		} else {
+			k = (int)entries.size();
+			if(k >= CACHE_BLOCK * CACHE_BLOCKS) {
+				printf("[cache] full, %s/%s is not cached.\n", p->topic, d->topic);
+				continue;
+			}
+			if(!blocks[k / CACHE_BLOCK]) {
+				blocks[k / CACHE_BLOCK] = (CacheSlot*)calloc(CACHE_BLOCK, sizeof(CacheSlot));
+			}
+			entries.push_back(CacheEntry());
+		}
+		slot_reset(slot_at(k));
+
+		CacheEntry* e = &entries[k];
+		e->path = string(p->topic) + "/" + d->topic;
+		e->group = p;
+		e->node = d;
+		e->live = true;
+
+		paths[e->path] = k;
+
+		/* the writer sees the slot ready */
+		__sync_synchronize();
+		d->cache = k;
+	}
+}
+
+int cache_init(void)
+{
+	pthread_mutex_lock(&entriesLock);
+
+	map<int, Group>::iterator i;
+	for (i = gmap->begin(); i != gmap->end(); ++i) {
+		Group* p = (Group*)&i->second;
+
+		if(!p->enable) {
+			continue;
+		}
+		cache_add(p);
+	}
+	cacheOn = true;
+
+	pthread_mutex_unlock(&entriesLock);
+
+	return (int)entries.size();
+}
+
+void cache_add_group(Group* p)
+{
+	if(!cacheOn) {
+		return;
+	}
+
+	pthread_mutex_lock(&entriesLock);
+	cache_add(p);
+	pthread_mutex_unlock(&entriesLock);
+}
+
+/* the group stopped, its nodes no longer write : the entries and their
+ * slots go back for the next reload to take, the cache does not grow */
+void cache_remove_group(Group* p)
+{
+	if(!cacheOn) {
+		return;
+	}
+
+	pthread_mutex_lock(&entriesLock);
+	for (size_t k = 0; k < entries.size(); k++) {
+		CacheEntry* e = &entries[k];
+		if(e->group != p || !e->live) {
+			continue;
+		}
+		e->live = false;
+		e->node->cache = -1;
+
+		map<string, int>::iterator it = paths.find(e->path);
+		if(it != paths.end() && it->second == (int)k) {
+			paths.erase(it);
+		}
+		e->path.clear();
+		e->group = NULL;
+		e->node = NULL;
+		freed.push_back((int)k);
+	}
+	pthread_mutex_unlock(&entriesLock);
+}
+
+static int64_t ua_time(UA_DateTime t)
+{
+	return (int64_t)((t - UA_DATETIME_UNIX_EPOCH) / UA_USEC_TO_DATETIME);
+}
+
+void cache_update(Node* d, const UA_DataValue* dv, int64_t now)
+{
+	if(d->cache < 0) {
+		return;
+	}
+
+	CacheSlot* s = slot_at(d->cache);
+
+	s->seq++;
+	__sync_synchronize();
+
+	s->status = dv->hasStatus ? dv->status : UA_STATUSCODE_GOOD;
+	s->time = now;
+
+	/* a status without a value keeps the last value, the status tells it is stale */
+	const UA_Variant* val = &dv->value;
+	if(dv->hasValue && val->type && UA_Variant_isScalar(val)) {
+		s->source = dv->hasSourceTimestamp ? ua_time(dv->sourceTimestamp) : 0;
+		s->server = dv->hasServerTimestamp ? ua_time(dv->serverTimestamp) : 0;
+		s->type = UAMQ_CACHE_NONE;
+
+		switch(val->type->typeIndex) {
+			case UA_TYPES_BOOLEAN : s->type = UAMQ_CACHE_BOOL; s->value.i = (*(UA_Boolean*)val->data) ? 1 : 0; break;
+			case UA_TYPES_SBYTE : s->type = UAMQ_CACHE_INT; s->value.i = (*(UA_SByte*)val->data); break;
+			case UA_TYPES_BYTE : s->type = UAMQ_CACHE_UINT; s->value.u = (*(UA_Byte*)val->data); break;
+			case UA_TYPES_INT16 : s->type = UAMQ_CACHE_INT; s->value.i = (*(UA_Int16*)val->data); break;
+			case UA_TYPES_UINT16 : s->type = UAMQ_CACHE_UINT; s->value.u = (*(UA_UInt16*)val->data); break;
+			case UA_TYPES_INT32 : s->type = UAMQ_CACHE_INT; s->value.i = (*(UA_Int32*)val->data); break;
+			case UA_TYPES_UINT32 : s->type = UAMQ_CACHE_UINT; s->value.u = (*(UA_UInt32*)val->data); break;
+			case UA_TYPES_INT64 : s->type = UAMQ_CACHE_INT; s->value.i = (*(UA_Int64*)val->data); break;
+			case UA_TYPES_UINT64 : s->type = UAMQ_CACHE_UINT; s->value.u = (*(UA_UInt64*)val->data); break;
+			case UA_TYPES_FLOAT : s->type = UAMQ_CACHE_DOUBLE; s->value.d = (*(UA_Float*)val->data); break;
+			case UA_TYPES_DOUBLE : s->type = UAMQ_CACHE_DOUBLE; s->value.d = (*(UA_Double*)val->data); break;
+			case UA_TYPES_STRING : {
+				const UA_String* str = (const UA_String*)val->data;
+				size_t len = str->length < UAMQ_CACHE_TEXT - 1 ? str->length : UAMQ_CACHE_TEXT - 1;
+				memcpy(s->text, str->data, len);
+				s->text[len] = '\0';
+				s->type = UAMQ_CACHE_STRING;
+			}
+			break;
+			default : {
+			}
+			break;
+		}
+	}
+
+	__sync_synchronize();
+	s->seq++;
+}
+
+/* a consistent copy of the slot, retried while the writer is inside */
+static void slot_read(const CacheSlot* s, CacheSlot* out)
+{
+	unsigned int seq;
+
+	do {
+		while((seq = s->seq) & 1) {
+			sched_yield();
+		}
+		__sync_synchronize();
+		memcpy(out, (const void*)s, sizeof(CacheSlot));
+		__sync_synchronize();
+	} while(seq != s->seq);
+}
+
+/* request : '<json|binary> [group <name> | <topic prefix>]', nothing selects every node */
+static void cache_select(const string& selector, vector<int>& out)
+{
+	if(selector.compare(0, 6, "group ") == 0) {
+		string name = selector.substr(6);
+		for (size_t k = 0; k < entries.size(); k++) {
+			if(entries[k].live && name == entries[k].group->name) {
+				out.push_back((int)k);
+			}
+		}
+		return;
+	}
+
+	map<string, int>::iterator it;
+	for (it = paths.lower_bound(selector); it != paths.end(); ++it) {
+		if(it->first.compare(0, selector.size(), selector) != 0) {
+			break;
+		}
+		out.push_back(it->second);
+	}
+}
+
+/* {"time": now, "values": {"<path>": {"group": .., "alias": .., "value": .., "status": .., "source": .., "server": .., "time": ..}}} */
+static void cache_json(const vector<int>& selected, string& out)
+{
+	json_object* jobj = json_object_new_object();
+	json_object* jvalues = json_object_new_object();
+
+	for (size_t k = 0; k < selected.size(); k++) {
+		const CacheEntry* e = &entries[selected[k]];
+		CacheSlot s;
+		slot_read(slot_at(selected[k]), &s);
+
+		json_object* jnode = json_object_new_object();
+		json_object_object_add(jnode, "group", json_object_new_string(e->group->name));
+		json_object_object_add(jnode, "alias", json_object_new_string(e->node->alias));
+
+		json_object* jvalue = NULL;
+		switch(s.type) {
+			case UAMQ_CACHE_BOOL : jvalue = json_object_new_boolean(s.value.i != 0); break;
+			case UAMQ_CACHE_INT : jvalue = json_object_new_int64(s.value.i); break;
+			case UAMQ_CACHE_UINT : {
+				/* json-c has no unsigned 64 bit number, the text keeps the digits above INT64_MAX */
+				if(s.value.u > (uint64_t)INT64_MAX) {
+					char digits[24];
+					snprintf(digits, sizeof(digits), "%llu", (unsigned long long)s.value.u);
+					jvalue = json_object_new_double_s((double)s.value.u, digits);
+				} else {
+					jvalue = json_object_new_int64((int64_t)s.value.u);
+				}
+			}
+			break;
+			case UAMQ_CACHE_DOUBLE : jvalue = json_object_new_double(s.value.d); break;
+			case UAMQ_CACHE_STRING : jvalue = json_object_new_string(s.text); break;
+			default : break;
+		}
+		json_object_object_add(jnode, "value", jvalue);
+		json_object_object_add(jnode, "status", json_object_new_int64(s.status));
+		json_object_object_add(jnode, "source", json_object_new_int64(s.source));
+		json_object_object_add(jnode, "server", json_object_new_int64(s.server));
+		json_object_object_add(jnode, "time", json_object_new_int64(s.time));
+
+		json_object_object_add(jvalues, e->path.c_str(), jnode);
+	}
+
+	json_object_object_add(jobj, "time", json_object_new_int64(epoch()));
+	json_object_object_add(jobj, "values", jvalues);
+
+	out = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN | JSON_C_TO_STRING_NOSLASHESCAPE);
+	out += "\n";
+
+	json_object_put(jobj);
+}
+
+static void put_le(string& out, uint64_t v, int bytes)
+{
+	for (int b = 0; b < bytes; b++) {
+		out += (char)((v >> (8 * b)) & 0xff);
+	}
+}
+
+/* little endian :
+ * header  "UAMQ", u16 version(1), u16 0, u32 count, i64 time
+ * entry   u16 path length, path, u8 type (UAMQ_CACHE_*), u32 status, i64 source, i64 server, i64 time,
+ *         value : bool u8 | int i64 | uint u64 | double f64 | string u16 length + bytes | none nothing */
+static void cache_binary(const vector<int>& selected, string& out)
+{
+	out.append("UAMQ", 4);
+	put_le(out, 1, 2);
+	put_le(out, 0, 2);
+	put_le(out, selected.size(), 4);
+	put_le(out, (uint64_t)epoch(), 8);
+
+	for (size_t k = 0; k < selected.size(); k++) {
+		const CacheEntry* e = &entries[selected[k]];
+		CacheSlot s;
+		slot_read(slot_at(selected[k]), &s);
+
+		put_le(out, e->path.size(), 2);
+		out += e->path;
+		put_le(out, s.type, 1);
+		put_le(out, s.status, 4);
+		put_le(out, (uint64_t)s.source, 8);
+		put_le(out, (uint64_t)s.server, 8);
+		put_le(out, (uint64_t)s.time, 8);
+
+		switch(s.type) {
+			case UAMQ_CACHE_BOOL : put_le(out, s.value.i != 0, 1); break;
+			case UAMQ_CACHE_INT : put_le(out, (uint64_t)s.value.i, 8); break;
+			case UAMQ_CACHE_UINT : put_le(out, s.value.u, 8); break;
+			case UAMQ_CACHE_DOUBLE : {
+				uint64_t bits;
+				memcpy(&bits, &s.value.d, sizeof(bits));
+				put_le(out, bits, 8);
+			}
+			break;
+			case UAMQ_CACHE_STRING : {
+				size_t len = strlen(s.text);
+				put_le(out, len, 2);
+				out.append(s.text, len);
+			}
+			break;
+			default : break;
+		}
+	}
+}
+
+static int cache_request(int fd, const string& line)
+{
+	string format = line.substr(0, line.find(' '));
+	string selector = format.size() < line.size() ? line.substr(format.size() + 1) : "";
+
+	vector<int> selected;
+	string out;
+
+	if(format == "json") {
+		pthread_mutex_lock(&entriesLock);
+		cache_select(selector, selected);
+		cache_json(selected, out);
+		pthread_mutex_unlock(&entriesLock);
+	} else if(format == "binary") {
+		pthread_mutex_lock(&entriesLock);
+		cache_select(selector, selected);
+		cache_binary(selected, out);
+		pthread_mutex_unlock(&entriesLock);
+	} else if(format == "threads") {
+		char* stats = thread_stats_json();
+		out = stats;
+		out += "\n";
+		free(stats);
+	} else if(format == "health") {
+		char* health = watchdog_health_json();
+		out = health;
+		out += "\n";
+		free(health);
+	} else if(format == "latency") {
+		char* latency = sink_latency_json();
+		out = latency;
+		out += "\n";
+		free(latency);
+	} else if(format == "rates") {
+		char* rates = sink_rate_json();
+		out = rates;
+		out += "\n";
+		free(rates);
+	} else {
+		out = "{\"error\":\"request is '<json|binary> [group <name> | <topic prefix>]', 'threads', 'health', 'latency' or 'rates'\"}\n";
+	}
+
+	size_t sent = 0;
+	while(sent < out.size()) {
+		ssize_t r = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+		if(r <= 0) {
+			return -1;
+		}
+		sent += (size_t)r;
+	}
+
+	return 0;
+}
+
+/* query server on the 'cache' unix socket, one request per line, a client
+ * may keep the connection and ask again. never touches the OPC UA session. */
+void* cache_run(void* param)
+{
+	const char* path = g_config->cacheSocket;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) {
+		printf("[cache] socket failed.\n");
+		return NULL;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	unlink(path);
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+		printf("[cache] listen on %s failed.\n", path);
+		close(fd);
+		return NULL;
+	}
+	printf("[cache] %d nodes, query socket %s\n", (int)entries.size(), path);
+
+	vector<CacheClient> clients;
+
+	while(!beStop) {
+		vector<struct pollfd> fds(clients.size() + 1);
+		fds[0].fd = fd;
+		fds[0].events = POLLIN;
+		for (size_t k = 0; k < clients.size(); k++) {
+			fds[k + 1].fd = clients[k].fd;
+			fds[k + 1].events = POLLIN;
+		}
+
+		if(poll(&fds[0], fds.size(), 1000) <= 0) {
+			continue;
+		}
+
+		/* backwards, a closed client is erased without moving the unvisited ones */
+		for (size_t k = clients.size(); k-- > 0; ) {
+			if(!fds[k + 1].revents) {
+				continue;
+			}
+
+			CacheClient* c = &clients[k];
+			char buf[512];
+			ssize_t r = recv(c->fd, buf, sizeof(buf), 0);
+			bool done = (r <= 0);
+
+			if(!done) {
+				c->in.append(buf, (size_t)r);
+
+				size_t eol;
+				while(!done && (eol = c->in.find('\n')) != string::npos) {
+					string line = c->in.substr(0, eol);
+					c->in.erase(0, eol + 1);
+					if(!line.empty() && line[line.size() - 1] == '\r') {
+						line.erase(line.size() - 1);
+					}
+					done = (cache_request(c->fd, line) < 0);
+				}
+				done = done || c->in.size() > CACHE_REQUEST_MAX;
+			}
+
+			if(done) {
+				close(c->fd);
+				clients.erase(clients.begin() + k);
+			}
+		}
+
+		if(fds[0].revents & POLLIN) {
+			int cfd = accept(fd, NULL, NULL);
+			if(cfd >= 0 && clients.size() >= CACHE_CLIENTS_MAX) {
+				close(cfd);
+			} else if(cfd >= 0) {
+				/* a reader that stops reading is dropped instead of holding the others */
+				struct timeval tv = { 1, 0 };
+				setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+				CacheClient c;
+				c.fd = cfd;
+				clients.push_back(c);
+			}
+		}
+	}
+
+	for (size_t k = 0; k < clients.size(); k++) {
+		close(clients[k].fd);
+	}
+	close(fd);
+	unlink(path);
+
+	return NULL;
+}
@@ -0,0 +1,61 @@
+#ifndef OPCUA_MQTT_BRIDGE_CACHE_H_
+#define OPCUA_MQTT_BRIDGE_CACHE_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+#else
+# include "open62541.h"
+#endif
+
+#include <stdint.h>
+
+struct Node;
+struct Group;
+
+/* value types of a cache slot, also the type byte of the binary snapshot */
+#define UAMQ_CACHE_NONE    0	/* no value yet, or a type the cache does not keep */
+#define UAMQ_CACHE_BOOL    1
+#define UAMQ_CACHE_INT     2
+#define UAMQ_CACHE_UINT    3
+#define UAMQ_CACHE_DOUBLE  4
+#define UAMQ_CACHE_STRING  5
+
+#define UAMQ_CACHE_TEXT    128
+
+/* the last value of a node. written by one thread (the group's poll thread
+ * or the endpoint's subscription callback), read by any number of query
+ * clients without a lock : 'seq' is odd while the writer is inside. */
+typedef struct {
+	volatile unsigned int seq;
+	int type;
+	UA_StatusCode status;
+	int64_t source;		/* unix epoch us, 0 when the server did not return it */
+	int64_t server;
+	int64_t time;		/* bridge clock when the value arrived */
+	union {
+		int64_t i;
+		uint64_t u;
+		double d;
+	} value;
+	char text[UAMQ_CACHE_TEXT];
+} CacheSlot;
+
+/* gives every node of the enabled groups a slot, returns the slot count */
+int cache_init(void);
+/* reload : the nodes of a started group get slots, a stopped group's leave the queries */
+void cache_add_group(struct Group* p);
+void cache_remove_group(struct Group* p);
+void cache_update(struct Node* d, const UA_DataValue* dv, int64_t now);
+void* cache_run(void* param);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_CACHE_H_ */
@@ -0,0 +1,261 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_client.h"
+# include "ua_client_highlevel.h"
+# include "ua_nodeids.h"
+# include "ua_network_tcp.h"
+# include "ua_config_standard.h"
+#else
+# include "open62541.h"
+# include <string.h>
+# include <stdlib.h>
+#endif
+
+#include "client-cbor.h"
+
+#define CBOR_UINT	0
+#define CBOR_NINT	1
+#define CBOR_BYTES	2
+#define CBOR_TEXT	3
+#define CBOR_ARRAY	4
+#define CBOR_MAP	5
+#define CBOR_TAG	6
+
+/* RFC 8746 */
+#define CBOR_TAG_MULTIDIM	40
+
+void cbor_init(CborBuf* b, size_t cap)
+{
+	b->cap = cap ? cap : 256;
+	b->data = (char*)malloc(b->cap);
+	b->len = 0;
+}
+
+void cbor_free(CborBuf* b)
+{
+	free(b->data);
+	b->data = NULL;
+	b->len = b->cap = 0;
+}
+
+static char* cbor_room(CborBuf* b, size_t n)
+{
+	if(b->len + n > b->cap) {
+		while(b->len + n > b->cap) {
+			b->cap *= 2;
+		}
+		b->data = (char*)realloc(b->data, b->cap);
+	}
+	char* at = b->data + b->len;
+	b->len += n;
+	return at;
+}
+
+/* major type and argument, the argument in the fewest bytes, big endian */
+static void cbor_head(CborBuf* b, int major, uint64_t v)
+{
+	unsigned char m = (unsigned char)(major << 5);
+	int bytes;
+	if(v < 24) {
+		*cbor_room(b, 1) = (char)(m | v);
+		return;
+	} else if(v <= 0xff) {
+		m |= 24;
+		bytes = 1;
+	} else if(v <= 0xffff) {
+		m |= 25;
+		bytes = 2;
+	} else if(v <= 0xffffffffULL) {
+		m |= 26;
+		bytes = 4;
+	} else {
+		m |= 27;
+		bytes = 8;
+	}
+
+	char* p = cbor_room(b, 1 + bytes);
+	p[0] = (char)m;
+	for (int k = bytes; k > 0; k--) {
+		p[k] = (char)(v & 0xff);
+		v >>= 8;
+	}
+}
+
+void cbor_uint(CborBuf* b, uint64_t v)
+{
+	cbor_head(b, CBOR_UINT, v);
+}
+
+void cbor_int(CborBuf* b, int64_t v)
+{
+	if(v >= 0) {
+		cbor_head(b, CBOR_UINT, (uint64_t)v);
+	} else {
+		cbor_head(b, CBOR_NINT, (uint64_t)(-1 - v));
+	}
+}
+
+void cbor_bool(CborBuf* b, bool v)
+{
+	*cbor_room(b, 1) = (char)(v ? 0xf5 : 0xf4);
+}
+
+void cbor_null(CborBuf* b)
+{
+	*cbor_room(b, 1) = (char)0xf6;
+}
+
+void cbor_float(CborBuf* b, float v)
+{
+	uint32_t u;
+	memcpy(&u, &v, sizeof(u));
+	char* p = cbor_room(b, 5);
+	p[0] = (char)0xfa;
+	for (int k = 4; k > 0; k--) {
+		p[k] = (char)(u & 0xff);
+		u >>= 8;
+	}
+}
+
+void cbor_double(CborBuf* b, double v)
+{
+	uint64_t u;
+	memcpy(&u, &v, sizeof(u));
+	char* p = cbor_room(b, 9);
+	p[0] = (char)0xfb;
+	for (int k = 8; k > 0; k--) {
+		p[k] = (char)(u & 0xff);
+		u >>= 8;
+	}
+}
+
+void cbor_text(CborBuf* b, const char* s, size_t len)
+{
+	cbor_head(b, CBOR_TEXT, len);
+	if(len) {
+		memcpy(cbor_room(b, len), s, len);
+	}
+}
+
+void cbor_key(CborBuf* b, const char* s)
+{
+	cbor_text(b, s, strlen(s));
+}
+
+void cbor_bytes(CborBuf* b, const void* data, size_t len)
+{
+	cbor_head(b, CBOR_BYTES, len);
+	if(len) {
+		memcpy(cbor_room(b, len), data, len);
+	}
+}
+
+void cbor_array(CborBuf* b, size_t count)
+{
+	cbor_head(b, CBOR_ARRAY, count);
+}
+
+void cbor_map(CborBuf* b, size_t count)
+{
+	cbor_head(b, CBOR_MAP, count);
+}
+
+void cbor_map_open(CborBuf* b)
+{
+	*cbor_room(b, 1) = (char)0xbf;
+}
+
+void cbor_end(CborBuf* b)
+{
+	*cbor_room(b, 1) = (char)0xff;
+}
+
+/* typed array tag of a number type in the byte order of this host, 0 : none */
+static uint64_t typed_tag(int typeIndex)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	const int le = 0;
+#else
+	const int le = 4;
+#endif
+	switch(typeIndex) {
+		case UA_TYPES_BYTE : return 64;
+		case UA_TYPES_SBYTE : return 72;
+		case UA_TYPES_UINT16 : return 65 + le;
+		case UA_TYPES_UINT32 : return 66 + le;
+		case UA_TYPES_UINT64 : return 67 + le;
+		case UA_TYPES_INT16 : return 73 + le;
+		case UA_TYPES_INT32 : return 74 + le;
+		case UA_TYPES_INT64 : return 75 + le;
+		case UA_TYPES_FLOAT : return 81 + le;
+		case UA_TYPES_DOUBLE : return 82 + le;
+		default : return 0;
+	}
+}
+
+/* one element, p points into the Variant data */
+static bool cbor_element(CborBuf* b, int typeIndex, const void* p)
+{
+	switch(typeIndex) {
+		case UA_TYPES_BOOLEAN : cbor_bool(b, *(const UA_Boolean*)p); break;
+		case UA_TYPES_SBYTE : cbor_int(b, *(const UA_SByte*)p); break;
+		case UA_TYPES_BYTE : cbor_uint(b, *(const UA_Byte*)p); break;
+		case UA_TYPES_INT16 : cbor_int(b, *(const UA_Int16*)p); break;
+		case UA_TYPES_UINT16 : cbor_uint(b, *(const UA_UInt16*)p); break;
+		case UA_TYPES_INT32 : cbor_int(b, *(const UA_Int32*)p); break;
+		case UA_TYPES_UINT32 : cbor_uint(b, *(const UA_UInt32*)p); break;
+		case UA_TYPES_INT64 : cbor_int(b, *(const UA_Int64*)p); break;
+		case UA_TYPES_UINT64 : cbor_uint(b, *(const UA_UInt64*)p); break;
+		case UA_TYPES_FLOAT : cbor_float(b, *(const UA_Float*)p); break;
+		case UA_TYPES_DOUBLE : cbor_double(b, *(const UA_Double*)p); break;
+		case UA_TYPES_DATETIME : cbor_int(b, (int64_t)((*(const UA_DateTime*)p - UA_DATETIME_UNIX_EPOCH) / UA_USEC_TO_DATETIME)); break;
+		case UA_TYPES_STRING : cbor_text(b, (const char*)((const UA_String*)p)->data, ((const UA_String*)p)->length); break;
+		case UA_TYPES_BYTESTRING : cbor_bytes(b, ((const UA_ByteString*)p)->data, ((const UA_ByteString*)p)->length); break;
+		default : return false;
+	}
+	return true;
+}
+
+bool cbor_variant(CborBuf* b, const UA_Variant* v)
+{
+	if(!v->type) {
+		return false;
+	}
+	int typeIndex = v->type->typeIndex;
+
+	if(UA_Variant_isScalar(v)) {
+		return cbor_element(b, typeIndex, v->data);
+	}
+
+	/* nothing is written for a type that is not supported */
+	uint64_t tag = typed_tag(typeIndex);
+	if(!tag && typeIndex != UA_TYPES_BOOLEAN && typeIndex != UA_TYPES_DATETIME &&
+			typeIndex != UA_TYPES_STRING && typeIndex != UA_TYPES_BYTESTRING) {
+		return false;
+	}
+
+	if(v->arrayDimensionsSize > 1) {
+		cbor_head(b, CBOR_TAG, CBOR_TAG_MULTIDIM);
+		cbor_array(b, 2);
+		cbor_array(b, v->arrayDimensionsSize);
+		for (size_t k = 0; k < v->arrayDimensionsSize; k++) {
+			cbor_uint(b, v->arrayDimensions[k]);
+		}
+	}
+
+	if(tag) {
+		/* the raw memory of the Variant, one copy */
+		cbor_head(b, CBOR_TAG, tag);
+		cbor_bytes(b, v->arrayLength ? v->data : NULL, v->arrayLength * v->type->memSize);
+		return true;
+	}
+
+	cbor_array(b, v->arrayLength);
+	for (size_t k = 0; k < v->arrayLength; k++) {
+		cbor_element(b, typeIndex, (const char*)v->data + k * v->type->memSize);
+	}
+	return true;
+}
@@ -0,0 +1,58 @@
+#ifndef OPCUA_MQTT_BRIDGE_CBOR_H_
+#define OPCUA_MQTT_BRIDGE_CBOR_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+#else
+# include "open62541.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* CBOR (RFC 8949) written into a malloc'ed buffer that is handed to the sinks
+ * as it is (sink_publish_buffer) : a message is encoded once, never copied */
+typedef struct {
+	char* data;
+	size_t len;
+	size_t cap;
+} CborBuf;
+
+void cbor_init(CborBuf* b, size_t cap);
+void cbor_free(CborBuf* b);
+
+void cbor_uint(CborBuf* b, uint64_t v);
+void cbor_int(CborBuf* b, int64_t v);
+void cbor_bool(CborBuf* b, bool v);
+void cbor_null(CborBuf* b);
+void cbor_float(CborBuf* b, float v);
+void cbor_double(CborBuf* b, double v);
+void cbor_text(CborBuf* b, const char* s, size_t len);
+void cbor_key(CborBuf* b, const char* s);
+void cbor_bytes(CborBuf* b, const void* data, size_t len);
+void cbor_array(CborBuf* b, size_t count);
+void cbor_map(CborBuf* b, size_t count);
+
+/* a map of unknown size, closed by cbor_end */
+void cbor_map_open(CborBuf* b);
+void cbor_end(CborBuf* b);
+
+/* the value of a Variant with its own width : integers, float32 / float64,
+ * bool, text, bytes, DateTime as unix us. arrays of numbers are RFC 8746
+ * typed arrays (tag 64..86 around the raw memory), with their dimensions
+ * (tag 40) when there are more than one. false : the type is not supported,
+ * nothing is written, a key written before is taken back by resetting len */
+bool cbor_variant(CborBuf* b, const UA_Variant* v);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_CBOR_H_ */
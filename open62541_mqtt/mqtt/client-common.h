@@ -26,19 +26,45 @@ extern "C" {
 #include "pub.h"
 #include "client-config.h"
 
-UA_StatusCode opcua_server_connect(UA_Client *client);
+void opcua_endpoint_init(UAMQ_Endpoint *ep);
+void opcua_endpoint_start(UAMQ_Endpoint *ep);
+void opcua_endpoint_stop(UAMQ_Endpoint *ep);
+UA_StatusCode opcua_server_connect(UAMQ_Endpoint *ep);
 UA_StatusCode opcua_server_browse(UA_Client *client);
 
-void monitor_start(UA_Client* client);
+void opcua_client_lock(UAMQ_Endpoint *ep);
+void opcua_client_unlock(UAMQ_Endpoint *ep);
+unsigned int opcua_session_generation(UAMQ_Endpoint *ep);
+UA_StatusCode opcua_session_recover(UAMQ_Endpoint *ep, unsigned int seen);
+void opcua_session_recover_start(UAMQ_Endpoint *ep, unsigned int seen);
+bool opcua_session_recovering(UAMQ_Endpoint *ep);
+UAMQ_Endpoint* opcua_priority_session(UAMQ_Endpoint *ep);
+void opcua_priority_close(void);
 
-int mqtt_publish(const char* mode, char* topic, const char* value);
-int amqp_publish(const char* mode, char* topic, const char* value);
-int tcp_publish(const char* mode, char* topic, const char* value);
+struct Group;
+
+void monitor_start(UAMQ_Endpoint *ep);
+void monitor_resubscribe(UAMQ_Endpoint *ep);
+void monitor_group_start(struct Group* p);
+void monitor_group_stop(struct Group* p);
+
+int mqtt_publish(const SinkMessage* msg);
+int amqp_publish(const SinkMessage* msg);
+int tcp_publish(const SinkMessage* msg);
+
+int write_init(void);
+void write_add_group(struct Group* p);
+void write_remove_group(struct Group* p);
+void write_command(const char* topic, int topiclen, const char* payload, int payloadlen);
+void* write_run(void* param);
 
 void* mqtt_run(void* param);
-void* tcp_run(void* param);
-void* amqp_run(void* param);
+void mqtt_stop(void);
 void* opcua_poll(void* param);
+bool opcua_poll_started(void);
+void opcua_poll_start(struct Group* p);
+void opcua_poll_stop(struct Group* p);
+void opcua_poll_join(void);
 
 #ifdef __cplusplus
 } // extern "C"
@@ -16,11 +16,18 @@
 
 #include <unistd.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <iostream>
 #include <list>
 #include <map>
+#include <set>
 using namespace std;
 
 #include "MQTTPacket.h"
@@ -28,11 +35,16 @@ using namespace std;
 #include "client-config.h"
 #include "json.h"
 #include "client-nodemap.h"
+#include "client-aggregate.h"
+#include "client-sink.h"
+#include "client-segment.h"
 
 extern int beStop;
 
 map<int, Group> m;
 map<int, Group>* gmap = &m;
+/* entries are added by a reload while other threads walk the map */
+pthread_mutex_t gmapLock = PTHREAD_MUTEX_INITIALIZER;
 
 UAMQ_Configuration g_Configutation;
 UAMQ_Configuration* g_config = &g_Configutation;
@@ -42,205 +54,1021 @@ ssize_t readlink(const char *pathname, char *buf, size_t bufsiz);
 
 void uses(char* exe) 
 {
-	printf("OPC/UA MQTT Bridge Server (version 1.0), MDS Technology.\nuses: %s -c|--config 'filename.json'\n", exe);
+	printf("OPC/UA MQTT Bridge Server (version 1.0), MDS Technology.\nuses: %s -c|--config 'filename.json' [--check] [--shard index/count] [--record file | --replay file [--speed N|max] | --backfill from,to] [--discover file]\n", exe);
+	printf("\t--check : load and validate the file, print the load time and exit (0 : valid)\n");
+	printf("\t--shard index/count : run only the node-map groups owned by shard 'index' (0 .. count-1)\n");
+	printf("\t--record file : append every sample to a binary log\n");
+	printf("\t--discover file : browse the server from the \"discovery\" roots, write the config with a group per object holding matching variables to 'file' and exit\n");
+	printf("\t--replay file : publish the samples of a log instead of reading OPC UA, N times the recorded pace (default 1) or as fast as possible (max)\n");
+	printf("\t--backfill from,to : publish the samples of the local store in the range (unix us or 2026-10-18T21:00:00 UTC) as fast as the sinks take them and exit\n");
+}
+
+/* rendezvous hashing : every shard scores the group name and the highest score
+ * owns it. when count changes only the groups of the added/removed shards move. */
+static uint64_t shard_score(const char* name, int shard)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	for (const char* c = name; *c; c++) {
+		h = (h ^ (unsigned char)*c) * 1099511628211ULL;
+	}
+	h = (h ^ (uint64_t)(shard + 1)) * 1099511628211ULL;
+
+	/* fnv-1a alone mixes the last byte poorly, finish with splitmix64 */
+	h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+
+	return h;
+}
+
+int getShardOwner(const char* name, int count)
+{
+	int owner = 0;
+	uint64_t best = 0;
+
+	for (int k = 0; k < count; k++) {
+		uint64_t score = shard_score(name, k);
+		if(k == 0 || score > best) {
+			best = score;
+			owner = k;
+		}
+	}
+
+	return owner;
+}
+
+static void shard_groups(map<int, Group>& groups)
+{
+	int owned = 0;
+
+	map<int, Group>::iterator i;
+	for (i = groups.begin(); i != groups.end(); ++i) {
+		Group* p = (Group*)&i->second;
+
+		if(getShardOwner(p->name, g_Configutation.shardCount) != g_Configutation.shardIndex) {
+			p->enable = false;
+			continue;
+		}
+		owned++;
+	}
+
+	printf("[shard %d/%d] %d of %d groups owned by this instance.\n", g_Configutation.shardIndex, g_Configutation.shardCount, owned, (int)groups.size());
+}
+
+static double monotonic_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
 }
 
 int config(int argc, char *argv[]) 
 {
-	if (argc != 3) {
+	char* file = NULL;
+	bool check = false;
+
+	g_Configutation.shardIndex = 0;
+	g_Configutation.shardCount = 1;
+	g_Configutation.recordFile[0] = '\0';
+	g_Configutation.replayFile[0] = '\0';
+	g_Configutation.replaySpeed = 1;
+	g_Configutation.discoverFile[0] = '\0';
+	g_Configutation.backfill = false;
+
+	for (int a = 1; a < argc; a++) {
+		if((!strcmp(argv[a], "-c") || !strcmp(argv[a], "--config")) && a + 1 < argc) {
+			file = argv[++a];
+		} else if(!strcmp(argv[a], "--check")) {
+			check = true;
+		} else if(!strcmp(argv[a], "--shard") && a + 1 < argc) {
+			int index = -1, count = 0;
+			if(sscanf(argv[++a], "%d/%d", &index, &count) != 2 || count < 1 || index < 0 || index >= count) {
+				printf("[error] invalid shard '%s', expected index/count with 0 <= index < count.\n", argv[a]);
+				return -1;
+			}
+			g_Configutation.shardIndex = index;
+			g_Configutation.shardCount = count;
+		} else if(!strcmp(argv[a], "--record") && a + 1 < argc) {
+			snprintf(g_Configutation.recordFile, sizeof(g_Configutation.recordFile), "%s", argv[++a]);
+		} else if(!strcmp(argv[a], "--replay") && a + 1 < argc) {
+			snprintf(g_Configutation.replayFile, sizeof(g_Configutation.replayFile), "%s", argv[++a]);
+		} else if(!strcmp(argv[a], "--backfill") && a + 1 < argc) {
+			string range = argv[++a];
+			size_t comma = range.find(',');
+			if(comma == string::npos || !segment_parse_time(range.substr(0, comma).c_str(), &g_Configutation.backfillFrom) ||
+					!segment_parse_time(range.substr(comma + 1).c_str(), &g_Configutation.backfillTo) ||
+					g_Configutation.backfillFrom > g_Configutation.backfillTo) {
+				printf("[error] invalid backfill range '%s', expected from,to in unix us or 2026-10-18T21:00:00 (UTC).\n", argv[a]);
+				return -1;
+			}
+			g_Configutation.backfill = true;
+		} else if(!strcmp(argv[a], "--discover") && a + 1 < argc) {
+			snprintf(g_Configutation.discoverFile, sizeof(g_Configutation.discoverFile), "%s", argv[++a]);
+		} else if(!strcmp(argv[a], "--speed") && a + 1 < argc) {
+			double speed = 0;
+			if(!strcmp(argv[++a], "max")) {
+				g_Configutation.replaySpeed = 0;
+			} else if(sscanf(argv[a], "%lf", &speed) == 1 && speed > 0) {
+				g_Configutation.replaySpeed = speed;
+			} else {
+				printf("[error] invalid speed '%s', expected N (or Nx) > 0 or max.\n", argv[a]);
+				return -1;
+			}
+		} else {
+			uses(argv[0]);
+			return -1;
+		}
+	}
+
+	if(!file) {
 		uses(argv[0]);
 		return -1;
 	}
 
-	if(strncmp(argv[1], "-c", strlen(argv[1]))) {
-		if(strncmp(argv[1], "--config", strlen(argv[1]))) {
-			uses(argv[0]);
-			return -1; 
-		}
+	if(g_Configutation.recordFile[0] && g_Configutation.replayFile[0]) {
+		printf("[error] --record and --replay can't be used together.\n");
+		return -1;
+	}
+	if(g_Configutation.backfill && (g_Configutation.recordFile[0] || g_Configutation.replayFile[0])) {
+		printf("[error] --backfill can't be used with --record or --replay.\n");
+		return -1;
 	}
 
-	strcpy(&g_Configutation.configFile[0], argv[2]);
+	snprintf(&g_Configutation.configFile[0], sizeof(g_Configutation.configFile), "%s", file);
+
+	double started = monotonic_ms();
 
 	if(load(&g_Configutation.configFile[0]) != UA_STATUSCODE_GOOD) {
-		printf("[error] the file (%s) has invalid json syntax or path is not valid.\n", &g_Configutation.configFile[0]);
+		printf("[error] the file (%s) is not loaded.\n", &g_Configutation.configFile[0]);
+		if(check) {
+			exit(1);
+		}
 		return -1;
 	}
 
+	if(g_Configutation.shardCount > 1) {
+		shard_groups(m);
+	}
+
+	int enabled = 0, nodes = 0;
+	map<int, Group>::iterator i;
+	for (i = m.begin(); i != m.end(); ++i) {
+		if(i->second.enable) {
+			enabled++;
+			nodes += (int)i->second.nodes.size();
+		}
+	}
+	printf("[config] %d groups (%d enabled, %d nodes) loaded in %.1f ms.\n", (int)m.size(), enabled, nodes, monotonic_ms() - started);
+
+	if(check) {
+		exit(0);
+	}
+
     return (int)UA_STATUSCODE_GOOD;
 }
 
-void travers(json_object *parent, json_object *r, enum json_type t)
+/* the bit of a sink plugin, 0 : not built in (amqp is an option) */
+static unsigned int group_sink(const char* name)
 {
-	enum json_type type;
+	int i = getSinkIndex(name);
+	if(i < 0) {
+		printf("[warning] sink '%s' is not built in, ignored.\n", name);
+		return 0;
+	}
 
-	switch(t) {
-		case json_type_object: {
+	return 1u << i;
+}
 
-			json_object_object_foreach(r, key, val) {
-				printf("key:%s > ", key);
-
-				type = json_object_get_type(val);
-				switch(type) {
-					case json_type_null: printf("2 %s\n", "null"); break;
-					case json_type_boolean: printf("2 %s=%d\n", "boolean", json_object_get_boolean(val)); break;
-					case json_type_double: printf("2 %s=%lf\n", "double", json_object_get_double(val)); break;
-					case json_type_int: printf("2 %s=%d\n", "int", json_object_get_int(val)); break;
-					case json_type_object: travers(r, val, json_type_object); break;
-					case json_type_array: travers(r, val, json_type_array); break;
-					case json_type_string: printf("2 %s=%s\n", "string", json_object_get_string(val)); break;
-					default :  printf("2 %s\n", "unknown"); break;
-				}
-			}
+/* "[error] node-map[3].intervalUSec : ..." */
+static bool field_type(json_object *v, enum json_type t, int group, int node, const char* key)
+{
+	enum json_type has = json_object_get_type(v);
+	if(has == t || (t == json_type_double && has == json_type_int)) {
+		return true;
+	}
+
+	if(node < 0) {
+		printf("[error] node-map[%d].%s : %s expected, not %s.\n", group, key, json_type_to_name(t), json_type_to_name(has));
+	} else {
+		printf("[error] node-map[%d].nodes[%d].%s : %s expected, not %s.\n", group, node, key, json_type_to_name(t), json_type_to_name(has));
+	}
+	return false;
+}
+
+static char* field_string(json_object *v)
+{
+	return strndup(json_object_get_string(v), json_object_get_string_len(v));
+}
+
+static const char* const methods[] = { "event", "poll", "auto", NULL };
+static const char* const formats[] = { "json", "kv", "cbor", "sparkplug", "delta", "gorilla", NULL };
+static const char* const timestamps[] = { "bridge", "source", "server", NULL };
+static const char* const priorities[] = { "high", "normal", NULL };
+/* every sink plugin, built in or not */
+static const char* const sinks[] = { "mqtt", "tcp", "amqp", NULL };
+
+/* one of the names, exactly : "jsn" or "" is an error, not the default */
+static bool field_choice(json_object *v, const char* const names[], int group, const char* key)
+{
+	const char* has = json_object_get_string(v);
+	for (int k = 0; names[k]; k++) {
+		if(!strcmp(has, names[k])) {
+			return true;
 		}
-		break;
-		case json_type_array: {
-			int l = json_object_array_length(r);
+	}
 
-			for (int i = 0; i < l; i++) {
-				json_object *val = json_object_array_get_idx(r, i);
-
-				enum json_type type;
-				type = json_object_get_type(val);
-				switch(type) {
-					case json_type_null: printf("3 %s\n", "null"); break;
-					case json_type_boolean: printf("3 %s=%d\n", "boolean", json_object_get_boolean(val)); break;
-					case json_type_double: printf("3 %s=%lf\n", "double", json_object_get_double(val)); break;
-					case json_type_int: printf("3 %s=%d\n", "int", json_object_get_int(val)); break;
-					case json_type_object: travers(r, val, json_type_object); break;
-					case json_type_array: travers(r, val, json_type_array); break;
-					case json_type_string: printf("3 %s=%s\n", "string", json_object_get_string(val)); break;
-					default : printf("3 %s\n", "unknown"); break;
-				}
-			}
+	string list;
+	for (int k = 0; names[k]; k++) {
+		if(k) {
+			list += names[k + 1] ? ", " : " or ";
 		}
-		break;
-		default: {
-			return;
+		list += names[k];
+	}
+	printf("[error] node-map[%d].%s : '%s' is not %s.\n", group, key, has, list.c_str());
+	return false;
+}
+
+/* the nested objects of a group hold only the keys the bridge reads */
+static bool field_keys(json_object *c, const char* const keys[], int group, const char* key)
+{
+	json_object_object_foreach(c, field, val) {
+		(void)val;
+		int k = 0;
+		while(keys[k] && strcmp(keys[k], field)) {
+			k++;
+		}
+		if(!keys[k]) {
+			printf("[error] node-map[%d].%s : unknown key '%s'.\n", group, key, field);
+			return false;
 		}
 	}
+
+	return true;
 }
 
-//===================================================================================================================================================================
-void make_node_list(int group, int depth, json_object *parent, json_object *r)
+static const char* const aggregateKeys[] = { "windowUSec", "slideUSec", "functions", NULL };
+static const char* const adaptiveKeys[] = { "minUSec", "maxUSec", NULL };
+static const char* const deltaKeys[] = { "keyframeEvery", "keyframeUSec", NULL };
+static const char* const batchKeys[] = { "windowUSec", "perNode", NULL };
+
+/* "aggregate": { "windowUSec": 1000000, "slideUSec": 1000000, "functions": ["min", "max", ...] }
+ * slideUSec defaults to windowUSec (tumbling), functions to all of them. */
+static int make_aggregate(json_object *r, int group, Group* G)
 {
-	enum json_type type;
+	json_object *v = NULL;
 
-	printf("make node list >> [G:%d/D:%d]\n",  group, depth);
+	if(!field_keys(r, aggregateKeys, group, "aggregate")) return -1;
 
-	int l = json_object_array_length(r);
+	if(json_object_object_get_ex(r, "windowUSec", &v)) {
+		if(!field_type(v, json_type_int, group, -1, "aggregate.windowUSec")) return -1;
+		G->windowUSec = json_object_get_int(v);
+	}
 
-	for (int i = 0; i < l; i++) {
-		json_object *val = json_object_array_get_idx(r, i);
+	G->slideUSec = G->windowUSec;
+	if(json_object_object_get_ex(r, "slideUSec", &v)) {
+		if(!field_type(v, json_type_int, group, -1, "aggregate.slideUSec")) return -1;
+		G->slideUSec = json_object_get_int(v);
+	}
 
-		enum json_type type;
-		type = json_object_get_type(val);
-		switch(type) {
-			case json_type_null: printf("%d/%d %s\n", group, i, "null"); break;
-			case json_type_boolean: printf("%d/%d %s=%d\n", group, i, "boolean", json_object_get_boolean(val)); break;
-			case json_type_double: printf("%d/%d %s=%lf\n", group, i,  "double", json_object_get_double(val)); break;
-			case json_type_int: printf("%d/%d %s=%d\n", group, i, "int",  json_object_get_int(val)); break;
-			case json_type_string: printf("%d/%d %s=%s\n", group, i,"string",   json_object_get_string(val)); break;
+	G->aggregates = UAMQ_AGG_ALL;
+	if(json_object_object_get_ex(r, "functions", &v)) {
+		if(!field_type(v, json_type_array, group, -1, "aggregate.functions")) return -1;
+		G->aggregates = 0;
 
-			case json_type_object: {
-				printf("%d/%d %s\n",  group, i, " ===> object");
-				//make_group(group, depth + 1, i, r, val);
+		int l = json_object_array_length(v);
+		for (int i = 0; i < l; i++) {
+			json_object *f = json_object_array_get_idx(v, i);
+			char key[48];
+			snprintf(key, sizeof(key), "aggregate.functions[%d]", i);
+			if(!field_type(f, json_type_string, group, -1, key)) return -1;
+			unsigned int a = getAggregate(json_object_get_string(f));
+			if(!a) {
+				printf("[error] node-map[%d].%s : unknown aggregate function '%s'.\n", group, key, json_object_get_string(f));
+				return -1;
 			}
-			break;
+			G->aggregates |= a;
+		}
+	}
 
-			case json_type_array: {
-				printf("%d/%d %s\n",  group, i, "===> array");
-				//make_node_list(group, depth + 1, r, val);
-			}
-			break;
-			
-			default :  printf("%d/%d %s\n",  group, i, "unknown"); break;
+	return 0;
+}
+
+/* "adaptive": { "minUSec": 10000, "maxUSec": 5000000 }, intervalUSec is where every node starts */
+static int make_adaptive(json_object *r, int group, Group* G)
+{
+	json_object *v = NULL;
+
+	if(!field_keys(r, adaptiveKeys, group, "adaptive")) return -1;
+
+	if(json_object_object_get_ex(r, "minUSec", &v)) {
+		if(!field_type(v, json_type_int, group, -1, "adaptive.minUSec")) return -1;
+		G->adaptiveMinUSec = json_object_get_int(v);
+	}
+	if(json_object_object_get_ex(r, "maxUSec", &v)) {
+		if(!field_type(v, json_type_int, group, -1, "adaptive.maxUSec")) return -1;
+		G->adaptiveMaxUSec = json_object_get_int(v);
+	}
+
+	return 0;
+}
+
+/* "delta": { "keyframeEvery": 100, "keyframeUSec": 10000000 } */
+static int make_delta(json_object *r, int group, Group* G)
+{
+	json_object *v = NULL;
+
+	if(!field_keys(r, deltaKeys, group, "delta")) return -1;
+
+	if(json_object_object_get_ex(r, "keyframeEvery", &v)) {
+		if(!field_type(v, json_type_int, group, -1, "delta.keyframeEvery")) return -1;
+		G->deltaEvery = json_object_get_int(v);
+	}
+	if(json_object_object_get_ex(r, "keyframeUSec", &v)) {
+		if(!field_type(v, json_type_int, group, -1, "delta.keyframeUSec")) return -1;
+		G->deltaKeyUSec = json_object_get_int(v);
+	}
+
+	return 0;
+}
+
+/* "batch": { "windowUSec": 1000000, "perNode": false } */
+static int make_batch(json_object *r, int group, Group* G)
+{
+	json_object *v = NULL;
+
+	if(!field_keys(r, batchKeys, group, "batch")) return -1;
+
+	if(json_object_object_get_ex(r, "windowUSec", &v)) {
+		if(!field_type(v, json_type_int, group, -1, "batch.windowUSec")) return -1;
+		G->batchUSec = json_object_get_int(v);
+	}
+	if(json_object_object_get_ex(r, "perNode", &v)) {
+		if(!field_type(v, json_type_boolean, group, -1, "batch.perNode")) return -1;
+		G->batchPerNode = json_object_get_boolean(v);
+	}
+
+	return 0;
+}
+
+static void node_free(Node* n)
+{
+	free(n->id);
+	free(n->topic);
+	free(n->alias);
+	n->id = NULL;
+	n->topic = NULL;
+	n->alias = NULL;
+}
+
+void group_free(Group* g)
+{
+	free(g->name);
+	free(g->method);
+	free(g->topic);
+	free(g->format);
+	free(g->timestamp);
+	free(g->endpoint);
+	g->name = NULL;
+	g->method = NULL;
+	g->topic = NULL;
+	g->format = NULL;
+	g->timestamp = NULL;
+	g->endpoint = NULL;
+
+	map<int, Node>::iterator n;
+	for (n = g->nodes.begin(); n != g->nodes.end(); ++n) {
+		node_free((Node*)&n->second);
+	}
+	g->nodes.clear();
+}
+
+/* on an error the caller frees what n holds with node_free */
+static int make_node(json_object *r, int group, int index, Node* n)
+{
+	n->id = NULL;
+	n->topic = NULL;
+	n->alias = NULL;
+	n->writable = false;
+	n->cache = -1;
+	n->index = -1;
+	n->store = -1;
+	n->monitorId = 0;
+	n->notified = 0;
+	n->spbType = 0;
+	n->spbAlias = 0;
+	n->parent = NULL;
+
+	if(json_object_get_type(r) != json_type_object) {
+		printf("[error] node-map[%d].nodes[%d] : object expected.\n", group, index);
+		return -1;
+	}
+
+	json_object_object_foreach(r, field, v) {
+		if(!strcmp(field, "id")) {
+			if(!field_type(v, json_type_string, group, index, field)) return -1;
+			n->id = field_string(v);
+		} else if(!strcmp(field, "topic")) {
+			if(!field_type(v, json_type_string, group, index, field)) return -1;
+			n->topic = field_string(v);
+		} else if(!strcmp(field, "alias")) {
+			if(!field_type(v, json_type_string, group, index, field)) return -1;
+			n->alias = field_string(v);
+		} else if(!strcmp(field, "writable")) {
+			if(!field_type(v, json_type_boolean, group, index, field)) return -1;
+			n->writable = json_object_get_boolean(v);
+		} else {
+			printf("[error] node-map[%d].nodes[%d] : unknown key '%s'.\n", group, index, field);
+			return -1;
 		}
 	}
+
+	if(!n->id || !n->topic) {
+		printf("[error] node-map[%d].nodes[%d] : '%s' is missing.\n", group, index, n->id ? "topic" : "id");
+		return -1;
+	}
+
+	/* an empty alias is the topic */
+	if(!n->alias || !n->alias[0]) {
+		free(n->alias);
+		n->alias = strdup(n->topic);
+	}
+
+	return 0;
 }
 
-int make_group(json_object *r, Group* G)
+/* exact keys, a wrong type or an unknown key is an error with its location */
+int make_group(json_object *r, int index, Group* G)
 {
-	enum json_type type;
-	int field = 0;
+	G->name = NULL;
+	G->method = NULL;
+	G->topic = NULL;
+	G->format = NULL;
 
 	json_object_object_foreach(r, key, val) {
 
-		if(!strncmp(key, "name", strlen(key))) {
-			G->name = strndup(json_object_get_string(val), strlen(json_object_get_string(val)));
-		} else if(!strncmp(key, "method", strlen(key))) {
-			G->method = strndup(json_object_get_string(val), strlen(json_object_get_string(val)));
-		} else if(!strncmp(key, "intervalUSec", strlen(key))) {
+		if(!strcmp(key, "name")) {
+			if(!field_type(val, json_type_string, index, -1, key)) return -1;
+			G->name = field_string(val);
+		} else if(!strcmp(key, "method")) {
+			if(!field_type(val, json_type_string, index, -1, key)) return -1;
+			if(!field_choice(val, methods, index, key)) return -1;
+			G->method = field_string(val);
+		} else if(!strcmp(key, "intervalUSec")) {
+			if(!field_type(val, json_type_int, index, -1, key)) return -1;
 			G->intervalUSec = json_object_get_int(val);
-		} else if(!strncmp(key, "topic", strlen(key))) {
-			G->topic = strndup(json_object_get_string(val), strlen(json_object_get_string(val)));
-		}  else if(!strncmp(key, "format", strlen(key))) {
-			G->format = strndup(json_object_get_string(val), strlen(json_object_get_string(val)));
-		} else if(!strncmp(key, "mqtt", strlen(key))) {
+		} else if(!strcmp(key, "topic")) {
+			if(!field_type(val, json_type_string, index, -1, key)) return -1;
+			G->topic = field_string(val);
+		} else if(!strcmp(key, "format")) {
+			if(!field_type(val, json_type_string, index, -1, key)) return -1;
+			if(!field_choice(val, formats, index, key)) return -1;
+			G->format = field_string(val);
+		} else if(!strcmp(key, "timestamp")) {
+			if(!field_type(val, json_type_string, index, -1, key)) return -1;
+			if(!field_choice(val, timestamps, index, key)) return -1;
+			G->timestamp = field_string(val);
+		} else if(!strcmp(key, "mqtt")) {
+			if(!field_type(val, json_type_boolean, index, -1, key)) return -1;
 			G->mqtt = json_object_get_boolean(val);
-		} else if(!strncmp(key, "amqp", strlen(key))) {
+		} else if(!strcmp(key, "amqp")) {
+			if(!field_type(val, json_type_boolean, index, -1, key)) return -1;
 			G->amqp = json_object_get_boolean(val);
-		} else if(!strncmp(key, "tcp", strlen(key))) {
+		} else if(!strcmp(key, "tcp")) {
+			if(!field_type(val, json_type_boolean, index, -1, key)) return -1;
 			G->tcp = json_object_get_boolean(val);
-		} else if(!strncmp(key, "enable", strlen(key))) {
+		} else if(!strcmp(key, "store")) {
+			if(!field_type(val, json_type_boolean, index, -1, key)) return -1;
+			G->store = json_object_get_boolean(val);
+		} else if(!strcmp(key, "enable")) {
+			if(!field_type(val, json_type_boolean, index, -1, key)) return -1;
 			G->enable = json_object_get_boolean(val);
-		} else if(!strncmp(key, "nodes", strlen(key))) {
-
-			type = json_object_get_type(val);
-
-			switch(type) {
-				case json_type_array: {
-
-					Node n;
-
-					int l = json_object_array_length(val);
-
-					for (int i = 0; i < l; i++) {
-						json_object *node = json_object_array_get_idx(val, i);
-
-						type = json_object_get_type(node);
-
-						switch(type) {
-							case json_type_object: {
-								json_object_object_foreach(node, field, v) {
-									
-									if(!strncmp(field, "id", strlen(field))) {
-										n.id = strndup(json_object_get_string(v), strlen(json_object_get_string(v)));
-									} else if(!strncmp(field, "topic", strlen(field))) {
-										n.topic = strndup(json_object_get_string(v), strlen(json_object_get_string(v)));
-									} else if(!strncmp(field, "alias", strlen(field))) {
-										if(strlen(json_object_get_string(v)) == 0) {
-											n.alias = strndup(n.topic, strlen(n.topic));
-										} else {
-											n.alias = strndup(json_object_get_string(v), strlen(json_object_get_string(v)));
-										}
-									}
-								}
-							}
-							break;
-
-							default :  {
-								printf("%d %s\n", i, " ===> other");
-							}
-							break;
-						}
-						cout << "\t[" << i << "] id: " << n.id << ", topic: " << n.topic << ", alias: " << n.alias << "\n";
-						G->nodes.insert(pair<int, Node>(i, n));
-					}
-				}
-				break;
-				default : {
-					printf("%s\n", " ===> other"); 
-					break;
+		} else if(!strcmp(key, "priority")) {
+			if(!field_type(val, json_type_string, index, -1, key)) return -1;
+			if(!field_choice(val, priorities, index, key)) return -1;
+			G->priority = !strcmp(json_object_get_string(val), "high");
+		} else if(!strcmp(key, "endpoint")) {
+			if(!field_type(val, json_type_string, index, -1, key)) return -1;
+			G->endpoint = field_string(val);
+		} else if(!strcmp(key, "adaptive")) {
+			if(!field_type(val, json_type_object, index, -1, key)) return -1;
+			if(make_adaptive(val, index, G) < 0) return -1;
+		} else if(!strcmp(key, "autoWindowUSec")) {
+			if(!field_type(val, json_type_int, index, -1, key)) return -1;
+			G->autoWindowUSec = json_object_get_int(val);
+		} else if(!strcmp(key, "aggregate")) {
+			if(!field_type(val, json_type_object, index, -1, key)) return -1;
+			if(make_aggregate(val, index, G) < 0) return -1;
+		} else if(!strcmp(key, "delta")) {
+			if(!field_type(val, json_type_object, index, -1, key)) return -1;
+			if(make_delta(val, index, G) < 0) return -1;
+		} else if(!strcmp(key, "batch")) {
+			if(!field_type(val, json_type_object, index, -1, key)) return -1;
+			if(make_batch(val, index, G) < 0) return -1;
+		} else if(!strcmp(key, "sinks")) {
+			if(!field_type(val, json_type_array, index, -1, key)) return -1;
+			/* "sinks": ["mqtt", "tcp", ...] adds sink plugins by name to mqtt/amqp/tcp */
+			int l = json_object_array_length(val);
+			for (int i = 0; i < l; i++) {
+				json_object *e = json_object_array_get_idx(val, i);
+				char sink[32];
+				snprintf(sink, sizeof(sink), "sinks[%d]", i);
+				if(!field_type(e, json_type_string, index, -1, sink)) return -1;
+				if(!field_choice(e, sinks, index, sink)) return -1;
+				G->sinks |= group_sink(json_object_get_string(e));
+			}
+		} else if(!strcmp(key, "nodes")) {
+			if(!field_type(val, json_type_array, index, -1, key)) return -1;
+
+			/* in index order : every insert goes to the end, no tree search */
+			int l = json_object_array_length(val);
+			for (int i = 0; i < l; i++) {
+				Node n;
+				if(make_node(json_object_array_get_idx(val, i), index, i, &n) < 0) {
+					node_free(&n);
+					return -1;
 				}
+				G->nodes.insert(G->nodes.end(), pair<int, Node>(i, n));
 			}
 		} else {
+			printf("[error] node-map[%d] : unknown key '%s'.\n", index, key);
+			return -1;
+		}
+	}
+
+	const char* missing = !G->name ? "name" : !G->method ? "method" : !G->topic ? "topic" : !G->format ? "format" : NULL;
+	if(missing) {
+		printf("[error] node-map[%d] : '%s' is missing.\n", index, missing);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* a key the section can't do without */
+static bool required(json_object *c, const char* section, const char* key, json_object **v)
+{
+	if(json_object_object_get_ex(c, key, v)) {
+		return true;
+	}
+
+	printf("[error] %s : '%s' is missing.\n", section, key);
+	return false;
+}
+
+/* "[error] server-configuration.tcpSever.queueSize : int expected, not string." */
+static bool section_type(json_object *v, enum json_type t, const char* section, const char* key)
+{
+	enum json_type has = json_object_get_type(v);
+	if(has == t || (t == json_type_double && has == json_type_int)) {
+		return true;
+	}
+
+	printf("[error] %s.%s : %s expected, not %s.\n", section, key, json_type_to_name(t), json_type_to_name(has));
+	return false;
+}
+
+/* an object holding only the keys the bridge reads : a misspelled key is an error, not a silent default */
+static bool section_keys(json_object *c, const char* section, const char* const keys[])
+{
+	if(json_object_get_type(c) != json_type_object) {
+		printf("[error] %s : object expected, not %s.\n", section, json_type_to_name(json_object_get_type(c)));
+		return false;
+	}
+
+	json_object_object_foreach(c, key, val) {
+		(void)val;
+		int k = 0;
+		while(keys[k] && strcmp(keys[k], key)) {
+			k++;
+		}
+		if(!keys[k]) {
+			printf("[error] %s : unknown key '%s'.\n", section, key);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static const char* const serverKeys[] = { "opcuaServer", "opcuaEndpoints", "cache", "store", "threads", "shutdown", "priority",
+	"watchdog", "reload", "discovery", "mqttBrocker", "amqpRabbit", "tcpSever", NULL };
+static const char* const opcuaServerKeys[] = { "EndpointURL", "publishIntervalUs", "asycRequestSupported", "method", NULL };
+static const char* const endpointKeys[] = { "name", "EndpointURL", NULL };
+static const char* const cacheKeys[] = { "socket", NULL };
+static const char* const threadKeys[] = { "cpus", "priority", NULL };
+static const char* const shutdownKeys[] = { "deadlineUSec", NULL };
+static const char* const priorityKeys[] = { "highSloUSec", "normalSloUSec", "sessions", NULL };
+static const char* const watchdogKeys[] = { "intervals", "minUSec", "restart", NULL };
+static const char* const reloadKeys[] = { "watch", NULL };
+static const char* const storeKeys[] = { "path", "partitionUSec", "flushUSec", "retentionUSec", NULL };
+static const char* const discoveryKeys[] = { "endpoint", "roots", "maxReferencesPerNode", "nodesPerRequest", "sessions", "maxDepth",
+	"namespaces", "properties", "pattern", "dataTypes", "snapshot", "group", NULL };
+static const char* const mqttKeys[] = { "enable", "ip", "port", "topicBase", "commandTopic", "ackTopic", "writeCoalesceUSec", "sparkplug",
+	"queueSize", "overload", "rate", NULL };
+static const char* const sparkplugKeys[] = { "groupId", "edgeNodeId", NULL };
+static const char* const amqpKeys[] = { "enable", "ip", "port", "topicBase", "queueSize", "overload", "rate", NULL };
+static const char* const tcpKeys[] = { "enable", "ip", "port", "sampleIntervalUs", "singleshot", "framing", "queueSize", "overload", "rate", NULL };
+static const char* const rateKeys[] = { "msgsPerSec", "bytesPerSec", "burstUSec", "topics", NULL };
+static const char* const rateTopicKeys[] = { "prefix", "msgsPerSec", "bytesPerSec", NULL };
+
+/* "msgsPerSec" and "bytesPerSec" of a rate, 0 : no limit */
+static int rate_limit(json_object *c, const char* section, const char* sink, UAMQ_RateLimit* r)
+{
+	json_object *v = NULL;
+
+	if(json_object_object_get_ex(c, "msgsPerSec", &v)) {
+		if(!section_type(v, json_type_double, section, "msgsPerSec")) return -1;
+		r->msgsPerSec = json_object_get_double(v);
+	}
+	if(json_object_object_get_ex(c, "bytesPerSec", &v)) {
+		if(!section_type(v, json_type_double, section, "bytesPerSec")) return -1;
+		r->bytesPerSec = json_object_get_double(v);
+	}
+	if(r->msgsPerSec < 0 || r->bytesPerSec < 0) {
+		printf("[error] %s : rate msgsPerSec and bytesPerSec should be >= 0.\n", sink);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* "queueSize", "overload" and "rate" of mqttBrocker / tcpSever / amqpRabbit */
+static int sink_policy(json_object *c, const char* section, const char* sink)
+{
+	json_object *v = NULL;
+
+	int i = getSinkIndex(sink);
+	if(i < 0) {
+		return 0;
+	}
+
+	if(json_object_object_get_ex(c, "queueSize", &v)) {
+		if(!section_type(v, json_type_int, section, "queueSize")) return -1;
+		g_Configutation.sinkQueueSize[i] = json_object_get_int(v);
+		if(g_Configutation.sinkQueueSize[i] <= 0) {
+			printf("[error] %s : queueSize should be > 0.\n", sink);
+			return -1;
+		}
+	}
+
+	if(json_object_object_get_ex(c, "overload", &v)) {
+		if(!section_type(v, json_type_string, section, "overload")) return -1;
+		g_Configutation.sinkOverload[i] = getOverloadPolicy(json_object_get_string(v));
+		if(g_Configutation.sinkOverload[i] == enumOverloadUnknown) {
+			printf("[error] %s : overload '%s' is not block, drop-oldest, drop-newest or coalesce-latest.\n", sink, json_object_get_string(v));
+			return -1;
+		}
+	}
+
+	json_object *r = NULL;
+	if(json_object_object_get_ex(c, "rate", &r)) {
+		string rs = string(section) + ".rate";
+		if(!section_keys(r, rs.c_str(), rateKeys)) {
+			return -1;
+		}
+		UAMQ_SinkRate* rate = &g_Configutation.sinkRate[i];
+		if(rate_limit(r, rs.c_str(), sink, &rate->sink) < 0) {
 			return -1;
 		}
+		if(json_object_object_get_ex(r, "burstUSec", &v)) {
+			if(!section_type(v, json_type_int, rs.c_str(), "burstUSec")) return -1;
+			rate->burstUSec = json_object_get_int(v);
+			if(rate->burstUSec <= 0) {
+				printf("[error] %s : rate burstUSec should be > 0.\n", sink);
+				return -1;
+			}
+		}
+		json_object *topics = NULL;
+		if(json_object_object_get_ex(r, "topics", &topics)) {
+			if(!section_type(topics, json_type_array, rs.c_str(), "topics")) return -1;
+			int count = json_object_array_length(topics);
+			if(count > UAMQ_MAX_RATE_TOPICS) {
+				printf("[error] %s : %d rate topics, %d at most.\n", sink, count, UAMQ_MAX_RATE_TOPICS);
+				return -1;
+			}
+			for (int t = 0; t < count; t++) {
+				json_object *e = json_object_array_get_idx(topics, t);
+				UAMQ_RateLimit* limit = &rate->topics[t];
+				char ts[128];
+				snprintf(ts, sizeof(ts), "%s.topics[%d]", rs.c_str(), t);
+				if(!section_keys(e, ts, rateTopicKeys)) {
+					return -1;
+				}
+				if(!json_object_object_get_ex(e, "prefix", &v) || json_object_get_type(v) != json_type_string ||
+						strlen(json_object_get_string(v)) >= sizeof(limit->prefix)) {
+					printf("[error] %s : rate topics[%d] needs a 'prefix' string shorter than %d.\n", sink, t, (int)sizeof(limit->prefix));
+					return -1;
+				}
+				strcpy(limit->prefix, json_object_get_string(v));
+				if(rate_limit(e, ts, sink, limit) < 0) {
+					return -1;
+				}
+			}
+			rate->topicCount = count;
+		}
+		printf("%s rate : %g msgs/s, %g bytes/s, burst %d us, %d topic prefixes\n", sink,
+			rate->sink.msgsPerSec, rate->sink.bytesPerSec, rate->burstUSec, rate->topicCount);
 	}
 
 	return 0;
 }
 
+/* json_tokener_parse_ex takes an int length, files go through in slices */
+#define PARSE_SLICE (16 * 1024 * 1024)
+
+/* the whole file, mapped and fed to one incremental tokener : no size limit, no copy */
+static json_object* parse_file(const char* fn)
+{
+	int fd = open(fn, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		printf("[error] %s : %s.\n", fn, strerror(errno));
+		return NULL;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) < 0 || st.st_size == 0) {
+		printf("[error] %s : empty or unreadable.\n", fn);
+		close(fd);
+		return NULL;
+	}
+	size_t size = (size_t)st.st_size;
+
+	void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(mapped == MAP_FAILED) {
+		printf("[error] %s : mmap failed (%s).\n", fn, strerror(errno));
+		return NULL;
+	}
+	madvise(mapped, size, MADV_SEQUENTIAL);
+	const char* data = (const char*)mapped;
+
+	json_tokener* tok = json_tokener_new_ex(JSON_TOKENER_DEFAULT_DEPTH);
+	json_object* jobj = NULL;
+	enum json_tokener_error jerr = json_tokener_continue;
+	size_t off = 0;
+
+	while(off < size && jerr == json_tokener_continue) {
+		int len = (int)(size - off < PARSE_SLICE ? size - off : PARSE_SLICE);
+		jobj = json_tokener_parse_ex(tok, data + off, len);
+		jerr = json_tokener_get_error(tok);
+		off += (jerr == json_tokener_continue) ? (size_t)len : (size_t)tok->char_offset;
+	}
+
+	if(jerr != json_tokener_success) {
+		/* line and column of the offending byte */
+		int line = 1, col = 1;
+		for (size_t k = 0; k < off && k < size; k++) {
+			if(data[k] == '\n') {
+				line++;
+				col = 1;
+			} else {
+				col++;
+			}
+		}
+		printf("[error] %s:%d:%d : %s.\n", fn, line, col,
+			jerr == json_tokener_continue ? "unexpected end of file" : json_tokener_error_desc(jerr));
+		jobj = NULL;
+	}
+
+	json_tokener_free(tok);
+	munmap(mapped, size);
+
+	return jobj;
+}
+
+static uint64_t fnv(uint64_t h, const void* data, size_t len)
+{
+	const unsigned char* c = (const unsigned char*)data;
+	for (size_t k = 0; k < len; k++) {
+		h = (h ^ c[k]) * 1099511628211ULL;
+	}
+	return h;
+}
+
+/* fnv-1a over the parsed values, no text is built */
+static uint64_t json_hash(json_object *v, uint64_t h)
+{
+	enum json_type type = json_object_get_type(v);
+	h = fnv(h, &type, sizeof(type));
+
+	switch(type) {
+		case json_type_object: {
+			json_object_object_foreach(v, key, val) {
+				h = fnv(h, key, strlen(key) + 1);
+				h = json_hash(val, h);
+			}
+		}
+		break;
+		case json_type_array: {
+			int l = json_object_array_length(v);
+			for (int i = 0; i < l; i++) {
+				h = json_hash(json_object_array_get_idx(v, i), h);
+			}
+		}
+		break;
+		case json_type_string: h = fnv(h, json_object_get_string(v), json_object_get_string_len(v)); break;
+		case json_type_int: { int64_t i = json_object_get_int64(v); h = fnv(h, &i, sizeof(i)); } break;
+		case json_type_double: { double d = json_object_get_double(v); h = fnv(h, &d, sizeof(d)); } break;
+		case json_type_boolean: { int b = json_object_get_boolean(v); h = fnv(h, &b, sizeof(b)); } break;
+		default : break;
+	}
+
+	return h;
+}
+
+/* what a group is without its sinks : a reload restarts a group only when this changes */
+static void group_spec(json_object *r, Group* G)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	json_object_object_foreach(r, key, val) {
+		if(strcmp(key, "mqtt") && strcmp(key, "amqp") && strcmp(key, "tcp") && strcmp(key, "sinks") && strcmp(key, "store")) {
+			h = fnv(h, key, strlen(key) + 1);
+			h = json_hash(val, h);
+		}
+	}
+	G->spec = h;
+}
+
+/* the node-map array into groups keyed by their position, NULL is an empty map */
+static int parse_groups(json_object *o, map<int, Group>& groups)
+{
+	if(o && json_object_get_type(o) != json_type_array) {
+		printf("[error] node-map : array expected, not %s.\n", json_type_to_name(json_object_get_type(o)));
+		return -1;
+	}
+
+	int l = o ? json_object_array_length(o) : 0;
+
+	for (int i = 0; i < l; i++) {
+		json_object *n = json_object_array_get_idx(o, i);
+
+		if(json_object_get_type(n) != json_type_object) {
+			printf("[error] node-map[%d] : object expected.\n", i);
+			return -1;
+		}
+
+		/* built in place, a node table is never copied */
+		Group* g = &groups.insert(groups.end(), pair<int, Group>(i, Group()))->second;
+		g->endpoint = NULL;
+		g->timestamp = NULL;
+		g->enable = true;
+		g->intervalUSec = 0;
+		g->ep = 0;
+		g->windowUSec = 0;
+		g->slideUSec = 0;
+		g->aggregates = 0;
+		g->adaptiveMinUSec = 0;
+		g->adaptiveMaxUSec = 0;
+		g->autoWindowUSec = 10000000;
+		g->deltaEvery = 100;
+		g->deltaKeyUSec = 10000000;
+		g->batchUSec = 1000000;
+		g->batchPerNode = false;
+		g->subscription = 0;
+		g->poll = NULL;
+		g->beat = 0;
+		g->mqtt = false;
+		g->amqp = false;
+		g->tcp = false;
+		g->sinks = 0;
+		g->store = false;
+		g->priority = false;
+		g->stop = false;
+		if(make_group(n, i, g) < 0) {
+			return -1;
+		}
+		group_spec(n, g);
+	}
+
+	set<string> devices;
+	map<int, Group>::iterator i;
+	for (i = groups.begin(); i != groups.end(); ++i) {
+		Group* p = (Group*)&i->second;
+
+		if(p->endpoint) {
+			p->ep = getEndpointIndex(p->endpoint);
+			if(p->ep < 0) {
+				printf("[error] group '%s' refers to unknown endpoint '%s'.\n", p->name, p->endpoint);
+				return -1;
+			}
+		}
+
+		if(p->store && !g_Configutation.storePath[0]) {
+			printf("[error] group '%s' : store needs the server-configuration.store section.\n", p->name);
+			return -1;
+		}
+
+		if(p->mqtt) p->sinks |= group_sink("mqtt");
+		if(p->amqp) p->sinks |= group_sink("amqp");
+		if(p->tcp) p->sinks |= group_sink("tcp");
+
+		enumPayloadFormat format = getPayloadFormat(p->format);
+		if((format == enumCBOR || format == enumDelta || format == enumGorilla) && (p->sinks & group_sink("tcp")) && !g_Configutation.tcpLengthFraming) {
+			printf("[error] group '%s' : %s on the tcp sink needs tcpSever.framing length, a line can't hold binary.\n", p->name, p->format);
+			return -1;
+		}
+
+		if(format == enumDelta) {
+			if(getMonitorMode(p->method) == enumEvent || p->windowUSec) {
+				printf("[error] group '%s' : delta is supported by poll and auto groups without aggregate only.\n", p->name);
+				return -1;
+			}
+			if(p->deltaEvery <= 0 || p->deltaKeyUSec <= 0) {
+				printf("[error] group '%s' : delta needs keyframeEvery > 0 and keyframeUSec > 0.\n", p->name);
+				return -1;
+			}
+		}
+
+		if(format == enumGorilla) {
+			if(getMonitorMode(p->method) == enumEvent || p->windowUSec) {
+				printf("[error] group '%s' : gorilla is supported by poll and auto groups without aggregate only.\n", p->name);
+				return -1;
+			}
+			if(p->batchUSec <= 0) {
+				printf("[error] group '%s' : batch needs windowUSec > 0.\n", p->name);
+				return -1;
+			}
+		}
+
+		if(format == enumSparkplug) {
+			if(!g_Configutation.sparkplug) {
+				printf("[error] group '%s' : sparkplug needs mqttBrocker.sparkplug.\n", p->name);
+				return -1;
+			}
+			if(p->sinks != group_sink("mqtt")) {
+				printf("[error] group '%s' : sparkplug is published on the mqtt sink only.\n", p->name);
+				return -1;
+			}
+			if(p->windowUSec) {
+				printf("[error] group '%s' : aggregate can't be published as sparkplug.\n", p->name);
+				return -1;
+			}
+			/* the topic names the device */
+			if(p->enable && !devices.insert(p->topic).second) {
+				printf("[error] group '%s' : sparkplug device '%s' is published by another group.\n", p->name, p->topic);
+				return -1;
+			}
+		}
+
+		if(p->windowUSec) {
+			if(getMonitorMode(p->method) == enumEvent) {
+				printf("[error] group '%s' : aggregate is supported by poll and auto groups only.\n", p->name);
+				return -1;
+			}
+			if(p->windowUSec < 0 || p->slideUSec <= 0 || p->slideUSec > p->windowUSec) {
+				printf("[error] group '%s' : aggregate needs 0 < slideUSec <= windowUSec.\n", p->name);
+				return -1;
+			}
+			if(!p->aggregates) {
+				printf("[error] group '%s' : aggregate has no valid function.\n", p->name);
+				return -1;
+			}
+		}
+
+		if(p->adaptiveMinUSec || p->adaptiveMaxUSec) {
+			if(getMonitorMode(p->method) == enumEvent) {
+				printf("[error] group '%s' : adaptive is supported by poll and auto groups only.\n", p->name);
+				return -1;
+			}
+			if(p->adaptiveMinUSec <= 0 || p->adaptiveMaxUSec < p->adaptiveMinUSec) {
+				printf("[error] group '%s' : adaptive needs 0 < minUSec <= maxUSec.\n", p->name);
+				return -1;
+			}
+		}
+
+		if(getMonitorMode(p->method) == enumAuto && (p->intervalUSec <= 0 || p->autoWindowUSec < p->intervalUSec)) {
+			printf("[error] group '%s' : auto needs 0 < intervalUSec <= autoWindowUSec.\n", p->name);
+			return -1;
+		}
+
+		/* after the checks above, they compare sink masks */
+		if(p->priority) {
+			p->sinks |= UAMQ_SINK_PRIORITY;
+		}
+		printf("[%d] name: %s, method: %s, interval(us): %d, nodes: %d, sinks: 0x%x%s\n", i->first, p->name, p->method, p->intervalUSec,
+			(int)p->nodes.size(), p->sinks & ~UAMQ_SINK_PRIORITY, p->priority ? ", priority: high" : "");
+	}
+
+	return (int)UA_STATUSCODE_GOOD;
+}
+
+/* nothing of a node-map with an error is kept */
+static int load_groups(json_object *o, map<int, Group>& groups)
+{
+	int r = parse_groups(o, groups);
+	if(r < 0) {
+		map<int, Group>::iterator i;
+		for (i = groups.begin(); i != groups.end(); ++i) {
+			group_free(&i->second);
+		}
+		groups.clear();
+	}
+
+	return r;
+}
+
 int load(char* fn)
 {
 	char exe[256] = {0, };
@@ -264,29 +1092,10 @@ int load(char* fn)
 
 	free(folder);
 
-	#define CHUNK 1024 * 1024
-	char data[CHUNK] = {0,};
-	FILE *file;
-
-	file = fopen(configFn, "r");
-	if (file) {
-		size_t nread;
-		while ((nread = fread(data, 1, sizeof data, file)) > 0) {
-			//fwrite(data, 1, nread, stdout);
-
-			//allowed first 1MB only.
-			break;
-		}
-
-		if (ferror(file)) {
-			/* deal with error */
-		}
-		fclose(file);
-	} else {
+	json_object *jobj = parse_file(configFn);
+	if(!jobj) {
 		return -1;
 	}
-
-	json_object *jobj = json_tokener_parse(data);
 	json_object *o = NULL;
 	json_object *c = NULL;
 	json_object *v = NULL;
@@ -294,175 +1103,505 @@ int load(char* fn)
 	bool b = json_object_object_get_ex(jobj, "device-configuration", &o);
 	if(b) {
 		printf("[[[ %s ]]]\n", "device-configuration");
-		if(!json_object_object_get_ex(o, "Device", &c)) {
+		if(!required(o, "device-configuration", "Device", &c)) {
 			return -1;
 		}
 
-		if(!json_object_object_get_ex(c, "deviceID", &v)) {
+		if(!required(c, "device-configuration.Device", "deviceID", &v)) {
 			return -1;
 		}
 		strcpy(g_Configutation.deviceID, json_object_get_string(v));
 	}
 
+	for (int i = 0; i < UAMQ_MAX_SINKS; i++) {
+		g_Configutation.sinkQueueSize[i] = UAMQ_SINK_QUEUE_MAX;
+		g_Configutation.sinkOverload[i] = enumOverloadDropOldest;
+		memset(&g_Configutation.sinkRate[i], 0, sizeof(UAMQ_SinkRate));
+		g_Configutation.sinkRate[i].burstUSec = 1000000;
+	}
+
 	b = json_object_object_get_ex(jobj, "server-configuration", &o);
 	if(b) {
 		printf("[[[ %s ]]]\n", "server-configuration");
-		//travers(jobj, o, json_type_object);
+		if(!section_keys(o, "server-configuration", serverKeys)) {
+			return -1;
+		}
 
-		if(!json_object_object_get_ex(o, "opcuaServer", &c)) {
+		if(!required(o, "server-configuration", "opcuaServer", &c) || !section_keys(c, "server-configuration.opcuaServer", opcuaServerKeys)) {
 			return -1;
 		}
 
-		if(!json_object_object_get_ex(c, "EndpointURL", &v)) {
+		if(!required(c, "server-configuration.opcuaServer", "EndpointURL", &v)) {
 			return -1;
 		}
 		strcpy(g_Configutation.uaServerAddress, json_object_get_string(v));
 
-		if(!json_object_object_get_ex(c, "publishIntervalUs", &v)) {
+		strcpy(g_Configutation.endpoints[0].name, "default");
+		strcpy(g_Configutation.endpoints[0].address, g_Configutation.uaServerAddress);
+		g_Configutation.endpointCount = 1;
+
+		if(!required(c, "server-configuration.opcuaServer", "publishIntervalUs", &v) || !section_type(v, json_type_int, "server-configuration.opcuaServer", "publishIntervalUs")) {
 			return -1;
 		}
 		g_Configutation.uaPublishIntervalUsecs = json_object_get_int(v);
 
-		if(!json_object_object_get_ex(c, "asycRequestSupported", &v)) {
+		if(!required(c, "server-configuration.opcuaServer", "asycRequestSupported", &v) || !section_type(v, json_type_boolean, "server-configuration.opcuaServer", "asycRequestSupported")) {
 			return -1;
 		}
 		g_Configutation.asycRequestSupported = json_object_get_boolean(v);
 
-		if(!json_object_object_get_ex(c, "method", &v)) {
+		if(!required(c, "server-configuration.opcuaServer", "method", &v)) {
+			return -1;
+		}
+		if(strcmp(json_object_get_string(v), "poll") && strcmp(json_object_get_string(v), "event")) {
+			printf("[error] server-configuration.opcuaServer.method : '%s' is not poll or event.\n", json_object_get_string(v));
 			return -1;
 		}
 		strcpy(g_Configutation.method, json_object_get_string(v));
 
+		// more OPC UA servers, groups refer to them by 'endpoint' name =========
+		if(json_object_object_get_ex(o, "opcuaEndpoints", &c)) {
+			if(!section_type(c, json_type_array, "server-configuration", "opcuaEndpoints")) {
+				return -1;
+			}
+			int l = json_object_array_length(c);
+
+			for (int i = 0; i < l; i++) {
+				json_object *e = json_object_array_get_idx(c, i);
+				json_object *name = NULL;
+				json_object *url = NULL;
+
+				if(g_Configutation.endpointCount >= UAMQ_MAX_ENDPOINTS) {
+					printf("[error] too many opcuaEndpoints (max %d).\n", UAMQ_MAX_ENDPOINTS);
+					return -1;
+				}
+
+				char section[64];
+				snprintf(section, sizeof(section), "server-configuration.opcuaEndpoints[%d]", i);
+				if(!section_keys(e, section, endpointKeys)) {
+					return -1;
+				}
+
+				if(!json_object_object_get_ex(e, "name", &name) || !json_object_object_get_ex(e, "EndpointURL", &url)) {
+					printf("[error] opcuaEndpoints #%d needs 'name' and 'EndpointURL'.\n", i);
+					return -1;
+				}
+
+				if(getEndpointIndex(json_object_get_string(name)) >= 0) {
+					printf("[error] opcuaEndpoints #%d : duplicated name '%s'.\n", i, json_object_get_string(name));
+					return -1;
+				}
+
+				UAMQ_Endpoint* ep = &g_Configutation.endpoints[g_Configutation.endpointCount++];
+				snprintf(ep->name, sizeof(ep->name), "%s", json_object_get_string(name));
+				snprintf(ep->address, sizeof(ep->address), "%s", json_object_get_string(url));
+			}
+		}
+
+		// last-value cache, optional =========
+		g_Configutation.cacheSocket[0] = '\0';
+		if(json_object_object_get_ex(o, "cache", &c) && !section_keys(c, "server-configuration.cache", cacheKeys)) {
+			return -1;
+		}
+		if(c && json_object_object_get_ex(c, "socket", &v)) {
+			if(strlen(json_object_get_string(v)) >= sizeof(g_Configutation.cacheSocket)) {
+				printf("[error] cache socket path is too long (max %d).\n", (int)sizeof(g_Configutation.cacheSocket) - 1);
+				return -1;
+			}
+			strcpy(g_Configutation.cacheSocket, json_object_get_string(v));
+		}
+
+		// thread placement, optional =========
+		memset(g_Configutation.threads, 0, sizeof(g_Configutation.threads));
+		g_Configutation.lockMemory = false;
+		if(json_object_object_get_ex(o, "threads", &c)) {
+			if(json_object_get_type(c) != json_type_object) {
+				printf("[error] server-configuration.threads : object expected, not %s.\n", json_type_to_name(json_object_get_type(c)));
+				return -1;
+			}
+			json_object_object_foreach(c, key, val) {
+				int t = 0;
+				while(t < enumThreadClassCount && strcmp(key, getThreadClassName(t))) {
+					t++;
+				}
+				if(t == enumThreadClassCount && strcmp(key, "mlockall")) {
+					printf("[error] server-configuration.threads : unknown key '%s'.\n", key);
+					return -1;
+				}
+				string section = string("server-configuration.threads.") + key;
+				if(t < enumThreadClassCount && !section_keys(val, section.c_str(), threadKeys)) {
+					return -1;
+				}
+			}
+			if(json_object_object_get_ex(c, "mlockall", &v)) {
+				if(!section_type(v, json_type_boolean, "server-configuration.threads", "mlockall")) return -1;
+				g_Configutation.lockMemory = json_object_get_boolean(v);
+			}
+			for (int t = 0; t < enumThreadClassCount; t++) {
+				json_object *tc = NULL;
+				if(!json_object_object_get_ex(c, getThreadClassName(t), &tc)) {
+					continue;
+				}
+				UAMQ_ThreadPolicy* tp = &g_Configutation.threads[t];
+				if(json_object_object_get_ex(tc, "cpus", &v) && getCpuMask(json_object_get_string(v), &tp->cpus) < 0) {
+					printf("[error] threads.%s : invalid cpus '%s', expected a list like \"0,2-3\" (cpu < 64).\n", getThreadClassName(t), json_object_get_string(v));
+					return -1;
+				}
+				if(json_object_object_get_ex(tc, "priority", &v)) {
+					string section = string("server-configuration.threads.") + getThreadClassName(t);
+					if(!section_type(v, json_type_int, section.c_str(), "priority")) return -1;
+					tp->priority = json_object_get_int(v);
+					if(tp->priority < 0 || tp->priority > 99) {
+						printf("[error] threads.%s : priority should be 0 (normal) or 1..99 (SCHED_FIFO).\n", getThreadClassName(t));
+						return -1;
+					}
+				}
+			}
+		}
+
+		// shutdown, optional =========
+		g_Configutation.shutdownDeadlineUSec = 5000000;
+		if(json_object_object_get_ex(o, "shutdown", &c) && !section_keys(c, "server-configuration.shutdown", shutdownKeys)) {
+			return -1;
+		}
+		if(c && json_object_object_get_ex(c, "deadlineUSec", &v)) {
+			if(!section_type(v, json_type_int, "server-configuration.shutdown", "deadlineUSec")) return -1;
+			g_Configutation.shutdownDeadlineUSec = json_object_get_int(v);
+			if(g_Configutation.shutdownDeadlineUSec < 0) {
+				printf("[error] shutdown.deadlineUSec should be 0 (no drain) or more.\n");
+				return -1;
+			}
+		}
+
+		// priority classes, optional =========
+		g_Configutation.sinkSloUSec[enumLaneHigh] = 100000;
+		g_Configutation.sinkSloUSec[enumLaneNormal] = 1000000;
+		g_Configutation.prioritySessions = true;
+		if(json_object_object_get_ex(o, "priority", &c)) {
+			if(!section_keys(c, "server-configuration.priority", priorityKeys)) {
+				return -1;
+			}
+			if(json_object_object_get_ex(c, "highSloUSec", &v)) {
+				if(!section_type(v, json_type_int, "server-configuration.priority", "highSloUSec")) return -1;
+				g_Configutation.sinkSloUSec[enumLaneHigh] = json_object_get_int(v);
+			}
+			if(json_object_object_get_ex(c, "normalSloUSec", &v)) {
+				if(!section_type(v, json_type_int, "server-configuration.priority", "normalSloUSec")) return -1;
+				g_Configutation.sinkSloUSec[enumLaneNormal] = json_object_get_int(v);
+			}
+			if(json_object_object_get_ex(c, "sessions", &v)) {
+				if(!section_type(v, json_type_boolean, "server-configuration.priority", "sessions")) return -1;
+				g_Configutation.prioritySessions = json_object_get_boolean(v);
+			}
+			if(g_Configutation.sinkSloUSec[enumLaneHigh] < 0 || g_Configutation.sinkSloUSec[enumLaneNormal] < 0) {
+				printf("[error] priority : highSloUSec and normalSloUSec should be 0 (none) or more.\n");
+				return -1;
+			}
+		}
+
+		// stall watchdog, optional =========
+		g_Configutation.watchdogEnable = false;
+		g_Configutation.watchdogIntervals = 10;
+		g_Configutation.watchdogMinUSec = 10000000;
+		g_Configutation.watchdogRestart = false;
+		if(json_object_object_get_ex(o, "watchdog", &c)) {
+			if(!section_keys(c, "server-configuration.watchdog", watchdogKeys)) {
+				return -1;
+			}
+			g_Configutation.watchdogEnable = true;
+			if(json_object_object_get_ex(c, "intervals", &v)) {
+				if(!section_type(v, json_type_int, "server-configuration.watchdog", "intervals")) return -1;
+				g_Configutation.watchdogIntervals = json_object_get_int(v);
+			}
+			if(json_object_object_get_ex(c, "minUSec", &v)) {
+				if(!section_type(v, json_type_int, "server-configuration.watchdog", "minUSec")) return -1;
+				g_Configutation.watchdogMinUSec = json_object_get_int(v);
+			}
+			if(json_object_object_get_ex(c, "restart", &v)) {
+				if(!section_type(v, json_type_boolean, "server-configuration.watchdog", "restart")) return -1;
+				g_Configutation.watchdogRestart = json_object_get_boolean(v);
+			}
+			if(g_Configutation.watchdogIntervals <= 0 || g_Configutation.watchdogMinUSec <= 0) {
+				printf("[error] watchdog needs intervals > 0 and minUSec > 0.\n");
+				return -1;
+			}
+		}
+
+		// node-map reload, optional =========
+		g_Configutation.reloadWatch = false;
+		if(json_object_object_get_ex(o, "reload", &c) && !section_keys(c, "server-configuration.reload", reloadKeys)) {
+			return -1;
+		}
+		if(c && json_object_object_get_ex(c, "watch", &v)) {
+			if(!section_type(v, json_type_boolean, "server-configuration.reload", "watch")) return -1;
+			g_Configutation.reloadWatch = json_object_get_boolean(v);
+		}
+
+		// local store, optional =========
+		g_Configutation.storePath[0] = '\0';
+		g_Configutation.storePartitionUSec = 3600000000LL;
+		g_Configutation.storeFlushUSec = 10000000;
+		g_Configutation.storeRetentionUSec = 0;
+		if(json_object_object_get_ex(o, "store", &c)) {
+			if(!section_keys(c, "server-configuration.store", storeKeys) || !required(c, "server-configuration.store", "path", &v)) {
+				return -1;
+			}
+			if(strlen(json_object_get_string(v)) >= sizeof(g_Configutation.storePath) || !json_object_get_string(v)[0]) {
+				printf("[error] store.path should be 1 to %d characters.\n", (int)sizeof(g_Configutation.storePath) - 1);
+				return -1;
+			}
+			strcpy(g_Configutation.storePath, json_object_get_string(v));
+			if(json_object_object_get_ex(c, "partitionUSec", &v)) {
+				if(!section_type(v, json_type_int, "server-configuration.store", "partitionUSec")) return -1;
+				g_Configutation.storePartitionUSec = json_object_get_int64(v);
+			}
+			if(json_object_object_get_ex(c, "flushUSec", &v)) {
+				if(!section_type(v, json_type_int, "server-configuration.store", "flushUSec")) return -1;
+				g_Configutation.storeFlushUSec = json_object_get_int(v);
+			}
+			if(json_object_object_get_ex(c, "retentionUSec", &v)) {
+				if(!section_type(v, json_type_int, "server-configuration.store", "retentionUSec")) return -1;
+				g_Configutation.storeRetentionUSec = json_object_get_int64(v);
+			}
+			/* the file names count in seconds */
+			if(g_Configutation.storePartitionUSec < 1000000 || g_Configutation.storePartitionUSec % 1000000) {
+				printf("[error] store.partitionUSec should be whole seconds, 1 s or more.\n");
+				return -1;
+			}
+			if(g_Configutation.storeFlushUSec <= 0 || g_Configutation.storeRetentionUSec < 0) {
+				printf("[error] store needs flushUSec > 0 and retentionUSec >= 0.\n");
+				return -1;
+			}
+		}
+		if(g_Configutation.backfill && !g_Configutation.storePath[0]) {
+			printf("[error] --backfill needs the server-configuration.store section.\n");
+			return -1;
+		}
+
+		// the discovery section is read by --discover, its keys are checked here as well
+		if(json_object_object_get_ex(o, "discovery", &c) && !section_keys(c, "server-configuration.discovery", discoveryKeys)) {
+			return -1;
+		}
+
 		// MQTT =========
-		if(!json_object_object_get_ex(o, "mqttBrocker", &c)) {
+		if(!required(o, "server-configuration", "mqttBrocker", &c) || !section_keys(c, "server-configuration.mqttBrocker", mqttKeys)) {
 			return -1;
 		}
 
-		if(!json_object_object_get_ex(c, "enable", &v)) {
+		if(!required(c, "server-configuration.mqttBrocker", "enable", &v) || !section_type(v, json_type_boolean, "server-configuration.mqttBrocker", "enable")) {
 			return -1;
 		}
 		g_Configutation.mqttEnable = json_object_get_boolean(v);
 
-		if(!json_object_object_get_ex(c, "ip", &v)) {
+		if(!required(c, "server-configuration.mqttBrocker", "ip", &v)) {
 			return -1;
 		}
 		strcpy(g_Configutation.mqttBrockerIP, json_object_get_string(v));
 
-		if(!json_object_object_get_ex(c, "port", &v)) {
+		if(!required(c, "server-configuration.mqttBrocker", "port", &v) || !section_type(v, json_type_int, "server-configuration.mqttBrocker", "port")) {
 			return -1;
 		}
 		g_Configutation.mqttBrockerPORT = json_object_get_int(v);
 
-		if(!json_object_object_get_ex(c, "topicBase", &v)) {
+		if(!required(c, "server-configuration.mqttBrocker", "topicBase", &v)) {
 			return -1;
 		}
 		strcpy(g_Configutation.topicBase, json_object_get_string(v));
 
+		if(sink_policy(c, "server-configuration.mqttBrocker", "mqtt") < 0) {
+			return -1;
+		}
+
+		// optional, '<topicBase>/<deviceID>/<commandTopic>/<group topic>/<node topic>' writes the node
+		g_Configutation.commandTopic[0] = '\0';
+		if(json_object_object_get_ex(c, "commandTopic", &v)) {
+			snprintf(g_Configutation.commandTopic, sizeof(g_Configutation.commandTopic), "%s", json_object_get_string(v));
+		}
+
+		strcpy(g_Configutation.ackTopic, "ack");
+		if(json_object_object_get_ex(c, "ackTopic", &v)) {
+			snprintf(g_Configutation.ackTopic, sizeof(g_Configutation.ackTopic), "%s", json_object_get_string(v));
+		}
+
+		g_Configutation.writeCoalesceUSec = 5000;
+		if(json_object_object_get_ex(c, "writeCoalesceUSec", &v)) {
+			if(!section_type(v, json_type_int, "server-configuration.mqttBrocker", "writeCoalesceUSec")) return -1;
+			g_Configutation.writeCoalesceUSec = json_object_get_int(v);
+		}
+
+		// Sparkplug B edge node, optional. edgeNodeId defaults to the deviceID (of the shard) =========
+		g_Configutation.sparkplug = false;
+		json_object* spb = NULL;
+		if(json_object_object_get_ex(c, "sparkplug", &spb)) {
+			if(!section_keys(spb, "server-configuration.mqttBrocker.sparkplug", sparkplugKeys)) {
+				return -1;
+			}
+			g_Configutation.sparkplug = true;
+			if(!required(spb, "server-configuration.mqttBrocker.sparkplug", "groupId", &v)) {
+				return -1;
+			}
+			int n = snprintf(g_Configutation.spbGroupId, sizeof(g_Configutation.spbGroupId), "%s", json_object_get_string(v));
+			if(n >= (int)sizeof(g_Configutation.spbGroupId)) {
+				printf("[error] mqttBrocker.sparkplug : groupId is longer than %d.\n", (int)sizeof(g_Configutation.spbGroupId) - 1);
+				return -1;
+			}
+
+			if(json_object_object_get_ex(spb, "edgeNodeId", &v)) {
+				n = snprintf(g_Configutation.spbEdgeNodeId, sizeof(g_Configutation.spbEdgeNodeId), "%s", json_object_get_string(v));
+			} else if(g_Configutation.shardCount > 1) {
+				n = snprintf(g_Configutation.spbEdgeNodeId, sizeof(g_Configutation.spbEdgeNodeId), "%s-%d", g_Configutation.deviceID, g_Configutation.shardIndex);
+			} else {
+				n = snprintf(g_Configutation.spbEdgeNodeId, sizeof(g_Configutation.spbEdgeNodeId), "%s", g_Configutation.deviceID);
+			}
+			/* a cut edgeNodeId could be the one of another bridge */
+			if(n >= (int)sizeof(g_Configutation.spbEdgeNodeId)) {
+				printf("[error] mqttBrocker.sparkplug : edgeNodeId (or deviceID-shard) is longer than %d.\n", (int)sizeof(g_Configutation.spbEdgeNodeId) - 1);
+				return -1;
+			}
+
+			if(!g_Configutation.spbGroupId[0] || strpbrk(g_Configutation.spbGroupId, "/+#") ||
+					!g_Configutation.spbEdgeNodeId[0] || strpbrk(g_Configutation.spbEdgeNodeId, "/+#")) {
+				printf("[error] mqttBrocker.sparkplug : groupId and edgeNodeId can't be empty or hold '/', '+' or '#'.\n");
+				return -1;
+			}
+		}
+
 		// AMQP Rabbit =========
-		if(!json_object_object_get_ex(o, "amqpRabbit", &c)) {
+		if(!required(o, "server-configuration", "amqpRabbit", &c) || !section_keys(c, "server-configuration.amqpRabbit", amqpKeys)) {
 			return -1;
 		}
 
-		if(!json_object_object_get_ex(c, "enable", &v)) {
+		if(!required(c, "server-configuration.amqpRabbit", "enable", &v) || !section_type(v, json_type_boolean, "server-configuration.amqpRabbit", "enable")) {
 			return -1;
 		}
 		g_Configutation.amqpEnable = json_object_get_boolean(v);
 
-		if(!json_object_object_get_ex(c, "ip", &v)) {
+		if(!required(c, "server-configuration.amqpRabbit", "ip", &v)) {
 			return -1;
 		}
 		strcpy(g_Configutation.amqpIP, json_object_get_string(v));
 
-		if(!json_object_object_get_ex(c, "port", &v)) {
+		if(!required(c, "server-configuration.amqpRabbit", "port", &v) || !section_type(v, json_type_int, "server-configuration.amqpRabbit", "port")) {
 			return -1;
 		}
 		g_Configutation.amqpPORT = json_object_get_int(v);
 
-		if(!json_object_object_get_ex(c, "topicBase", &v)) {
+		if(!required(c, "server-configuration.amqpRabbit", "topicBase", &v)) {
 			return -1;
 		}
 		strcpy(g_Configutation.amqpTopicBase, json_object_get_string(v));
 
+		if(sink_policy(c, "server-configuration.amqpRabbit", "amqp") < 0) {
+			return -1;
+		}
+
 		// TCP ============
-		if(!json_object_object_get_ex(o, "tcpSever", &c)) {
+		if(!required(o, "server-configuration", "tcpSever", &c) || !section_keys(c, "server-configuration.tcpSever", tcpKeys)) {
 			return -1;
 		}
-		if(!json_object_object_get_ex(c, "ip", &v)) {
+		if(!required(c, "server-configuration.tcpSever", "ip", &v)) {
 			return -1;
 		}
 		strcpy(g_Configutation.tcpBrockerIP, json_object_get_string(v));
 
-		if(!json_object_object_get_ex(c, "port", &v)) {
+		if(!required(c, "server-configuration.tcpSever", "port", &v) || !section_type(v, json_type_int, "server-configuration.tcpSever", "port")) {
 			return -1;
 		}
 		g_Configutation.tcpBrockerPORT = json_object_get_int(v);
 		
-		if(!json_object_object_get_ex(c, "sampleIntervalUs", &v)) {
+		if(!required(c, "server-configuration.tcpSever", "sampleIntervalUs", &v) || !section_type(v, json_type_int, "server-configuration.tcpSever", "sampleIntervalUs")) {
 			return -1;
 		}
 		g_Configutation.tcpSampleIntervalUs = json_object_get_int(v);
 
-		if(!json_object_object_get_ex(c, "singleshot", &v)) {
+		if(!required(c, "server-configuration.tcpSever", "singleshot", &v) || !section_type(v, json_type_boolean, "server-configuration.tcpSever", "singleshot")) {
 			return -1;
 		}
 		g_Configutation.singleshot = json_object_get_boolean(v);
 
-		if(!json_object_object_get_ex(c, "enable", &v)) {
+		if(!required(c, "server-configuration.tcpSever", "enable", &v) || !section_type(v, json_type_boolean, "server-configuration.tcpSever", "enable")) {
 			return -1;
 		}
 		g_Configutation.tcpEnable = json_object_get_boolean(v);
+
+		g_Configutation.tcpLengthFraming = false;
+		if(json_object_object_get_ex(c, "framing", &v)) {
+			if(!strcmp(json_object_get_string(v), "length")) {
+				g_Configutation.tcpLengthFraming = true;
+			} else if(strcmp(json_object_get_string(v), "line")) {
+				printf("[error] tcpSever.framing should be line or length.\n");
+				return -1;
+			}
+		}
+
+		if(sink_policy(c, "server-configuration.tcpSever", "tcp") < 0) {
+			return -1;
+		}
 	}
 
-	b = json_object_object_get_ex(jobj, "node-map", &o);
-	if(b) {
+	o = NULL;
+	if(json_object_object_get_ex(jobj, "node-map", &o)) {
 		printf("[[[ %s ]]]\n", "node-map");
+	}
 
-		int l = json_object_array_length(o);
+	/* the groups copied what they keep, the tree goes */
+	int r = load_groups(o, m);
+	json_object_put(jobj);
 
-		for (int i = 0; i < l; i++) {
-			json_object *n = json_object_array_get_idx(o, i);
-
-			enum json_type type;
-			type = json_object_get_type(n);
-			switch(type) {
-				case json_type_object: {
-					printf("[[[ %s : RECORD GROUP(OBJ) #%d ]]]\n", "node-map", i);
-					Group g;
-					make_group(n, &g);
-					m.insert(pair<int, Group>(i, g));
-				}
-				break;
-				default : {
-					printf("%s\n", "node-map should be contained object array only.");
-					break;
-				}
-			}
+	return r;
+}
+
+/* reload : the node-map of the same file again, the rest of it was applied at start */
+int load_node_map(map<int, Group>& groups)
+{
+	json_object *jobj = parse_file(g_Configutation.configFile);
+	json_object *o = NULL;
+
+	if(!jobj || json_object_get_type(jobj) != json_type_object) {
+		if(jobj) {
+			printf("[error] %s : object expected.\n", g_Configutation.configFile);
+			json_object_put(jobj);
 		}
+		return -1;
 	}
 
-	cout << "\n";
+	json_object_object_get_ex(jobj, "node-map", &o);
+	int r = load_groups(o, groups);
+	json_object_put(jobj);
 
-	map<int, Group>::iterator i;
-	for (i = m.begin(); i != m.end(); ++i) {
-		Group* p = (Group*)&i->second;
-		cout << "[" << i->first << "] name: " << p->name << ", method: " << p->method << ", interval(us): " << p->intervalUSec << ", mqtt: " << p->mqtt << ", tcp: " << p->tcp << "\n";
+	if(r == (int)UA_STATUSCODE_GOOD && g_Configutation.shardCount > 1) {
+		shard_groups(groups);
+	}
 
-		map<int, Node>::iterator n;
-		for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
-			Node* d = (Node*)&n->second;
-			cout << "\t[" << n->first << "] id: " << d->id << ", topic: " <<  d->topic << ", alias: " << d->alias << "\n";
+	return r;
+}
+
+/* discovery : the whole file, written again with the groups it found */
+json_object* load_config_json(void)
+{
+	return parse_file(g_Configutation.configFile);
+}
+
+int getEndpointIndex(const char* name)
+{
+	for (int i = 0; i < g_Configutation.endpointCount; i++) {
+		if(!strcmp(g_Configutation.endpoints[i].name, name)) {
+			return i;
 		}
 	}
 
-	return (int)UA_STATUSCODE_GOOD;
+	return -1;
 }
 
+/* the loader let the names through exactly, see field_choice */
 enumMonitorMode getMonitorMode(char* method)
 {
-	if(!strncmp(method, "event", strlen(method))) {
+	if(!strcmp(method, "event")) {
 		return enumEvent;
-	} else if(!strncmp(method, "poll", strlen(method))) {
+	} else if(!strcmp(method, "poll")) {
 		return enumPoll;
+	} else if(!strcmp(method, "auto")) {
+		return enumAuto;
 	} else {
 		return enumPoll;
 	}
@@ -470,11 +1609,47 @@ enumMonitorMode getMonitorMode(char* method)
 
 enumPayloadFormat getPayloadFormat(char* format)
 {
-	if(!strncmp(format, "json", strlen(format))) {
+	if(!strcmp(format, "json")) {
 		return enumJSON;
-	} else if(!strncmp(format, "kv", strlen(format))) {
+	} else if(!strcmp(format, "kv")) {
 		return enumKeyVal;
+	} else if(!strcmp(format, "cbor")) {
+		return enumCBOR;
+	} else if(!strcmp(format, "sparkplug")) {
+		return enumSparkplug;
+	} else if(!strcmp(format, "delta")) {
+		return enumDelta;
+	} else if(!strcmp(format, "gorilla")) {
+		return enumGorilla;
 	} else {
 		return enumJSON;
 	}	
-}
\ No newline at end of file
+}
+
+enumTimestampSource getTimestampSource(char* timestamp)
+{
+	if(!timestamp) {
+		return enumTsBridge;
+	} else if(!strcmp(timestamp, "source")) {
+		return enumTsSource;
+	} else if(!strcmp(timestamp, "server")) {
+		return enumTsServer;
+	} else {
+		return enumTsBridge;
+	}
+}
+
+enum enumOverloadPolicy getOverloadPolicy(const char* overload)
+{
+	if(!strcmp(overload, "block")) {
+		return enumOverloadBlock;
+	} else if(!strcmp(overload, "drop-oldest")) {
+		return enumOverloadDropOldest;
+	} else if(!strcmp(overload, "drop-newest")) {
+		return enumOverloadDropNewest;
+	} else if(!strcmp(overload, "coalesce-latest")) {
+		return enumOverloadCoalesceLatest;
+	} else {
+		return enumOverloadUnknown;
+	}
+}
@@ -19,6 +19,38 @@ extern "C" {
 # include <stdlib.h>
 #endif
 
+#include <pthread.h>
+
+#include "client-sink.h"
+#include "client-thread.h"
+
+#define UAMQ_MAX_ENDPOINTS 32
+
+typedef struct {
+	char name[64];
+	char address[128];
+
+	UA_Client* client;
+	pthread_mutex_t lock;
+
+	/* reconnect coordinator state, see client-connection.c */
+	pthread_mutex_t recoverLock;
+	pthread_cond_t recoverDone;
+	pthread_cond_t recoverWake;
+	pthread_t recoverThread;	/* connects the endpoint first, then recovers its session */
+	bool recovering;
+	bool started;	/* browsed and its event groups monitored once */
+	unsigned int generation;
+	UA_StatusCode recoverState;
+
+	/* a priority read session : the reads of the high priority groups, nothing subscribed */
+	bool reader;
+
+	/* a subscription exists : the main loop sends its publish requests */
+	bool subscribed;
+	UA_UInt32 subscription;	/* the one of the event groups, 0 when event mode is off */
+} UAMQ_Endpoint;
+
 typedef struct {
 	char configFile[128];
 	char configFolder[128];
@@ -33,23 +65,92 @@ typedef struct {
 	char mqttBrockerIP[128];
 	int mqttBrockerPORT;
 	char topicBase[32];
+
+	/* MQTT -> OPC UA write-back, disabled when commandTopic is empty */
+	char commandTopic[64];
+	char ackTopic[64];
+	int writeCoalesceUSec;
+
+	/* Sparkplug B edge node of the "sparkplug" groups, see client-sparkplug.h */
+	bool sparkplug;
+	char spbGroupId[64];
+	char spbEdgeNodeId[64];
+
+	/* last-value cache query socket, disabled when empty */
+	char cacheSocket[108];
+
+	/* "threads" : cpu sets and SCHED_FIFO priorities per thread class, mlockall */
+	UAMQ_ThreadPolicy threads[enumThreadClassCount];
+	bool lockMemory;
+
+	/* "shutdown" : how long the sinks may drain their queues on stop */
+	int shutdownDeadlineUSec;
+
+	/* "priority" : publish to send latency objective per sink lane (0 : none), a read session per endpoint for the high groups */
+	int sinkSloUSec[enumLaneCount];
+	bool prioritySessions;
+
+	/* "watchdog" : a stage is stalled after max(intervals x its interval, minUSec) without progress */
+	bool watchdogEnable;
+	int watchdogIntervals;
+	int watchdogMinUSec;
+	bool watchdogRestart;	/* abort the connection of a stalled sink */
+
+	/* "reload" : the node-map is applied again on SIGHUP, and on every save when watch is set */
+	bool reloadWatch;
 	
 	bool tcpEnable;
 	char tcpBrockerIP[128];
 	int tcpBrockerPORT;
 	int tcpSampleIntervalUs;
 	bool singleshot;
+	bool tcpLengthFraming;	/* "framing": "length" : u32 length prefix instead of '\n' */
 
 	bool amqpEnable;
 	char amqpIP[128];
 	int amqpPORT;
 	char amqpTopicBase[32];
 
-	UA_Client* client;
+	/* per sink plugin index, 'queueSize', 'overload' and 'rate' of its section */
+	int sinkQueueSize[UAMQ_MAX_SINKS];
+	enum enumOverloadPolicy sinkOverload[UAMQ_MAX_SINKS];
+	UAMQ_SinkRate sinkRate[UAMQ_MAX_SINKS];
+
+	/* --shard index/count, this instance runs only the groups it owns */
+	int shardIndex;
+	int shardCount;
+
+	/* --record file : samples to a log, --replay file [--speed N] : the log instead of OPC UA */
+	char recordFile[256];
+	char replayFile[256];
+	double replaySpeed;
+
+	/* "store" : local history of the groups with "store": true, empty path when off */
+	char storePath[256];
+	int64_t storePartitionUSec;
+	int storeFlushUSec;
+	int64_t storeRetentionUSec;	/* 0 : kept */
+
+	/* --backfill from,to : the stored samples of the range instead of OPC UA */
+	bool backfill;
+	int64_t backfillFrom;
+	int64_t backfillTo;
+
+	/* --discover file : the config again with the groups found by browsing, see "discovery" */
+	char discoverFile[256];
+
+	/* endpoints[0] is 'opcuaServer', the others come from 'opcuaEndpoints' */
+	UAMQ_Endpoint endpoints[UAMQ_MAX_ENDPOINTS];
+	int endpointCount;
+
+	/* the priority read session of endpoints[i], client NULL until a high group asks */
+	UAMQ_Endpoint readers[UAMQ_MAX_ENDPOINTS];
 } UAMQ_Configuration;
 
 
 int config(int argc, char *argv[]);
+int getEndpointIndex(const char* name);
+int getShardOwner(const char* name, int count);
 
 
 #ifdef __cplusplus
@@ -15,22 +15,28 @@
 #endif
 
 #include <stdio.h>
-#include "client-config.h"
+#include <time.h>
+#include <errno.h>
+#include "client-common.h"
+
+#define RECONNECT_BACKOFF_MIN_US    100000
+#define RECONNECT_BACKOFF_MAX_US    30000000
 
 extern int beStop;
-extern UAMQ_Configuration g_Configutation;
+extern UAMQ_Configuration* g_config;
 
-UA_StatusCode opcua_server_connect(UA_Client *client)
+UA_StatusCode opcua_server_connect(UAMQ_Endpoint *ep)
 {
+    UA_Client *client = ep->client;
     UA_EndpointDescription* endpoints = NULL;
 
-    printf(">> connect opc.ua server ... to %s\n", g_Configutation.uaServerAddress);
+    printf(">> connect opc.ua server [%s] ... to %s\n", ep->name, ep->address);
 
     size_t epsize = 0;
-    UA_StatusCode retval = UA_Client_getEndpoints(client, g_Configutation.uaServerAddress, &epsize, &endpoints);
+    UA_StatusCode retval = UA_Client_getEndpoints(client, ep->address, &epsize, &endpoints);
     if(retval != UA_STATUSCODE_GOOD) {
         UA_Array_delete(endpoints, epsize, &UA_TYPES[UA_TYPES_ENDPOINTDESCRIPTION]);
-        UA_Client_delete(client);
+        UA_Client_reset(client);
         return (int)retval;
     }
 
@@ -42,11 +48,279 @@ UA_StatusCode opcua_server_connect(UA_Client *client)
     }
     UA_Array_delete(endpoints, epsize, &UA_TYPES[UA_TYPES_ENDPOINTDESCRIPTION]);
 
-    retval = UA_Client_connect(client, g_Configutation.uaServerAddress);
+    retval = UA_Client_connect(client, ep->address);
     if(retval != UA_STATUSCODE_GOOD) {
-        UA_Client_delete(client);
+        UA_Client_reset(client);
         return (int)retval;
     }
 
     return retval;
-}
\ No newline at end of file
+}
+
+void opcua_endpoint_init(UAMQ_Endpoint *ep)
+{
+    ep->client = UA_Client_new(UA_ClientConfig_standard);
+
+    /* the client is not thread safe, every service call goes through ep->lock. */
+    pthread_mutex_init(&ep->lock, NULL);
+
+    /* reconnect coordinator : only one thread recovers, the others wait for it. */
+    pthread_mutex_init(&ep->recoverLock, NULL);
+    pthread_cond_init(&ep->recoverDone, NULL);
+    pthread_cond_init(&ep->recoverWake, NULL);
+    ep->recoverThread = 0;
+    ep->recovering = false;
+    ep->started = false;
+    ep->generation = 0;
+    ep->recoverState = UA_STATUSCODE_GOOD;
+    ep->reader = false;
+    ep->subscribed = false;
+    ep->subscription = 0;
+}
+
+void opcua_client_lock(UAMQ_Endpoint *ep)
+{
+    pthread_mutex_lock(&ep->lock);
+}
+
+void opcua_client_unlock(UAMQ_Endpoint *ep)
+{
+    pthread_mutex_unlock(&ep->lock);
+}
+
+unsigned int opcua_session_generation(UAMQ_Endpoint *ep)
+{
+    pthread_mutex_lock(&ep->recoverLock);
+    unsigned int g = ep->generation;
+    pthread_mutex_unlock(&ep->recoverLock);
+
+    return g;
+}
+
+/* the first connect : browse and the event subscription, once */
+static UA_StatusCode session_start(UAMQ_Endpoint *ep)
+{
+    UA_StatusCode retval = opcua_server_connect(ep);
+    if(retval == UA_STATUSCODE_GOOD) {
+        retval = opcua_server_browse(ep->client);
+        if(retval != UA_STATUSCODE_GOOD) {
+            UA_Client_reset(ep->client);
+        }
+    }
+    if(retval != UA_STATUSCODE_GOOD) {
+        return retval;
+    }
+
+    monitor_start(ep);
+    ep->started = true;
+
+    return retval;
+}
+
+static UA_StatusCode session_reconnect(UAMQ_Endpoint *ep)
+{
+    UA_Client *client = ep->client;
+
+    /* fast path : new secure channel, same session, subscriptions are kept. */
+    UA_StatusCode retval = UA_Client_reconnect(client);
+    if(retval == UA_STATUSCODE_GOOD) {
+        printf(">> opc.ua session re-activated on [%s] %s\n", ep->name, ep->address);
+        return retval;
+    }
+
+    /* the session is gone : new session and re-create the subscriptions. */
+    UA_Client_reset(client);
+    retval = UA_Client_connect(client, ep->address);
+    if(retval != UA_STATUSCODE_GOOD) {
+        UA_Client_reset(client);
+        return retval;
+    }
+
+    printf(">> opc.ua session re-created on [%s] %s\n", ep->name, ep->address);
+    if(!ep->reader) {
+        monitor_resubscribe(ep);
+    }
+
+    return retval;
+}
+
+static pthread_mutex_t readersLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the read session of the high priority poll groups of 'ep', connected by the
+ * first one that asks : their reads never wait on ep->lock behind the bulk
+ * reads. 'ep' itself when priority.sessions is off or the server refuses a
+ * second session, the groups share it then. */
+UAMQ_Endpoint* opcua_priority_session(UAMQ_Endpoint *ep)
+{
+    if(!g_config->prioritySessions) {
+        return ep;
+    }
+
+    int index = (int)(ep - g_config->endpoints);
+    UAMQ_Endpoint *rs = &g_config->readers[index];
+
+    pthread_mutex_lock(&readersLock);
+    if(!rs->client && !rs->reader) {
+        snprintf(rs->name, sizeof(rs->name), "%s", ep->name);
+        snprintf(rs->address, sizeof(rs->address), "%s", ep->address);
+        opcua_endpoint_init(rs);
+        rs->reader = true;
+
+        UA_StatusCode state = UA_Client_connect(rs->client, rs->address);
+        if(state == UA_STATUSCODE_GOOD) {
+            printf(">> opc.ua priority read session on [%s] %s\n", rs->name, rs->address);
+            rs->started = true;
+            opcua_endpoint_start(rs);
+        } else {
+            printf("[priority] [%s] : no second session (0x%08x), the high priority groups share the session.\n", ep->name, state);
+            UA_Client_delete(rs->client);
+            rs->client = NULL;
+        }
+    }
+    pthread_mutex_unlock(&readersLock);
+
+    return rs->client ? rs : ep;
+}
+
+/* on stop, after the poll groups */
+void opcua_priority_close(void)
+{
+    for(int e = 0; e < UAMQ_MAX_ENDPOINTS; e++) {
+        UAMQ_Endpoint *rs = &g_config->readers[e];
+        if(rs->client) {
+            opcua_endpoint_stop(rs);
+            UA_Client_disconnect(rs->client);
+            UA_Client_delete(rs->client);
+            rs->client = NULL;
+        }
+    }
+}
+
+/* the recovery thread of an endpoint : connects it the first time, then
+ * recovers its session each time a thread asks, with backoff. the other
+ * endpoints and the publish loop never wait for it. */
+static void* endpoint_run(void *param)
+{
+    UAMQ_Endpoint *ep = (UAMQ_Endpoint*)param;
+    unsigned int seed = (unsigned int)time(NULL) ^ (unsigned int)pthread_self();
+
+    pthread_mutex_lock(&ep->recoverLock);
+    while(!beStop) {
+        if(!ep->recovering) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += 1;
+            pthread_cond_timedwait(&ep->recoverWake, &ep->recoverLock, &ts);
+            continue;
+        }
+        pthread_mutex_unlock(&ep->recoverLock);
+
+        UA_StatusCode state = UA_STATUSCODE_BADCONNECTIONCLOSED;
+        long backoff = RECONNECT_BACKOFF_MIN_US;
+        int attempt = 0;
+
+        while(!beStop) {
+            opcua_client_lock(ep);
+            state = ep->started ? session_reconnect(ep) : session_start(ep);
+            opcua_client_unlock(ep);
+
+            attempt++;
+            if(state == UA_STATUSCODE_GOOD) {
+                break;
+            }
+
+            /* exponential backoff, full jitter in the upper half of the window */
+            long wait = backoff / 2 + (long)(rand_r(&seed) % (backoff / 2 + 1));
+            printf("OPC UA Server [%s] %s #%d failed (0x%08x), retry in %ld ms.\n", ep->name,
+                   ep->started ? "reconnect" : "connect", attempt, state, wait / 1000);
+            for(long waited = 0; waited < wait && !beStop; waited += 100000) {
+                usleep((useconds_t)(wait - waited < 100000 ? wait - waited : 100000));
+            }
+
+            backoff *= 2;
+            if(backoff > RECONNECT_BACKOFF_MAX_US) {
+                backoff = RECONNECT_BACKOFF_MAX_US;
+            }
+        }
+
+        pthread_mutex_lock(&ep->recoverLock);
+        ep->recovering = false;
+        ep->recoverState = state;
+        ep->generation++;
+        pthread_cond_broadcast(&ep->recoverDone);
+    }
+    pthread_mutex_unlock(&ep->recoverLock);
+
+    return NULL;
+}
+
+/* the recovery thread of 'ep'. not started yet (ep->started false) : it
+ * connects, browses and starts the event groups in the background */
+void opcua_endpoint_start(UAMQ_Endpoint *ep)
+{
+    pthread_mutex_lock(&ep->recoverLock);
+    ep->recovering = !ep->started;
+    pthread_mutex_unlock(&ep->recoverLock);
+
+    if(pthread_create(&ep->recoverThread, NULL, endpoint_run, ep) != 0) {
+        ep->recoverThread = 0;
+        printf("[error] [%s] : no recovery thread, the endpoint is not connected.\n", ep->name);
+    }
+}
+
+/* on stop, beStop is set : the attempt in flight completes */
+void opcua_endpoint_stop(UAMQ_Endpoint *ep)
+{
+    if(!ep->recoverThread) {
+        return;
+    }
+
+    pthread_mutex_lock(&ep->recoverLock);
+    pthread_cond_broadcast(&ep->recoverWake);
+    pthread_cond_broadcast(&ep->recoverDone);
+    pthread_mutex_unlock(&ep->recoverLock);
+
+    pthread_join(ep->recoverThread, NULL);
+    ep->recoverThread = 0;
+}
+
+bool opcua_session_recovering(UAMQ_Endpoint *ep)
+{
+    pthread_mutex_lock(&ep->recoverLock);
+    bool recovering = ep->recovering;
+    pthread_mutex_unlock(&ep->recoverLock);
+
+    return recovering;
+}
+
+/* asks the recovery thread of 'ep' for a new session and returns at once.
+ * 'seen' is the generation the caller observed before its request failed :
+ * nothing happens if the session was recovered since or a recovery runs. */
+void opcua_session_recover_start(UAMQ_Endpoint *ep, unsigned int seen)
+{
+    pthread_mutex_lock(&ep->recoverLock);
+    if(ep->generation == seen && !ep->recovering) {
+        ep->recovering = true;
+        pthread_cond_signal(&ep->recoverWake);
+    }
+    pthread_mutex_unlock(&ep->recoverLock);
+}
+
+/* called by a group thread whose request failed, waits for the session
+ * recovered after 'seen' (see opcua_session_recover_start) */
+UA_StatusCode opcua_session_recover(UAMQ_Endpoint *ep, unsigned int seen)
+{
+    opcua_session_recover_start(ep, seen);
+
+    pthread_mutex_lock(&ep->recoverLock);
+    while(ep->generation == seen && !beStop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        pthread_cond_timedwait(&ep->recoverDone, &ep->recoverLock, &ts);
+    }
+    UA_StatusCode state = ep->generation == seen ? UA_STATUSCODE_BADSHUTDOWN : ep->recoverState;
+    pthread_mutex_unlock(&ep->recoverLock);
+
+    return state;
+}
@@ -0,0 +1,109 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_types_generated_handling.h"
+#else
+# include "open62541.h"
+#endif
+#include <string.h>
+#include <stdlib.h>
+
+#include "client-delta.h"
+
+void delta_init(DeltaState* d, const char* const* aliases, size_t count, int every, int64_t keyUSec)
+{
+	d->aliases = NULL;
+	d->last = NULL;
+	d->changed = NULL;
+	d->count = count;
+	d->changedCount = 0;
+	d->every = every;
+	d->keyUSec = keyUSec;
+	d->seq = 0;
+	d->since = 0;
+	d->keyAt = 0;
+	if(!count) {
+		return;
+	}
+
+	d->aliases = (const char**)malloc(count * sizeof(const char*));
+	memcpy(d->aliases, aliases, count * sizeof(const char*));
+	d->last = (UA_Variant*)malloc(count * sizeof(UA_Variant));
+	for (size_t r = 0; r < count; r++) {
+		UA_Variant_init(&d->last[r]);
+	}
+	d->changed = (size_t*)malloc(count * sizeof(size_t));
+}
+
+void delta_free(DeltaState* d)
+{
+	for (size_t r = 0; r < d->count; r++) {
+		UA_Variant_deleteMembers(&d->last[r]);
+	}
+	free(d->aliases);
+	free(d->last);
+	free(d->changed);
+	d->aliases = NULL;
+	d->last = NULL;
+	d->changed = NULL;
+	d->count = d->changedCount = 0;
+}
+
+void delta_set(DeltaState* d, size_t r, const UA_Variant* v)
+{
+	UA_Variant_deleteMembers(&d->last[r]);
+	UA_Variant_copy(v, &d->last[r]);
+	if(d->changedCount < d->count) {
+		d->changed[d->changedCount++] = r;
+	}
+}
+
+bool delta_message(DeltaState* d, CborBuf* b, const char* group, int64_t t, int64_t now)
+{
+	bool key = d->seq == 0 || d->since + 1 >= d->every || now - d->keyAt >= d->keyUSec;
+	if(!key && !d->changedCount) {
+		return false;
+	}
+
+	cbor_init(b, 16 * (key ? d->count : d->changedCount) + 64);
+	cbor_map(b, key ? 5 : 4);
+	cbor_key(b, "g");
+	cbor_key(b, group);
+	cbor_key(b, "s");
+	cbor_uint(b, d->seq);
+	cbor_key(b, "t");
+	cbor_int(b, t);
+
+	if(key) {
+		cbor_key(b, "k");
+		cbor_array(b, d->count);
+		for (size_t r = 0; r < d->count; r++) {
+			cbor_key(b, d->aliases[r]);
+		}
+		/* null : no value yet, or a type cbor does not support */
+		cbor_key(b, "v");
+		cbor_array(b, d->count);
+		for (size_t r = 0; r < d->count; r++) {
+			if(!d->last[r].type || !cbor_variant(b, &d->last[r])) {
+				cbor_null(b);
+			}
+		}
+		d->since = 0;
+		d->keyAt = now;
+	} else {
+		cbor_key(b, "d");
+		cbor_map(b, d->changedCount);
+		for (size_t k = 0; k < d->changedCount; k++) {
+			cbor_uint(b, d->changed[k]);
+			if(!cbor_variant(b, &d->last[d->changed[k]])) {
+				cbor_null(b);
+			}
+		}
+		d->since++;
+	}
+	d->changedCount = 0;
+	d->seq++;
+	return true;
+}
@@ -0,0 +1,60 @@
+#ifndef OPCUA_MQTT_BRIDGE_DELTA_H_
+#define OPCUA_MQTT_BRIDGE_DELTA_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+#else
+# include "open62541.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "client-cbor.h"
+
+/* format "delta" of a group, cbor maps :
+ *
+ *   keyframe  {"g": name, "s": seq, "t": time, "k": [alias, ..], "v": [value, ..]}
+ *   delta     {"g": name, "s": seq, "t": time, "d": {position: value, ..}}
+ *
+ * positions follow the node list of the group, a delta holds the nodes that
+ * changed since the previous message. s counts every message from 0 : a
+ * consumer that misses one waits for a keyframe, see delta-decode.py. a
+ * keyframe goes out after every - 1 deltas or keyUSec, whichever comes first */
+typedef struct {
+	const char** aliases;
+	UA_Variant* last;	/* the last value of every position, no type before the first */
+	size_t count;
+	size_t* changed;	/* positions set since the previous message */
+	size_t changedCount;
+	int every;
+	int64_t keyUSec;
+	uint64_t seq;
+	int since;	/* deltas since the last keyframe */
+	int64_t keyAt;
+} DeltaState;
+
+/* the aliases are not copied, they stay valid as long as the state */
+void delta_init(DeltaState* d, const char* const* aliases, size_t count, int every, int64_t keyUSec);
+void delta_free(DeltaState* d);
+
+/* a new value of position r, at most once between two messages. v is copied */
+void delta_set(DeltaState* d, size_t r, const UA_Variant* v);
+
+/* the message of the values set since the previous one, into b (cbor_init'ed
+ * here) at time t. false : nothing changed and no keyframe is due, b is left
+ * alone */
+bool delta_message(DeltaState* d, CborBuf* b, const char* group, int64_t t, int64_t now);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_DELTA_H_ */
@@ -0,0 +1,923 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_client.h"
+# include "ua_client_highlevel.h"
+# include "ua_nodeids.h"
+# include "ua_network_tcp.h"
+# include "ua_config_standard.h"
+#else
+# include "open62541.h"
+# include <string.h>
+# include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <fnmatch.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <map>
+using namespace std;
+
+#include "client-common.h"
+#include "client-nodemap.h"
+#include "client-nodeid.h"
+#include "client-discover.h"
+#include "json.h"
+
+extern int beStop;
+extern UAMQ_Configuration* g_config;
+
+json_object* load_config_json(void);
+int make_group(json_object *r, int index, Group* G);
+
+#define SNAPSHOT_MAGIC "UAMQSNAP"
+#define SNAPSHOT_VERSION 1
+
+typedef struct {
+	string id;		/* ns=..;i=.. | ns=..;s=.., empty when a node-map can't address it */
+	string name;		/* browse name */
+	string dataType;	/* variables, as an id too */
+	int parent;		/* index, -1 for a root */
+	int depth;
+	int nodeClass;		/* UA_NODECLASS_OBJECT | UA_NODECLASS_VARIABLE */
+} Found;
+
+typedef struct {
+	/* "discovery" */
+	int ep;
+	vector<string> roots;
+	UA_UInt32 maxReferences;
+	int batch;
+	int sessions;
+	int maxDepth;
+	set<int> namespaces;	/* empty : all but 0 */
+	bool properties;
+	vector<string> patterns;
+	set<string> dataTypes;
+	string snapshot;
+	json_object* group;
+
+	/* the walk, a found node is browsed once whatever the number of paths to it */
+	vector<Found> nodes;
+	vector<UA_NodeId> ua;
+	map<string, int> seen;
+	deque<int> frontier;
+	int busy;
+	bool failed;
+	size_t typed;		/* next variable of the data type reads */
+	vector<int> variables;
+	unsigned long requests;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} Discovery;
+
+typedef struct {
+	Discovery* d;
+	UAMQ_Endpoint ep;	/* a session of its own, continuation points belong to it */
+} Session;
+
+static double discover_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* the text getUA_NodeID reads back : it splits at ';' and '=', has no guid nor bytestring */
+static string node_text(const UA_NodeId* id)
+{
+	char buf[48];
+	if(id->identifierType == UA_NODEIDTYPE_NUMERIC) {
+		snprintf(buf, sizeof(buf), "ns=%d;i=%u", (int)id->namespaceIndex, (unsigned int)id->identifier.numeric);
+		return buf;
+	}
+	if(id->identifierType == UA_NODEIDTYPE_STRING && id->identifier.string.length) {
+		string s((const char*)id->identifier.string.data, id->identifier.string.length);
+		if(s.find_first_of(";=") != string::npos) {
+			return "";
+		}
+		snprintf(buf, sizeof(buf), "ns=%d;s=", (int)id->namespaceIndex);
+		return buf + s;
+	}
+	return "";
+}
+
+static string node_key(const UA_NodeId* id)
+{
+	string k((const char*)&id->namespaceIndex, sizeof(id->namespaceIndex));
+	k += (char)id->identifierType;
+	switch(id->identifierType) {
+		case UA_NODEIDTYPE_NUMERIC:
+			k.append((const char*)&id->identifier.numeric, sizeof(id->identifier.numeric));
+			break;
+		case UA_NODEIDTYPE_GUID:
+			k.append((const char*)&id->identifier.guid, sizeof(id->identifier.guid));
+			break;
+		default:
+			k.append((const char*)id->identifier.string.data, id->identifier.string.length);
+			break;
+	}
+	return k;
+}
+
+static bool parse_id(const char* text, UA_NodeId* id)
+{
+	UA_NodeId_init(id);
+	id->identifierType = (UA_NodeIdType)-1;
+	char* s = strdup(text);
+	getUA_NodeID(s, id);
+	free(s);
+	return id->identifierType == UA_NODEIDTYPE_NUMERIC || id->identifierType == UA_NODEIDTYPE_STRING;
+}
+
+static uint64_t fnv(uint64_t h, const void* data, size_t len)
+{
+	const unsigned char* c = (const unsigned char*)data;
+	for (size_t k = 0; k < len; k++) {
+		h = (h ^ c[k]) * 1099511628211ULL;
+	}
+	return h;
+}
+
+static uint64_t fnv_str(uint64_t h, const string& s)
+{
+	/* with the length : "ab","c" and "a","bc" differ */
+	uint32_t len = (uint32_t)s.size();
+	return fnv(fnv(h, &len, sizeof(len)), s.data(), s.size());
+}
+
+/* "discovery" of server-configuration, defaults when absent */
+static int discover_options(json_object* jobj, Discovery* d)
+{
+	json_object *o = NULL, *c = NULL, *v = NULL;
+
+	d->ep = 0;
+	d->maxReferences = 1000;
+	d->batch = 100;
+	d->sessions = 1;
+	d->maxDepth = 16;
+	d->properties = false;
+	d->group = NULL;
+
+	if(json_object_object_get_ex(jobj, "server-configuration", &o)) {
+		json_object_object_get_ex(o, "discovery", &c);
+	}
+
+	if(c && json_object_object_get_ex(c, "endpoint", &v)) {
+		d->ep = getEndpointIndex(json_object_get_string(v));
+		if(d->ep < 0) {
+			printf("[error] discovery : unknown endpoint '%s'.\n", json_object_get_string(v));
+			return -1;
+		}
+	}
+	if(c && json_object_object_get_ex(c, "roots", &v)) {
+		for (int i = 0; i < (int)json_object_array_length(v); i++) {
+			d->roots.push_back(json_object_get_string(json_object_array_get_idx(v, i)));
+		}
+	}
+	if(d->roots.empty()) {
+		d->roots.push_back("ns=0;i=85");	/* Objects */
+	}
+	if(c && json_object_object_get_ex(c, "maxReferencesPerNode", &v)) {
+		d->maxReferences = (UA_UInt32)json_object_get_int(v);
+	}
+	if(c && json_object_object_get_ex(c, "nodesPerRequest", &v)) {
+		d->batch = json_object_get_int(v);
+	}
+	if(c && json_object_object_get_ex(c, "sessions", &v)) {
+		d->sessions = json_object_get_int(v);
+	}
+	if(c && json_object_object_get_ex(c, "maxDepth", &v)) {
+		d->maxDepth = json_object_get_int(v);
+	}
+	if(c && json_object_object_get_ex(c, "namespaces", &v)) {
+		for (int i = 0; i < (int)json_object_array_length(v); i++) {
+			d->namespaces.insert(json_object_get_int(json_object_array_get_idx(v, i)));
+		}
+	}
+	if(c && json_object_object_get_ex(c, "properties", &v)) {
+		d->properties = json_object_get_boolean(v);
+	}
+	if(c && json_object_object_get_ex(c, "pattern", &v)) {
+		if(json_object_get_type(v) == json_type_array) {
+			for (int i = 0; i < (int)json_object_array_length(v); i++) {
+				d->patterns.push_back(json_object_get_string(json_object_array_get_idx(v, i)));
+			}
+		} else {
+			d->patterns.push_back(json_object_get_string(v));
+		}
+	}
+	if(c && json_object_object_get_ex(c, "dataTypes", &v)) {
+		for (int i = 0; i < (int)json_object_array_length(v); i++) {
+			const char* t = json_object_get_string(json_object_array_get_idx(v, i));
+			UA_NodeId id;
+			string found;
+			if(strchr(t, '=')) {
+				if(parse_id(t, &id)) {
+					found = node_text(&id);
+				}
+				UA_NodeId_deleteMembers(&id);
+			}
+#ifdef UA_ENABLE_TYPENAMES
+			for (size_t k = 0; found.empty() && k < UA_TYPES_COUNT; k++) {
+				if(!strcmp(UA_TYPES[k].typeName, t)) {
+					found = node_text(&UA_TYPES[k].typeId);
+				}
+			}
+#endif
+			if(found.empty()) {
+				printf("[error] discovery.dataTypes : unknown type '%s', expected a built-in type name or a node id.\n", t);
+				return -1;
+			}
+			d->dataTypes.insert(found);
+		}
+	}
+	if(c && json_object_object_get_ex(c, "snapshot", &v)) {
+		d->snapshot = json_object_get_string(v);
+	}
+
+	if(d->maxReferences == 0 || d->batch <= 0 || d->sessions <= 0 || d->sessions > 64 || d->maxDepth <= 0) {
+		printf("[error] discovery needs maxReferencesPerNode > 0, nodesPerRequest > 0, 0 < sessions <= 64 and maxDepth > 0.\n");
+		return -1;
+	}
+
+	for (size_t r = 0; r < d->roots.size(); r++) {
+		UA_NodeId id;
+		bool ok = parse_id(d->roots[r].c_str(), &id);
+		UA_NodeId_deleteMembers(&id);
+		if(!ok) {
+			printf("[error] discovery.roots : invalid node id '%s'.\n", d->roots[r].c_str());
+			return -1;
+		}
+	}
+
+	/* the generated groups : the template with their name, topic and nodes */
+	d->group = json_object_new_object();
+	json_object_object_add(d->group, "method", json_object_new_string("poll"));
+	json_object_object_add(d->group, "intervalUSec", json_object_new_int(1000000));
+	json_object_object_add(d->group, "format", json_object_new_string("json"));
+	json_object_object_add(d->group, "mqtt", json_object_new_boolean(true));
+	if(d->ep) {
+		json_object_object_add(d->group, "endpoint", json_object_new_string(g_config->endpoints[d->ep].name));
+	}
+	if(c && json_object_object_get_ex(c, "group", &v)) {
+		json_object_object_foreach(v, key, val) {
+			if(!strcmp(key, "name") || !strcmp(key, "topic") || !strcmp(key, "nodes")) {
+				printf("[error] discovery.group : '%s' is set by the discovery.\n", key);
+				return -1;
+			}
+			json_object_object_add(d->group, key, json_object_get(val));
+		}
+	}
+
+	json_object* probe = NULL;
+	json_object_deep_copy(d->group, &probe, NULL);
+	json_object_object_add(probe, "name", json_object_new_string("discovery"));
+	json_object_object_add(probe, "topic", json_object_new_string("discovery"));
+	Group g = Group();
+	int r = make_group(probe, -1, &g);
+	json_object_put(probe);
+	group_free(&g);
+	if(r < 0) {
+		printf("[error] discovery.group is not a valid group, see above.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static bool namespace_wanted(Discovery* d, int ns)
+{
+	return d->namespaces.empty() ? ns != 0 : d->namespaces.count(ns) > 0;
+}
+
+/* the children of one browsed node, under d->lock */
+static void add_references(Discovery* d, int parent, const UA_BrowseResult* result)
+{
+	for (size_t k = 0; k < result->referencesSize; k++) {
+		const UA_ReferenceDescription* ref = &result->references[k];
+		const UA_NodeId* id = &ref->nodeId.nodeId;
+
+		/* another server's node, or a property left out */
+		if(ref->nodeId.serverIndex || ref->nodeId.namespaceUri.length) {
+			continue;
+		}
+		if(!d->properties && ref->referenceTypeId.namespaceIndex == 0 && ref->referenceTypeId.identifierType == UA_NODEIDTYPE_NUMERIC &&
+				ref->referenceTypeId.identifier.numeric == UA_NS0ID_HASPROPERTY) {
+			continue;
+		}
+		if(!namespace_wanted(d, id->namespaceIndex) || d->nodes[parent].depth >= d->maxDepth) {
+			continue;
+		}
+
+		string key = node_key(id);
+		if(d->seen.count(key)) {
+			continue;
+		}
+
+		Found f;
+		f.id = node_text(id);
+		f.name.assign((const char*)ref->browseName.name.data, ref->browseName.name.length);
+		f.parent = parent;
+		f.depth = d->nodes[parent].depth + 1;
+		f.nodeClass = ref->nodeClass;
+
+		int index = (int)d->nodes.size();
+		d->seen[key] = index;
+		d->nodes.push_back(f);
+		d->ua.push_back(UA_NodeId());
+		UA_NodeId_copy(id, &d->ua.back());
+
+		if(f.nodeClass == UA_NODECLASS_OBJECT) {
+			d->frontier.push_back(index);
+		} else {
+			d->variables.push_back(index);
+		}
+	}
+}
+
+/* nodesPerRequest nodes per Browse, then BrowseNext for all their continuation points at once */
+static bool browse_batch(Session* s, const vector<int>& batch, UA_BrowseRequest* req)
+{
+	Discovery* d = s->d;
+	UA_Client* client = s->ep.client;
+
+	UA_BrowseResponse resp = UA_Client_Service_browse(client, *req);
+	bool ok = resp.responseHeader.serviceResult == UA_STATUSCODE_GOOD;
+	if(!ok) {
+		printf("[error] discovery : browse failed (%s).\n", UA_StatusCode_name(resp.responseHeader.serviceResult));
+	}
+
+	vector<UA_ByteString> points;
+	vector<int> owners;
+
+	pthread_mutex_lock(&d->lock);
+	d->requests++;
+	for (size_t k = 0; ok && k < resp.resultsSize && k < batch.size(); k++) {
+		if(resp.results[k].statusCode != UA_STATUSCODE_GOOD) {
+			printf("[discover] %s : %s.\n", d->nodes[batch[k]].id.c_str(), UA_StatusCode_name(resp.results[k].statusCode));
+			continue;
+		}
+		add_references(d, batch[k], &resp.results[k]);
+		if(resp.results[k].continuationPoint.length) {
+			points.push_back(resp.results[k].continuationPoint);
+			UA_ByteString_init(&resp.results[k].continuationPoint);
+			owners.push_back(batch[k]);
+		}
+	}
+	pthread_mutex_unlock(&d->lock);
+	UA_BrowseResponse_deleteMembers(&resp);
+
+	while(ok && !points.empty()) {
+		UA_BrowseNextRequest next;
+		UA_BrowseNextRequest_init(&next);
+		next.releaseContinuationPoints = beStop ? true : false;
+		next.continuationPointsSize = points.size();
+		next.continuationPoints = (UA_ByteString*)UA_Array_new(points.size(), &UA_TYPES[UA_TYPES_BYTESTRING]);
+		for (size_t k = 0; k < points.size(); k++) {
+			next.continuationPoints[k] = points[k];
+		}
+		vector<int> asked(owners);
+		points.clear();
+		owners.clear();
+
+		UA_BrowseNextResponse nresp = UA_Client_Service_browseNext(client, next);
+		UA_BrowseNextRequest_deleteMembers(&next);
+		ok = nresp.responseHeader.serviceResult == UA_STATUSCODE_GOOD;
+		if(!ok) {
+			printf("[error] discovery : browse next failed (%s).\n", UA_StatusCode_name(nresp.responseHeader.serviceResult));
+		}
+
+		pthread_mutex_lock(&d->lock);
+		d->requests++;
+		for (size_t k = 0; ok && !beStop && k < nresp.resultsSize && k < asked.size(); k++) {
+			if(nresp.results[k].statusCode != UA_STATUSCODE_GOOD) {
+				printf("[discover] %s : %s.\n", d->nodes[asked[k]].id.c_str(), UA_StatusCode_name(nresp.results[k].statusCode));
+				continue;
+			}
+			add_references(d, asked[k], &nresp.results[k]);
+			if(nresp.results[k].continuationPoint.length) {
+				points.push_back(nresp.results[k].continuationPoint);
+				UA_ByteString_init(&nresp.results[k].continuationPoint);
+				owners.push_back(asked[k]);
+			}
+		}
+		pthread_mutex_unlock(&d->lock);
+		UA_BrowseNextResponse_deleteMembers(&nresp);
+	}
+
+	for (size_t k = 0; k < points.size(); k++) {
+		UA_ByteString_deleteMembers(&points[k]);
+	}
+
+	return ok;
+}
+
+/* the sessions share one frontier : a level is spread over all of them */
+static void* browse_run(void* param)
+{
+	Session* s = (Session*)param;
+	Discovery* d = s->d;
+
+	while(true) {
+		pthread_mutex_lock(&d->lock);
+		while(d->frontier.empty() && d->busy && !d->failed && !beStop) {
+			pthread_cond_wait(&d->cond, &d->lock);
+		}
+		if(d->frontier.empty() || d->failed || beStop) {
+			pthread_cond_broadcast(&d->cond);
+			pthread_mutex_unlock(&d->lock);
+			break;
+		}
+
+		vector<int> batch;
+		UA_BrowseRequest req;
+		UA_BrowseRequest_init(&req);
+		req.requestedMaxReferencesPerNode = d->maxReferences;
+		size_t count = d->frontier.size() < (size_t)d->batch ? d->frontier.size() : (size_t)d->batch;
+		req.nodesToBrowse = (UA_BrowseDescription*)UA_Array_new(count, &UA_TYPES[UA_TYPES_BROWSEDESCRIPTION]);
+		req.nodesToBrowseSize = count;
+		for (size_t k = 0; k < count; k++) {
+			int n = d->frontier.front();
+			d->frontier.pop_front();
+			batch.push_back(n);
+
+			UA_BrowseDescription* bd = &req.nodesToBrowse[k];
+			UA_NodeId_copy(&d->ua[n], &bd->nodeId);
+			bd->browseDirection = UA_BROWSEDIRECTION_FORWARD;
+			bd->referenceTypeId = UA_NODEID_NUMERIC(0, UA_NS0ID_HIERARCHICALREFERENCES);
+			bd->includeSubtypes = true;
+			bd->nodeClassMask = UA_NODECLASS_OBJECT | UA_NODECLASS_VARIABLE;
+			bd->resultMask = UA_BROWSERESULTMASK_REFERENCETYPEID | UA_BROWSERESULTMASK_NODECLASS | UA_BROWSERESULTMASK_BROWSENAME;
+		}
+		d->busy++;
+		pthread_mutex_unlock(&d->lock);
+
+		bool ok = browse_batch(s, batch, &req);
+		UA_BrowseRequest_deleteMembers(&req);
+
+		pthread_mutex_lock(&d->lock);
+		d->busy--;
+		d->failed = d->failed || !ok;
+		pthread_cond_broadcast(&d->cond);
+		pthread_mutex_unlock(&d->lock);
+	}
+
+	return NULL;
+}
+
+/* the DataType attribute of every variable, nodesPerRequest per Read */
+static void* type_run(void* param)
+{
+	Session* s = (Session*)param;
+	Discovery* d = s->d;
+
+	while(!beStop) {
+		pthread_mutex_lock(&d->lock);
+		size_t first = d->typed;
+		size_t count = d->variables.size() - first < (size_t)d->batch ? d->variables.size() - first : (size_t)d->batch;
+		d->typed += count;
+		bool done = d->failed || count == 0;
+		pthread_mutex_unlock(&d->lock);
+		if(done) {
+			break;
+		}
+
+		/* the walk is over, d->ua and d->nodes no longer grow */
+		UA_ReadRequest req;
+		UA_ReadRequest_init(&req);
+		req.timestampsToReturn = UA_TIMESTAMPSTORETURN_NEITHER;
+		req.nodesToRead = (UA_ReadValueId*)UA_Array_new(count, &UA_TYPES[UA_TYPES_READVALUEID]);
+		req.nodesToReadSize = count;
+		for (size_t k = 0; k < count; k++) {
+			UA_NodeId_copy(&d->ua[d->variables[first + k]], &req.nodesToRead[k].nodeId);
+			req.nodesToRead[k].attributeId = UA_ATTRIBUTEID_DATATYPE;
+		}
+
+		UA_ReadResponse resp = UA_Client_Service_read(s->ep.client, req);
+		bool ok = resp.responseHeader.serviceResult == UA_STATUSCODE_GOOD;
+		for (size_t k = 0; ok && k < resp.resultsSize && k < count; k++) {
+			UA_DataValue* dv = &resp.results[k];
+			if(dv->hasValue && dv->value.type == &UA_TYPES[UA_TYPES_NODEID] && dv->value.data) {
+				d->nodes[d->variables[first + k]].dataType = node_text((UA_NodeId*)dv->value.data);
+			}
+		}
+		UA_ReadRequest_deleteMembers(&req);
+
+		pthread_mutex_lock(&d->lock);
+		d->requests++;
+		if(!ok) {
+			printf("[error] discovery : reading the data types failed (%s).\n", UA_StatusCode_name(resp.responseHeader.serviceResult));
+			d->failed = true;
+		}
+		pthread_mutex_unlock(&d->lock);
+		UA_ReadResponse_deleteMembers(&resp);
+	}
+
+	return NULL;
+}
+
+static void run_sessions(vector<Session>& sessions, void* (*run)(void*))
+{
+	vector<pthread_t> tids(sessions.size());
+	for (size_t k = 0; k < sessions.size(); k++) {
+		pthread_create(&tids[k], NULL, run, &sessions[k]);
+	}
+	for (size_t k = 0; k < sessions.size(); k++) {
+		pthread_join(tids[k], NULL);
+	}
+}
+
+/* the namespace array and the build info : a server changing its address space
+ * without a new namespace or a new build is browsed again after the snapshot is removed */
+static bool server_version(Discovery* d, UA_Client* client, uint64_t* key)
+{
+	const UA_UInt32 ids[] = {UA_NS0ID_SERVER_NAMESPACEARRAY, UA_NS0ID_SERVER_SERVERSTATUS_BUILDINFO_SOFTWAREVERSION,
+		UA_NS0ID_SERVER_SERVERSTATUS_BUILDINFO_BUILDNUMBER, UA_NS0ID_SERVER_SERVERSTATUS_BUILDINFO_BUILDDATE};
+	const size_t count = sizeof(ids) / sizeof(ids[0]);
+
+	UA_ReadRequest req;
+	UA_ReadRequest_init(&req);
+	req.timestampsToReturn = UA_TIMESTAMPSTORETURN_NEITHER;
+	req.nodesToRead = (UA_ReadValueId*)UA_Array_new(count, &UA_TYPES[UA_TYPES_READVALUEID]);
+	req.nodesToReadSize = count;
+	for (size_t k = 0; k < count; k++) {
+		req.nodesToRead[k].nodeId = UA_NODEID_NUMERIC(0, ids[k]);
+		req.nodesToRead[k].attributeId = UA_ATTRIBUTEID_VALUE;
+	}
+
+	UA_ReadResponse resp = UA_Client_Service_read(client, req);
+	UA_ReadRequest_deleteMembers(&req);
+	if(resp.responseHeader.serviceResult != UA_STATUSCODE_GOOD || resp.resultsSize != count || !resp.results[0].hasValue) {
+		UA_ReadResponse_deleteMembers(&resp);
+		return false;
+	}
+
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t k = 0; k < count; k++) {
+		UA_Variant* v = &resp.results[k].value;
+		if(!resp.results[k].hasValue || !v->type || !v->data) {
+			continue;
+		}
+		size_t n = UA_Variant_isScalar(v) ? 1 : v->arrayLength;
+		if(v->type == &UA_TYPES[UA_TYPES_STRING]) {
+			for (size_t i = 0; i < n; i++) {
+				UA_String* s = &((UA_String*)v->data)[i];
+				h = fnv_str(h, string((const char*)s->data, s->length));
+			}
+		} else if(v->type->pointerFree) {
+			h = fnv(h, v->data, n * v->type->memSize);
+		}
+	}
+	UA_ReadResponse_deleteMembers(&resp);
+
+	/* and what was browsed : other roots or limits are another snapshot */
+	h = fnv_str(h, g_config->endpoints[d->ep].address);
+	for (size_t r = 0; r < d->roots.size(); r++) {
+		h = fnv_str(h, d->roots[r]);
+	}
+	for (set<int>::iterator n = d->namespaces.begin(); n != d->namespaces.end(); ++n) {
+		int ns = *n;
+		h = fnv(h, &ns, sizeof(ns));
+	}
+	h = fnv(h, &d->maxDepth, sizeof(d->maxDepth));
+	h = fnv(h, &d->properties, sizeof(d->properties));
+
+	*key = h;
+	return true;
+}
+
+static void put_str(FILE* f, const string& s)
+{
+	uint32_t len = (uint32_t)s.size();
+	fwrite(&len, sizeof(len), 1, f);
+	fwrite(s.data(), 1, s.size(), f);
+}
+
+static bool get_str(FILE* f, string& s)
+{
+	uint32_t len = 0;
+	if(fread(&len, sizeof(len), 1, f) != 1 || len > (1u << 20)) {
+		return false;
+	}
+	s.resize(len);
+	return len == 0 || fread(&s[0], 1, len, f) == len;
+}
+
+/* host byte order : a cache of this machine, not an exchange format */
+static bool snapshot_save(Discovery* d, uint64_t key)
+{
+	string tmp = d->snapshot + ".tmp";
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if(!f) {
+		return false;
+	}
+
+	uint32_t version = SNAPSHOT_VERSION;
+	uint32_t count = (uint32_t)d->nodes.size();
+	fwrite(SNAPSHOT_MAGIC, 1, 8, f);
+	fwrite(&version, sizeof(version), 1, f);
+	fwrite(&key, sizeof(key), 1, f);
+	fwrite(&count, sizeof(count), 1, f);
+
+	for (size_t k = 0; k < d->nodes.size(); k++) {
+		Found* n = &d->nodes[k];
+		int32_t head[3] = {n->parent, n->depth, n->nodeClass};
+		fwrite(head, sizeof(head), 1, f);
+		put_str(f, n->id);
+		put_str(f, n->name);
+		put_str(f, n->dataType);
+	}
+
+	bool ok = !ferror(f);
+	ok = (fclose(f) == 0) && ok;
+	if(!ok || rename(tmp.c_str(), d->snapshot.c_str()) < 0) {
+		remove(tmp.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+static bool snapshot_load(Discovery* d, uint64_t key)
+{
+	FILE* f = fopen(d->snapshot.c_str(), "rb");
+	if(!f) {
+		return false;
+	}
+
+	char magic[8];
+	uint32_t version = 0, count = 0;
+	uint64_t saved = 0;
+	bool ok = fread(magic, 1, 8, f) == 8 && !memcmp(magic, SNAPSHOT_MAGIC, 8) &&
+		fread(&version, sizeof(version), 1, f) == 1 && version == SNAPSHOT_VERSION &&
+		fread(&saved, sizeof(saved), 1, f) == 1 && saved == key &&
+		fread(&count, sizeof(count), 1, f) == 1;
+
+	vector<Found> nodes;
+	for (uint32_t k = 0; ok && k < count; k++) {
+		Found n;
+		int32_t head[3];
+		ok = fread(head, sizeof(head), 1, f) == 1 && head[0] < (int32_t)k &&
+			get_str(f, n.id) && get_str(f, n.name) && get_str(f, n.dataType);
+		n.parent = head[0];
+		n.depth = head[1];
+		n.nodeClass = head[2];
+		nodes.push_back(n);
+	}
+	fclose(f);
+
+	if(ok) {
+		d->nodes.swap(nodes);
+	}
+	return ok;
+}
+
+static string topic_part(const string& s, bool level)
+{
+	/* no wildcard, and a node topic is one level */
+	string t(s);
+	for (size_t k = 0; k < t.size(); k++) {
+		if(t[k] == '+' || t[k] == '#' || (level && t[k] == '/')) {
+			t[k] = '_';
+		}
+	}
+	return t;
+}
+
+/* one group per object holding matching variables, named after its browse path */
+static int emit(Discovery* d, json_object* jobj, const char* out)
+{
+	vector<string> paths(d->nodes.size());
+	for (size_t k = 0; k < d->nodes.size(); k++) {
+		Found* n = &d->nodes[k];
+		paths[k] = n->parent < 0 ? n->name : paths[n->parent] + "/" + n->name;
+	}
+
+	map<int, vector<int> > owners;
+	int variables = 0, matched = 0, unaddressable = 0;
+	for (size_t k = 0; k < d->nodes.size(); k++) {
+		Found* n = &d->nodes[k];
+		if(n->nodeClass != UA_NODECLASS_VARIABLE) {
+			continue;
+		}
+		variables++;
+
+		bool wanted = d->patterns.empty();
+		for (size_t p = 0; p < d->patterns.size() && !wanted; p++) {
+			wanted = fnmatch(d->patterns[p].c_str(), paths[k].c_str(), 0) == 0;
+		}
+		if(!wanted || (!d->dataTypes.empty() && !d->dataTypes.count(n->dataType))) {
+			continue;
+		}
+		if(n->id.empty()) {
+			unaddressable++;
+			continue;
+		}
+		matched++;
+		owners[n->parent].push_back((int)k);
+	}
+
+	json_object* nodeMap = NULL;
+	if(!json_object_object_get_ex(jobj, "node-map", &nodeMap)) {
+		nodeMap = json_object_new_array();
+		json_object_object_add(jobj, "node-map", nodeMap);
+	}
+
+	/* the groups of the file stay as they are, a second run adds nothing twice */
+	set<string> names;
+	for (int i = 0; i < (int)json_object_array_length(nodeMap); i++) {
+		json_object* name = NULL;
+		if(json_object_object_get_ex(json_object_array_get_idx(nodeMap, i), "name", &name)) {
+			names.insert(json_object_get_string(name));
+		}
+	}
+
+	int added = 0, kept = 0;
+	map<int, vector<int> >::iterator o;
+	for (o = owners.begin(); o != owners.end(); ++o) {
+		string name = paths[o->first];
+		if(names.count(name)) {
+			kept++;
+			continue;
+		}
+		names.insert(name);
+
+		/* the topic is the path under the root */
+		size_t slash = name.find('/');
+		string topic = topic_part(slash == string::npos ? name : name.substr(slash + 1), false);
+
+		json_object* g = NULL;
+		json_object_deep_copy(d->group, &g, NULL);
+		json_object_object_add(g, "name", json_object_new_string(name.c_str()));
+		json_object_object_add(g, "topic", json_object_new_string(topic.c_str()));
+
+		json_object* nodes = json_object_new_array();
+		for (size_t k = 0; k < o->second.size(); k++) {
+			Found* n = &d->nodes[o->second[k]];
+			json_object* jn = json_object_new_object();
+			json_object_object_add(jn, "id", json_object_new_string(n->id.c_str()));
+			json_object_object_add(jn, "topic", json_object_new_string(topic_part(n->name, true).c_str()));
+			json_object_object_add(jn, "alias", json_object_new_string(""));
+			json_object_array_add(nodes, jn);
+		}
+		json_object_object_add(g, "nodes", nodes);
+		json_object_array_add(nodeMap, g);
+		added++;
+	}
+
+	printf("[discover] %d variables, %d matching", variables, matched);
+	if(unaddressable) {
+		printf(", %d left out (guid, bytestring or ';' '=' in the id)", unaddressable);
+	}
+	printf(" : %d groups added, %d already in the node-map.\n", added, kept);
+
+	/* a bridge watching the file reloads once, on the rename */
+	string tmp = string(out) + ".tmp";
+	if(json_object_to_file_ext(tmp.c_str(), jobj, JSON_C_TO_STRING_PRETTY) < 0 || rename(tmp.c_str(), out) < 0) {
+		printf("[error] discovery : can't write %s.\n", out);
+		remove(tmp.c_str());
+		return -1;
+	}
+	printf("[discover] %s written.\n", out);
+
+	return 0;
+}
+
+/* every way out : the sessions disconnect, the walk and the config go */
+static int discover_end(Discovery* d, vector<Session>& sessions, json_object* jobj, int r)
+{
+	for (size_t k = 0; k < sessions.size(); k++) {
+		if(sessions[k].ep.client) {
+			UA_Client_disconnect(sessions[k].ep.client);
+			UA_Client_delete(sessions[k].ep.client);
+		}
+	}
+	for (size_t k = 0; k < d->ua.size(); k++) {
+		UA_NodeId_deleteMembers(&d->ua[k]);
+	}
+	if(d->group) {
+		json_object_put(d->group);
+	}
+	pthread_cond_destroy(&d->cond);
+	pthread_mutex_destroy(&d->lock);
+	delete d;
+	json_object_put(jobj);
+
+	return r;
+}
+
+int discover_run(const char* out)
+{
+	json_object* jobj = load_config_json();
+	if(!jobj) {
+		return -1;
+	}
+
+	Discovery* d = new Discovery();
+	d->busy = 0;
+	d->failed = false;
+	d->typed = 0;
+	d->requests = 0;
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_cond_init(&d->cond, NULL);
+
+	/* value initialized : a session not connected yet has no client */
+	vector<Session> sessions;
+	if(discover_options(jobj, d) < 0) {
+		return discover_end(d, sessions, jobj, -1);
+	}
+
+	UAMQ_Endpoint* base = &g_config->endpoints[d->ep];
+	sessions.resize(d->sessions);
+	for (size_t k = 0; k < sessions.size(); k++) {
+		Session* s = &sessions[k];
+		s->d = d;
+		memset(&s->ep, 0, sizeof(s->ep));
+		snprintf(s->ep.name, sizeof(s->ep.name), "%s", base->name);
+		snprintf(s->ep.address, sizeof(s->ep.address), "%s", base->address);
+		opcua_endpoint_init(&s->ep);
+		if(opcua_server_connect(&s->ep) != UA_STATUSCODE_GOOD) {
+			printf("[error] discovery : can't connect to [%s] %s.\n", base->name, base->address);
+			return discover_end(d, sessions, jobj, -1);
+		}
+		/* the first session decides : a snapshot makes the others useless */
+		if(k == 0 && !d->snapshot.empty()) {
+			uint64_t key = 0;
+			if(!server_version(d, s->ep.client, &key)) {
+				printf("[discover] the server version can't be read, browsing.\n");
+			} else if(snapshot_load(d, key)) {
+				printf("[discover] %s : the server is unchanged, %d nodes from the snapshot.\n", d->snapshot.c_str(), (int)d->nodes.size());
+				sessions.resize(1);
+				break;
+			}
+		}
+	}
+
+	double started = discover_ms();
+	bool browsed = d->nodes.empty();
+
+	if(browsed) {
+		/* the roots, with their browse names for the paths */
+		UA_Client* client = sessions[0].ep.client;
+		for (size_t r = 0; r < d->roots.size(); r++) {
+			UA_NodeId id;
+			parse_id(d->roots[r].c_str(), &id);
+			UA_QualifiedName name;
+			UA_QualifiedName_init(&name);
+			if(UA_Client_readBrowseNameAttribute(client, id, &name) != UA_STATUSCODE_GOOD) {
+				printf("[error] discovery.roots : %s can't be read.\n", d->roots[r].c_str());
+				UA_NodeId_deleteMembers(&id);
+				UA_QualifiedName_deleteMembers(&name);
+				return discover_end(d, sessions, jobj, -1);
+			}
+			string key = node_key(&id);
+			if(!d->seen.count(key)) {
+				Found f;
+				f.id = node_text(&id);
+				f.name.assign((const char*)name.name.data, name.name.length);
+				f.parent = -1;
+				f.depth = 0;
+				f.nodeClass = UA_NODECLASS_OBJECT;
+				d->seen[key] = (int)d->nodes.size();
+				d->frontier.push_back((int)d->nodes.size());
+				d->nodes.push_back(f);
+				d->ua.push_back(id);
+			} else {
+				UA_NodeId_deleteMembers(&id);
+			}
+			UA_QualifiedName_deleteMembers(&name);
+		}
+
+		run_sessions(sessions, browse_run);
+		run_sessions(sessions, type_run);
+
+		if(d->failed || beStop) {
+			printf("[error] discovery : the browse did not complete, nothing is written.\n");
+			return discover_end(d, sessions, jobj, -1);
+		}
+		printf("[discover] %d nodes browsed in %.1f ms, %lu requests on %d sessions.\n", (int)d->nodes.size(),
+			discover_ms() - started, d->requests, (int)sessions.size());
+
+		uint64_t key = 0;
+		if(!d->snapshot.empty()) {
+			if(server_version(d, sessions[0].ep.client, &key) && snapshot_save(d, key)) {
+				printf("[discover] %s saved.\n", d->snapshot.c_str());
+			} else {
+				printf("[discover] %s : the snapshot is not saved.\n", d->snapshot.c_str());
+			}
+		}
+	}
+
+	int r = emit(d, jobj, out);
+
+	return discover_end(d, sessions, jobj, r);
+}
@@ -0,0 +1,19 @@
+#ifndef OPCUA_MQTT_BRIDGE_DISCOVER_H_
+#define OPCUA_MQTT_BRIDGE_DISCOVER_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* --discover file : browses the address space from the "discovery" roots (or
+ * takes the snapshot of an unchanged server), writes the config file again
+ * with one group per object holding matching variables, 0 when written */
+int discover_run(const char* out);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_DISCOVER_H_ */
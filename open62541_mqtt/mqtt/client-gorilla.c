@@ -0,0 +1,445 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "client-gorilla.h"
+
+void gorilla_init(GorillaSeries* s)
+{
+	s->data = NULL;
+	s->cap = 0;
+	s->kind = GORILLA_NONE;
+	gorilla_reset(s);
+}
+
+void gorilla_reset(GorillaSeries* s)
+{
+	/* put_bits ors into zeroed bytes */
+	if(s->data) {
+		memset(s->data, 0, (s->bits + 7) / 8);
+	}
+	s->bits = 0;
+	s->kind &= GORILLA_VALUES;
+	s->count = 0;
+	s->t = 0;
+	s->delta = 0;
+	s->v = 0;
+	s->lead = -1;
+	s->trail = 0;
+}
+
+void gorilla_free(GorillaSeries* s)
+{
+	free(s->data);
+	s->data = NULL;
+	s->cap = 0;
+	gorilla_reset(s);
+}
+
+void gorilla_values_only(GorillaSeries* s)
+{
+	s->kind |= GORILLA_VALUES;
+}
+
+/* the n low bits of v, most significant first */
+static void put_bits(GorillaSeries* s, uint64_t v, int n)
+{
+	size_t need = (s->bits + n + 7) / 8;
+	if(need > s->cap) {
+		size_t cap = s->cap ? s->cap : 64;
+		while(cap < need) {
+			cap *= 2;
+		}
+		s->data = (uint8_t*)realloc(s->data, cap);
+		memset(s->data + s->cap, 0, cap - s->cap);
+		s->cap = cap;
+	}
+
+	while(n > 0) {
+		size_t byte = s->bits / 8;
+		int room = 8 - (int)(s->bits % 8);
+		int take = n < room ? n : room;
+		uint8_t chunk = (uint8_t)((v >> (n - take)) & ((1u << take) - 1));
+		s->data[byte] |= (uint8_t)(chunk << (room - take));
+		s->bits += take;
+		n -= take;
+	}
+}
+
+static void put_time(GorillaSeries* s, int64_t t)
+{
+	if(s->kind & GORILLA_VALUES) {
+		return;
+	}
+	if(!s->count) {
+		put_bits(s, (uint64_t)t, 64);
+		s->t = t;
+		s->delta = 0;
+		return;
+	}
+
+	/* wrapping, a 64 bits delta of delta holds any step */
+	int64_t delta = (int64_t)((uint64_t)t - (uint64_t)s->t);
+	int64_t dod = (int64_t)((uint64_t)delta - (uint64_t)s->delta);
+	if(dod == 0) {
+		put_bits(s, 0, 1);
+	} else if(dod >= -64 && dod < 64) {
+		put_bits(s, 2, 2);
+		put_bits(s, (uint64_t)dod, 7);
+	} else if(dod >= -2048 && dod < 2048) {
+		put_bits(s, 6, 3);
+		put_bits(s, (uint64_t)dod, 12);
+	} else if(dod >= -(1 << 19) && dod < (1 << 19)) {
+		put_bits(s, 14, 4);
+		put_bits(s, (uint64_t)dod, 20);
+	} else {
+		put_bits(s, 15, 4);
+		put_bits(s, (uint64_t)dod, 64);
+	}
+	s->t = t;
+	s->delta = delta;
+}
+
+bool gorilla_put_double(GorillaSeries* s, int64_t t, double v)
+{
+	int kind = s->kind & ~GORILLA_VALUES;
+	if(kind != GORILLA_NONE && kind != GORILLA_FLOAT) {
+		return false;
+	}
+	s->kind |= GORILLA_FLOAT;
+
+	uint64_t u;
+	memcpy(&u, &v, sizeof(u));
+
+	put_time(s, t);
+	if(!s->count) {
+		put_bits(s, u, 64);
+	} else {
+		uint64_t x = u ^ s->v;
+		if(!x) {
+			put_bits(s, 0, 1);
+		} else {
+			int lead = __builtin_clzll(x);
+			int trail = __builtin_ctzll(x);
+			if(lead > 31) {
+				lead = 31;
+			}
+			if(s->lead >= 0 && lead >= s->lead && trail >= s->trail) {
+				put_bits(s, 2, 2);
+				put_bits(s, x >> s->trail, 64 - s->lead - s->trail);
+			} else {
+				int len = 64 - lead - trail;
+				put_bits(s, 3, 2);
+				put_bits(s, (uint64_t)lead, 5);
+				put_bits(s, (uint64_t)(len - 1), 6);
+				put_bits(s, x >> trail, len);
+				s->lead = lead;
+				s->trail = trail;
+			}
+		}
+	}
+	s->v = u;
+	s->count++;
+	return true;
+}
+
+bool gorilla_put_int(GorillaSeries* s, int64_t t, int64_t v)
+{
+	int kind = s->kind & ~GORILLA_VALUES;
+	if(kind != GORILLA_NONE && kind != GORILLA_INT) {
+		return false;
+	}
+	s->kind |= GORILLA_INT;
+
+	put_time(s, t);
+	if(!s->count) {
+		put_bits(s, (uint64_t)v, 64);
+	} else {
+		uint64_t d = (uint64_t)v - s->v;
+		uint64_t z = (d << 1) ^ (uint64_t)((int64_t)d >> 63);
+		if(!z) {
+			put_bits(s, 0, 1);
+		} else if(z < (1ULL << 8)) {
+			put_bits(s, 2, 2);
+			put_bits(s, z, 8);
+		} else if(z < (1ULL << 16)) {
+			put_bits(s, 6, 3);
+			put_bits(s, z, 16);
+		} else if(z < (1ULL << 32)) {
+			put_bits(s, 14, 4);
+			put_bits(s, z, 32);
+		} else {
+			put_bits(s, 15, 4);
+			put_bits(s, z, 64);
+		}
+	}
+	s->v = (uint64_t)v;
+	s->count++;
+	return true;
+}
+
+bool gorilla_put_time(GorillaSeries* s, int64_t t)
+{
+	if(s->kind != GORILLA_NONE && s->kind != GORILLA_TIME) {
+		return false;
+	}
+	s->kind = GORILLA_TIME;
+
+	put_time(s, t);
+	s->count++;
+	return true;
+}
+
+size_t gorilla_bytes(const GorillaSeries* s)
+{
+	return (s->bits + 7) / 8;
+}
+
+void gorilla_reader(GorillaReader* r, int kind, uint32_t count, const uint8_t* data, size_t len)
+{
+	r->data = data;
+	r->bits = len * 8;
+	r->at = 0;
+	r->kind = kind;
+	r->count = count;
+	r->read = 0;
+	r->t = 0;
+	r->delta = 0;
+	r->v = 0;
+	r->lead = -1;
+	r->trail = 0;
+}
+
+static bool get_bits(GorillaReader* r, int n, uint64_t* v)
+{
+	if(r->at + n > r->bits) {
+		return false;
+	}
+	uint64_t out = 0;
+	while(n > 0) {
+		int room = 8 - (int)(r->at % 8);
+		int take = n < room ? n : room;
+		uint8_t byte = r->data[r->at / 8];
+		out = (out << take) | ((byte >> (room - take)) & ((1u << take) - 1));
+		r->at += take;
+		n -= take;
+	}
+	*v = out;
+	return true;
+}
+
+/* the number of leading '1' of a prefix, at most max */
+static bool get_prefix(GorillaReader* r, int max, int* ones)
+{
+	uint64_t b = 0;
+	*ones = 0;
+	while(*ones < max) {
+		if(!get_bits(r, 1, &b)) {
+			return false;
+		}
+		if(!b) {
+			break;
+		}
+		(*ones)++;
+	}
+	return true;
+}
+
+/* n bits two's complement */
+static int64_t sign(uint64_t v, int n)
+{
+	if(n < 64 && (v >> (n - 1)) & 1) {
+		v |= ~0ULL << n;
+	}
+	return (int64_t)v;
+}
+
+bool gorilla_next(GorillaReader* r, int64_t* t, uint64_t* v)
+{
+	static const int timeBits[] = { 0, 7, 12, 20, 64 };
+	static const int intBits[] = { 0, 8, 16, 32, 64 };
+	uint64_t b = 0;
+	int ones = 0;
+
+	if(r->read >= r->count) {
+		return false;
+	}
+
+	int kind = r->kind & ~GORILLA_VALUES;
+
+	if(r->kind & GORILLA_VALUES) {
+		/* no timestamps */
+	} else if(!r->read) {
+		if(!get_bits(r, 64, &b)) {
+			return false;
+		}
+		r->t = (int64_t)b;
+	} else {
+		if(!get_prefix(r, 4, &ones)) {
+			return false;
+		}
+		if(ones) {
+			if(!get_bits(r, timeBits[ones], &b)) {
+				return false;
+			}
+			r->delta = (int64_t)((uint64_t)r->delta + (uint64_t)sign(b, timeBits[ones]));
+		}
+		r->t = (int64_t)((uint64_t)r->t + (uint64_t)r->delta);
+	}
+
+	if(kind == GORILLA_TIME) {
+		/* no values */
+	} else if(!r->read) {
+		if(!get_bits(r, 64, &r->v)) {
+			return false;
+		}
+	} else if(kind == GORILLA_FLOAT) {
+		if(!get_prefix(r, 2, &ones)) {
+			return false;
+		}
+		if(ones == 1) {
+			if(r->lead < 0 || !get_bits(r, 64 - r->lead - r->trail, &b)) {
+				return false;
+			}
+			r->v ^= b << r->trail;
+		} else if(ones == 2) {
+			uint64_t lead = 0, len = 0;
+			if(!get_bits(r, 5, &lead) || !get_bits(r, 6, &len) || !get_bits(r, (int)len + 1, &b)) {
+				return false;
+			}
+			r->lead = (int)lead;
+			r->trail = 64 - (int)lead - (int)len - 1;
+			if(r->trail < 0) {
+				return false;
+			}
+			r->v ^= b << r->trail;
+		}
+	} else {
+		if(!get_prefix(r, 4, &ones)) {
+			return false;
+		}
+		if(ones) {
+			if(!get_bits(r, intBits[ones], &b)) {
+				return false;
+			}
+			uint64_t d = (b >> 1) ^ (0 - (b & 1));
+			r->v += d;
+		}
+	}
+
+	r->read++;
+	*t = r->t;
+	*v = r->v;
+	return true;
+}
+
+static char* frame_room(GorillaFrame* f, size_t n)
+{
+	if(f->len + n > f->cap) {
+		while(f->len + n > f->cap) {
+			f->cap = f->cap ? f->cap * 2 : 256;
+		}
+		f->data = (char*)realloc(f->data, f->cap);
+	}
+	char* at = f->data + f->len;
+	f->len += n;
+	return at;
+}
+
+static void frame_be(GorillaFrame* f, uint32_t v, int bytes)
+{
+	char* p = frame_room(f, bytes);
+	for (int k = bytes - 1; k >= 0; k--) {
+		p[k] = (char)(v & 0xff);
+		v >>= 8;
+	}
+}
+
+static void frame_name(GorillaFrame* f, const char* name)
+{
+	size_t len = strlen(name);
+	if(len > 255) {
+		len = 255;
+	}
+	frame_be(f, (uint32_t)len, 1);
+	memcpy(frame_room(f, len), name, len);
+}
+
+void gorilla_frame_begin(GorillaFrame* f, const char* group, uint16_t series)
+{
+	f->data = NULL;
+	f->len = f->cap = 0;
+	memcpy(frame_room(f, 4), GORILLA_MAGIC, 4);
+	frame_name(f, group);
+	frame_be(f, series, 2);
+}
+
+void gorilla_frame_series(GorillaFrame* f, const char* name, const GorillaSeries* s)
+{
+	size_t bytes = gorilla_bytes(s);
+	frame_name(f, name);
+	frame_be(f, (uint32_t)s->kind, 1);
+	frame_be(f, s->count, 4);
+	frame_be(f, (uint32_t)bytes, 4);
+	if(bytes) {
+		memcpy(frame_room(f, bytes), s->data, bytes);
+	}
+}
+
+static bool frame_get(GorillaFrameReader* f, int bytes, uint32_t* v)
+{
+	if(f->at + bytes > f->len) {
+		return false;
+	}
+	*v = 0;
+	for (int k = 0; k < bytes; k++) {
+		*v = (*v << 8) | f->data[f->at++];
+	}
+	return true;
+}
+
+static bool frame_get_name(GorillaFrameReader* f, const char** name, size_t* len)
+{
+	uint32_t n = 0;
+	if(!frame_get(f, 1, &n) || f->at + n > f->len) {
+		return false;
+	}
+	*name = (const char*)f->data + f->at;
+	*len = n;
+	f->at += n;
+	return true;
+}
+
+bool gorilla_frame_open(GorillaFrameReader* f, const void* data, size_t len, const char** group, size_t* groupLen)
+{
+	uint32_t series = 0;
+
+	f->data = (const uint8_t*)data;
+	f->len = len;
+	f->at = 4;
+	f->read = 0;
+	if(len < 4 || memcmp(data, GORILLA_MAGIC, 4) || !frame_get_name(f, group, groupLen) || !frame_get(f, 2, &series)) {
+		return false;
+	}
+	f->series = (uint16_t)series;
+	return true;
+}
+
+bool gorilla_frame_next(GorillaFrameReader* f, const char** name, size_t* nameLen, GorillaReader* r)
+{
+	uint32_t kind = 0, count = 0, bytes = 0;
+
+	if(f->read >= f->series) {
+		return false;
+	}
+	if(!frame_get_name(f, name, nameLen) || !frame_get(f, 1, &kind) || !frame_get(f, 4, &count) ||
+			!frame_get(f, 4, &bytes) || f->at + bytes > f->len) {
+		return false;
+	}
+	gorilla_reader(r, (int)kind, count, f->data + f->at, bytes);
+	f->at += bytes;
+	f->read++;
+	return true;
+}
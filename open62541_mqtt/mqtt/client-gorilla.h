@@ -0,0 +1,111 @@
+#ifndef OPCUA_MQTT_BRIDGE_GORILLA_H_
+#define OPCUA_MQTT_BRIDGE_GORILLA_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Gorilla (Pelkonen et al., VLDB 2015) time series batches. plain C without
+ * open62541 : consumers build client-gorilla.c alone to read the frames.
+ *
+ * timestamps (unix us) : the first one in 64 bits, then the delta of the delta
+ *   '0' same delta, '10' + 7 bits, '110' + 12 bits, '1110' + 20 bits, '1111' + 64 bits
+ * GORILLA_FLOAT values (float64) : the first one in 64 bits, then the xor with the previous one
+ *   '0' same value, '10' + the bits inside the previous window,
+ *   '11' + 5 bits leading zeros + 6 bits length - 1 + the meaningful bits
+ * GORILLA_INT values (int64) : the first one in 64 bits, then the zigzag delta
+ *   '0' same value, '10' + 8 bits, '110' + 16 bits, '1110' + 32 bits, '1111' + 64 bits
+ *
+ * GORILLA_TIME : the timestamps alone, GORILLA_VALUES : the values alone. a
+ *   column pair of the same samples, see client-segment.h
+ *
+ * frame, integers big endian :
+ *   "GRL" 1, u8 length + group name, u16 series,
+ *   per series : u8 length + name, u8 kind, u32 samples, u32 bytes, the bit stream */
+#define GORILLA_MAGIC	"GRL\1"
+
+#define GORILLA_NONE	0	/* a reset series, the kind comes with the first sample */
+#define GORILLA_FLOAT	1
+#define GORILLA_INT	2
+#define GORILLA_TIME	3	/* gorilla_put_time only */
+#define GORILLA_VALUES	0x10	/* or'ed into FLOAT or INT : no timestamps, see gorilla_values_only */
+
+typedef struct {
+	uint8_t* data;
+	size_t bits;
+	size_t cap;	/* bytes */
+	int kind;
+	uint32_t count;
+	int64_t t;
+	int64_t delta;
+	uint64_t v;
+	int lead;	/* xor window of the last value, lead < 0 : none yet */
+	int trail;
+} GorillaSeries;
+
+void gorilla_init(GorillaSeries* s);
+void gorilla_reset(GorillaSeries* s);	/* empty again, the memory stays */
+void gorilla_free(GorillaSeries* s);
+/* before the first sample : the series keeps values only, reset keeps it so */
+void gorilla_values_only(GorillaSeries* s);
+
+/* false : the kind differs from the first sample of the batch, nothing is written */
+bool gorilla_put_double(GorillaSeries* s, int64_t t, double v);
+bool gorilla_put_int(GorillaSeries* s, int64_t t, int64_t v);
+bool gorilla_put_time(GorillaSeries* s, int64_t t);
+
+size_t gorilla_bytes(const GorillaSeries* s);
+
+typedef struct {
+	const uint8_t* data;
+	size_t bits;
+	size_t at;
+	int kind;
+	uint32_t count;
+	uint32_t read;
+	int64_t t;
+	int64_t delta;
+	uint64_t v;
+	int lead;
+	int trail;
+} GorillaReader;
+
+void gorilla_reader(GorillaReader* r, int kind, uint32_t count, const uint8_t* data, size_t len);
+/* the next sample, v holds the float64 bits or the int64 (0 for GORILLA_TIME), t is 0 for
+ * GORILLA_VALUES. false at the end or on a broken stream */
+bool gorilla_next(GorillaReader* r, int64_t* t, uint64_t* v);
+
+/* frames are written into a malloc'ed buffer the sinks take over */
+typedef struct {
+	char* data;
+	size_t len;
+	size_t cap;
+} GorillaFrame;
+
+void gorilla_frame_begin(GorillaFrame* f, const char* group, uint16_t series);
+void gorilla_frame_series(GorillaFrame* f, const char* name, const GorillaSeries* s);
+
+/* reading a frame : the series one after the other, names are not terminated */
+typedef struct {
+	const uint8_t* data;
+	size_t len;
+	size_t at;
+	uint16_t series;
+	uint16_t read;
+} GorillaFrameReader;
+
+/* false : not a frame. the group name is returned as pointer and length */
+bool gorilla_frame_open(GorillaFrameReader* f, const void* data, size_t len, const char** group, size_t* groupLen);
+bool gorilla_frame_next(GorillaFrameReader* f, const char** name, size_t* nameLen, GorillaReader* r);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_GORILLA_H_ */
@@ -23,9 +23,19 @@ using namespace std;
 #include "MQTTPacket.h"
 #include "client-common.h"
 #include "client-trans-tcp.h"
+#include "client-sink.h"
+#include "client-cache.h"
+#include "client-record.h"
+#include "client-store.h"
+#include "client-thread.h"
+#include "client-watchdog.h"
+#include "client-reload.h"
+#include "client-discover.h"
 
 int beStop = 0;
 
+int64_t epoch(void);
+
 extern UAMQ_Configuration* g_config;
 
 void signal_finish(int sig)
@@ -34,10 +44,16 @@ void signal_finish(int sig)
 	beStop = 1;
 }
 
+void signal_reload(int sig)
+{
+	reload_request();
+}
+
 void signal_stop(void)
 {
 	signal(SIGINT, signal_finish);
 	signal(SIGTERM, signal_finish);
+	signal(SIGHUP, signal_reload);
     signal(SIGPIPE, SIG_IGN);
 }
 
@@ -49,62 +65,162 @@ int main(int argc, char *argv[]) {
 		return (int) UA_STATUSCODE_GOOD;
 	}
 
-    UA_Client *client = NULL;
-    g_config->client = NULL;
+    /* --discover : a node-map is written, nothing is bridged */
+    if(g_config->discoverFile[0]) {
+        return discover_run(g_config->discoverFile) < 0 ? 1 : 0;
+    }
 
     UA_StatusCode state = UA_STATUSCODE_GOOD;
 
-    do {
-        g_config->client = client = UA_Client_new(UA_ClientConfig_standard);
+    /* before any thread starts, MCL_FUTURE covers their stacks too */
+    if(g_config->lockMemory) {
+        thread_lock_memory();
+    }
+
+    /* --replay : the log stands in for every OPC UA server, --backfill : the local store */
+    bool replay = (g_config->replayFile[0] != '\0') || g_config->backfill;
+
+    if(g_config->recordFile[0] && record_open() < 0) {
+        return (int) UA_STATUSCODE_GOOD;
+    }
+
+    /* a backfill publishes what the store holds, it does not store it again */
+    if(g_config->storePath[0] && !g_config->backfill && store_open() < 0) {
+        return (int) UA_STATUSCODE_GOOD;
+    }
+
+    /* last values of every node for local readers, filled before the first publish */
+    pthread_t tid6 = 0;
+    void* s6 = NULL;
+    if(g_config->cacheSocket[0] && cache_init() > 0) {
+        int th6 = pthread_create(&tid6, NULL, cache_run, NULL);
+    }
 
-        state = opcua_server_connect(client);
-        if(state == UA_STATUSCODE_GOOD) {
-            state = opcua_server_browse(client);
-        } else {
-			sleep(2);
-            printf("retry connect to opcua server.\n");
-		}
-    } while(!beStop && state != UA_STATUSCODE_GOOD);
+    /* every endpoint connects on its own thread, an unreachable server holds up no other */
+    for(int e = 0; e < g_config->endpointCount && !replay; e++) {
+        UAMQ_Endpoint* ep = &g_config->endpoints[e];
+        opcua_endpoint_init(ep);
+        opcua_endpoint_start(ep);
+    }
 
-    monitor_start(client);
+    /* MQTT -> OPC UA write-back */
+    pthread_t tid5 = 0;
+    void* s5 = NULL;
+    if(!replay && g_config->mqttEnable && g_config->commandTopic[0] && write_init() > 0) {
+        int th5 = pthread_create(&tid5, NULL, write_run, NULL);
+    }
 
     pthread_t tid1 = 0;
     void* s1 = NULL;
-	int th1 = pthread_create(&tid1, NULL, mqtt_run, (void*)client);
-
-    pthread_t tid2 = 0;
-    void* s2 = NULL;
-	int th2 = pthread_create(&tid2, NULL, tcp_run, (void*)client);
+	int th1 = pthread_create(&tid1, NULL, mqtt_run, NULL);
 
-    pthread_t tid3 = 0;
-    void* s3 = NULL;
-	//int th3 = pthread_create(&tid3, NULL, amqp_run, (void*)client);
+    /* every sink (mqtt, tcp, amqp) publishes from its own queue and thread */
+    sink_start();
 
     pthread_t tid4 = 0;
     void* s4 = NULL;
-	int th4 = pthread_create(&tid4, NULL, opcua_poll, (void*)client);
+	int th4 = pthread_create(&tid4, NULL, g_config->backfill ? store_backfill_run : replay ? replay_run : opcua_poll, NULL);
+
+    /* stall detection, on its own when systemd asks for pings (WatchdogSec=) */
+    pthread_t tid7 = 0;
+    void* s7 = NULL;
+    if(g_config->watchdogEnable || getenv("WATCHDOG_USEC")) {
+        int th7 = pthread_create(&tid7, NULL, watchdog_run, NULL);
+    }
+
+    /* node-map changes on SIGHUP, or on save */
+    reload_watch();
+
+    /* last : the threads above would inherit the scheduler's cpus and priority */
+    thread_apply(enumThreadScheduler, "scheduler");
+
+    watchdog_notify("READY=1");
 
 	while (!beStop)
 	{
+        watchdog_beat(epoch());
         usleep(g_config->uaPublishIntervalUsecs);
 
-        if(!g_config->asycRequestSupported && (!strncmp(g_config->method, "poll", strlen(g_config->method)))) {
-            sleep(2);
+        if(reload_due(epoch())) {
+            reload_apply();
+        }
+
+        if(replay) {
             continue;
-        } else {
-            UA_Client_Subscriptions_manuallySendPublishRequest(client);
         }
+
+        /* poll mode : only the subscriptions of auto groups need publish requests */
+        bool pollOnly = !g_config->asycRequestSupported && (!strncmp(g_config->method, "poll", strlen(g_config->method)));
+        int serviced = 0;
+
+        for(int e = 0; e < g_config->endpointCount; e++) {
+            UAMQ_Endpoint* ep = &g_config->endpoints[e];
+            if(pollOnly && !ep->subscribed) {
+                continue;
+            }
+            serviced++;
+
+            /* its recovery thread reconnects it, the other endpoints are serviced meanwhile */
+            if(opcua_session_recovering(ep)) {
+                continue;
+            }
+
+            unsigned int generation = opcua_session_generation(ep);
+
+            opcua_client_lock(ep);
+            state = UA_Client_Subscriptions_manuallySendPublishRequest(ep->client);
+            UA_ClientState cs = UA_Client_getState(ep->client);
+            opcua_client_unlock(ep);
+
+            if(cs != UA_CLIENTSTATE_CONNECTED) {
+                opcua_session_recover_start(ep, generation);
+            }
+        }
+
+        if(!serviced) {
+            sleep(2);
+        }
+    }
+
+    watchdog_notify("STOPPING=1");
+    if(tid7) {
+        pthread_join(tid7, &s7);
+    }
+
+    /* while every thread is still there to be read */
+    thread_stats_print();
+
+    /* shutdown in stages, the publish requests stopped above :
+     * 1. the poll groups, replay and write-back finish what they read or write */
+    printf("stopping : finishing reads.\n");
+    pthread_join(tid4, &s4);
+    opcua_poll_join();
+    if(tid5) {
+        pthread_join(tid5, &s5);
     }
+    record_close();
+    store_close();
+
+    /* 2. the sinks drain their queues, up to the shutdown deadline */
+    printf("stopping : draining sinks (deadline %d us).\n", g_config->shutdownDeadlineUSec);
+    sink_stop();
 
-    pthread_cancel(tid1);
-    pthread_cancel(tid2);
-    pthread_cancel(tid3);
+    /* 3. MQTT DISCONNECT once the mqtt sink is empty */
+    mqtt_stop();
 	pthread_join(tid1, &s1);
-	pthread_join(tid2, &s2);
-    pthread_join(tid3, &s3);
+    if(tid6) {
+        pthread_join(tid6, &s6);
+    }
 
-    UA_Client_disconnect(client);
-    UA_Client_delete(client);
+    /* 4. the OPC UA sessions */
+    opcua_priority_close();
+    for(int e = 0; e < g_config->endpointCount; e++) {
+        if(g_config->endpoints[e].client) {
+            opcua_endpoint_stop(&g_config->endpoints[e]);
+            UA_Client_disconnect(g_config->endpoints[e].client);
+            UA_Client_delete(g_config->endpoints[e].client);
+        }
+    }
 
     printf("stopped.\n");
 
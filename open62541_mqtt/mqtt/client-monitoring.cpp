@@ -27,11 +27,22 @@ using namespace std;
 #include "client-nodeid.h"
 #include "MQTTPacket.h"
 #include "client-common.h"
+#include "client-aggregate.h"
+#include "client-cbor.h"
+#include "client-delta.h"
+#include "client-sparkplug.h"
+#include "client-gorilla.h"
+#include "client-store.h"
+#include "client-sink.h"
+#include "client-cache.h"
+#include "client-record.h"
+#include "client-thread.h"
 #include "json.h"
 
 extern int beStop;
 
 extern map<int, Group>* gmap;
+extern pthread_mutex_t gmapLock;
 extern UAMQ_Configuration* g_config;
 
 #include <stdio.h>
@@ -61,21 +72,69 @@ int64_t epoch(void) {
     return micros;
 }
 
-static void callback(UA_UInt32 mid, UA_DataValue *data, void *context) {
+/* unix epoch micro seconds of the selected DataValue timestamp, the bridge
+ * clock ('now') when the server did not return it. */
+int64_t datavalue_time(const UA_DataValue* dv, enumTimestampSource ts, int64_t now)
+{
+    UA_DateTime t = 0;
+
+    if(ts == enumTsSource && dv->hasSourceTimestamp) {
+        t = dv->sourceTimestamp;
+    } else if(ts == enumTsServer && dv->hasServerTimestamp) {
+        t = dv->serverTimestamp;
+    } else {
+        return now;
+    }
+
+    return (int64_t)((t - UA_DATETIME_UNIX_EPOCH) / UA_USEC_TO_DATETIME);
+}
 
-    if(!data->hasValue) {
+/* cbor : {alias: value, "time": t}, encoded into the buffer the sinks send */
+static void event_cbor(Group* p, Node* d, UA_DataValue* data, int64_t now)
+{
+    CborBuf b;
+    cbor_init(&b, 64);
+    cbor_map(&b, 2);
+    cbor_key(&b, d->alias);
+    if(!cbor_variant(&b, &data->value)) {
+        printf("not supported dataType : %s, typeIndex:%d\n", data->value.type->typeName, data->value.type->typeIndex);
+        cbor_free(&b);
         return;
     }
+    cbor_key(&b, "time");
+    cbor_int(&b, datavalue_time(data, getTimestampSource(p->timestamp), now));
+
+    char topic[256];
+    snprintf(topic, sizeof(topic), "%s/%s/%s/%s", g_config->topicBase, g_config->deviceID, p->topic, d->topic);
+    sink_publish_buffer(p->sinks, "event", topic, b.data, b.len, true);
+}
+
+/* one sample of an event group, from the subscription or the replay */
+void event_process(Node* d, UA_DataValue *data, int64_t now) {
 
-    Node* d = (Node*)context;
     Group* p = d->parent;
 
+    cache_update(d, data, now);
+    store_update(d, data, now);
+
+    if(!data->hasValue || !data->value.type) {
+        return;
+    }
+
+    if(getPayloadFormat(p->format) == enumCBOR) {
+        event_cbor(p, d, data, now);
+        return;
+    }
+
+    if(getPayloadFormat(p->format) == enumSparkplug) {
+        sparkplug_publish(p, &d, data, 1, getTimestampSource(p->timestamp), now);
+        return;
+    }
+
     UA_Variant val = data->value;
     const UA_DataType* type = val.type;
 
-    static char topic[64] = {0,};
-    static char payload[256] = {0,};
-    static char value[32] = {0,};
+    char value[512] = {0,};
 
     json_object* jobj = json_object_new_object();
 
@@ -104,7 +163,8 @@ static void callback(UA_UInt32 mid, UA_DataValue *data, void *context) {
         }
     }
 
-    sprintf(topic, "%s/%s/%s/%s", g_config->topicBase, g_config->deviceID, p->topic, d->topic);
+    char topic[256];
+    snprintf(topic, sizeof(topic), "%s/%s/%s/%s", g_config->topicBase, g_config->deviceID, p->topic, d->topic);
     
     bool bEmpty = true;
     json_object_object_foreach(jobj, key, v) {
@@ -112,23 +172,19 @@ static void callback(UA_UInt32 mid, UA_DataValue *data, void *context) {
     }
 
     if(!bEmpty) {
-        int64_t t = epoch();
+        int64_t t = datavalue_time(data, getTimestampSource(p->timestamp), now);
         json_object_object_add(jobj, "time", json_object_new_int64(t));
-        sprintf(payload, "%s=%ld, %s=%s", "time", t, d->alias, value);
+        string kv = "time=" + to_string(t) + ", " + d->alias + "=" + value;
 
         const char* contents = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
         
         switch(getPayloadFormat(p->format)) {
             case enumJSON : {
-                if(p->mqtt) mqtt_publish("event", topic, contents);
-                //if(p->amqp) amqp_publish("event", topic, contents);
-                if(p->tcp) tcp_publish("event", topic, contents);
+                sink_publish(p->sinks, "event", topic, contents, strlen(contents));
             }
             break;
             case enumKeyVal : {
-                if(p->mqtt) mqtt_publish("event", topic, payload);
-                //if(p->amqp) amqp_publish("event", topic, payload);
-                if(p->tcp) tcp_publish("event", topic, payload);
+                sink_publish(p->sinks, "event", topic, kv.c_str(), kv.size());
             }
             break;
 
@@ -142,24 +198,72 @@ static void callback(UA_UInt32 mid, UA_DataValue *data, void *context) {
     json_object_put(jobj);
 }
 
-void monitor_start(UA_Client* client)
+static void auto_notify(Node* d, UA_DataValue* data, int64_t now);
+
+static void callback(UA_UInt32 mid, UA_DataValue *data, void *context) {
+
+    Node* d = (Node*)context;
+    int64_t now = epoch();
+
+    record_sample(d, data, now);
+    if(getMonitorMode(d->parent->method) == enumAuto) {
+        auto_notify(d, data, now);
+    } else {
+        event_process(d, data, now);
+    }
+}
+
+static UA_UInt32 monitor_add(UA_Client* client, UA_UInt32 subId, Node* d)
+{
+    UA_UInt32 monId = 0; 
+    UA_Client_Subscriptions_addMonitoredItem(client, subId, d->ua, UA_ATTRIBUTEID_VALUE, &callback, d, &monId);
+    if (!monId) {
+        switch(d->ua.identifierType) {
+            case UA_NODEIDTYPE_STRING : {
+                printf("Monitoring id %u for %s ==> FAILED.\n", subId, d->ua.identifier.string.data);
+            }
+            break;
+            case UA_NODEIDTYPE_NUMERIC : {
+                printf("Monitoring id %u for %d ==> FAILED.\n", subId, d->ua.identifier.numeric);
+            }
+            break;
+            default: {
+                printf("Monitoring FAILED.\n");
+                break;
+            }
+        }
+    }
+
+    return monId;
+}
+
+void monitor_start(UAMQ_Endpoint *ep)
 {
     if(!g_config->asycRequestSupported && (getMonitorMode(g_config->method) == enumPoll)) {
         cout << "\n[EVENT MODE] DISCARDED.\n";
         return;
     }
 
+    UA_Client* client = ep->client;
+    int index = (int)(ep - g_config->endpoints);
+
     UA_UInt32 subId = 0;
     UA_Client_Subscriptions_new(client, UA_SubscriptionSettings_standard, &subId);
-    if(subId)
+    if(subId) {
         printf("Create subscription succeeded, id %u\n", subId);
+        ep->subscribed = true;
+        ep->subscription = subId;
+    }
+
+    /* the endpoint's recovery thread, with the client lock : a reload may insert groups meanwhile */
+    pthread_mutex_lock(&gmapLock);
 
-    printf("\n[EVENT MODE]\n");
+    printf("\n[EVENT MODE] %s\n", ep->name);
 	map<int, Group>::iterator i;
 	for (i = gmap->begin(); i != gmap->end(); ++i) {
 		Group* p = (Group*)&i->second;
 
-        if(getMonitorMode(p->method) == enumEvent) {
+        if(getMonitorMode(p->method) == enumEvent && p->ep == index) {
             cout << "\t[" << i->first << "] name: \"" << p->name << "\", enable: " << p->enable << ", method: " << p->method << ", interval(us): " << p->intervalUSec << ", mqtt: " << p->mqtt << ", tcp: " << p->tcp << "\n";
 
             if(!p->enable) {
@@ -169,251 +273,1209 @@ void monitor_start(UA_Client* client)
             for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
                 Node* d = (Node*)&n->second;
                 d->parent = p;
-                cout << "\t\t[" << n->first << "] id: " << d->id << ", topic: " <<  d->topic << ", alias: " << d->alias << "\n";
 
                 UA_NodeIdType type = getUA_NodeID(d->id, &d->ua);
 
-                UA_UInt32 monId = 0; 
-                UA_Client_Subscriptions_addMonitoredItem(client, subId, d->ua, UA_ATTRIBUTEID_VALUE, &callback, d, &monId);
-                if (!monId) {
-                    switch(d->ua.identifierType) {
-                        case UA_NODEIDTYPE_STRING : {
-                            printf("Monitoring id %u for %s ==> FAILED.\n", subId, d->ua.identifier.string.data);
-                        }
-                        break;
-                        case UA_NODEIDTYPE_NUMERIC : {
-                            printf("Monitoring id %u for %d ==> FAILED.\n", subId, d->ua.identifier.numeric);
-                        }
-                        break;
-                        default: {
-                            printf("Monitoring FAILED.\n");
-                            break;
-                        }
-                    }
-                }
+                d->monitorId = monitor_add(client, subId, d);
             }
         }
 	}
+    pthread_mutex_unlock(&gmapLock);
 }
 
-void* opcua_poll_group(void* param)
+/* auto groups : one subscription per group, created with its first node. the
+ * sampling interval of this client is the publishing interval, intervalUSec.
+ * caller holds the client lock. */
+static bool auto_subscribe(UAMQ_Endpoint* ep, Group* p, Node* d)
 {
-    UA_Client* client = (UA_Client*)g_config->client;
-    Group* p = (Group*)param;
+    if(!p->subscription) {
+        UA_SubscriptionSettings settings = UA_SubscriptionSettings_standard;
+        settings.requestedPublishingInterval = p->intervalUSec / 1000.0;
+        UA_Client_Subscriptions_new(ep->client, settings, &p->subscription);
+        if(!p->subscription) {
+            printf("[auto] %s : create subscription ==> FAILED.\n", p->name);
+            return false;
+        }
+        ep->subscribed = true;
+    }
 
-    do {
-        json_object* jobj = json_object_new_object();
-        vector<char*> kvs;
+    d->monitorId = monitor_add(ep->client, p->subscription, d);
+    return d->monitorId != 0;
+}
+
+static void auto_unsubscribe(UAMQ_Endpoint* ep, Group* p, Node* d)
+{
+    UA_Client_Subscriptions_removeMonitoredItem(ep->client, p->subscription, d->monitorId);
+    d->monitorId = 0;
+}
+
+/* the session was re-created : the server dropped the old subscription, add
+ * every monitored item again in one pass. caller holds the client lock. */
+void monitor_resubscribe(UAMQ_Endpoint *ep)
+{
+    UA_Client* client = ep->client;
+    int index = (int)(ep - g_config->endpoints);
 
+    /* a reload may insert groups meanwhile */
+    pthread_mutex_lock(&gmapLock);
+
+    /* auto groups get their subscription back with the nodes subscribed before */
+	map<int, Group>::iterator g;
+	for (g = gmap->begin(); g != gmap->end(); ++g) {
+		Group* p = (Group*)&g->second;
+
+        if(getMonitorMode(p->method) != enumAuto || !p->enable || p->ep != index || !p->subscription) {
+            continue;
+        }
+
+        p->subscription = 0;
+        int count = 0;
         map<int, Node>::iterator n;
         for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
             Node* d = (Node*)&n->second;
+            if(d->monitorId) {
+                count += auto_subscribe(ep, p, d);
+            }
+        }
+        printf("Re-create subscription of auto group %s on [%s], id %u, %d monitored items.\n", p->name, ep->name, p->subscription, count);
+	}
 
-            UA_Variant *val = UA_Variant_new();
-            UA_StatusCode retval = UA_Client_readValueAttribute(client, d->ua, val);
-
-            if(retval != UA_STATUSCODE_GOOD) {
-                UA_Variant_delete(val);
-                printf("read failed.\n");
-                usleep(p->intervalUSec);
-
-				UA_StatusCode state = UA_STATUSCODE_GOOD;
-
-				do {
-					state = opcua_server_connect(client);
-					if (state == UA_STATUSCODE_GOOD) {
-						state = opcua_server_browse(client);
-						
-					} else {
-						sleep(2);
-						printf("OPC UA Server connect failed.");
-					}
-				} while(state != UA_STATUSCODE_GOOD);
-                
-				continue;
-            }
-
-            // typedef struct {
-            //     const UA_DataType *type;      /* The data type description */
-            //     UA_VariantStorageType storageType;
-            //     size_t arrayLength;           /* The number of elements in the data array */
-            //     void *data;                   /* Points to the scalar or array data */
-            //     size_t arrayDimensionsSize;   /* The number of dimensions */
-            //     UA_UInt32 *arrayDimensions;   /* The length of each dimension */
-            // } UA_Variant;
-            // UA_Boolean isScalar = UA_Variant_isScalar(val);
-            // if(!isScalar) {
-            //     printf(" ---- NOT SCALAR ----\n");
-            //     //arrayDimensionsSize
-            //     printf("\t arrayLength : %d\n", (int)val->arrayLength);
-
-            //     for(int i = 0; i < (int)val->arrayLength; i++) {
-            //         UA_UInt32 as = val->arrayDimensions[i];
-            //     }
-            // }
-
-
-            char value[512] = {0,};
-
-            const UA_DataType* type = val->type;
-
-            switch(type->typeIndex) {
-                case UA_TYPES_BOOLEAN : {
-                    json_object_object_add(jobj, d->alias, json_object_new_boolean((*(UA_Boolean*)val->data))); 
-                    sprintf(&value[0], "%s", (*(UA_Boolean*)val->data) == true ? "true" : "false");
-                }
-                break;
-                case UA_TYPES_SBYTE : {
-                    json_object_object_add(jobj, d->alias, json_object_new_int((*(UA_SByte*)val->data))); 
-                    sprintf(&value[0], "%d", (*(UA_SByte*)val->data));
-                }
-                break;
-                case UA_TYPES_BYTE : {
-                    json_object_object_add(jobj, d->alias, json_object_new_int((*(UA_Byte*)val->data))); 
-                    sprintf(&value[0], "%d", (*(UA_Byte*)val->data));
-                }
-                break;
-                case UA_TYPES_INT16 : {
-                    json_object_object_add(jobj, d->alias, json_object_new_int((*(UA_Int16*)val->data))); 
-                    sprintf(&value[0], "%d", (*(UA_Int16*)val->data)); 
-                }
-                break;
-                case UA_TYPES_UINT16 : {
-                    json_object_object_add(jobj, d->alias, json_object_new_int((*(UA_UInt16*)val->data))); 
-                    sprintf(&value[0], "%d", (*(UA_UInt16*)val->data)); 
-                }
-                break;
-                case UA_TYPES_INT32 : {
-                    json_object_object_add(jobj, d->alias, json_object_new_int((*(UA_Int32*)val->data))); 
-                    sprintf(&value[0], "%d", (*(UA_Int32*)val->data)); 
-                }
-                break;
-                case UA_TYPES_UINT32 : {
-                    json_object_object_add(jobj, d->alias, json_object_new_int((*(UA_UInt32*)val->data))); 
-                    sprintf(&value[0], "%d", (*(UA_UInt32*)val->data)); 
-                }
-                break;
-                case UA_TYPES_INT64 : {
-                    json_object_object_add(jobj, d->alias, json_object_new_int64((*(UA_Int64*)val->data))); 
-                    sprintf(&value[0], "%ld", (*(UA_Int64*)val->data)); 
-                }
-                break;
-                case UA_TYPES_UINT64 : {
-                    json_object_object_add(jobj, d->alias, json_object_new_int64((*(UA_UInt64*)val->data))); 
-                    sprintf(&value[0], "%ld", (*(UA_UInt64*)val->data)); 
-                }
-                break;
-                case UA_TYPES_FLOAT : {
-                    json_object_object_add(jobj, d->alias, json_object_new_double((*(UA_Float*)val->data))); 
-                    sprintf(&value[0], "%f", (*(UA_Float*)val->data)); 
-                }break;
-                case UA_TYPES_DOUBLE : {
-                    json_object_object_add(jobj, d->alias, json_object_new_double((*(UA_Double*)val->data))); 
-                    sprintf(&value[0], "%f", (*(UA_Double*)val->data));
-                }
-                break;
-                case UA_TYPES_STRING : {
-                    if(0 != (*(UA_String*)val->data).length ) {
-                        sprintf(&value[0], "%s", ((*(UA_String*)val->data).data));
-                        json_object_object_add(jobj, d->alias, json_object_new_string(value));
-                        sprintf(&value[0], "\"%s\"", ((*(UA_String*)val->data).data));
-                    }
-                }
-                break;
-                default : {
-                    printf("not supported dataType : %s, typeIndex:%d\n", val->type->typeName, val->type->typeIndex);
-                    UA_Variant_delete(val);
-                    usleep(p->intervalUSec);
-                    continue;
+    if(!g_config->asycRequestSupported && (getMonitorMode(g_config->method) == enumPoll)) {
+        pthread_mutex_unlock(&gmapLock);
+        return;
+    }
+
+    UA_UInt32 subId = 0;
+    UA_Client_Subscriptions_new(client, UA_SubscriptionSettings_standard, &subId);
+    ep->subscription = subId;
+    if(!subId) {
+        printf("Re-create subscription ==> FAILED.\n");
+        pthread_mutex_unlock(&gmapLock);
+        return;
+    }
+
+    int count = 0;
+	map<int, Group>::iterator i;
+	for (i = gmap->begin(); i != gmap->end(); ++i) {
+		Group* p = (Group*)&i->second;
+
+        if(getMonitorMode(p->method) != enumEvent || !p->enable || p->ep != index) {
+            continue;
+        }
+
+        map<int, Node>::iterator n;
+        for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
+            Node* d = (Node*)&n->second;
+            d->monitorId = monitor_add(client, subId, d);
+            count++;
+        }
+	}
+    pthread_mutex_unlock(&gmapLock);
+
+    printf("Re-create subscription succeeded on [%s], id %u, %d monitored items.\n", ep->name, subId, count);
+}
+
+/* reload : an event group joins the subscription of its endpoint. the nodes
+ * are prepared before the group is enabled, a resubscribe may add them first. */
+void monitor_group_start(Group* p)
+{
+    UAMQ_Endpoint* ep = &g_config->endpoints[p->ep];
+
+    opcua_client_lock(ep);
+    if(!ep->subscription) {
+        opcua_client_unlock(ep);
+        printf("[reload] %s : no event subscription on [%s], the group is not monitored.\n", p->name, ep->name);
+        return;
+    }
+
+    int count = 0;
+    map<int, Node>::iterator n;
+    for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
+        Node* d = (Node*)&n->second;
+        if(!d->monitorId) {
+            d->monitorId = monitor_add(ep->client, ep->subscription, d);
+        }
+        count += (d->monitorId != 0);
+    }
+    opcua_client_unlock(ep);
+
+    printf("[reload] %s : %d monitored items on [%s].\n", p->name, count, ep->name);
+}
+
+/* reload : no notification reaches the group once this returns */
+void monitor_group_stop(Group* p)
+{
+    UAMQ_Endpoint* ep = &g_config->endpoints[p->ep];
+
+    opcua_client_lock(ep);
+    map<int, Node>::iterator n;
+    for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
+        Node* d = (Node*)&n->second;
+        if(d->monitorId) {
+            UA_Client_Subscriptions_removeMonitoredItem(ep->client, ep->subscription, d->monitorId);
+            d->monitorId = 0;
+        }
+    }
+    opcua_client_unlock(ep);
+}
+
+/* numeric scalars feed the aggregation windows, everything else is skipped */
+static bool variant_number(const UA_Variant* val, double* out)
+{
+    if(!UA_Variant_isScalar(val)) {
+        return false;
+    }
+
+    switch(val->type->typeIndex) {
+        case UA_TYPES_BOOLEAN : *out = (*(UA_Boolean*)val->data) ? 1 : 0; break;
+        case UA_TYPES_SBYTE : *out = (*(UA_SByte*)val->data); break;
+        case UA_TYPES_BYTE : *out = (*(UA_Byte*)val->data); break;
+        case UA_TYPES_INT16 : *out = (*(UA_Int16*)val->data); break;
+        case UA_TYPES_UINT16 : *out = (*(UA_UInt16*)val->data); break;
+        case UA_TYPES_INT32 : *out = (*(UA_Int32*)val->data); break;
+        case UA_TYPES_UINT32 : *out = (*(UA_UInt32*)val->data); break;
+        case UA_TYPES_INT64 : *out = (double)(*(UA_Int64*)val->data); break;
+        case UA_TYPES_UINT64 : *out = (double)(*(UA_UInt64*)val->data); break;
+        case UA_TYPES_FLOAT : *out = (*(UA_Float*)val->data); break;
+        case UA_TYPES_DOUBLE : *out = (*(UA_Double*)val->data); break;
+        default : return false;
+    }
+
+    return true;
+}
+
+/* one message for the window (end - windowUSec, end] of every node :
+ * json {"alias": {"min": .., "max": ..}, "time": end, "window": windowUSec}
+ * kv   alias.min=.., alias.max=.., time=end
+ * cbor the json map, count as an integer and the others as float64 */
+static void aggregate_publish(Group* p, vector<Node*>& nodes, vector<AggRing>& rings, int64_t end)
+{
+    json_object* jobj = json_object_new_object();
+    ostringstream ss;
+    bool bEmpty = true;
+
+    bool cbor = getPayloadFormat(p->format) == enumCBOR;
+    CborBuf cb;
+    if(cbor) {
+        cbor_init(&cb, 64 * nodes.size() + 32);
+        cbor_map_open(&cb);
+    }
+
+    for (size_t r = 0; r < nodes.size(); r++) {
+        AggResult res;
+        if(!agg_ring_reduce(&rings[r], end, &res)) {
+            continue;
+        }
+
+        double values[] = { res.min, res.max, res.mean, (double)res.count, res.first, res.last, res.stddev };
+        unsigned int flags[] = { UAMQ_AGG_MIN, UAMQ_AGG_MAX, UAMQ_AGG_MEAN, UAMQ_AGG_COUNT, UAMQ_AGG_FIRST, UAMQ_AGG_LAST, UAMQ_AGG_STDDEV };
+
+        json_object* jnode = json_object_new_object();
+        if(cbor) {
+            cbor_key(&cb, nodes[r]->alias);
+            cbor_map_open(&cb);
+        }
+        for (size_t k = 0; k < sizeof(flags) / sizeof(flags[0]); k++) {
+            if(!(p->aggregates & flags[k])) {
+                continue;
+            }
+
+            const char* name = getAggregateName(flags[k]);
+            if(cbor) {
+                cbor_key(&cb, name);
+                if(flags[k] == UAMQ_AGG_COUNT) {
+                    cbor_uint(&cb, res.count);
+                } else {
+                    cbor_double(&cb, values[k]);
                 }
             }
-            UA_Variant_delete(val);
+            if(flags[k] == UAMQ_AGG_COUNT) {
+                json_object_object_add(jnode, name, json_object_new_int64((int64_t)res.count));
+            } else {
+                json_object_object_add(jnode, name, json_object_new_double(values[k]));
+            }
+            ss << nodes[r]->alias << "." << name << "=" << values[k] << ", ";
+        }
+        if(cbor) {
+            cbor_end(&cb);
+        }
+        json_object_object_add(jobj, nodes[r]->alias, jnode);
+        bEmpty = false;
+    }
+
+    if(!bEmpty) {
+        json_object_object_add(jobj, "time", json_object_new_int64(end));
+        json_object_object_add(jobj, "window", json_object_new_int(p->windowUSec));
+        ss << "time=" << end;
+
+        char topic[256];
+        snprintf(topic, sizeof(topic), "%s/%s/%s", g_config->topicBase, g_config->deviceID, p->topic);
+
+        const char* contents = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
+        switch(getPayloadFormat(p->format)) {
+            case enumCBOR : {
+                cbor_key(&cb, "time");
+                cbor_int(&cb, end);
+                cbor_key(&cb, "window");
+                cbor_int(&cb, p->windowUSec);
+                cbor_end(&cb);
+                sink_publish_buffer(p->sinks, "poll", topic, cb.data, cb.len, true);
+                cbor = false;
+            }
+            break;
+            case enumJSON : {
+                sink_publish(p->sinks, "poll", topic, contents, strlen(contents));
+            }
+            break;
+            case enumKeyVal : {
+                string kv = ss.str();
+                sink_publish(p->sinks, "poll", topic, kv.c_str(), kv.size());
+            }
+            break;
+
+            default: {
+            }
+            break;
+        }
+    }
+
+    /* handed to the sinks, or nothing to send */
+    if(cbor) {
+        cbor_free(&cb);
+    }
+    json_object_put(jobj);
+}
+
+/* a poll group between two reads, the replay keeps one per group too */
+struct PollState {
+    Group* group;
+    vector<Node*> nodes;
+    enumTimestampSource ts;
+    vector<AggRing> rings;
+    int64_t windowEnd;
+    /* auto groups : notifications come in on the scheduler thread */
+    pthread_mutex_t lock;
+    map<Node*, size_t> position;
+    /* format delta : the last published value of every node */
+    DeltaState delta;
+    /* format gorilla : the open batch of every node */
+    vector<GorillaSeries> series;
+    int64_t batchEnd;
+};
+
+static void poll_state_init(PollState* ps, Group* p)
+{
+    ps->group = p;
+    ps->ts = getTimestampSource(p->timestamp);
+    ps->windowEnd = 0;
+
+    map<int, Node>::iterator n;
+    for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
+        ps->position[(Node*)&n->second] = ps->nodes.size();
+        ps->nodes.push_back((Node*)&n->second);
+    }
+    pthread_mutex_init(&ps->lock, NULL);
+
+    if(p->windowUSec > 0) {
+        ps->rings.resize(ps->nodes.size());
+        for (size_t r = 0; r < ps->rings.size(); r++) {
+            agg_ring_init(&ps->rings[r], (size_t)(p->windowUSec / (p->intervalUSec > 0 ? p->intervalUSec : 1)) + 2);
+        }
+    }
+
+    vector<const char*> aliases;
+    if(getPayloadFormat(p->format) == enumDelta) {
+        for (size_t r = 0; r < ps->nodes.size(); r++) {
+            aliases.push_back(ps->nodes[r]->alias);
+        }
+    }
+    delta_init(&ps->delta, aliases.empty() ? NULL : &aliases[0], aliases.size(), p->deltaEvery, p->deltaKeyUSec);
+
+    ps->batchEnd = 0;
+    if(getPayloadFormat(p->format) == enumGorilla) {
+        ps->series.resize(ps->nodes.size());
+        for (size_t r = 0; r < ps->series.size(); r++) {
+            gorilla_init(&ps->series[r]);
+        }
+    }
+}
+
+static void batch_publish(PollState* ps);
+
+static void poll_state_free(PollState* ps)
+{
+    /* the open batch goes out with the last reads, before the sinks drain */
+    if(!ps->series.empty()) {
+        batch_publish(ps);
+    }
+    for (size_t r = 0; r < ps->series.size(); r++) {
+        gorilla_free(&ps->series[r]);
+    }
+    for (size_t r = 0; r < ps->rings.size(); r++) {
+        agg_ring_free(&ps->rings[r]);
+    }
+    delta_free(&ps->delta);
+    pthread_mutex_destroy(&ps->lock);
+}
+
+static bool variant_changed(const UA_Variant* a, const UA_Variant* b);
+
+/* delta : the nodes that changed since the previous message, or a keyframe,
+ * see client-delta.h. nothing is sent while nothing changed and no keyframe
+ * is due */
+static void delta_publish(PollState* ps, UA_DataValue* results, int64_t now)
+{
+    Group* p = ps->group;
+    DeltaState* d = &ps->delta;
+
+    int64_t latest = 0;
+    for (size_t r = 0; r < d->count; r++) {
+        UA_DataValue* dv = &results[r];
+        if(!dv->hasValue || !dv->value.type || (dv->hasStatus && dv->status != UA_STATUSCODE_GOOD)) {
+            continue;
+        }
+        if(ps->ts != enumTsBridge) {
+            int64_t t = datavalue_time(dv, ps->ts, now);
+            if(t > latest) {
+                latest = t;
+            }
+        }
+        if(d->last[r].type && !variant_changed(&d->last[r], &dv->value)) {
+            continue;
+        }
+        delta_set(d, r, &dv->value);
+    }
+
+    CborBuf b;
+    if(!delta_message(d, &b, p->name, (ps->ts == enumTsBridge || !latest) ? now : latest, now)) {
+        return;
+    }
+
+    char topic[256];
+    snprintf(topic, sizeof(topic), "%s/%s/%s", g_config->topicBase, g_config->deviceID, p->topic);
+    sink_publish_buffer(p->sinks, "poll", topic, b.data, b.len, true);
+}
+
+/* gorilla : the frames of the batch, one for the group or one per node, then
+ * every series starts again */
+static void batch_publish(PollState* ps)
+{
+    Group* p = ps->group;
+    vector<Node*>& nodes = ps->nodes;
+    vector<GorillaSeries>& series = ps->series;
+
+    uint16_t used = 0;
+    for (size_t r = 0; r < series.size(); r++) {
+        used += series[r].count > 0;
+    }
+    if(!used) {
+        return;
+    }
+
+    char topic[256];
+    if(p->batchPerNode) {
+        for (size_t r = 0; r < series.size(); r++) {
+            if(!series[r].count) {
+                continue;
+            }
+            GorillaFrame f;
+            gorilla_frame_begin(&f, p->name, 1);
+            gorilla_frame_series(&f, nodes[r]->alias, &series[r]);
+            snprintf(topic, sizeof(topic), "%s/%s/%s/%s", g_config->topicBase, g_config->deviceID, p->topic, nodes[r]->topic);
+            sink_publish_buffer(p->sinks, "batch", topic, f.data, f.len, true);
+        }
+    } else {
+        GorillaFrame f;
+        gorilla_frame_begin(&f, p->name, used);
+        for (size_t r = 0; r < series.size(); r++) {
+            if(series[r].count) {
+                gorilla_frame_series(&f, nodes[r]->alias, &series[r]);
+            }
+        }
+        snprintf(topic, sizeof(topic), "%s/%s/%s", g_config->topicBase, g_config->deviceID, p->topic);
+        sink_publish_buffer(p->sinks, "batch", topic, f.data, f.len, true);
+    }
 
-            static char skv[32] = {0,};
-            sprintf(skv, "%s=%s", d->alias, value);
-            kvs.push_back(strndup(skv, strlen(skv)));
+    for (size_t r = 0; r < series.size(); r++) {
+        gorilla_reset(&series[r]);
+    }
+}
+
+/* gorilla : numbers, bools and DateTime join the batch of their node, with
+ * the group's timestamp. the batches close on the bridge clock, aligned to
+ * multiples of batchUSec like the aggregation windows */
+static void batch_process(PollState* ps, UA_DataValue* results, int64_t now)
+{
+    Group* p = ps->group;
+
+    if(ps->batchEnd && now >= ps->batchEnd) {
+        batch_publish(ps);
+    }
+    if(!ps->batchEnd || now >= ps->batchEnd) {
+        ps->batchEnd = (now / p->batchUSec + 1) * p->batchUSec;
+    }
+
+    for (size_t r = 0; r < ps->nodes.size(); r++) {
+        UA_DataValue* dv = &results[r];
+        if(!dv->hasValue || !dv->value.type || !UA_Variant_isScalar(&dv->value) ||
+                (dv->hasStatus && dv->status != UA_STATUSCODE_GOOD)) {
+            continue;
         }
 
-        static char topic[64] = {0,};
-        sprintf(topic, "%s/%s/%s", g_config->topicBase, g_config->deviceID, p->topic);
+        int64_t t = datavalue_time(dv, ps->ts, now);
+        const void* v = dv->value.data;
+        GorillaSeries* s = &ps->series[r];
+        bool ok = true;
+        switch(dv->value.type->typeIndex) {
+            case UA_TYPES_FLOAT : ok = gorilla_put_double(s, t, *(const UA_Float*)v); break;
+            case UA_TYPES_DOUBLE : ok = gorilla_put_double(s, t, *(const UA_Double*)v); break;
+            case UA_TYPES_BOOLEAN : ok = gorilla_put_int(s, t, *(const UA_Boolean*)v ? 1 : 0); break;
+            case UA_TYPES_SBYTE : ok = gorilla_put_int(s, t, *(const UA_SByte*)v); break;
+            case UA_TYPES_BYTE : ok = gorilla_put_int(s, t, *(const UA_Byte*)v); break;
+            case UA_TYPES_INT16 : ok = gorilla_put_int(s, t, *(const UA_Int16*)v); break;
+            case UA_TYPES_UINT16 : ok = gorilla_put_int(s, t, *(const UA_UInt16*)v); break;
+            case UA_TYPES_INT32 : ok = gorilla_put_int(s, t, *(const UA_Int32*)v); break;
+            case UA_TYPES_UINT32 : ok = gorilla_put_int(s, t, *(const UA_UInt32*)v); break;
+            case UA_TYPES_INT64 : ok = gorilla_put_int(s, t, *(const UA_Int64*)v); break;
+            case UA_TYPES_UINT64 : ok = gorilla_put_int(s, t, (int64_t)*(const UA_UInt64*)v); break;
+            case UA_TYPES_DATETIME : ok = gorilla_put_int(s, t, (*(const UA_DateTime*)v - UA_DATETIME_UNIX_EPOCH) / UA_USEC_TO_DATETIME); break;
+            default : {
+                printf("not supported dataType : %s, typeIndex:%d\n", dv->value.type->typeName, dv->value.type->typeIndex);
+            }
+            break;
+        }
+        if(!ok) {
+            printf("[batch] %s : a number changed between integer and float, sample dropped until the next batch.\n", ps->nodes[r]->alias);
+        }
+    }
+}
 
-        bool bEmpty = true;
-        json_object_object_foreach(jobj, key, val) {
-            bEmpty = false;
+/* encode and publish one read of the group, results[r] belongs to nodes[r] */
+static void poll_process(PollState* ps, UA_DataValue* results, int64_t now)
+{
+    Group* p = ps->group;
+    vector<Node*>& nodes = ps->nodes;
+    vector<AggRing>& rings = ps->rings;
+    size_t count = nodes.size();
+    enumTimestampSource ts = ps->ts;
+
+    pthread_mutex_lock(&ps->lock);
+
+    /* aggregation : windows run on the bridge clock, aligned to multiples of
+     * slideUSec so several bridges close their windows at the same instant. */
+    if(p->windowUSec > 0 && !ps->windowEnd) {
+        ps->windowEnd = (now / p->slideUSec + 1) * p->slideUSec;
+    }
+
+    json_object* jobj = json_object_new_object();
+    json_object* jtimes = NULL;
+    string kv;
+    int64_t latest = 0;
+
+    /* cbor : {alias: value, .., "time": t[, "times": {alias: t}]}, no json is built */
+    bool cbor = getPayloadFormat(p->format) == enumCBOR;
+    CborBuf cb;
+    vector<pair<const char*, int64_t> > ctimes;
+    int centries = 0;
+    if(cbor) {
+        cbor_init(&cb, 16 * count + 32);
+        cbor_map_open(&cb);
+    }
+
+    /* sparkplug : the whole read is one DDATA (or DBIRTH), delta : the changed
+     * fields of the read, both encoded after the loop */
+    bool spb = getPayloadFormat(p->format) == enumSparkplug;
+    bool delta = getPayloadFormat(p->format) == enumDelta;
+    bool batch = getPayloadFormat(p->format) == enumGorilla;
+
+    for (size_t r = 0; r < count; r++) {
+        Node* d = nodes[r];
+        UA_DataValue* dv = &results[r];
+
+        /* not read in this cycle (adaptive tier, replay gap) */
+        if(!dv->hasValue && !dv->hasStatus) {
+            continue;
         }
 
-        if(!bEmpty) {
-            int64_t t = epoch();
-            json_object_object_add(jobj, "time", json_object_new_int64(t));
+        cache_update(d, dv, now);
+        store_update(d, dv, now);
 
-            static char skv[32] = {0,};
-            sprintf(skv, "%s=%lu", "time", t);
-            kvs.push_back(strndup(skv, strlen(skv)));
+        if(!dv->hasValue || !dv->value.type || (dv->hasStatus && dv->status != UA_STATUSCODE_GOOD)) {
+            printf("read failed : %s (0x%08x)\n", d->id, dv->hasStatus ? dv->status : UA_STATUSCODE_GOOD);
+            continue;
+        }
 
-            static char payload[512] = {0,};
+        if(spb || delta || batch) {
+            continue;
+        }
 
-            ostringstream ss;
+        if(p->windowUSec > 0) {
+            double x = 0;
+            if(variant_number(&dv->value, &x)) {
+                agg_ring_push(&rings[r], now, x);
+            }
+            continue;
+        }
 
-            copy(kvs.begin(), kvs.end() - 1, ostream_iterator<char*>(ss, ", "));
-            ss << kvs.back();
+        UA_Variant* val = &dv->value;
 
-            const char* contents = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
-            switch(getPayloadFormat(p->format)) {
-                case enumJSON : {
-                    if(p->mqtt) mqtt_publish("poll", topic, contents);
-                    //if(p->amqp) amqp_publish("poll", topic, contents);
-                    if(p->tcp)
-                    {
-                        char* contents2 = const_cast<char*>(json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN));
-                        strcat(contents2,"\n");
-                        tcp_publish("poll", topic, contents2);
-                    }
+        if(cbor) {
+            size_t mark = cb.len;
+            cbor_key(&cb, d->alias);
+            if(!cbor_variant(&cb, val)) {
+                cb.len = mark;
+                printf("not supported dataType : %s, typeIndex:%d\n", val->type->typeName, val->type->typeIndex);
+                continue;
+            }
+            centries++;
+            if(ts != enumTsBridge) {
+                int64_t t = datavalue_time(dv, ts, now);
+                ctimes.push_back(pair<const char*, int64_t>(d->alias, t));
+                if(t > latest) {
+                    latest = t;
                 }
-                break;
-                case enumKeyVal : {
-                    if(p->mqtt) mqtt_publish("poll", topic, ss.str().c_str());
-                    //if(p->amqp) amqp_publish("poll", topic, ss.str().c_str());
-                    if(p->tcp) tcp_publish("poll", topic, ss.str().c_str());
+            }
+            continue;
+        }
+
+        char value[512] = {0,};
+
+        const UA_DataType* type = val->type;
+
+        switch(type->typeIndex) {
+            case UA_TYPES_BOOLEAN : {
+                json_object_object_add(jobj, d->alias, json_object_new_boolean((*(UA_Boolean*)val->data))); 
+                sprintf(&value[0], "%s", (*(UA_Boolean*)val->data) == true ? "true" : "false");
+            }
+            break;
+            case UA_TYPES_SBYTE : {
+                json_object_object_add(jobj, d->alias, json_object_new_int((*(UA_SByte*)val->data))); 
+                sprintf(&value[0], "%d", (*(UA_SByte*)val->data));
+            }
+            break;
+            case UA_TYPES_BYTE : {
+                json_object_object_add(jobj, d->alias, json_object_new_int((*(UA_Byte*)val->data))); 
+                sprintf(&value[0], "%d", (*(UA_Byte*)val->data));
+            }
+            break;
+            case UA_TYPES_INT16 : {
+                json_object_object_add(jobj, d->alias, json_object_new_int((*(UA_Int16*)val->data))); 
+                sprintf(&value[0], "%d", (*(UA_Int16*)val->data)); 
+            }
+            break;
+            case UA_TYPES_UINT16 : {
+                json_object_object_add(jobj, d->alias, json_object_new_int((*(UA_UInt16*)val->data))); 
+                sprintf(&value[0], "%d", (*(UA_UInt16*)val->data)); 
+            }
+            break;
+            case UA_TYPES_INT32 : {
+                json_object_object_add(jobj, d->alias, json_object_new_int((*(UA_Int32*)val->data))); 
+                sprintf(&value[0], "%d", (*(UA_Int32*)val->data)); 
+            }
+            break;
+            case UA_TYPES_UINT32 : {
+                json_object_object_add(jobj, d->alias, json_object_new_int((*(UA_UInt32*)val->data))); 
+                sprintf(&value[0], "%d", (*(UA_UInt32*)val->data)); 
+            }
+            break;
+            case UA_TYPES_INT64 : {
+                json_object_object_add(jobj, d->alias, json_object_new_int64((*(UA_Int64*)val->data))); 
+                sprintf(&value[0], "%ld", (*(UA_Int64*)val->data)); 
+            }
+            break;
+            case UA_TYPES_UINT64 : {
+                json_object_object_add(jobj, d->alias, json_object_new_int64((*(UA_UInt64*)val->data))); 
+                sprintf(&value[0], "%ld", (*(UA_UInt64*)val->data)); 
+            }
+            break;
+            case UA_TYPES_FLOAT : {
+                json_object_object_add(jobj, d->alias, json_object_new_double((*(UA_Float*)val->data))); 
+                sprintf(&value[0], "%f", (*(UA_Float*)val->data)); 
+            }break;
+            case UA_TYPES_DOUBLE : {
+                json_object_object_add(jobj, d->alias, json_object_new_double((*(UA_Double*)val->data))); 
+                sprintf(&value[0], "%f", (*(UA_Double*)val->data));
+            }
+            break;
+            case UA_TYPES_STRING : {
+                if(0 != (*(UA_String*)val->data).length ) {
+                    sprintf(&value[0], "%s", ((*(UA_String*)val->data).data));
+                    json_object_object_add(jobj, d->alias, json_object_new_string(value));
+                    sprintf(&value[0], "\"%s\"", ((*(UA_String*)val->data).data));
                 }
-                break;
+            }
+            break;
+            default : {
+                printf("not supported dataType : %s, typeIndex:%d\n", val->type->typeName, val->type->typeIndex);
+                continue;
+            }
+        }
 
-                default: {
+        if(ts != enumTsBridge) {
+            int64_t t = datavalue_time(dv, ts, now);
+            if(!jtimes) {
+                jtimes = json_object_new_object();
+            }
+            json_object_object_add(jtimes, d->alias, json_object_new_int64(t));
+            if(t > latest) {
+                latest = t;
+            }
+        }
+
+        if(!kv.empty()) {
+            kv += ", ";
+        }
+        kv += d->alias;
+        kv += "=";
+        kv += value;
+    }
+
+    char topic[256];
+    snprintf(topic, sizeof(topic), "%s/%s/%s", g_config->topicBase, g_config->deviceID, p->topic);
+
+    if(cbor && centries) {
+        cbor_key(&cb, "time");
+        cbor_int(&cb, (ts == enumTsBridge) ? now : latest);
+        if(!ctimes.empty()) {
+            cbor_key(&cb, "times");
+            cbor_map(&cb, ctimes.size());
+            for (size_t k = 0; k < ctimes.size(); k++) {
+                cbor_key(&cb, ctimes[k].first);
+                cbor_int(&cb, ctimes[k].second);
+            }
+        }
+        cbor_end(&cb);
+        sink_publish_buffer(p->sinks, "poll", topic, cb.data, cb.len, true);
+    } else if(cbor) {
+        cbor_free(&cb);
+    }
+
+    if(spb && count) {
+        sparkplug_publish(p, &nodes[0], results, count, ts, now);
+    } else if(delta) {
+        delta_publish(ps, results, now);
+    } else if(batch) {
+        batch_process(ps, results, now);
+    }
+
+    bool bEmpty = true;
+    json_object_object_foreach(jobj, key, val) {
+        bEmpty = false;
+    }
+
+    if(!bEmpty) {
+        int64_t t = (ts == enumTsBridge) ? now : latest;
+        json_object_object_add(jobj, "time", json_object_new_int64(t));
+        if(jtimes) {
+            json_object_object_add(jobj, "times", jtimes);
+            jtimes = NULL;
+        }
+
+        if(!kv.empty()) {
+            kv += ", ";
+        }
+        kv += "time=" + to_string(t);
+
+        const char* contents = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
+        switch(getPayloadFormat(p->format)) {
+            case enumJSON : {
+                sink_publish(p->sinks, "poll", topic, contents, strlen(contents));
+            }
+            break;
+            case enumKeyVal : {
+                sink_publish(p->sinks, "poll", topic, kv.c_str(), kv.size());
+            }
+            break;
+
+            default: {
+            }
+            break;
+        }  
+    }
+
+    if(p->windowUSec > 0 && now >= ps->windowEnd) {
+        /* after a stall publish only the latest closed window */
+        int64_t end = ps->windowEnd + ((now - ps->windowEnd) / p->slideUSec) * p->slideUSec;
+        /* the samples of the windows skipped by the stall are not part of this one */
+        for (size_t r = 0; r < count; r++) {
+            agg_ring_evict(&rings[r], end - p->windowUSec);
+        }
+        aggregate_publish(p, nodes, rings, end);
+
+        /* the next window is (end + slide - window, end + slide] */
+        for (size_t r = 0; r < count; r++) {
+            agg_ring_evict(&rings[r], end + p->slideUSec - p->windowUSec);
+        }
+        ps->windowEnd = end + p->slideUSec;
+    }
+
+    json_object_put(jobj);
+    if(jtimes) {
+        json_object_put(jtimes);
+    }
+
+    pthread_mutex_unlock(&ps->lock);
+}
+
+/* adaptive polling : node r is read every 2^tier[r] ticks of minUSec, the
+ * nodes of one tier form a virtual sub-group and due tiers share one read.
+ * ADAPT_FASTER changes within ADAPT_WINDOW reads move a node one tier faster,
+ * ADAPT_WINDOW reads without a change move it one tier slower. */
+#define ADAPT_WINDOW 8
+#define ADAPT_FASTER 3
+#define ADAPT_REPORT_USEC 10000000
+
+struct AdaptiveState {
+    int maxTier;
+    vector<int> tier;
+    vector<int> reads;
+    vector<int> changes;
+    vector<UA_Variant> last;
+    unsigned long long tick;
+    bool moved;
+    int64_t reported;
+};
+
+static void adaptive_init(AdaptiveState* as, Group* p, size_t count)
+{
+    as->maxTier = 0;
+    while(as->maxTier < 30 && ((int64_t)p->adaptiveMinUSec << (as->maxTier + 1)) <= p->adaptiveMaxUSec) {
+        as->maxTier++;
+    }
+
+    /* every node starts at the tier closest below intervalUSec */
+    int start = 0;
+    while(start < as->maxTier && ((int64_t)p->adaptiveMinUSec << (start + 1)) <= p->intervalUSec) {
+        start++;
+    }
+
+    as->tier.assign(count, start);
+    as->reads.assign(count, 0);
+    as->changes.assign(count, 0);
+    as->last.resize(count);
+    for (size_t r = 0; r < count; r++) {
+        UA_Variant_init(&as->last[r]);
+    }
+    as->tick = 0;
+    as->moved = false;
+    as->reported = 0;
+}
+
+static void adaptive_free(AdaptiveState* as)
+{
+    for (size_t r = 0; r < as->last.size(); r++) {
+        UA_Variant_deleteMembers(&as->last[r]);
+    }
+}
+
+static bool variant_changed(const UA_Variant* a, const UA_Variant* b)
+{
+    if(a->type != b->type || UA_Variant_isScalar(a) != UA_Variant_isScalar(b)) {
+        return true;
+    }
+    if(!UA_Variant_isScalar(a)) {
+        /* arrays of numbers and bools compare as memory, dimensions included */
+        if(!a->type->pointerFree || a->arrayLength != b->arrayLength || a->arrayDimensionsSize != b->arrayDimensionsSize) {
+            return true;
+        }
+        if(a->arrayDimensionsSize && memcmp(a->arrayDimensions, b->arrayDimensions, a->arrayDimensionsSize * sizeof(UA_UInt32))) {
+            return true;
+        }
+        return a->arrayLength && memcmp(a->data, b->data, a->arrayLength * a->type->memSize) != 0;
+    }
+    if(a->type == &UA_TYPES[UA_TYPES_STRING]) {
+        return !UA_String_equal((const UA_String*)a->data, (const UA_String*)b->data);
+    }
+    if(a->type->pointerFree) {
+        return memcmp(a->data, b->data, a->type->memSize) != 0;
+    }
+
+    /* no cheap comparison, never slow such a node down */
+    return true;
+}
+
+static void adaptive_update(AdaptiveState* as, size_t r, const UA_DataValue* dv)
+{
+    if(!dv->hasValue || (dv->hasStatus && dv->status != UA_STATUSCODE_GOOD)) {
+        return;
+    }
+
+    /* the first value has nothing to compare with */
+    if(as->last[r].type) {
+        as->reads[r]++;
+        if(variant_changed(&as->last[r], &dv->value)) {
+            as->changes[r]++;
+        }
+    }
+    UA_Variant_deleteMembers(&as->last[r]);
+    UA_Variant_copy(&dv->value, &as->last[r]);
+
+    int tier = as->tier[r];
+    if(as->changes[r] >= ADAPT_FASTER) {
+        tier = tier > 0 ? tier - 1 : 0;
+    } else if(as->reads[r] >= ADAPT_WINDOW) {
+        tier = as->changes[r] == 0 && tier < as->maxTier ? tier + 1 : tier;
+    } else {
+        return;
+    }
+
+    as->reads[r] = as->changes[r] = 0;
+    if(tier != as->tier[r]) {
+        as->tier[r] = tier;
+        as->moved = true;
+    }
+}
+
+/* "[adaptive] g1 : 10000us x2, 640000us x14", when tiers moved, at most every 10 s */
+static void adaptive_report(AdaptiveState* as, Group* p, int64_t now)
+{
+    if(!as->moved || now - as->reported < ADAPT_REPORT_USEC) {
+        return;
+    }
+
+    ostringstream ss;
+    for (int t = 0; t <= as->maxTier; t++) {
+        size_t n = 0;
+        for (size_t r = 0; r < as->tier.size(); r++) {
+            n += (as->tier[r] == t);
+        }
+        if(n) {
+            ss << (ss.tellp() > 0 ? ", " : "") << ((int64_t)p->adaptiveMinUSec << t) << "us x" << n;
+        }
+    }
+    printf("[adaptive] %s : %s\n", p->name, ss.str().c_str());
+
+    as->moved = false;
+    as->reported = now;
+}
+
+/* auto : the first autoWindowUSec polls every node and counts its changes.
+ * at the end of each window a polled node that changed in at most 1/AUTO_QUIET
+ * of its reads moves to the group subscription, a subscribed node notified in
+ * more than 1/AUTO_BUSY of the sampling intervals comes back to the read. the
+ * gap between both keeps a node with a steady rate from flapping. */
+#define AUTO_QUIET 5
+#define AUTO_BUSY 2
+
+struct AutoState {
+    vector<int> reads;
+    vector<int> changes;
+    vector<UA_Variant> last;
+    int64_t windowStart;
+};
+
+static void auto_init(AutoState* au, size_t count)
+{
+    au->reads.assign(count, 0);
+    au->changes.assign(count, 0);
+    au->last.resize(count);
+    for (size_t r = 0; r < count; r++) {
+        UA_Variant_init(&au->last[r]);
+    }
+    au->windowStart = epoch();
+}
+
+static void auto_free(AutoState* au)
+{
+    for (size_t r = 0; r < au->last.size(); r++) {
+        UA_Variant_deleteMembers(&au->last[r]);
+    }
+}
+
+static void auto_update(AutoState* au, size_t r, const UA_DataValue* dv)
+{
+    if(!dv->hasValue || (dv->hasStatus && dv->status != UA_STATUSCODE_GOOD)) {
+        return;
+    }
+
+    if(au->last[r].type) {
+        au->reads[r]++;
+        if(variant_changed(&au->last[r], &dv->value)) {
+            au->changes[r]++;
+        }
+    }
+    UA_Variant_deleteMembers(&au->last[r]);
+    UA_Variant_copy(&dv->value, &au->last[r]);
+}
+
+/* "[auto] g1 : 3 polled, 12 subscribed", when nodes moved */
+static void auto_evaluate(AutoState* au, PollState* ps, UAMQ_Endpoint* ep, int64_t now)
+{
+    Group* p = ps->group;
+    if(now - au->windowStart < p->autoWindowUSec) {
+        return;
+    }
+
+    int64_t samples = (now - au->windowStart) / p->intervalUSec;
+    size_t subscribed = 0;
+    bool moved = false;
+
+    opcua_client_lock(ep);
+    for (size_t r = 0; r < ps->nodes.size(); r++) {
+        Node* d = ps->nodes[r];
+        unsigned int notified = __sync_fetch_and_and(&d->notified, 0);
+
+        if(!d->monitorId) {
+            if(au->reads[r] > 0 && au->changes[r] * AUTO_QUIET <= au->reads[r] && auto_subscribe(ep, p, d)) {
+                /* compared again from the first read after it comes back */
+                UA_Variant_deleteMembers(&au->last[r]);
+                UA_Variant_init(&au->last[r]);
+                moved = true;
+            }
+        } else if((int64_t)notified * AUTO_BUSY > samples) {
+            auto_unsubscribe(ep, p, d);
+            moved = true;
+        }
+
+        subscribed += (d->monitorId != 0);
+        au->reads[r] = au->changes[r] = 0;
+    }
+    opcua_client_unlock(ep);
+
+    if(moved) {
+        printf("[auto] %s : %d polled, %d subscribed.\n", p->name, (int)(ps->nodes.size() - subscribed), (int)subscribed);
+    }
+    au->windowStart = now;
+}
+
+/* a notification of a subscribed node goes out as a one-node read of its group */
+static void auto_notify(Node* d, UA_DataValue* data, int64_t now)
+{
+    PollState* ps = d->parent->poll;
+
+    __sync_add_and_fetch(&d->notified, 1);
+    if(!ps) {
+        return;
+    }
+
+    vector<UA_DataValue> results(ps->nodes.size());
+    for (size_t r = 0; r < results.size(); r++) {
+        UA_DataValue_init(&results[r]);
+    }
+    results[ps->position[d]] = *data;
+
+    poll_process(ps, &results[0], now);
+}
+
+/* a stop is noticed within 100 ms, a read in flight still completes */
+static void poll_wait(Group* p, int usec)
+{
+    while(usec > 0 && !beStop && !p->stop) {
+        int slice = usec < 100000 ? usec : 100000;
+        usleep(slice);
+        usec -= slice;
+    }
+}
+
+void* opcua_poll_group(void* param)
+{
+    Group* p = (Group*)param;
+    UAMQ_Endpoint* ep = &g_config->endpoints[p->ep];
+    UA_Client* client = ep->client;
+
+    thread_apply(p->priority ? enumThreadPollHigh : enumThreadPoll, (string("poll:") + p->name).c_str());
+
+    /* the reads of a high priority group go through its own session, an auto group keeps its subscription on ep */
+    UAMQ_Endpoint* rs = p->priority ? opcua_priority_session(ep) : ep;
+
+    PollState ps;
+    poll_state_init(&ps, p);
+    p->beat = epoch();
+
+    /* one ReadRequest for the whole group, built once */
+    size_t count = ps.nodes.size();
+
+    UA_ReadRequest request;
+    UA_ReadRequest_init(&request);
+    request.nodesToRead = (UA_ReadValueId*)UA_Array_new(count, &UA_TYPES[UA_TYPES_READVALUEID]);
+    request.nodesToReadSize = count;
+    request.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+
+    for (size_t r = 0; r < count; r++) {
+        UA_NodeId_copy(&ps.nodes[r]->ua, &request.nodesToRead[r].nodeId);
+        request.nodesToRead[r].attributeId = UA_ATTRIBUTEID_VALUE;
+    }
+
+    /* adaptive, auto : each cycle reads only the due nodes, the request borrows their ReadValueIds */
+    bool adaptive = (p->adaptiveMinUSec > 0);
+    bool automatic = (getMonitorMode(p->method) == enumAuto);
+    bool partial = adaptive || automatic;
+    int cycleUSec = adaptive ? p->adaptiveMinUSec : p->intervalUSec;
+    AdaptiveState as;
+    AutoState au;
+    vector<size_t> due;
+    vector<Node*> dueNodes;
+    vector<UA_ReadValueId> dueIds;
+    vector<UA_DataValue> results;
+    if(adaptive) {
+        adaptive_init(&as, p, count);
+    }
+    if(automatic) {
+        auto_init(&au, count);
+        p->poll = &ps;
+    }
+    if(partial) {
+        results.resize(count);
+    }
+
+    do {
+        UA_ReadRequest cycle = request;
+
+        if(partial) {
+            due.clear();
+            dueNodes.clear();
+            dueIds.clear();
+            for (size_t r = 0; r < count; r++) {
+                if((!adaptive || as.tick % (1ULL << as.tier[r]) == 0) && !ps.nodes[r]->monitorId) {
+                    due.push_back(r);
+                    dueNodes.push_back(ps.nodes[r]);
+                    dueIds.push_back(request.nodesToRead[r]);
                 }
-                break;
-            }  
+            }
+            if(adaptive) {
+                as.tick++;
+            }
+            if(automatic) {
+                auto_evaluate(&au, &ps, ep, epoch());
+            }
+
+            if(due.empty()) {
+                p->beat = epoch();
+                poll_wait(p, cycleUSec);
+                continue;
+            }
+            cycle.nodesToRead = &dueIds[0];
+            cycle.nodesToReadSize = dueIds.size();
+        }
+
+        unsigned int generation = opcua_session_generation(rs);
+
+        opcua_client_lock(rs);
+        UA_ReadResponse response = UA_Client_Service_read(rs->client, cycle);
+        opcua_client_unlock(rs);
+
+        if(response.responseHeader.serviceResult != UA_STATUSCODE_GOOD || response.resultsSize != cycle.nodesToReadSize) {
+            UA_ReadResponse_deleteMembers(&response);
+            printf("read failed.\n");
+
+            /* pause until the session is back, one thread reconnects for all groups */
+            opcua_session_recover(rs, generation);
+            p->beat = epoch();
+            poll_wait(p, cycleUSec);
+            continue;
         }
 
-        json_object_put(jobj);
-        for ( size_t i = 0; i < kvs.size(); i++)
-        {
-            delete kvs[i];
+        int64_t now = epoch();
+        p->beat = now;
+
+        if(partial) {
+            /* results of the group in node order, the nodes not read stay empty (borrowed, not freed) */
+            for (size_t r = 0; r < count; r++) {
+                UA_DataValue_init(&results[r]);
+            }
+            for (size_t k = 0; k < due.size(); k++) {
+                results[due[k]] = response.results[k];
+            }
+
+            record_batch(&dueNodes[0], response.results, due.size(), now);
+            poll_process(&ps, &results[0], now);
+
+            for (size_t k = 0; k < due.size(); k++) {
+                if(adaptive) {
+                    adaptive_update(&as, due[k], &response.results[k]);
+                }
+                if(automatic) {
+                    auto_update(&au, due[k], &response.results[k]);
+                }
+            }
+            if(adaptive) {
+                adaptive_report(&as, p, now);
+            }
+        } else {
+            record_batch(&ps.nodes[0], response.results, count, now);
+            poll_process(&ps, response.results, now);
         }
-        vector<char*>().swap(kvs);
 
-        usleep(p->intervalUSec);
+        UA_ReadResponse_deleteMembers(&response);
+
+        poll_wait(p, cycleUSec);
 
-    } while (!beStop);
+    } while (!beStop && !p->stop);
+
+    if(automatic) {
+        /* no notification may reach ps once it is gone */
+        opcua_client_lock(ep);
+        if(p->subscription) {
+            UA_Client_Subscriptions_remove(client, p->subscription);
+            p->subscription = 0;
+        }
+        p->poll = NULL;
+        opcua_client_unlock(ep);
+        auto_free(&au);
+    }
+
+    UA_ReadRequest_deleteMembers(&request);
+    poll_state_free(&ps);
+    if(adaptive) {
+        adaptive_free(&as);
+    }
 
     return NULL;
 
 }
 
+/* replayed reads, one PollState per group for the whole replay */
+static map<Group*, PollState> replayStates;
+
+void poll_replay(Group* p, UA_DataValue* results, int64_t now)
+{
+    map<Group*, PollState>::iterator it = replayStates.find(p);
+    if(it == replayStates.end()) {
+        it = replayStates.insert(pair<Group*, PollState>(p, PollState())).first;
+        poll_state_init(&it->second, p);
+    }
+
+    poll_process(&it->second, results, now);
+}
+
+void poll_replay_end(void)
+{
+    map<Group*, PollState>::iterator it;
+    for (it = replayStates.begin(); it != replayStates.end(); ++it) {
+        poll_state_free(&it->second);
+    }
+    replayStates.clear();
+}
+
+/* joined on shutdown, before the sinks drain, or by a reload of the group */
+static map<Group*, pthread_t> pollThreads;
+static pthread_mutex_t pollThreadsLock = PTHREAD_MUTEX_INITIALIZER;
+static volatile bool pollStarted = false;
+
+/* auto groups run in every mode, they read and subscribe by themselves */
+static bool poll_runs(Group* p)
+{
+    enumMonitorMode mode = getMonitorMode(p->method);
+    if(mode == enumAuto) {
+        return true;
+    }
+
+    return mode == enumPoll && !(!g_config->asycRequestSupported && (getMonitorMode(g_config->method) == enumEvent));
+}
+
 void* opcua_poll(void* param)
 {
     if(!g_config->asycRequestSupported && (getMonitorMode(g_config->method) == enumEvent)) {
         cout << "\n[POLL MODE] DISCARDED.\n";
-        return NULL;
     }
 
-    UA_Client* client = (UA_Client*)param;
-
     printf("\n[POLL MODE]\n");
     map<int, Group>::iterator i;
 	for (i = gmap->begin(); i != gmap->end(); ++i) {
 		Group* p = (Group*)&i->second;
 
-        if(getMonitorMode(p->method) == enumPoll) {
-            cout << "\t[" << i->first << "] name: \"" << p->name << "\", enable: " << p->enable << ", method: " << p->method << ", interval(us): " << p->intervalUSec << ", mqtt: " << p->mqtt << ", tcp: " << p->tcp << "\n";
+        if(poll_runs(p)) {
+            cout << "\t[" << i->first << "] name: \"" << p->name << "\", enable: " << p->enable << ", endpoint: " << g_config->endpoints[p->ep].name << ", method: " << p->method << ", interval(us): " << p->intervalUSec << ", mqtt: " << p->mqtt << ", tcp: " << p->tcp << "\n";
             if(!p->enable) {
                 continue;
             }
@@ -423,8 +1485,6 @@ void* opcua_poll(void* param)
                 Node* d = (Node*)&n->second;
                 d->parent = p;
 
-                cout << "\t\t[" << n->first << "] id: " << d->id << ", topic: " <<  d->topic << ", alias: " << d->alias << "\n";
-
                 UA_NodeIdType type = getUA_NodeID(d->id, &d->ua);
             }
         }
@@ -433,16 +1493,62 @@ void* opcua_poll(void* param)
     for (i = gmap->begin(); i != gmap->end(); ++i) {
         Group* p = (Group*)&i->second;
 
-        if(getMonitorMode(p->method) == enumPoll) {
-            if(!p->enable) {
-                continue;
-            }
-
-            pthread_t tid = 0;
-            void* s = NULL;
-            int th = pthread_create(&tid, NULL, opcua_poll_group, (void*)p);               
+        if(p->enable) {
+            opcua_poll_start(p);
         }
     }
 
+    pollStarted = true;
+
     return NULL;
-}
\ No newline at end of file
+}
+
+/* a reload waits for the groups of the file to be running */
+bool opcua_poll_started(void)
+{
+    return pollStarted;
+}
+
+/* nodes prepared by the caller, nothing happens for a group read by no thread */
+void opcua_poll_start(Group* p)
+{
+    if(!poll_runs(p)) {
+        return;
+    }
+
+    p->stop = false;
+    pthread_t tid = 0;
+    if(pthread_create(&tid, NULL, opcua_poll_group, (void*)p) == 0) {
+        pthread_mutex_lock(&pollThreadsLock);
+        pollThreads[p] = tid;
+        pthread_mutex_unlock(&pollThreadsLock);
+    }
+}
+
+/* the read in flight completes, an auto group drops its subscription */
+void opcua_poll_stop(Group* p)
+{
+    pthread_mutex_lock(&pollThreadsLock);
+    map<Group*, pthread_t>::iterator t = pollThreads.find(p);
+    if(t == pollThreads.end()) {
+        pthread_mutex_unlock(&pollThreadsLock);
+        return;
+    }
+    pthread_t tid = t->second;
+    pollThreads.erase(t);
+    pthread_mutex_unlock(&pollThreadsLock);
+
+    p->stop = true;
+    pthread_join(tid, NULL);
+}
+
+void opcua_poll_join(void)
+{
+    pthread_mutex_lock(&pollThreadsLock);
+    map<Group*, pthread_t>::iterator t;
+    for (t = pollThreads.begin(); t != pollThreads.end(); ++t) {
+        pthread_join(t->second, NULL);
+    }
+    pollThreads.clear();
+    pthread_mutex_unlock(&pollThreadsLock);
+}
@@ -19,12 +19,49 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "MQTTPacket.h"
 #include "transport.h"
 #include "client-config.h"
+#include "client-sink.h"
+#include "client-sparkplug.h"
 
 static int sock = 0;
+static volatile bool connected = false;
+
+/* set after the sinks drained : the connection outlives beStop until then */
+static volatile bool stopping = false;
+
+/* publishers, acks and the keep alive share the socket */
+static pthread_mutex_t sendLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* sparkplug : a seq goes on the wire in the order it was given, an NBIRTH
+ * (seq 0) never passes a device message numbered before it */
+static pthread_mutex_t seqLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the Will of the connection, also published on a clean stop */
+static const char* deathTopic = NULL;
+static const char* deathPayload = NULL;
+static int deathLen = 0;
+
+void write_command(const char* topic, int topiclen, const char* payload, int payloadlen);
+
+static int mqtt_send(unsigned char* buf, int len)
+{
+	if(len <= 0) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&sendLock);
+	int rc = transport_sendPacketBuffer(sock, buf, len);
+	pthread_mutex_unlock(&sendLock);
+
+	return rc;
+}
 
 extern int beStop;
 extern UAMQ_Configuration* g_config;
@@ -34,7 +71,7 @@ int mqtt_connect(int argc, char *argv[])
 	int rc = 0;
 	int len = 0;
 
-	unsigned char buf[128];
+	unsigned char buf[512];
 	int buflen = sizeof(buf);
 
 	char* host = g_config->mqttBrockerIP;
@@ -46,15 +83,35 @@ int mqtt_connect(int argc, char *argv[])
 		return sock;
 	} else {
 		printf("open mqtt trasport (hostname '%s' port %d) ==> ok.\n", host, port);
+		sink_socket(sock);
+	}
+
+	/* shards share the broker, each one needs its own client id */
+	static char clientID[32] = "public";
+	if(g_config->shardCount > 1) {
+		snprintf(clientID, sizeof(clientID), "public-%d", g_config->shardIndex);
 	}
 
 	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
-	data.clientID.cstring = "public";
+	data.clientID.cstring = clientID;
 	data.keepAliveInterval = 20;
 	data.cleansession = 1;
 	data.username.cstring = "";
 	data.password.cstring = "";
 
+	if(g_config->sparkplug) {
+		sparkplug_death(&deathTopic, &deathPayload, &deathLen);
+		data.willFlag = 1;
+		data.will.qos = 1;
+		data.will.retained = 0;
+#pragma GCC diagnostic push  // require GCC 4.6
+#pragma GCC diagnostic ignored "-Wcast-qual"
+		data.will.topicName.cstring = (char*)deathTopic;
+		data.will.message.lenstring.data = (char*)deathPayload;
+#pragma GCC diagnostic pop 
+		data.will.message.lenstring.len = deathLen;
+	}
+
 	len = MQTTSerialize_connect(buf, buflen, &data);
 	rc = transport_sendPacketBuffer(sock, buf, len);
 
@@ -78,26 +135,221 @@ int mqtt_connect(int argc, char *argv[])
 	return 0;
 }
 
-int mqtt_publish(const char* mode, char* topic, const char* value) 
+int mqtt_publish(const SinkMessage* msg) 
 {
-	printf("[mqtt] publish (%s) %s\t%s \n", mode, topic, value);
-	
+	if(!connected) {
+		return -1;
+	}
+
 	MQTTString topicString = MQTTString_initializer;
 	
-	unsigned char buf[200] = {0, };
-	int buflen = sizeof(buf);
+	/* fixed header, topic length and the remaining length bytes fit in 16 */
+	int buflen = (int)(strlen(msg->topic) + msg->len + 16);
+	unsigned char* buf = (unsigned char*)malloc(buflen);
 	int len = 0;
 
-	topicString.cstring = topic;
+	topicString.cstring = msg->topic;
 #pragma GCC diagnostic push  // require GCC 4.6
 #pragma GCC diagnostic ignored "-Wcast-qual"
-	len = MQTTSerialize_publish(buf, buflen, 0, 0, 0, 0, topicString, (unsigned char*)value, strlen(value));
+	len = MQTTSerialize_publish(buf, buflen, 0, 0, 0, 0, topicString, (unsigned char*)msg->data, (int)msg->len);
 #pragma GCC diagnostic pop 
-	int rc = transport_sendPacketBuffer(sock, buf, len);
+
+	/* the seq goes into the packet, the message may be shared with other sinks */
+	bool spb = g_config->sparkplug && !strncmp(msg->topic, "spBv1.0/", 8);
+	if(spb) {
+		pthread_mutex_lock(&seqLock);
+		if(!sparkplug_sequence(msg, buf + len - msg->len)) {
+			pthread_mutex_unlock(&seqLock);
+			free(buf);
+			printf("[mqtt] drop (%s) %s\t: the device is born again first\n", msg->mode, msg->topic);
+			return 0;
+		}
+	}
+
+	if(msg->binary) {
+		printf("[mqtt] publish (%s) %s\t(%d bytes) \n", msg->mode, msg->topic, (int)msg->len);
+	} else {
+		printf("[mqtt] publish (%s) %s\t%s \n", msg->mode, msg->topic, msg->data);
+	}
+
+	int rc = mqtt_send(buf, len);
+	if(spb) {
+		pthread_mutex_unlock(&seqLock);
+	}
+	free(buf);
 
 	return rc;
 }
 
+/* QoS 1, commands must not get lost */
+static int mqtt_subscribe(const char* filter, unsigned short msgid)
+{
+	MQTTString topicString = MQTTString_initializer;
+#pragma GCC diagnostic push  // require GCC 4.6
+#pragma GCC diagnostic ignored "-Wcast-qual"
+	topicString.cstring = (char*)filter;
+#pragma GCC diagnostic pop 
+	int qos = 1;
+
+	unsigned char buf[256];
+	int len = MQTTSerialize_subscribe(buf, sizeof(buf), 0, msgid, 1, &topicString, &qos);
+
+	printf("[mqtt] subscribe %s\n", filter);
+	return mqtt_send(buf, len);
+}
+
+/* sparkplug : NBIRTH of the connection, or of a rebirth request */
+static int mqtt_node_birth(void)
+{
+	char topic[192];
+	size_t plen = 0;
+
+	pthread_mutex_lock(&seqLock);
+	char* payload = sparkplug_node_birth(topic, sizeof(topic), &plen);
+
+	MQTTString topicString = MQTTString_initializer;
+	topicString.cstring = topic;
+	int buflen = (int)(strlen(topic) + plen + 16);
+	unsigned char* buf = (unsigned char*)malloc(buflen);
+	int len = MQTTSerialize_publish(buf, buflen, 0, 0, 0, 0, topicString, (unsigned char*)payload, (int)plen);
+	int rc = mqtt_send(buf, len);
+	pthread_mutex_unlock(&seqLock);
+
+	printf("[mqtt] publish (NBIRTH) %s\t(%d bytes) \n", topic, (int)plen);
+	free(buf);
+	free(payload);
+
+	return rc;
+}
+
+/* a new connection : subscriptions, then the NBIRTH before any device message */
+static void mqtt_session(void)
+{
+	if(g_config->commandTopic[0]) {
+		/* '<topicBase>/<deviceID>/<commandTopic>/#' */
+		static char filter[192] = {0,};
+		snprintf(filter, sizeof(filter), "%s/%s/%s/#", g_config->topicBase, g_config->deviceID, g_config->commandTopic);
+		mqtt_subscribe(filter, 1);
+	}
+
+	if(g_config->sparkplug) {
+		mqtt_subscribe(sparkplug_command_topic(), 2);
+		mqtt_node_birth();
+	}
+}
+
+/* a packet larger than this is read and dropped, the connection stays */
+#define MQTT_PACKET_MAX (1024 * 1024)
+
+/* all 'count' bytes, recv may return less */
+static int mqtt_read(unsigned char* buf, int count)
+{
+	int got = 0;
+	while(got < count) {
+		int rc = transport_getdata(buf + got, count - got);
+		if(rc <= 0) {
+			return -1;
+		}
+		got += rc;
+	}
+	return got;
+}
+
+/* one packet from the broker, returns -1 when the connection is gone.
+ * the buffer is sized from the remaining length of the fixed header */
+static int mqtt_receive(void)
+{
+	unsigned char head[5];
+	int n = 0;
+	int remaining = 0;
+	int multiplier = 1;
+
+	if(mqtt_read(head, 1) < 0) {
+		return -1;
+	}
+	n = 1;
+	do {
+		if(n == (int)sizeof(head) || mqtt_read(head + n, 1) < 0) {
+			return -1;
+		}
+		remaining += (head[n] & 127) * multiplier;
+		multiplier *= 128;
+	} while(head[n++] & 128);
+
+	if(remaining > MQTT_PACKET_MAX) {
+		printf("[mqtt] drop a packet of %d bytes, more than %d\n", remaining, MQTT_PACKET_MAX);
+		unsigned char skip[4096];
+		while(remaining > 0) {
+			int k = remaining < (int)sizeof(skip) ? remaining : (int)sizeof(skip);
+			if(mqtt_read(skip, k) < 0) {
+				return -1;
+			}
+			remaining -= k;
+		}
+		return 0;
+	}
+
+	int buflen = n + remaining;
+	unsigned char* buf = (unsigned char*)malloc(buflen);
+	memcpy(buf, head, n);
+	if(remaining && mqtt_read(buf + n, remaining) < 0) {
+		free(buf);
+		return -1;
+	}
+
+	MQTTHeader header;
+	header.byte = buf[0];
+	int type = header.bits.type;
+	switch(type) {
+		case PUBLISH : {
+			unsigned char dup;
+			int qos;
+			unsigned char retained;
+			unsigned short msgid;
+			int payloadlen_in;
+			unsigned char* payload_in;
+			MQTTString receivedTopic;
+
+			if(MQTTDeserialize_publish(&dup, &qos, &retained, &msgid, &receivedTopic, &payload_in, &payloadlen_in, buf, buflen) != 1) {
+				break;
+			}
+
+			if(g_config->sparkplug && receivedTopic.lenstring.len > 8 && !strncmp(receivedTopic.lenstring.data, "spBv1.0/", 8)) {
+				printf("[mqtt] command %.*s\t(%d bytes)\n", receivedTopic.lenstring.len, receivedTopic.lenstring.data, payloadlen_in);
+				if(sparkplug_command(payload_in, payloadlen_in)) {
+					mqtt_node_birth();
+				}
+			} else {
+				printf("[mqtt] command %.*s\t%.*s\n", receivedTopic.lenstring.len, receivedTopic.lenstring.data, payloadlen_in, payload_in);
+				write_command(receivedTopic.lenstring.data, receivedTopic.lenstring.len, (char*)payload_in, payloadlen_in);
+			}
+
+			if(qos == 1) {
+				unsigned char ack[8];
+				mqtt_send(ack, MQTTSerialize_puback(ack, sizeof(ack), msgid));
+			}
+		}
+		break;
+		case SUBACK : {
+			unsigned short msgid;
+			int count = 0;
+			int granted = 0;
+			MQTTDeserialize_suback(&msgid, 1, &count, &granted, buf, buflen);
+			printf("[mqtt] subscribed, granted qos %d\n", granted);
+		}
+		break;
+		case PINGRESP : {
+		}
+		break;
+		default : {
+		}
+		break;
+	}
+	free(buf);
+
+	return 0;
+}
+
 int mqtt_main(int argc, char *argv[])
 {
 	int rc = 0;
@@ -109,50 +361,61 @@ int mqtt_main(int argc, char *argv[])
 	do {
 		rc = mqtt_connect(argc, argv);
 	} while(!beStop && rc < 0 );
+	if(rc == 0) {
+		mqtt_session();
+	}
+	connected = (rc == 0);
 
-
-	MQTTString topicString = MQTTString_initializer;
 	unsigned char buf[256];
 	int buflen = sizeof(buf);
-	
-	char* payload = "hello";
-	int payloadlen = strlen(payload);
 	int len = 0;
 
-	topicString.cstring = "sensor";
-	while (!beStop)
-	{
-		#if 0
-		printf("1\n");
-		if (MQTTPacket_read(buf, buflen, transport_getdata) == PUBLISH)
-		{
-			printf("2\n");
-			unsigned char dup;
-			int qos;
-			unsigned char retained;
-			unsigned short msgid;
-			int payloadlen_in;
-			unsigned char* payload_in;
-			int rc;
-			MQTTString receivedTopic;
-
-			printf("3\n");
+	time_t lastPing = time(NULL);
 
-			rc = MQTTDeserialize_publish(&dup, &qos, &retained, &msgid, &receivedTopic, &payload_in, &payloadlen_in, buf, buflen);
-			printf("message arrived %.*s\n", payloadlen_in, payload_in);
-			usleep(500000);
+	/* the socket is watched with or without commands : a broken connection
+	 * (or one the watchdog aborted) is connected again here */
+	while (!stopping)
+	{
+		struct pollfd pfd = { sock, POLLIN, 0 };
+		if(poll(&pfd, 1, 1000) > 0 && mqtt_receive() < 0) {
+			printf("mqtt brocker connection lost, reconnect.\n");
+			connected = false;
+			transport_close(sock);
+			do {
+				sleep(1);
+				rc = mqtt_connect(argc, argv);
+			} while(!stopping && rc < 0);
+			if(rc == 0) {
+				mqtt_session();
+			}
+			connected = (rc == 0);
+			lastPing = time(NULL);
+			continue;
 		}
-		#endif
-		sleep(3);
 
-		// printf("publish: %s --> %s\n", topicString.cstring, payload);
-		// len = MQTTSerialize_publish(buf, buflen, 0, 0, 0, 0, topicString, (unsigned char*)payload, payloadlen);
-		// rc = transport_sendPacketBuffer(sock, buf, len);
+		/* keepAliveInterval is 20s, the bridge may have nothing to publish */
+		if(time(NULL) - lastPing >= 10) {
+			len = MQTTSerialize_pingreq(buf, buflen);
+			mqtt_send(buf, len);
+			lastPing = time(NULL);
+		}
 	}
 
 	printf("disconnecting\n");
+	if(g_config->sparkplug && connected) {
+		/* the broker drops the Will on DISCONNECT */
+		MQTTString topicString = MQTTString_initializer;
+#pragma GCC diagnostic push  // require GCC 4.6
+#pragma GCC diagnostic ignored "-Wcast-qual"
+		topicString.cstring = (char*)deathTopic;
+		len = MQTTSerialize_publish(buf, buflen, 0, 0, 0, 0, topicString, (unsigned char*)deathPayload, deathLen);
+#pragma GCC diagnostic pop 
+		mqtt_send(buf, len);
+		printf("[mqtt] publish (NDEATH) %s\t(%d bytes) \n", deathTopic, deathLen);
+	}
 	len = MQTTSerialize_disconnect(buf, buflen);
-	rc = transport_sendPacketBuffer(sock, buf, len);
+	rc = mqtt_send(buf, len);
+	connected = false;
 
 exit:
 	transport_close(sock);
@@ -164,3 +427,47 @@ void* mqtt_run(void* param)
 {
 	return (void*)mqtt_main(0, 0);
 }
+
+/* the sinks are drained : send DISCONNECT and end mqtt_run */
+void mqtt_stop(void)
+{
+	stopping = true;
+}
+
+/* sink plugin : the connection belongs to mqtt_main, the sink only publishes on it */
+static bool mqtt_sink_enabled(void)
+{
+	return g_config->mqttEnable;
+}
+
+static int mqtt_sink_open(void)
+{
+	return connected ? 0 : -1;
+}
+
+static int mqtt_sink_send(const SinkMessage* msg)
+{
+	return mqtt_publish(msg);
+}
+
+static void mqtt_sink_close(void)
+{
+}
+
+/* mqtt_main sees the connection drop and connects again */
+static void mqtt_sink_abort(void)
+{
+	if(connected) {
+		shutdown(sock, SHUT_RDWR);
+	}
+}
+
+const SinkOps mqttSink = {
+	"mqtt",
+	mqtt_sink_enabled,
+	mqtt_sink_open,
+	mqtt_sink_send,
+	NULL,
+	mqtt_sink_close,
+	mqtt_sink_abort
+};
@@ -23,12 +23,21 @@ extern "C" {
 #include <map>
 
 struct Group;
+struct PollState;
 
 typedef struct Node {
 	char* id;
 	char* topic;
 	char* alias;
 	UA_NodeId ua;
+	bool writable;
+	int cache;	/* last-value cache slot, -1 when the cache is off */
+	int index;	/* position among the nodes of the enabled groups, see client-record.cpp */
+	int store;	/* id in the local store, -1 before its first stored sample */
+	UA_UInt32 monitorId;	/* monitored item of an event node, of an auto node while subscribed */
+	unsigned int notified;	/* auto groups : notifications since the last evaluation */
+	int spbType;	/* sparkplug : datatype of the last DBIRTH, 0 before */
+	uint64_t spbAlias;
 	Group* parent;
 } Node;
 
@@ -37,17 +46,47 @@ typedef struct Group {
 	char* method;
 	char* topic;
 	char* format;
+	char* timestamp;
 	int intervalUSec;
 	bool mqtt;
 	bool amqp;
 	bool tcp;
+	unsigned int sinks;	/* bit i : sink plugin i, see client-sink.h */
+	bool store;	/* samples to the local store, see client-store.h */
+	bool priority;	/* "priority": "high" : poll-high thread, own read session and the high sink lane */
 	bool enable;
+	char* endpoint;
+	int ep;
+	/* windowUSec > 0 : publish UAMQ_AGG_* of every window instead of raw samples */
+	int windowUSec;
+	int slideUSec;
+	unsigned int aggregates;
+	/* adaptiveMinUSec > 0 : every node is read at its own interval, min * 2^k up to max */
+	int adaptiveMinUSec;
+	int adaptiveMaxUSec;
+	/* method "auto" : every autoWindowUSec each node moves to a subscription or back to the read */
+	int autoWindowUSec;
+	/* format "delta" : a keyframe after deltaEvery - 1 deltas or deltaKeyUSec, whichever comes first */
+	int deltaEvery;
+	int deltaKeyUSec;
+	/* format "gorilla" : the samples of batchUSec in one frame per group, or per node */
+	int batchUSec;
+	bool batchPerNode;
+	UA_UInt32 subscription;	/* created with the first subscribed node */
+	struct PollState* poll;	/* shared by the poll thread and the notifications */
+	volatile int64_t beat;	/* poll thread : unix us of the last good read, 0 until it runs */
+	volatile bool stop;	/* poll thread : leave, the group was reloaded */
+	uint64_t spec;	/* hash of the node-map entry without its sinks, see client-reload.cpp */
 	map<int, Node> nodes;
 } Group;
 
+/* frees the strings of a parsed group and its nodes, one never handed to a thread */
+void group_free(Group* g);
+
 enum enumMonitorMode { 
 	enumEvent, 
-	enumPoll
+	enumPoll,
+	enumAuto	/* polled or subscribed per node, by change rate */
 };
 
 enumMonitorMode getMonitorMode(char*);
@@ -55,11 +94,27 @@ enumMonitorMode getMonitorMode(char*);
 
 enum enumPayloadFormat { 
 	enumJSON,
-	enumKeyVal
+	enumKeyVal,
+	enumCBOR,	/* binary, typed values, see client-cbor.h */
+	enumSparkplug,	/* Sparkplug B device on the mqtt sink, see client-sparkplug.h */
+	enumDelta,	/* cbor keyframes and changed fields by position, see client-delta.h */
+	enumGorilla	/* batches of compressed samples, see client-gorilla.h */
 };
 
 enumPayloadFormat getPayloadFormat(char*);
 
+
+enum enumTimestampSource {
+	enumTsBridge,
+	enumTsSource,
+	enumTsServer
+};
+
+enumTimestampSource getTimestampSource(char*);
+
+/* unix us of the selected timestamp of dv, now when the server did not return it */
+int64_t datavalue_time(const UA_DataValue* dv, enumTimestampSource ts, int64_t now);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,370 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_client.h"
+# include "ua_client_highlevel.h"
+# include "ua_nodeids.h"
+# include "ua_network_tcp.h"
+# include "ua_config_standard.h"
+#else
+# include "open62541.h"
+# include <string.h>
+# include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+using namespace std;
+
+#include "client-common.h"
+#include "client-nodemap.h"
+#include "client-record.h"
+
+extern int beStop;
+
+extern map<int, Group>* gmap;
+extern UAMQ_Configuration* g_config;
+
+int64_t epoch(void);
+
+/* log layout, host byte order :
+ * header  "UAMQREC" 1, u32 node count, per node u16 length + '<group topic>/<node topic>'
+ * sample  u32 node index, u8 flags, u16 type (UA_TYPES_*), i64 bridge time (unix us),
+ *         [i64 source (UA_DateTime)], [i64 server (UA_DateTime)], [u32 status],
+ *         [u16 length + raw value bytes]
+ * the samples of one poll read are written together, all but the last with RECORD_MORE. */
+#define RECORD_MAGIC   "UAMQREC\1"
+#define RECORD_MORE    0x01
+#define RECORD_SOURCE  0x02
+#define RECORD_SERVER  0x04
+#define RECORD_STATUS  0x08
+#define RECORD_VALUE   0x10
+
+/* nodes of the enabled groups by index, the same order for --record and --replay */
+static vector<Node*> nodes;
+static vector<size_t> positions;	/* index of the node inside its group */
+static vector<string> paths;
+
+static FILE* recordFile = NULL;
+static volatile bool recording = false;
+static pthread_mutex_t recordLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void record_index(void)
+{
+	map<int, Group>::iterator i;
+	for (i = gmap->begin(); i != gmap->end(); ++i) {
+		Group* p = (Group*)&i->second;
+
+		if(!p->enable) {
+			continue;
+		}
+
+		size_t position = 0;
+		map<int, Node>::iterator n;
+		for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
+			Node* d = (Node*)&n->second;
+			d->parent = p;
+			d->index = (int)nodes.size();
+
+			nodes.push_back(d);
+			positions.push_back(position++);
+			paths.push_back(string(p->topic) + "/" + d->topic);
+		}
+	}
+}
+
+int record_open(void)
+{
+	record_index();
+
+	recordFile = fopen(g_config->recordFile, "wb");
+	if(!recordFile) {
+		printf("[error] can't create record file %s.\n", g_config->recordFile);
+		return -1;
+	}
+	setvbuf(recordFile, NULL, _IOFBF, 1 << 20);
+
+	uint32_t count = (uint32_t)nodes.size();
+	fwrite(RECORD_MAGIC, 1, 8, recordFile);
+	fwrite(&count, sizeof(count), 1, recordFile);
+	for (size_t k = 0; k < paths.size(); k++) {
+		uint16_t len = (uint16_t)paths[k].size();
+		fwrite(&len, sizeof(len), 1, recordFile);
+		fwrite(paths[k].data(), 1, len, recordFile);
+	}
+
+	printf("[record] %u nodes to %s\n", count, g_config->recordFile);
+	recording = true;
+
+	return 0;
+}
+
+void record_close(void)
+{
+	pthread_mutex_lock(&recordLock);
+	recording = false;
+	if(recordFile) {
+		fclose(recordFile);
+		recordFile = NULL;
+	}
+	pthread_mutex_unlock(&recordLock);
+}
+
+template <typename T> static void put(string& out, T v)
+{
+	out.append((const char*)&v, sizeof(v));
+}
+
+static void encode(string& out, const Node* d, const UA_DataValue* dv, int64_t now, bool more)
+{
+	const UA_Variant* val = &dv->value;
+	/* strings and the scalars without pointers (numbers, DateTime, Guid, ..) are kept */
+	bool value = dv->hasValue && val->type && UA_Variant_isScalar(val) && val->type == &UA_TYPES[val->type->typeIndex] &&
+		(val->type->pointerFree || val->type->typeIndex == UA_TYPES_STRING);
+
+	uint8_t flags = (more ? RECORD_MORE : 0) | (dv->hasSourceTimestamp ? RECORD_SOURCE : 0) |
+		(dv->hasServerTimestamp ? RECORD_SERVER : 0) | (dv->hasStatus ? RECORD_STATUS : 0) | (value ? RECORD_VALUE : 0);
+
+	put<uint32_t>(out, (uint32_t)d->index);
+	put<uint8_t>(out, flags);
+	put<uint16_t>(out, value ? val->type->typeIndex : 0);
+	put<int64_t>(out, now);
+	if(flags & RECORD_SOURCE) {
+		put<int64_t>(out, dv->sourceTimestamp);
+	}
+	if(flags & RECORD_SERVER) {
+		put<int64_t>(out, dv->serverTimestamp);
+	}
+	if(flags & RECORD_STATUS) {
+		put<uint32_t>(out, dv->status);
+	}
+	if(value) {
+		if(val->type->typeIndex == UA_TYPES_STRING) {
+			const UA_String* str = (const UA_String*)val->data;
+			uint16_t len = str->length < 0xffff ? (uint16_t)str->length : 0xffff;
+			put<uint16_t>(out, len);
+			out.append((const char*)str->data, len);
+		} else {
+			put<uint16_t>(out, (uint16_t)val->type->memSize);
+			out.append((const char*)val->data, val->type->memSize);
+		}
+	}
+}
+
+static void record_write(const string& out)
+{
+	pthread_mutex_lock(&recordLock);
+	if(recordFile) {
+		fwrite(out.data(), 1, out.size(), recordFile);
+	}
+	pthread_mutex_unlock(&recordLock);
+}
+
+void record_batch(Node* const* batch, const UA_DataValue* results, size_t count, int64_t now)
+{
+	if(!recording || !count) {
+		return;
+	}
+
+	string out;
+	for (size_t r = 0; r < count; r++) {
+		encode(out, batch[r], &results[r], now, r + 1 < count);
+	}
+	record_write(out);
+}
+
+void record_sample(Node* d, const UA_DataValue* dv, int64_t now)
+{
+	if(!recording) {
+		return;
+	}
+
+	string out;
+	encode(out, d, dv, now, false);
+	record_write(out);
+}
+
+template <typename T> static bool get(FILE* f, T* v)
+{
+	return fread(v, sizeof(T), 1, f) == 1;
+}
+
+/* one sample of the log, false at the end (or a truncated tail) */
+static bool decode(FILE* f, uint32_t* index, uint8_t* flags, int64_t* time, UA_DataValue* dv)
+{
+	uint16_t type = 0;
+
+	UA_DataValue_init(dv);
+	if(!get(f, index) || !get(f, flags) || !get(f, &type) || !get(f, time)) {
+		return false;
+	}
+	if((*flags & RECORD_SOURCE) && !get(f, &dv->sourceTimestamp)) {
+		return false;
+	}
+	if((*flags & RECORD_SERVER) && !get(f, &dv->serverTimestamp)) {
+		return false;
+	}
+	if((*flags & RECORD_STATUS) && !get(f, &dv->status)) {
+		return false;
+	}
+	dv->hasSourceTimestamp = (*flags & RECORD_SOURCE) != 0;
+	dv->hasServerTimestamp = (*flags & RECORD_SERVER) != 0;
+	dv->hasStatus = (*flags & RECORD_STATUS) != 0;
+
+	if(*flags & RECORD_VALUE) {
+		uint16_t len = 0;
+		char bytes[0xffff];
+		if(!get(f, &len) || fread(bytes, 1, len, f) != len || type >= UA_TYPES_COUNT) {
+			return false;
+		}
+
+		if(type == UA_TYPES_STRING) {
+			UA_String str;
+			str.length = len;
+			str.data = (UA_Byte*)bytes;
+			UA_Variant_setScalarCopy(&dv->value, &str, &UA_TYPES[UA_TYPES_STRING]);
+		} else if(UA_TYPES[type].pointerFree && len == UA_TYPES[type].memSize) {
+			UA_Variant_setScalarCopy(&dv->value, bytes, &UA_TYPES[type]);
+		} else {
+			return false;
+		}
+		dv->hasValue = true;
+	}
+
+	if(*index >= nodes.size()) {
+		UA_DataValue_deleteMembers(dv);
+		return false;
+	}
+
+	return true;
+}
+
+static bool replay_header(FILE* f)
+{
+	char magic[8];
+	uint32_t count = 0;
+
+	if(fread(magic, 1, 8, f) != 8 || memcmp(magic, RECORD_MAGIC, 8) || !get(f, &count)) {
+		printf("[error] %s is not a record file.\n", g_config->replayFile);
+		return false;
+	}
+
+	/* the indexes of the log must name the same nodes in this config */
+	bool same = (count == nodes.size());
+	for (uint32_t k = 0; k < count; k++) {
+		uint16_t len = 0;
+		char path[0xffff];
+		if(!get(f, &len) || fread(path, 1, len, f) != len) {
+			printf("[error] %s has a truncated header.\n", g_config->replayFile);
+			return false;
+		}
+		if(same && paths[k] != string(path, len)) {
+			same = false;
+		}
+	}
+	if(!same) {
+		printf("[error] %s was recorded with other node-map groups (%u nodes, this config has %d).\n",
+			g_config->replayFile, count, (int)nodes.size());
+	}
+
+	return same;
+}
+
+/* feeds the log through the encode/publish pipeline at 'replaySpeed' times
+ * the recorded pace (0 : as fast as possible), then stops the bridge. */
+void* replay_run(void* param)
+{
+	record_index();
+
+	FILE* f = fopen(g_config->replayFile, "rb");
+	if(!f) {
+		printf("[error] can't open replay file %s.\n", g_config->replayFile);
+		beStop = 1;
+		return NULL;
+	}
+	setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+	if(!replay_header(f)) {
+		fclose(f);
+		beStop = 1;
+		return NULL;
+	}
+
+	double speed = g_config->replaySpeed;
+	int64_t start = epoch();
+	int64_t first = 0;
+	unsigned long samples = 0, reads = 0;
+
+	vector<UA_DataValue> results;
+	uint32_t index;
+	uint8_t flags;
+	int64_t time;
+	UA_DataValue dv;
+
+	while(!beStop && decode(f, &index, &flags, &time, &dv)) {
+		Node* d = nodes[index];
+		Group* p = d->parent;
+		samples++;
+
+		if(!first) {
+			first = time;
+		}
+		if(speed > 0) {
+			int64_t due = start + (int64_t)((time - first) / speed);
+			int64_t wait;
+			while(!beStop && (wait = due - epoch()) > 0) {
+				usleep((useconds_t)(wait < 100000 ? wait : 100000));
+			}
+		}
+
+		if(getMonitorMode(p->method) == enumEvent) {
+			event_process(d, &dv, time);
+			UA_DataValue_deleteMembers(&dv);
+			reads++;
+			continue;
+		}
+
+		/* a poll read : collect the samples of the group, nodes not in the log stay empty */
+		results.resize(p->nodes.size());
+		for (size_t r = 0; r < results.size(); r++) {
+			UA_DataValue_init(&results[r]);
+		}
+		results[positions[index]] = dv;
+
+		while((flags & RECORD_MORE) && decode(f, &index, &flags, &time, &dv)) {
+			if(nodes[index]->parent == p) {
+				UA_DataValue_deleteMembers(&results[positions[index]]);
+				results[positions[index]] = dv;
+			} else {
+				UA_DataValue_deleteMembers(&dv);
+			}
+			samples++;
+		}
+
+		poll_replay(p, &results[0], time);
+		for (size_t r = 0; r < results.size(); r++) {
+			UA_DataValue_deleteMembers(&results[r]);
+		}
+		reads++;
+	}
+
+	fclose(f);
+	poll_replay_end();
+
+	double elapsed = (epoch() - start) / 1000000.0;
+	printf("[replay] %lu samples, %lu reads in %.3f s (%.0f samples/s).\n", samples, reads, elapsed,
+		elapsed > 0 ? samples / elapsed : 0.0);
+
+	/* the sinks drain what is queued on the way out */
+	beStop = 1;
+
+	return NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef OPCUA_MQTT_BRIDGE_RECORD_H_
+#define OPCUA_MQTT_BRIDGE_RECORD_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+#else
+# include "open62541.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct Node;
+struct Group;
+
+/* --record : every sample of the enabled groups is appended to the log
+ * --replay : the log feeds the encode/publish pipeline instead of OPC UA */
+int record_open(void);
+void record_close(void);
+void record_batch(struct Node* const* nodes, const UA_DataValue* results, size_t count, int64_t now);
+void record_sample(struct Node* d, const UA_DataValue* dv, int64_t now);
+void* replay_run(void* param);
+
+/* the pipeline halves the replay drives, see client-monitoring.cpp */
+void event_process(struct Node* d, UA_DataValue* data, int64_t now);
+void poll_replay(struct Group* p, UA_DataValue* results, int64_t now);
+void poll_replay_end(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_RECORD_H_ */
@@ -0,0 +1,266 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_client.h"
+# include "ua_client_highlevel.h"
+# include "ua_nodeids.h"
+# include "ua_network_tcp.h"
+# include "ua_config_standard.h"
+#else
+# include "open62541.h"
+# include <string.h>
+# include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include <string>
+#include <set>
+#include <map>
+using namespace std;
+
+#include "client-common.h"
+#include "client-nodemap.h"
+#include "client-nodeid.h"
+#include "client-cache.h"
+#include "client-sparkplug.h"
+#include "client-reload.h"
+
+extern map<int, Group>* gmap;
+extern pthread_mutex_t gmapLock;
+extern UAMQ_Configuration* g_config;
+
+int load_node_map(map<int, Group>& groups);
+
+/* editors save in several writes, or write a temporary file and rename it */
+#define RELOAD_QUIET_USEC 200000
+
+static volatile sig_atomic_t requested = 0;
+static int watchFd = -1;
+static string watchName;
+static int64_t savedAt = 0;
+
+void reload_request(void)
+{
+	requested = 1;
+}
+
+int reload_watch(void)
+{
+	if(!g_config->reloadWatch) {
+		return 0;
+	}
+
+	string path = g_config->configFile;
+	size_t slash = path.rfind('/');
+	string dir = (slash == string::npos) ? "." : path.substr(0, slash ? slash : 1);
+	watchName = (slash == string::npos) ? path : path.substr(slash + 1);
+
+	/* the directory : a rename replaces the inode a file watch would follow */
+	watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(watchFd < 0 || inotify_add_watch(watchFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		printf("[reload] can't watch %s, SIGHUP still reloads.\n", dir.c_str());
+		if(watchFd >= 0) {
+			close(watchFd);
+			watchFd = -1;
+		}
+		return -1;
+	}
+
+	printf("[reload] watching %s.\n", g_config->configFile);
+	return 0;
+}
+
+bool reload_due(int64_t now)
+{
+	if(watchFd >= 0) {
+		char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		ssize_t r;
+		while((r = read(watchFd, buf, sizeof(buf))) > 0) {
+			for (char* e = buf; e < buf + r; ) {
+				struct inotify_event* ev = (struct inotify_event*)e;
+				if(ev->len && watchName == ev->name) {
+					savedAt = now;
+				}
+				e += sizeof(struct inotify_event) + ev->len;
+			}
+		}
+		if(savedAt && now - savedAt >= RELOAD_QUIET_USEC) {
+			savedAt = 0;
+			requested = 1;
+		}
+	}
+
+	if(!requested) {
+		return false;
+	}
+
+	/* the log indexes the nodes of the start */
+	if(g_config->recordFile[0] || g_config->replayFile[0] || g_config->backfill) {
+		printf("[reload] ignored while recording, replaying or backfilling.\n");
+		requested = 0;
+		return false;
+	}
+
+	/* the groups of the file are started first */
+	return opcua_poll_started();
+}
+
+static bool group_event(Group* p)
+{
+	return getMonitorMode(p->method) == enumEvent;
+}
+
+/* the group leaves the map enabled last, the threads walking the map never
+ * start it twice. the entry itself stays : callbacks, sink messages and
+ * write commands in flight may still point at it. */
+static Group* group_start(const Group& g)
+{
+	pthread_mutex_lock(&gmapLock);
+	int key = gmap->empty() ? 0 : gmap->rbegin()->first + 1;
+	Group* p = &gmap->insert(pair<int, Group>(key, g)).first->second;
+	p->enable = false;
+	pthread_mutex_unlock(&gmapLock);
+
+	map<int, Node>::iterator n;
+	for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
+		Node* d = (Node*)&n->second;
+		d->parent = p;
+		getUA_NodeID(d->id, &d->ua);
+	}
+
+	cache_add_group(p);
+	write_add_group(p);
+
+	pthread_mutex_lock(&gmapLock);
+	p->enable = true;
+	pthread_mutex_unlock(&gmapLock);
+
+	if(group_event(p)) {
+		monitor_group_start(p);
+	} else {
+		opcua_poll_start(p);
+	}
+	printf("[reload] %s : started, %s on [%s], %d nodes.\n", p->name, p->method, g_config->endpoints[p->ep].name, (int)p->nodes.size());
+
+	return p;
+}
+
+static void group_stop(Group* p)
+{
+	pthread_mutex_lock(&gmapLock);
+	p->enable = false;
+	pthread_mutex_unlock(&gmapLock);
+
+	if(group_event(p)) {
+		monitor_group_stop(p);
+	} else {
+		opcua_poll_stop(p);
+	}
+
+	cache_remove_group(p);
+	write_remove_group(p);
+	sparkplug_device_death(p);
+	printf("[reload] %s : stopped.\n", p->name);
+}
+
+/* the parsed groups but those handed to group_start */
+static void fresh_free(map<int, Group>& fresh, const set<Group*>* started)
+{
+	map<int, Group>::iterator i;
+	for (i = fresh.begin(); i != fresh.end(); ++i) {
+		if(!started || !started->count(&i->second)) {
+			group_free(&i->second);
+		}
+	}
+}
+
+void reload_apply(void)
+{
+	requested = 0;
+	printf("[reload] %s\n", g_config->configFile);
+
+	/* a started group keeps the strings of its parsed copy, the other copies are freed */
+	map<int, Group> fresh;
+	if(load_node_map(fresh) != (int)UA_STATUSCODE_GOOD) {
+		printf("[reload] the node-map is not valid, the running one stays.\n");
+		return;
+	}
+
+	/* groups are matched by name */
+	set<string> wanted;
+	map<int, Group>::iterator i;
+	for (i = fresh.begin(); i != fresh.end(); ++i) {
+		Group* g = (Group*)&i->second;
+		if(g->enable && !wanted.insert(g->name).second) {
+			printf("[reload] group '%s' is defined twice, the running node-map stays.\n", g->name);
+			fresh_free(fresh, NULL);
+			return;
+		}
+	}
+
+	map<string, Group*> running;
+	pthread_mutex_lock(&gmapLock);
+	for (i = gmap->begin(); i != gmap->end(); ++i) {
+		Group* p = (Group*)&i->second;
+		if(p->enable) {
+			running[p->name] = p;
+		}
+	}
+	pthread_mutex_unlock(&gmapLock);
+
+	int unchanged = 0, added = 0, removed = 0, changed = 0, rerouted = 0;
+	set<Group*> started;
+
+	map<string, Group*>::iterator r;
+	for (r = running.begin(); r != running.end(); ++r) {
+		if(!wanted.count(r->first)) {
+			group_stop(r->second);
+			removed++;
+		}
+	}
+
+	for (i = fresh.begin(); i != fresh.end(); ++i) {
+		Group* g = (Group*)&i->second;
+		if(!g->enable) {
+			continue;
+		}
+
+		r = running.find(g->name);
+		if(r == running.end()) {
+			group_start(*g);
+			started.insert(g);
+			added++;
+			continue;
+		}
+
+		Group* p = r->second;
+		if(p->spec != g->spec) {
+			group_stop(p);
+			group_start(*g);
+			started.insert(g);
+			changed++;
+		} else if(p->sinks != g->sinks || p->store != g->store) {
+			/* read by the publisher at every message, no restart */
+			p->mqtt = g->mqtt;
+			p->amqp = g->amqp;
+			p->tcp = g->tcp;
+			p->sinks = g->sinks;
+			p->store = g->store;
+			printf("[reload] %s : sinks re-routed.\n", p->name);
+			rerouted++;
+		} else {
+			unchanged++;
+		}
+	}
+
+	fresh_free(fresh, &started);
+
+	printf("[reload] %d unchanged, %d added, %d removed, %d changed, %d re-routed.\n", unchanged, added, removed, changed, rerouted);
+}
@@ -0,0 +1,28 @@
+#ifndef OPCUA_MQTT_BRIDGE_RELOAD_H_
+#define OPCUA_MQTT_BRIDGE_RELOAD_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* SIGHUP : safe in a signal handler */
+void reload_request(void);
+
+/* "reload": {"watch": true} : inotify on the directory of the config file */
+int reload_watch(void);
+
+/* called by the scheduler loop, a save is applied once the file is quiet */
+bool reload_due(int64_t now);
+
+/* the node-map of the file again : the changed groups restart, the others keep running */
+void reload_apply(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_RELOAD_H_ */
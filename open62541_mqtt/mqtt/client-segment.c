@@ -0,0 +1,404 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	/* strptime, timegm */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "client-segment.h"
+
+/* crc32 (zlib), a nibble at a time */
+static uint32_t crc32(const void* data, size_t len)
+{
+	static const uint32_t table[16] = {
+		0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+		0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+	};
+	const uint8_t* p = (const uint8_t*)data;
+	uint32_t crc = 0xffffffff;
+
+	for (size_t k = 0; k < len; k++) {
+		crc ^= p[k];
+		crc = (crc >> 4) ^ table[crc & 15];
+		crc = (crc >> 4) ^ table[crc & 15];
+	}
+	return ~crc;
+}
+
+void segment_buf_init(SegmentBuf* b)
+{
+	b->data = NULL;
+	b->len = b->cap = 0;
+}
+
+void segment_buf_free(SegmentBuf* b)
+{
+	free(b->data);
+	segment_buf_init(b);
+}
+
+static char* buf_room(SegmentBuf* b, size_t n)
+{
+	if(b->len + n > b->cap) {
+		while(b->len + n > b->cap) {
+			b->cap = b->cap ? b->cap * 2 : 4096;
+		}
+		b->data = (char*)realloc(b->data, b->cap);
+	}
+	char* at = b->data + b->len;
+	b->len += n;
+	return at;
+}
+
+static void buf_be(SegmentBuf* b, uint64_t v, int bytes)
+{
+	char* p = buf_room(b, bytes);
+	for (int k = bytes - 1; k >= 0; k--) {
+		p[k] = (char)(v & 0xff);
+		v >>= 8;
+	}
+}
+
+static void buf_bytes(SegmentBuf* b, const void* data, size_t len)
+{
+	if(len) {
+		memcpy(buf_room(b, len), data, len);
+	}
+}
+
+static uint64_t get_be(const uint8_t* p, int bytes)
+{
+	uint64_t v = 0;
+	for (int k = 0; k < bytes; k++) {
+		v = (v << 8) | p[k];
+	}
+	return v;
+}
+
+static void put_be(uint8_t* p, uint64_t v, int bytes)
+{
+	for (int k = bytes - 1; k >= 0; k--) {
+		p[k] = (uint8_t)(v & 0xff);
+		v >>= 8;
+	}
+}
+
+void segment_header(SegmentBuf* b, int64_t start, int64_t length)
+{
+	buf_bytes(b, SEGMENT_MAGIC, 8);
+	buf_be(b, (uint64_t)start, 8);
+	buf_be(b, (uint64_t)length, 8);
+}
+
+/* type, length and crc go in front of the body once it is written */
+static size_t record_begin(SegmentBuf* b, char type)
+{
+	size_t at = b->len;
+	buf_be(b, (uint8_t)type, 1);
+	buf_be(b, 0, 4);
+	buf_be(b, 0, 4);
+	return at;
+}
+
+static void record_end(SegmentBuf* b, size_t at)
+{
+	uint8_t* head = (uint8_t*)b->data + at;
+	size_t len = b->len - at - 9;
+	put_be(head + 1, len, 4);
+	put_be(head + 5, crc32(head + 9, len), 4);
+}
+
+void segment_node(SegmentBuf* b, uint32_t id, const char* path)
+{
+	size_t len = strlen(path);
+	if(len > 0xffff) {
+		len = 0xffff;
+	}
+
+	size_t at = record_begin(b, SEGMENT_NODE);
+	buf_be(b, id, 4);
+	buf_be(b, len, 2);
+	buf_bytes(b, path, len);
+	record_end(b, at);
+}
+
+void segment_block_init(SegmentBlock* k)
+{
+	gorilla_init(&k->time);
+	gorilla_init(&k->value);
+	gorilla_values_only(&k->value);
+	segment_buf_init(&k->status);
+	segment_block_reset(k, 0, GORILLA_NONE);
+}
+
+void segment_block_free(SegmentBlock* k)
+{
+	gorilla_free(&k->time);
+	gorilla_free(&k->value);
+	segment_buf_free(&k->status);
+}
+
+void segment_block_reset(SegmentBlock* k, uint16_t type, int kind)
+{
+	gorilla_reset(&k->time);
+	gorilla_reset(&k->value);
+	k->status.len = 0;
+	k->type = type;
+	k->kind = kind;
+	k->count = 0;
+	k->first = k->last = 0;
+	k->runStatus = 0;
+	k->runCount = 0;
+}
+
+static void block_run_end(SegmentBlock* k)
+{
+	if(k->runCount) {
+		buf_be(&k->status, k->runStatus, 4);
+		buf_be(&k->status, k->runCount, 4);
+		k->runCount = 0;
+	}
+}
+
+void segment_block_put(SegmentBlock* k, int64_t t, uint64_t v, uint32_t status)
+{
+	double d;
+
+	gorilla_put_time(&k->time, t);
+	if(k->kind == GORILLA_FLOAT) {
+		memcpy(&d, &v, sizeof(d));
+		gorilla_put_double(&k->value, 0, d);
+	} else {
+		gorilla_put_int(&k->value, 0, (int64_t)v);
+	}
+
+	if(k->runCount && status != k->runStatus) {
+		block_run_end(k);
+	}
+	k->runStatus = status;
+	k->runCount++;
+
+	if(!k->count || t < k->first) {
+		k->first = t;
+	}
+	if(!k->count || t > k->last) {
+		k->last = t;
+	}
+	k->count++;
+}
+
+void segment_block_write(SegmentBuf* b, uint32_t node, SegmentBlock* k)
+{
+	block_run_end(k);
+
+	size_t bytes[3] = { gorilla_bytes(&k->time), gorilla_bytes(&k->value), k->status.len };
+
+	size_t at = record_begin(b, SEGMENT_BLOCK);
+	buf_be(b, node, 4);
+	buf_be(b, k->type, 2);
+	buf_be(b, (uint8_t)k->kind, 1);
+	buf_be(b, k->count, 4);
+	buf_be(b, (uint64_t)k->first, 8);
+	buf_be(b, (uint64_t)k->last, 8);
+	for (int c = 0; c < 3; c++) {
+		buf_be(b, bytes[c], 4);
+	}
+	buf_bytes(b, k->time.data, bytes[0]);
+	buf_bytes(b, k->value.data, bytes[1]);
+	buf_bytes(b, k->status.data, bytes[2]);
+	record_end(b, at);
+}
+
+int segment_open(SegmentFile* f, const char* path)
+{
+	struct stat st;
+
+	memset(f, 0, sizeof(*f));
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		return -1;
+	}
+	if(fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if(st.st_size < SEGMENT_HEADER) {
+		close(fd);
+		return -2;
+	}
+
+	void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		return -1;
+	}
+
+	f->map = map;
+	f->data = (const uint8_t*)map;
+	f->len = (size_t)st.st_size;
+	if(memcmp(f->data, SEGMENT_MAGIC, 8)) {
+		segment_close(f);
+		return -2;
+	}
+	f->start = (int64_t)get_be(f->data + 8, 8);
+	f->length = (int64_t)get_be(f->data + 16, 8);
+	f->at = SEGMENT_HEADER;
+
+	/* read in order, the pages behind are not needed again */
+	madvise(f->map, f->len, MADV_SEQUENTIAL);
+	return 0;
+}
+
+void segment_close(SegmentFile* f)
+{
+	if(f->map) {
+		munmap(f->map, f->len);
+	}
+	f->map = NULL;
+	f->data = NULL;
+	f->len = 0;
+}
+
+bool segment_next(SegmentFile* f, SegmentRecord* r)
+{
+	if(f->at + 9 > f->len) {
+		return false;
+	}
+
+	const uint8_t* head = f->data + f->at;
+	size_t len = (size_t)get_be(head + 1, 4);
+	if(f->at + 9 + len > f->len || crc32(head + 9, len) != (uint32_t)get_be(head + 5, 4)) {
+		return false;
+	}
+
+	const uint8_t* p = head + 9;
+	memset(r, 0, sizeof(*r));
+	r->type = (char)head[0];
+
+	if(r->type == SEGMENT_NODE) {
+		if(len < 6 || 6 + get_be(p + 4, 2) > len) {
+			return false;
+		}
+		r->node = (uint32_t)get_be(p, 4);
+		r->pathLen = (size_t)get_be(p + 4, 2);
+		r->path = (const char*)p + 6;
+	} else if(r->type == SEGMENT_BLOCK) {
+		if(len < 39) {
+			return false;
+		}
+		r->node = (uint32_t)get_be(p, 4);
+		r->uaType = (uint16_t)get_be(p + 4, 2);
+		r->kind = p[6];
+		r->count = (uint32_t)get_be(p + 7, 4);
+		r->first = (int64_t)get_be(p + 11, 8);
+		r->last = (int64_t)get_be(p + 19, 8);
+		size_t at = 39;
+		for (int c = 0; c < 3; c++) {
+			r->bytes[c] = (uint32_t)get_be(p + 27 + 4 * c, 4);
+			r->columns[c] = p + at;
+			at += r->bytes[c];
+		}
+		if(at != len) {
+			return false;
+		}
+	}
+	/* other types are skipped, a later version may add some */
+
+	f->at += 9 + len;
+	return true;
+}
+
+void segment_cursor(SegmentCursor* c, const SegmentRecord* r)
+{
+	gorilla_reader(&c->time, GORILLA_TIME, r->count, r->columns[0], r->bytes[0]);
+	gorilla_reader(&c->value, r->kind | GORILLA_VALUES, r->count, r->columns[1], r->bytes[1]);
+	c->status = r->columns[2];
+	c->statusLen = r->bytes[2];
+	c->statusAt = 0;
+	c->runStatus = 0;
+	c->runLeft = 0;
+}
+
+bool segment_cursor_next(SegmentCursor* c, int64_t* t, uint64_t* v, uint32_t* status)
+{
+	int64_t unused;
+	uint64_t none;
+
+	if(!c->runLeft) {
+		if(c->statusAt + 8 > c->statusLen) {
+			return false;
+		}
+		c->runStatus = (uint32_t)get_be(c->status + c->statusAt, 4);
+		c->runLeft = (uint32_t)get_be(c->status + c->statusAt + 4, 4);
+		c->statusAt += 8;
+		if(!c->runLeft) {
+			return false;
+		}
+	}
+	if(!gorilla_next(&c->time, t, &none) || !gorilla_next(&c->value, &unused, v)) {
+		return false;
+	}
+	*status = c->runStatus;
+	c->runLeft--;
+	return true;
+}
+
+bool segment_parse_time(const char* s, int64_t* us)
+{
+	const char* p = s;
+	while(isdigit((unsigned char)*p)) {
+		p++;
+	}
+	if(p != s && !*p) {
+		*us = strtoll(s, NULL, 10);
+		return true;
+	}
+
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	p = strptime(s, "%Y-%m-%dT%H:%M:%S", &tm);
+	if(!p) {
+		return false;
+	}
+
+	int64_t frac = 0;
+	if(*p == '.') {
+		int digits = 0;
+		for (p++; isdigit((unsigned char)*p); p++, digits++) {
+			if(digits < 6) {
+				frac = frac * 10 + (*p - '0');
+			}
+		}
+		for (; digits < 6; digits++) {
+			frac *= 10;
+		}
+	}
+	if(*p == 'Z') {
+		p++;
+	}
+	if(*p) {
+		return false;
+	}
+
+	*us = (int64_t)timegm(&tm) * 1000000 + frac;
+	return true;
+}
+
+void segment_file_name(int64_t start, char* name, size_t size)
+{
+	time_t sec = (time_t)(start / 1000000);
+	struct tm tm;
+	gmtime_r(&sec, &tm);
+	strftime(name, size, "%Y%m%dT%H%M%SZ.seg", &tm);
+}
@@ -0,0 +1,129 @@
+#ifndef OPCUA_MQTT_BRIDGE_SEGMENT_H_
+#define OPCUA_MQTT_BRIDGE_SEGMENT_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "client-gorilla.h"
+
+/* segment files of the local store, one per time partition. plain C without
+ * open62541 like client-gorilla.c : the store writes them, store-query and
+ * the backfill read them mmapped. integers big endian :
+ *
+ * header  "UASEG" 0 0 1, i64 partition start (unix us), i64 partition length (us)
+ * record  u8 type, u32 body length, u32 crc32 of the body, body
+ *   'N' node   u32 id, u16 length + '<group topic>/<node topic>', before its first block
+ *   'B' block  u32 node id, u16 UA type (UA_TYPES_*), u8 value kind, u32 samples,
+ *              i64 first time, i64 last time, u32 bytes of each of the 3 columns,
+ *              the columns one after the other :
+ *                time    GORILLA_TIME series (delta of delta, unix us)
+ *                value   GORILLA_FLOAT or GORILLA_INT series | GORILLA_VALUES
+ *                status  runs of u32 status code, u32 samples
+ *
+ * files are only appended to. a record cut by a crash fails its length or crc
+ * check : the readers stop before it and the store cuts it when it opens the
+ * file again. */
+#define SEGMENT_MAGIC	"UASEG\0\0\1"
+#define SEGMENT_HEADER	24
+#define SEGMENT_NODE	'N'
+#define SEGMENT_BLOCK	'B'
+
+/* a malloc'ed output buffer */
+typedef struct {
+	char* data;
+	size_t len;
+	size_t cap;
+} SegmentBuf;
+
+void segment_buf_init(SegmentBuf* b);
+void segment_buf_free(SegmentBuf* b);
+
+void segment_header(SegmentBuf* b, int64_t start, int64_t length);
+void segment_node(SegmentBuf* b, uint32_t id, const char* path);
+
+/* the columns of one node's samples, all of one UA type */
+typedef struct {
+	uint16_t type;
+	int kind;	/* GORILLA_FLOAT or GORILLA_INT */
+	uint32_t count;
+	int64_t first;
+	int64_t last;
+	GorillaSeries time;
+	GorillaSeries value;
+	SegmentBuf status;
+	uint32_t runStatus;
+	uint32_t runCount;
+} SegmentBlock;
+
+void segment_block_init(SegmentBlock* k);
+void segment_block_free(SegmentBlock* k);
+/* empty again for samples of 'type', kind GORILLA_FLOAT or GORILLA_INT */
+void segment_block_reset(SegmentBlock* k, uint16_t type, int kind);
+/* v : the float64 bits or the int64 */
+void segment_block_put(SegmentBlock* k, int64_t t, uint64_t v, uint32_t status);
+void segment_block_write(SegmentBuf* b, uint32_t node, SegmentBlock* k);
+
+/* reading : the file is mapped, nothing is copied */
+typedef struct {
+	void* map;
+	const uint8_t* data;
+	size_t len;
+	size_t at;	/* after the last whole record read */
+	int64_t start;
+	int64_t length;
+} SegmentFile;
+
+/* 0 : mapped, -1 : can't be read (errno), -2 : not a segment file */
+int segment_open(SegmentFile* f, const char* path);
+void segment_close(SegmentFile* f);
+
+typedef struct {
+	char type;
+	uint32_t node;
+	/* 'N' */
+	const char* path;
+	size_t pathLen;
+	/* 'B' */
+	uint16_t uaType;
+	int kind;
+	uint32_t count;
+	int64_t first;
+	int64_t last;
+	const uint8_t* columns[3];
+	uint32_t bytes[3];
+} SegmentRecord;
+
+/* the next record, false at the end or before a cut or broken one */
+bool segment_next(SegmentFile* f, SegmentRecord* r);
+
+/* the samples of a 'B' record */
+typedef struct {
+	GorillaReader time;
+	GorillaReader value;
+	const uint8_t* status;
+	size_t statusLen;
+	size_t statusAt;
+	uint32_t runStatus;
+	uint32_t runLeft;
+} SegmentCursor;
+
+void segment_cursor(SegmentCursor* c, const SegmentRecord* r);
+bool segment_cursor_next(SegmentCursor* c, int64_t* t, uint64_t* v, uint32_t* status);
+
+/* "1792359871029254" (unix us) or "2026-10-18T21:00:00" (UTC, optional .ffffff) */
+bool segment_parse_time(const char* s, int64_t* us);
+/* '20261018T210000Z.seg', the file of the partition starting at 'start' */
+void segment_file_name(int64_t start, char* name, size_t size);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_SEGMENT_H_ */
@@ -0,0 +1,877 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <deque>
+#include <vector>
+#include <map>
+#include <string>
+using namespace std;
+
+#include "client-sink.h"
+#include "client-config.h"
+#include "client-thread.h"
+#include "json.h"
+
+extern int beStop;
+extern UAMQ_Configuration* g_config;
+
+int64_t epoch(void);
+
+static const SinkOps* plugins[] = {
+	&mqttSink,
+	&tcpSink,
+#ifdef UAMQ_ENABLE_AMQP
+	&amqpSink,
+#endif
+};
+
+#define SINK_COUNT (int)(sizeof(plugins) / sizeof(plugins[0]))
+
+/* messages handed to the sink thread per wakeup */
+#define SINK_BATCH 64
+
+/* sends of one message on fresh connections before it is given up */
+#define SINK_RETRIES 3
+
+/* unsent bytes a sink socket may hold, see sink_socket */
+#define SINK_NOTSENT_LOWAT (16 * 1024)
+
+/* latency histogram : 0..3 us, then 4 buckets per power of 2 */
+#define LATENCY_BUCKETS 248
+
+typedef struct {
+	deque<SinkMessage*> queue;
+	unsigned long long head;	/* sequence number of queue.front() */
+	map<string, unsigned long long> slots;	/* coalesce-latest : topic -> sequence of its queued message */
+	volatile size_t waiting;	/* queue.size(), read by the sink thread between sends */
+} SinkLane;
+
+/* publish to send latency of a lane */
+typedef struct {
+	unsigned long buckets[LATENCY_BUCKETS];
+	unsigned long sent;
+	unsigned long late;
+	long long max;
+} LaneLatency;
+
+/* a token bucket of messages [0] and bytes [1], refilled by the time since 'last' */
+typedef struct {
+	double rate[2];	/* per second, 0 : no limit */
+	double burst[2];
+	double tokens[2];
+	long long last;	/* monotonic us */
+} RateBucket;
+
+/* the messages of a topic prefix over its rate wait in 'pending', under the
+ * sink's overload policy : coalesce-latest keeps the newest per topic */
+typedef struct {
+	string prefix;
+	RateBucket bucket;
+	SinkLane pending;
+	unsigned long throttled;
+} SinkRule;
+
+typedef struct {
+	const SinkOps* ops;
+	SinkLane lanes[enumLaneCount];
+	LaneLatency latency[enumLaneCount];
+	size_t held;	/* messages taken by the sink thread, put back behind a high one or for tokens */
+	size_t capacity;	/* per lane and per rule */
+	enumOverloadPolicy policy;
+	RateBucket rate;	/* the sink's own, taken by the sink thread before every send */
+	unsigned long rateThrottled;
+	vector<SinkRule> rules;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	pthread_cond_t space;
+	pthread_t tid;
+	bool running;
+	SinkStats stats;
+} Sink;
+
+static Sink sinks[SINK_COUNT];
+
+/* set by sink_stop once nothing publishes any more : the sinks send what is
+ * queued, reconnecting if they have to, until drainDeadline (monotonic us) */
+static volatile bool draining = false;
+static long long drainDeadline = 0;
+
+static long long monotonic(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool drain_expired(void)
+{
+	return draining && monotonic() >= drainDeadline;
+}
+
+int getSinkIndex(const char* name)
+{
+	for (int i = 0; i < SINK_COUNT; i++) {
+		if(!strcmp(plugins[i]->name, name)) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+const char* getSinkName(int index)
+{
+	return (index >= 0 && index < SINK_COUNT) ? plugins[index]->name : "";
+}
+
+int getSinkCount(void)
+{
+	return SINK_COUNT;
+}
+
+const char* getSinkLaneName(int lane)
+{
+	return lane == enumLaneHigh ? "high" : "normal";
+}
+
+static int latency_bucket(long long us)
+{
+	if(us < 4) {
+		return us < 0 ? 0 : (int)us;
+	}
+	int e = 63 - __builtin_clzll((unsigned long long)us);
+	return 4 * (e - 1) + (int)((us >> (e - 2)) & 3);
+}
+
+/* the largest latency of a bucket */
+static long long latency_bound(int b)
+{
+	if(b < 4) {
+		return b;
+	}
+	int e = b / 4 + 1;
+	long long step = 1LL << (e - 2);
+	return (1LL << e) + (b % 4) * step + step - 1;
+}
+
+static long long latency_percentile(const LaneLatency* l, double fraction)
+{
+	unsigned long rank = (unsigned long)(fraction * l->sent);
+	unsigned long seen = 0;
+	for (int b = 0; b < LATENCY_BUCKETS; b++) {
+		seen += l->buckets[b];
+		if(seen > rank) {
+			return latency_bound(b) < l->max ? latency_bound(b) : l->max;
+		}
+	}
+	return l->max;
+}
+
+/* queued and held, caller holds s->lock */
+static size_t sink_depth(Sink* s)
+{
+	size_t depth = s->held;
+	for (int l = 0; l < enumLaneCount; l++) {
+		depth += s->lanes[l].queue.size();
+	}
+	return depth;
+}
+
+static void message_unref(SinkMessage* msg)
+{
+	if(__sync_sub_and_fetch(&msg->refs, 1) == 0) {
+		free(msg->topic);
+		free(msg->data);
+		free(msg);
+	}
+}
+
+static void rate_init(RateBucket* b, const UAMQ_RateLimit* r, int burstUSec)
+{
+	b->rate[0] = r->msgsPerSec;
+	b->rate[1] = r->bytesPerSec;
+	for (int k = 0; k < 2; k++) {
+		b->burst[k] = b->rate[k] * burstUSec / 1e6;
+		if(b->burst[k] < 1) {
+			b->burst[k] = 1;
+		}
+		b->tokens[k] = b->burst[k];
+	}
+	b->last = monotonic();
+}
+
+/* tokens for a message of len bytes : 0 and taken, or the us until there are.
+ * a message larger than the burst goes with a full bucket and leaves a debt */
+static long long rate_take(RateBucket* b, size_t len, long long now)
+{
+	double cost[2] = { 1, (double)len };
+	long long wait = 0;
+
+	for (int k = 0; k < 2; k++) {
+		if(b->rate[k] <= 0) {
+			continue;
+		}
+		b->tokens[k] += b->rate[k] * (double)(now - b->last) / 1e6;
+		if(b->tokens[k] > b->burst[k]) {
+			b->tokens[k] = b->burst[k];
+		}
+		double need = cost[k] < b->burst[k] ? cost[k] : b->burst[k];
+		if(b->tokens[k] < need) {
+			long long w = (long long)((need - b->tokens[k]) * 1e6 / b->rate[k]) + 1;
+			wait = w > wait ? w : wait;
+		}
+	}
+	b->last = now;
+
+	if(wait) {
+		return wait;
+	}
+	for (int k = 0; k < 2; k++) {
+		if(b->rate[k] > 0) {
+			b->tokens[k] -= cost[k];
+		}
+	}
+	return 0;
+}
+
+/* the longest prefix of the topic with a rate, NULL : none */
+static SinkRule* sink_rule(Sink* s, const char* topic)
+{
+	SinkRule* found = NULL;
+	for (size_t k = 0; k < s->rules.size(); k++) {
+		SinkRule* r = &s->rules[k];
+		if(!strncmp(topic, r->prefix.c_str(), r->prefix.size()) && (!found || r->prefix.size() > found->prefix.size())) {
+			found = r;
+		}
+	}
+	return found;
+}
+
+/* caller holds s->lock */
+static SinkMessage* sink_pop(Sink* s, SinkLane* l)
+{
+	SinkMessage* msg = l->queue.front();
+
+	if(s->policy == enumOverloadCoalesceLatest) {
+		map<string, unsigned long long>::iterator slot = l->slots.find(msg->topic);
+		if(slot != l->slots.end() && slot->second == l->head) {
+			l->slots.erase(slot);
+		}
+	}
+
+	l->queue.pop_front();
+	l->head++;
+	l->waiting = l->queue.size();
+
+	return msg;
+}
+
+/* caller holds s->lock : msg into l by the overload policy, returns the message
+ * that left l (or was refused). fresh : from a publisher, not from a rule */
+static SinkMessage* lane_push(Sink* s, SinkLane* l, SinkMessage* msg, bool fresh)
+{
+	SinkMessage* out = NULL;
+
+	if(s->policy == enumOverloadCoalesceLatest) {
+		/* the topic is already queued : the new value takes its place and turn */
+		map<string, unsigned long long>::iterator slot = l->slots.find(msg->topic);
+		if(slot != l->slots.end()) {
+			SinkMessage** queued = &l->queue[slot->second - l->head];
+			out = *queued;
+			*queued = msg;
+			s->stats.coalesced++;
+			return out;
+		}
+	}
+
+	if(l->queue.size() >= s->capacity) {
+		switch(s->policy) {
+			case enumOverloadBlock : {
+				while(l->queue.size() >= s->capacity && !beStop) {
+					struct timespec ts;
+					clock_gettime(CLOCK_REALTIME, &ts);
+					ts.tv_sec += 1;
+					pthread_cond_timedwait(&s->space, &s->lock, &ts);
+				}
+				if(l->queue.size() >= s->capacity) {
+					s->stats.dropped++;
+					return msg;
+				}
+			}
+			break;
+			case enumOverloadDropNewest : {
+				s->stats.dropped++;
+				return msg;
+			}
+			/* coalesce-latest with more topics than room falls back to drop-oldest */
+			case enumOverloadCoalesceLatest :
+			case enumOverloadDropOldest :
+			default : {
+				out = sink_pop(s, l);
+				s->stats.dropped++;
+			}
+			break;
+		}
+	}
+
+	if(s->policy == enumOverloadCoalesceLatest) {
+		l->slots[msg->topic] = l->head + l->queue.size();
+	}
+	l->queue.push_back(msg);
+	l->waiting = l->queue.size();
+	if(fresh) {
+		s->stats.enqueued++;
+	}
+
+	return out;
+}
+
+/* caller holds s->lock, returns the message that left the queue (or was refused).
+ * the lanes fill up and overflow apart : bulk traffic never pushes out a high
+ * message. a topic over the rate of its prefix waits behind the rule's others */
+static SinkMessage* sink_push(Sink* s, SinkMessage* msg)
+{
+	SinkLane* l = &s->lanes[msg->lane];
+
+	SinkRule* r = sink_rule(s, msg->topic);
+	if(r && (!r->pending.queue.empty() || rate_take(&r->bucket, msg->len, monotonic()) > 0)) {
+		l = &r->pending;
+		r->throttled++;
+		s->stats.throttled++;
+	}
+
+	SinkMessage* out = lane_push(s, l, msg, true);
+	s->stats.depth = sink_depth(s);
+	pthread_cond_signal(&s->ready);
+
+	return out;
+}
+
+/* caller holds s->lock : the throttled messages the rates of their prefix allow
+ * now go to their lanes. returns the us until the next one may, -1 : none waits
+ * or only for room in its lane */
+static long long sink_release(Sink* s)
+{
+	long long next = -1;
+	long long now = monotonic();
+	bool moved = false;
+
+	for (size_t k = 0; k < s->rules.size(); k++) {
+		SinkRule* r = &s->rules[k];
+		while(!r->pending.queue.empty()) {
+			SinkMessage* msg = r->pending.queue.front();
+			SinkLane* l = &s->lanes[msg->lane];
+			if(l->queue.size() >= s->capacity) {
+				break;
+			}
+			long long wait = rate_take(&r->bucket, msg->len, now);
+			if(wait) {
+				next = (next < 0 || wait < next) ? wait : next;
+				break;
+			}
+			sink_pop(s, &r->pending);
+			SinkMessage* old = lane_push(s, l, msg, false);
+			if(old) {
+				message_unref(old);
+			}
+			moved = true;
+		}
+	}
+
+	if(moved) {
+		s->stats.depth = sink_depth(s);
+		pthread_cond_broadcast(&s->space);
+	}
+	return next;
+}
+
+/* caller holds s->lock */
+static void sink_wait(Sink* s, long long usec)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	long long ns = ts.tv_nsec + usec * 1000;
+	ts.tv_sec += (time_t)(ns / 1000000000);
+	ts.tv_nsec = (long)(ns % 1000000000);
+	pthread_cond_timedwait(&s->ready, &s->lock, &ts);
+}
+
+/* caller holds s->lock : the lane's messages up to a full batch */
+static void sink_take(Sink* s, int lane, vector<SinkMessage*>& batch)
+{
+	SinkLane* l = &s->lanes[lane];
+	while(!l->queue.empty() && batch.size() < SINK_BATCH) {
+		batch.push_back(sink_pop(s, l));
+	}
+}
+
+/* caller holds s->lock */
+static void sink_account(Sink* s, int lane, long long latency)
+{
+	LaneLatency* l = &s->latency[lane];
+	long long slo = g_config->sinkSloUSec[lane];
+
+	l->buckets[latency_bucket(latency)]++;
+	l->sent++;
+	if(slo > 0 && latency > slo) {
+		l->late++;
+	}
+	if(latency > l->max) {
+		l->max = latency;
+	}
+}
+
+static void* sink_run(void* param)
+{
+	Sink* s = (Sink*)param;
+	bool opened = false;
+	vector<SinkMessage*> batch;
+	vector<SinkMessage*> rest;
+	vector<pair<int, long long> > latencies;
+	const SinkMessage* deferred = NULL;
+	const SinkMessage* retried = NULL;
+	int retries = 0;
+
+	thread_apply(enumThreadSink, (string("sink:") + s->ops->name).c_str());
+
+	pthread_mutex_lock(&s->lock);
+	s->stats.progress = epoch();
+	pthread_mutex_unlock(&s->lock);
+
+	while(true) {
+		if(!opened) {
+			if(drain_expired()) {
+				break;
+			}
+			/* nothing to send is no stall, the watchdog looks at queued messages only */
+			pthread_mutex_lock(&s->lock);
+			if(!sink_depth(s)) {
+				s->stats.progress = epoch();
+			}
+			pthread_mutex_unlock(&s->lock);
+
+			if(s->ops->open() != 0) {
+				usleep(draining ? 100000 : 1000000);
+				continue;
+			}
+			printf("[%s] sink opened.\n", s->ops->name);
+			opened = true;
+		}
+
+		pthread_mutex_lock(&s->lock);
+		/* throttled topics count as queued on shutdown : they are sent at their rate too */
+		long long next = sink_release(s);
+		while(!sink_depth(s) && (!draining || next >= 0) && !drain_expired()) {
+			sink_wait(s, (next >= 0 && next < 1000000) ? next : 1000000);
+			s->stats.progress = epoch();
+			next = sink_release(s);
+		}
+		/* on shutdown the queue is drained first, up to the deadline */
+		if(!sink_depth(s) || drain_expired()) {
+			pthread_mutex_unlock(&s->lock);
+			break;
+		}
+		/* put back high messages first, the high lane, then the normal messages put back */
+		size_t high = 0;
+		while(high < rest.size() && rest[high]->lane == enumLaneHigh) {
+			high++;
+		}
+		batch.insert(batch.end(), rest.begin(), rest.begin() + high);
+		sink_take(s, enumLaneHigh, batch);
+		batch.insert(batch.end(), rest.begin() + high, rest.end());
+		rest.clear();
+		s->held = 0;
+		sink_take(s, enumLaneNormal, batch);
+		s->stats.depth = sink_depth(s);
+		pthread_cond_broadcast(&s->space);
+		pthread_mutex_unlock(&s->lock);
+
+		unsigned long sent = 0, failed = 0, throttled = 0;
+		long long throttle = 0;
+		size_t k = 0;
+		for (; k < batch.size(); k++) {
+			/* strict priority : a high message queued meanwhile goes before the next normal one */
+			if(batch[k]->lane != enumLaneHigh && s->lanes[enumLaneHigh].waiting) {
+				break;
+			}
+			/* over the sink's rate : the batch waits for tokens, the queue fills under its overload policy */
+			if((throttle = rate_take(&s->rate, batch[k]->len, monotonic())) > 0) {
+				if(batch[k] != deferred) {
+					deferred = batch[k];
+					throttled++;
+				}
+				break;
+			}
+			if(s->ops->send(batch[k]) < 0) {
+				/* the connection is gone : this message and the rest go again on the next one,
+				 * unless this one failed SINK_RETRIES times in a row */
+				s->ops->close();
+				opened = false;
+				if(batch[k] != retried) {
+					retried = batch[k];
+					retries = 0;
+				}
+				if(++retries >= SINK_RETRIES) {
+					message_unref(batch[k]);
+					retried = NULL;
+					failed++;
+					k++;
+				}
+				break;
+			}
+			sent++;
+			retried = NULL;
+			latencies.push_back(pair<int, long long>(batch[k]->lane, epoch() - batch[k]->queued));
+			message_unref(batch[k]);
+		}
+		rest.assign(batch.begin() + k, batch.end());
+		batch.clear();
+
+		if(opened && s->ops->flush) {
+			s->ops->flush();
+		}
+
+		pthread_mutex_lock(&s->lock);
+		s->held = rest.size();
+		s->stats.sent += sent;
+		s->stats.failed += failed;
+		s->stats.throttled += throttled;
+		s->rateThrottled += throttled;
+		/* waiting for tokens is no stall */
+		if(sent || throttle > 0) {
+			s->stats.progress = epoch();
+		}
+		for (size_t n = 0; n < latencies.size(); n++) {
+			sink_account(s, latencies[n].first, latencies[n].second);
+		}
+		pthread_mutex_unlock(&s->lock);
+		latencies.clear();
+
+		if(throttle > 0) {
+			usleep((useconds_t)(throttle < 100000 ? throttle : 100000));
+		}
+	}
+
+	pthread_mutex_lock(&s->lock);
+	unsigned long lost = rest.size();
+	for (size_t k = 0; k < rest.size(); k++) {
+		message_unref(rest[k]);
+	}
+	s->held = 0;
+	for (int l = 0; l < enumLaneCount; l++) {
+		while(!s->lanes[l].queue.empty()) {
+			message_unref(sink_pop(s, &s->lanes[l]));
+			lost++;
+		}
+	}
+	for (size_t r = 0; r < s->rules.size(); r++) {
+		while(!s->rules[r].pending.queue.empty()) {
+			message_unref(sink_pop(s, &s->rules[r].pending));
+			lost++;
+		}
+	}
+	s->stats.dropped += lost;
+	s->stats.depth = 0;
+	pthread_cond_broadcast(&s->space);
+	pthread_mutex_unlock(&s->lock);
+
+	if(lost) {
+		printf("[%s] shutdown deadline passed, %lu queued messages dropped.\n", s->ops->name, lost);
+	}
+
+	if(opened) {
+		s->ops->close();
+	}
+
+	return NULL;
+}
+
+int sink_start(void)
+{
+	int started = 0;
+
+	for (int i = 0; i < SINK_COUNT; i++) {
+		Sink* s = &sinks[i];
+		s->ops = plugins[i];
+		s->running = false;
+		for (int l = 0; l < enumLaneCount; l++) {
+			s->lanes[l].head = 0;
+			s->lanes[l].waiting = 0;
+			memset(&s->latency[l], 0, sizeof(LaneLatency));
+		}
+		s->held = 0;
+		s->capacity = (size_t)g_config->sinkQueueSize[i];
+		s->policy = g_config->sinkOverload[i];
+
+		const UAMQ_SinkRate* rate = &g_config->sinkRate[i];
+		rate_init(&s->rate, &rate->sink, rate->burstUSec);
+		s->rateThrottled = 0;
+		s->rules.resize(rate->topicCount);
+		for (int t = 0; t < rate->topicCount; t++) {
+			SinkRule* r = &s->rules[t];
+			r->prefix = rate->topics[t].prefix;
+			rate_init(&r->bucket, &rate->topics[t], rate->burstUSec);
+			r->pending.head = 0;
+			r->pending.waiting = 0;
+			r->throttled = 0;
+		}
+		memset(&s->stats, 0, sizeof(s->stats));
+		pthread_mutex_init(&s->lock, NULL);
+		pthread_cond_init(&s->ready, NULL);
+		pthread_cond_init(&s->space, NULL);
+
+		if(!s->ops->enabled()) {
+			continue;
+		}
+
+		if(pthread_create(&s->tid, NULL, sink_run, s) == 0) {
+			s->running = true;
+			started++;
+		}
+	}
+
+	return started;
+}
+
+/* the publishers have ended : every sink drains its queue within
+ * shutdownDeadlineUSec, closes and its thread ends */
+void sink_stop(void)
+{
+	drainDeadline = monotonic() + g_config->shutdownDeadlineUSec;
+	draining = true;
+
+	for (int i = 0; i < SINK_COUNT; i++) {
+		Sink* s = &sinks[i];
+		if(!s->running) {
+			continue;
+		}
+
+		pthread_mutex_lock(&s->lock);
+		pthread_cond_signal(&s->ready);
+		pthread_mutex_unlock(&s->lock);
+
+		pthread_join(s->tid, NULL);
+		s->running = false;
+
+		printf("[%s] sink stopped : enqueued %lu, sent %lu, failed %lu, dropped %lu, coalesced %lu, throttled %lu.\n", s->ops->name,
+			s->stats.enqueued, s->stats.sent, s->stats.failed, s->stats.dropped, s->stats.coalesced, s->stats.throttled);
+		if(s->rateThrottled) {
+			printf("[%s] rate : %lu throttled.\n", s->ops->name, s->rateThrottled);
+		}
+		for (size_t r = 0; r < s->rules.size(); r++) {
+			if(s->rules[r].throttled) {
+				printf("[%s] rate of '%s' : %lu throttled.\n", s->ops->name, s->rules[r].prefix.c_str(), s->rules[r].throttled);
+			}
+		}
+		for (int l = 0; l < enumLaneCount; l++) {
+			SinkLatency lat;
+			sink_latency(i, l, &lat);
+			if(lat.sent) {
+				printf("[%s] %s lane : %lu sent, latency p50 %lld us, p99 %lld us, max %lld us, %lu over %lld us.\n", s->ops->name,
+					getSinkLaneName(l), lat.sent, lat.p50USec, lat.p99USec, lat.maxUSec, lat.late, lat.sloUSec);
+			}
+		}
+	}
+}
+
+static int sink_targets(unsigned int mask)
+{
+	int targets = 0;
+	for (int i = 0; i < SINK_COUNT; i++) {
+		if((mask & (1u << i)) && sinks[i].running) {
+			targets++;
+		}
+	}
+	return targets;
+}
+
+/* the payload is copied once and shared by every selected sink */
+void sink_publish(unsigned int mask, const char* mode, const char* topic, const char* data, size_t len)
+{
+	if(!sink_targets(mask)) {
+		return;
+	}
+
+	char* copy = (char*)malloc(len + 1);
+	memcpy(copy, data, len);
+	copy[len] = '\0';
+	sink_publish_buffer(mask, mode, topic, copy, len, false);
+}
+
+void sink_publish_buffer(unsigned int mask, const char* mode, const char* topic, char* data, size_t len, bool binary)
+{
+	int targets = sink_targets(mask);
+	if(!targets) {
+		free(data);
+		return;
+	}
+
+	SinkMessage* msg = (SinkMessage*)malloc(sizeof(SinkMessage));
+	msg->refs = targets;
+	msg->mode = mode;
+	msg->topic = strdup(topic);
+	msg->data = data;
+	msg->len = len;
+	msg->binary = binary;
+	msg->lane = (mask & UAMQ_SINK_PRIORITY) ? enumLaneHigh : enumLaneNormal;
+	msg->queued = epoch();
+
+	for (int i = 0; i < SINK_COUNT; i++) {
+		Sink* s = &sinks[i];
+		if(!(mask & (1u << i)) || !s->running) {
+			continue;
+		}
+
+		pthread_mutex_lock(&s->lock);
+		SinkMessage* old = sink_push(s, msg);
+		pthread_mutex_unlock(&s->lock);
+
+		if(old) {
+			message_unref(old);
+		}
+	}
+}
+
+void sink_stats(int index, SinkStats* out)
+{
+	memset(out, 0, sizeof(SinkStats));
+	if(index < 0 || index >= SINK_COUNT) {
+		return;
+	}
+
+	Sink* s = &sinks[index];
+	if(!s->running) {
+		return;
+	}
+	pthread_mutex_lock(&s->lock);
+	*out = s->stats;
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* a send blocked on a full socket buffer is woken only once half of it (MBs)
+ * is sent, ahead of any lane. with little unsent data in the kernel the send
+ * returns per message and the next one comes from the lanes, high first. */
+void sink_socket(int sock)
+{
+#ifdef TCP_NOTSENT_LOWAT
+	int lowat = SINK_NOTSENT_LOWAT;
+	setsockopt(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+#endif
+}
+
+/* stats stay readable once the sink stopped, until the next sink_start */
+void sink_latency(int index, int lane, SinkLatency* out)
+{
+	memset(out, 0, sizeof(SinkLatency));
+	if(index < 0 || index >= SINK_COUNT || lane < 0 || lane >= enumLaneCount || !sinks[index].ops) {
+		return;
+	}
+
+	Sink* s = &sinks[index];
+	const LaneLatency* l = &s->latency[lane];
+	pthread_mutex_lock(&s->lock);
+	out->sent = l->sent;
+	out->late = l->late;
+	out->sloUSec = g_config->sinkSloUSec[lane];
+	out->p50USec = l->sent ? latency_percentile(l, 0.50) : 0;
+	out->p99USec = l->sent ? latency_percentile(l, 0.99) : 0;
+	out->maxUSec = l->max;
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* {"time":..,"lanes":[{"sink":"mqtt","lane":"high","sent":..,"late":..,"sloUSec":..,"p50USec":..,"p99USec":..,"maxUSec":..}, ..]}, caller frees */
+char* sink_latency_json(void)
+{
+	json_object* jobj = json_object_new_object();
+	json_object* jarr = json_object_new_array();
+
+	json_object_object_add(jobj, "time", json_object_new_int64(epoch()));
+	for (int i = 0; i < SINK_COUNT; i++) {
+		if(!sinks[i].running) {
+			continue;
+		}
+		for (int l = 0; l < enumLaneCount; l++) {
+			SinkLatency lat;
+			sink_latency(i, l, &lat);
+
+			json_object* jl = json_object_new_object();
+			json_object_object_add(jl, "sink", json_object_new_string(getSinkName(i)));
+			json_object_object_add(jl, "lane", json_object_new_string(getSinkLaneName(l)));
+			json_object_object_add(jl, "sent", json_object_new_int64(lat.sent));
+			json_object_object_add(jl, "late", json_object_new_int64(lat.late));
+			json_object_object_add(jl, "sloUSec", json_object_new_int64(lat.sloUSec));
+			json_object_object_add(jl, "p50USec", json_object_new_int64(lat.p50USec));
+			json_object_object_add(jl, "p99USec", json_object_new_int64(lat.p99USec));
+			json_object_object_add(jl, "maxUSec", json_object_new_int64(lat.maxUSec));
+			json_object_array_add(jarr, jl);
+		}
+	}
+	json_object_object_add(jobj, "lanes", jarr);
+
+	char* out = strdup(json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN));
+	json_object_put(jobj);
+
+	return out;
+}
+
+static json_object* rate_json(const char* sink, const char* prefix, const RateBucket* b, unsigned long throttled, size_t waiting)
+{
+	json_object* jr = json_object_new_object();
+	json_object_object_add(jr, "sink", json_object_new_string(sink));
+	json_object_object_add(jr, "prefix", json_object_new_string(prefix));
+	json_object_object_add(jr, "msgsPerSec", json_object_new_double(b->rate[0]));
+	json_object_object_add(jr, "bytesPerSec", json_object_new_double(b->rate[1]));
+	json_object_object_add(jr, "throttled", json_object_new_int64(throttled));
+	json_object_object_add(jr, "waiting", json_object_new_int64(waiting));
+	return jr;
+}
+
+/* {"time":..,"rates":[{"sink":"mqtt","prefix":"","msgsPerSec":..,"bytesPerSec":..,"throttled":..,"waiting":..}, ..]},
+ * prefix "" : the sink's own rate, its waiting messages are the whole queue. caller frees */
+char* sink_rate_json(void)
+{
+	json_object* jobj = json_object_new_object();
+	json_object* jarr = json_object_new_array();
+
+	json_object_object_add(jobj, "time", json_object_new_int64(epoch()));
+	for (int i = 0; i < SINK_COUNT; i++) {
+		Sink* s = &sinks[i];
+		if(!s->running) {
+			continue;
+		}
+		pthread_mutex_lock(&s->lock);
+		json_object_array_add(jarr, rate_json(s->ops->name, "", &s->rate, s->rateThrottled, sink_depth(s)));
+		for (size_t r = 0; r < s->rules.size(); r++) {
+			const SinkRule* rule = &s->rules[r];
+			json_object_array_add(jarr, rate_json(s->ops->name, rule->prefix.c_str(), &rule->bucket, rule->throttled, rule->pending.queue.size()));
+		}
+		pthread_mutex_unlock(&s->lock);
+	}
+	json_object_object_add(jobj, "rates", jarr);
+
+	char* out = strdup(json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN));
+	json_object_put(jobj);
+
+	return out;
+}
+
+/* the sink thread sees its send fail, closes and opens a new connection */
+bool sink_abort(int index)
+{
+	if(index < 0 || index >= SINK_COUNT || !sinks[index].running || !sinks[index].ops->abort) {
+		return false;
+	}
+
+	sinks[index].ops->abort();
+	return true;
+}
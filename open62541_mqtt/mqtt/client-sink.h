@@ -0,0 +1,129 @@
+#ifndef OPCUA_MQTT_BRIDGE_SINK_H_
+#define OPCUA_MQTT_BRIDGE_SINK_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define UAMQ_MAX_SINKS 8
+#define UAMQ_SINK_QUEUE_MAX 4096
+
+/* in a sink mask : the message takes the high lane of every sink */
+#define UAMQ_SINK_PRIORITY 0x80000000u
+
+/* every sink queue has a lane per priority class, the high one is always sent first */
+enum enumSinkLane {
+	enumLaneNormal,
+	enumLaneHigh,
+	enumLaneCount
+};
+
+const char* getSinkLaneName(int lane);
+
+/* what a full sink queue does with the next message */
+enum enumOverloadPolicy {
+	enumOverloadBlock,		/* the publisher waits for room */
+	enumOverloadDropOldest,
+	enumOverloadDropNewest,
+	enumOverloadCoalesceLatest,	/* one queued message per topic, replaced in place */
+	enumOverloadUnknown		/* not a policy name, refused when the config is loaded */
+};
+
+enum enumOverloadPolicy getOverloadPolicy(const char*);
+
+#define UAMQ_MAX_RATE_TOPICS 16
+
+/* a token bucket : msgs and bytes per second (0 : no limit), bursts of burstUSec worth of them */
+typedef struct {
+	char prefix[128];	/* topics : the full topic starts with it, the longest prefix wins */
+	double msgsPerSec;
+	double bytesPerSec;
+} UAMQ_RateLimit;
+
+/* "rate" of a sink section : the sink's own bucket and per topic prefix ones */
+typedef struct {
+	UAMQ_RateLimit sink;
+	int burstUSec;
+	UAMQ_RateLimit topics[UAMQ_MAX_RATE_TOPICS];
+	int topicCount;
+} UAMQ_SinkRate;
+
+/* an encoded payload, queued on every sink of the group and freed by the last one */
+typedef struct {
+	int refs;
+	const char* mode;
+	char* topic;
+	char* data;
+	size_t len;
+	bool binary;		/* cbor : not text, the tcp sink needs its length framing */
+	int lane;
+	long long queued;	/* unix us of the publish, the latency runs from here to the send */
+} SinkMessage;
+
+typedef struct {
+	unsigned long enqueued;
+	unsigned long sent;
+	unsigned long failed;
+	unsigned long dropped;
+	unsigned long coalesced;
+	unsigned long throttled;	/* messages that waited for the tokens of a rate */
+	unsigned long depth;
+	long long progress;	/* unix us of the last send or of an empty queue, 0 before the thread runs */
+} SinkStats;
+
+/* publish to send of one lane, percentiles within a quarter of a power of 2 */
+typedef struct {
+	unsigned long sent;
+	unsigned long late;	/* over sloUSec */
+	long long sloUSec;
+	long long p50USec;
+	long long p99USec;
+	long long maxUSec;
+} SinkLatency;
+
+/* a sink plugin. open, send, flush and close run on the sink's own thread,
+ * open is retried every second until it returns 0. abort (optional) runs on
+ * the watchdog thread : it breaks the connection under a stuck send. */
+typedef struct {
+	const char* name;
+	bool (*enabled)(void);
+	int (*open)(void);
+	int (*send)(const SinkMessage* msg);
+	int (*flush)(void);
+	void (*close)(void);
+	void (*abort)(void);
+} SinkOps;
+
+extern const SinkOps mqttSink;
+extern const SinkOps tcpSink;
+#ifdef UAMQ_ENABLE_AMQP
+extern const SinkOps amqpSink;
+#endif
+
+int getSinkIndex(const char* name);
+const char* getSinkName(int index);
+int getSinkCount(void);
+
+int sink_start(void);
+void sink_stop(void);
+void sink_publish(unsigned int sinks, const char* mode, const char* topic, const char* data, size_t len);
+/* the same without a copy : data (malloc'ed) belongs to the sinks from now on */
+void sink_publish_buffer(unsigned int sinks, const char* mode, const char* topic, char* data, size_t len, bool binary);
+/* called by a sink plugin on its connected socket */
+void sink_socket(int sock);
+void sink_stats(int index, SinkStats* out);
+void sink_latency(int index, int lane, SinkLatency* out);
+char* sink_latency_json(void);
+char* sink_rate_json(void);
+bool sink_abort(int index);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_SINK_H_ */
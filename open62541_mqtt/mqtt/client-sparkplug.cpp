@@ -0,0 +1,634 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_client.h"
+# include "ua_client_highlevel.h"
+# include "ua_nodeids.h"
+# include "ua_network_tcp.h"
+# include "ua_config_standard.h"
+#else
+# include "open62541.h"
+# include <string.h>
+# include <stdlib.h>
+# include <stdio.h>
+#endif
+
+#include <pthread.h>
+
+#include <map>
+#include <string>
+using namespace std;
+
+#include "client-nodemap.h"
+#include "client-config.h"
+#include "client-sparkplug.h"
+
+extern UAMQ_Configuration* g_config;
+
+int64_t epoch(void);
+
+/* Payload and Payload.Metric fields of sparkplug_b.proto */
+#define PB_VARINT	0
+#define PB_FIXED64	1
+#define PB_LEN		2
+#define PB_FIXED32	5
+
+#define SPB_PAYLOAD_TIMESTAMP	1
+#define SPB_PAYLOAD_METRICS	2
+#define SPB_PAYLOAD_SEQ		3
+
+#define SPB_METRIC_NAME		1
+#define SPB_METRIC_ALIAS	2
+#define SPB_METRIC_TIMESTAMP	3
+#define SPB_METRIC_DATATYPE	4
+#define SPB_METRIC_IS_NULL	7
+#define SPB_METRIC_INT		10
+#define SPB_METRIC_LONG		11
+#define SPB_METRIC_FLOAT	12
+#define SPB_METRIC_DOUBLE	13
+#define SPB_METRIC_BOOLEAN	14
+#define SPB_METRIC_STRING	15
+#define SPB_METRIC_BYTES	16
+
+/* Sparkplug B datatypes */
+#define SPB_INT8	1
+#define SPB_INT16	2
+#define SPB_INT32	3
+#define SPB_INT64	4
+#define SPB_UINT8	5
+#define SPB_UINT16	6
+#define SPB_UINT32	7
+#define SPB_UINT64	8
+#define SPB_FLOAT	9
+#define SPB_DOUBLE	10
+#define SPB_BOOLEAN	11
+#define SPB_STRING	12
+#define SPB_DATETIME	13
+#define SPB_BYTES	17
+#define SPB_ARRAY	21	/* Int8Array 22 .. DoubleArray 31 : SPB_ARRAY + scalar type */
+#define SPB_STRING_ARRAY	33
+#define SPB_DATETIME_ARRAY	34
+
+#define SPB_REBIRTH "Node Control/Rebirth"
+
+/* device states : a DBIRTH is encoded for an unborn device, sent for a
+ * pending one. a DDATA reaches the broker only after the DBIRTH did */
+enum { SPB_UNBORN, SPB_PENDING, SPB_BORN };
+
+typedef struct {
+	int state;
+	uint64_t base;	/* alias of the first node, the others follow in node-map order */
+} SpbDevice;
+
+static pthread_mutex_t spbLock = PTHREAD_MUTEX_INITIALIZER;
+static map<string, SpbDevice> devices;
+static uint64_t nextAlias = 0;
+static unsigned int seq = 0;
+static int bdSeq = -1;
+
+typedef struct {
+	char* data;
+	size_t len;
+	size_t cap;
+} SpbBuf;
+
+static void pb_init(SpbBuf* b, size_t cap)
+{
+	b->cap = cap ? cap : 256;
+	b->data = (char*)malloc(b->cap);
+	b->len = 0;
+}
+
+static char* pb_room(SpbBuf* b, size_t n)
+{
+	if(b->len + n > b->cap) {
+		while(b->len + n > b->cap) {
+			b->cap *= 2;
+		}
+		b->data = (char*)realloc(b->data, b->cap);
+	}
+	char* at = b->data + b->len;
+	b->len += n;
+	return at;
+}
+
+static void pb_varint(SpbBuf* b, uint64_t v)
+{
+	char* p = pb_room(b, 10);
+	size_t n = 0;
+	while(v >= 0x80) {
+		p[n++] = (char)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (char)v;
+	b->len -= 10 - n;
+}
+
+static void pb_tag(SpbBuf* b, int field, int wire)
+{
+	pb_varint(b, (uint64_t)(field << 3 | wire));
+}
+
+static void pb_uint(SpbBuf* b, int field, uint64_t v)
+{
+	pb_tag(b, field, PB_VARINT);
+	pb_varint(b, v);
+}
+
+static void pb_bytes(SpbBuf* b, int field, const void* data, size_t len)
+{
+	pb_tag(b, field, PB_LEN);
+	pb_varint(b, len);
+	if(len) {
+		memcpy(pb_room(b, len), data, len);
+	}
+}
+
+/* fixed width, little endian whatever the host */
+static void pb_le(SpbBuf* b, uint64_t v, int bytes)
+{
+	char* p = pb_room(b, bytes);
+	for (int k = 0; k < bytes; k++) {
+		p[k] = (char)(v & 0xff);
+		v >>= 8;
+	}
+}
+
+static int64_t unix_ms(UA_DateTime t)
+{
+	return (int64_t)((t - UA_DATETIME_UNIX_EPOCH) / UA_MSEC_TO_DATETIME);
+}
+
+/* Sparkplug datatype of a scalar type, 0 : not supported */
+static int spb_scalar_type(int typeIndex)
+{
+	switch(typeIndex) {
+		case UA_TYPES_SBYTE : return SPB_INT8;
+		case UA_TYPES_INT16 : return SPB_INT16;
+		case UA_TYPES_INT32 : return SPB_INT32;
+		case UA_TYPES_INT64 : return SPB_INT64;
+		case UA_TYPES_BYTE : return SPB_UINT8;
+		case UA_TYPES_UINT16 : return SPB_UINT16;
+		case UA_TYPES_UINT32 : return SPB_UINT32;
+		case UA_TYPES_UINT64 : return SPB_UINT64;
+		case UA_TYPES_FLOAT : return SPB_FLOAT;
+		case UA_TYPES_DOUBLE : return SPB_DOUBLE;
+		case UA_TYPES_BOOLEAN : return SPB_BOOLEAN;
+		case UA_TYPES_STRING : return SPB_STRING;
+		case UA_TYPES_DATETIME : return SPB_DATETIME;
+		case UA_TYPES_BYTESTRING : return SPB_BYTES;
+		default : return 0;
+	}
+}
+
+/* arrays of numbers, strings and DateTime, flattened : a Sparkplug array has
+ * no dimensions. boolean and ByteString arrays are not supported */
+static int spb_type(const UA_Variant* v)
+{
+	if(!v->type) {
+		return 0;
+	}
+	int t = spb_scalar_type(v->type->typeIndex);
+	if(UA_Variant_isScalar(v) || !t) {
+		return t;
+	}
+	if(t <= SPB_DOUBLE) {
+		return SPB_ARRAY + t;
+	} else if(t == SPB_STRING) {
+		return SPB_STRING_ARRAY;
+	} else if(t == SPB_DATETIME) {
+		return SPB_DATETIME_ARRAY;
+	}
+	return 0;
+}
+
+/* the value field of a metric of datatype t */
+static void spb_value(SpbBuf* m, int t, const UA_Variant* v)
+{
+	const void* p = v->data;
+
+	switch(t) {
+		case SPB_INT8 : pb_uint(m, SPB_METRIC_INT, (uint32_t)(int32_t)*(const UA_SByte*)p); break;
+		case SPB_INT16 : pb_uint(m, SPB_METRIC_INT, (uint32_t)(int32_t)*(const UA_Int16*)p); break;
+		case SPB_INT32 : pb_uint(m, SPB_METRIC_INT, (uint32_t)*(const UA_Int32*)p); break;
+		case SPB_UINT8 : pb_uint(m, SPB_METRIC_INT, *(const UA_Byte*)p); break;
+		case SPB_UINT16 : pb_uint(m, SPB_METRIC_INT, *(const UA_UInt16*)p); break;
+		case SPB_UINT32 : pb_uint(m, SPB_METRIC_INT, *(const UA_UInt32*)p); break;
+		case SPB_INT64 : pb_uint(m, SPB_METRIC_LONG, (uint64_t)*(const UA_Int64*)p); break;
+		case SPB_UINT64 : pb_uint(m, SPB_METRIC_LONG, *(const UA_UInt64*)p); break;
+		case SPB_BOOLEAN : pb_uint(m, SPB_METRIC_BOOLEAN, *(const UA_Boolean*)p ? 1 : 0); break;
+		case SPB_DATETIME : pb_uint(m, SPB_METRIC_LONG, (uint64_t)unix_ms(*(const UA_DateTime*)p)); break;
+		case SPB_FLOAT : {
+			uint32_t u;
+			memcpy(&u, p, sizeof(u));
+			pb_tag(m, SPB_METRIC_FLOAT, PB_FIXED32);
+			pb_le(m, u, 4);
+		}
+		break;
+		case SPB_DOUBLE : {
+			uint64_t u;
+			memcpy(&u, p, sizeof(u));
+			pb_tag(m, SPB_METRIC_DOUBLE, PB_FIXED64);
+			pb_le(m, u, 8);
+		}
+		break;
+		case SPB_STRING : {
+			const UA_String* s = (const UA_String*)p;
+			pb_bytes(m, SPB_METRIC_STRING, s->data, s->length);
+		}
+		break;
+		case SPB_BYTES : {
+			const UA_ByteString* s = (const UA_ByteString*)p;
+			pb_bytes(m, SPB_METRIC_BYTES, s->data, s->length);
+		}
+		break;
+		case SPB_STRING_ARRAY : {
+			/* null terminated strings one after the other */
+			size_t total = 0;
+			for (size_t k = 0; k < v->arrayLength; k++) {
+				total += ((const UA_String*)p)[k].length + 1;
+			}
+			pb_tag(m, SPB_METRIC_BYTES, PB_LEN);
+			pb_varint(m, total);
+			for (size_t k = 0; k < v->arrayLength; k++) {
+				const UA_String* s = &((const UA_String*)p)[k];
+				char* at = pb_room(m, s->length + 1);
+				if(s->length) {
+					memcpy(at, s->data, s->length);
+				}
+				at[s->length] = '\0';
+			}
+		}
+		break;
+		case SPB_DATETIME_ARRAY : {
+			pb_tag(m, SPB_METRIC_BYTES, PB_LEN);
+			pb_varint(m, v->arrayLength * 8);
+			for (size_t k = 0; k < v->arrayLength; k++) {
+				pb_le(m, (uint64_t)unix_ms(((const UA_DateTime*)p)[k]), 8);
+			}
+		}
+		break;
+		default : {
+			/* numbers : packed little endian, the raw memory on such a host */
+			size_t size = v->type->memSize;
+			pb_tag(m, SPB_METRIC_BYTES, PB_LEN);
+			pb_varint(m, v->arrayLength * size);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			for (size_t k = 0; k < v->arrayLength; k++) {
+				uint64_t u = 0;
+				memcpy((char*)&u + sizeof(u) - size, (const char*)p + k * size, size);
+				pb_le(m, u, (int)size);
+			}
+#else
+			if(v->arrayLength) {
+				memcpy(pb_room(m, v->arrayLength * size), p, v->arrayLength * size);
+			}
+#endif
+		}
+		break;
+	}
+}
+
+/* metric m is appended to the payload as field 2 */
+static void spb_metric_end(SpbBuf* b, SpbBuf* m)
+{
+	pb_bytes(b, SPB_PAYLOAD_METRICS, m->data, m->len);
+	m->len = 0;
+}
+
+/* the placeholder of sparkplug_sequence : a two byte varint, the value is
+ * written into the copy that is sent */
+static void spb_seq_room(SpbBuf* b)
+{
+	char* p = pb_room(b, SPB_SEQ_ROOM);
+	p[0] = (char)(SPB_PAYLOAD_SEQ << 3 | PB_VARINT);
+	p[1] = (char)0x80;
+	p[2] = 0;
+}
+
+/* Sparkplug ids must not hold '/', '+' or '#' */
+static void spb_device_id(const Group* p, char* out, size_t size)
+{
+	snprintf(out, size, "%s", p->topic);
+	for (char* c = out; *c; c++) {
+		if(*c == '/' || *c == '+' || *c == '#') {
+			*c = '_';
+		}
+	}
+}
+
+static void spb_topic(char* out, size_t size, const char* type, const char* device)
+{
+	if(device) {
+		snprintf(out, size, "spBv1.0/%s/%s/%s/%s", g_config->spbGroupId, type, g_config->spbEdgeNodeId, device);
+	} else {
+		snprintf(out, size, "spBv1.0/%s/%s/%s", g_config->spbGroupId, type, g_config->spbEdgeNodeId);
+	}
+}
+
+void sparkplug_death(const char** topic, const char** payload, int* len)
+{
+	static char deathTopic[192];
+	static SpbBuf death = { NULL, 0, 0 };
+
+	pthread_mutex_lock(&spbLock);
+	bdSeq = (bdSeq + 1) % 256;
+	int bd = bdSeq;
+	pthread_mutex_unlock(&spbLock);
+
+	spb_topic(deathTopic, sizeof(deathTopic), "NDEATH", NULL);
+
+	if(!death.data) {
+		pb_init(&death, 64);
+	}
+	death.len = 0;
+
+	SpbBuf m;
+	pb_init(&m, 32);
+	pb_uint(&death, SPB_PAYLOAD_TIMESTAMP, (uint64_t)(epoch() / 1000));
+	pb_bytes(&m, SPB_METRIC_NAME, "bdSeq", 5);
+	pb_uint(&m, SPB_METRIC_DATATYPE, SPB_UINT64);
+	pb_uint(&m, SPB_METRIC_LONG, (uint64_t)bd);
+	spb_metric_end(&death, &m);
+	free(m.data);
+
+	*topic = deathTopic;
+	*payload = death.data;
+	*len = (int)death.len;
+}
+
+char* sparkplug_node_birth(char* topic, size_t size, size_t* len)
+{
+	spb_topic(topic, size, "NBIRTH", NULL);
+
+	SpbBuf b, m;
+	pb_init(&b, 128);
+	pb_init(&m, 64);
+
+	pthread_mutex_lock(&spbLock);
+	pb_uint(&b, SPB_PAYLOAD_TIMESTAMP, (uint64_t)(epoch() / 1000));
+
+	pb_bytes(&m, SPB_METRIC_NAME, "bdSeq", 5);
+	pb_uint(&m, SPB_METRIC_DATATYPE, SPB_UINT64);
+	pb_uint(&m, SPB_METRIC_LONG, (uint64_t)(bdSeq < 0 ? 0 : bdSeq));
+	spb_metric_end(&b, &m);
+
+	pb_bytes(&m, SPB_METRIC_NAME, SPB_REBIRTH, strlen(SPB_REBIRTH));
+	pb_uint(&m, SPB_METRIC_DATATYPE, SPB_BOOLEAN);
+	pb_uint(&m, SPB_METRIC_BOOLEAN, 0);
+	spb_metric_end(&b, &m);
+
+	pb_uint(&b, SPB_PAYLOAD_SEQ, 0);
+	seq = 1;
+
+	map<string, SpbDevice>::iterator i;
+	for (i = devices.begin(); i != devices.end(); ++i) {
+		i->second.state = SPB_UNBORN;
+	}
+	pthread_mutex_unlock(&spbLock);
+
+	free(m.data);
+	*len = b.len;
+	return b.data;
+}
+
+const char* sparkplug_command_topic(void)
+{
+	static char filter[192];
+	spb_topic(filter, sizeof(filter), "NCMD", NULL);
+	return filter;
+}
+
+static bool pb_read_varint(const unsigned char** p, const unsigned char* end, uint64_t* v)
+{
+	*v = 0;
+	for (int shift = 0; *p < end && shift < 64; shift += 7) {
+		unsigned char c = *(*p)++;
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		if(!(c & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* the field at p, its payload in [*data, *data + *size) or its varint in *v */
+static bool pb_read_field(const unsigned char** p, const unsigned char* end, int* field, int* wire, uint64_t* v, const unsigned char** data, size_t* size)
+{
+	uint64_t tag;
+	if(!pb_read_varint(p, end, &tag)) {
+		return false;
+	}
+	*field = (int)(tag >> 3);
+	*wire = (int)(tag & 7);
+
+	switch(*wire) {
+		case PB_VARINT : return pb_read_varint(p, end, v);
+		case PB_FIXED64 : *p += 8; break;
+		case PB_FIXED32 : *p += 4; break;
+		case PB_LEN : {
+			if(!pb_read_varint(p, end, v) || *v > (uint64_t)(end - *p)) {
+				return false;
+			}
+			*data = *p;
+			*size = (size_t)*v;
+			*p += *size;
+		}
+		break;
+		default : return false;
+	}
+	return *p <= end;
+}
+
+bool sparkplug_command(const unsigned char* payload, int len)
+{
+	const unsigned char* p = payload;
+	const unsigned char* end = payload + len;
+	int field, wire;
+	uint64_t v;
+	const unsigned char* data;
+	size_t size;
+
+	while(p < end && pb_read_field(&p, end, &field, &wire, &v, &data, &size)) {
+		if(field != SPB_PAYLOAD_METRICS || wire != PB_LEN) {
+			continue;
+		}
+
+		const unsigned char* q = data;
+		const unsigned char* qend = data + size;
+		bool rebirth = false, value = false;
+		const unsigned char* name;
+		size_t nameLen;
+		while(q < qend && pb_read_field(&q, qend, &field, &wire, &v, &name, &nameLen)) {
+			if(field == SPB_METRIC_NAME && wire == PB_LEN) {
+				rebirth = nameLen == strlen(SPB_REBIRTH) && !memcmp(name, SPB_REBIRTH, nameLen);
+			} else if(field == SPB_METRIC_BOOLEAN && wire == PB_VARINT) {
+				value = v != 0;
+			}
+		}
+		if(rebirth && value) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool sparkplug_sequence(const SinkMessage* msg, unsigned char* payload)
+{
+	if(strncmp(msg->topic, "spBv1.0/", 8) || msg->len < SPB_SEQ_ROOM) {
+		return true;
+	}
+	const char* device = strrchr(msg->topic, '/') + 1;
+
+	pthread_mutex_lock(&spbLock);
+	map<string, SpbDevice>::iterator i = devices.find(device);
+	if(!strcmp(msg->mode, "DBIRTH")) {
+		if(i != devices.end()) {
+			i->second.state = SPB_BORN;
+		}
+	} else if(!strcmp(msg->mode, "DDATA")) {
+		if(i == devices.end() || i->second.state != SPB_BORN) {
+			/* the DBIRTH was lost or came before the NBIRTH */
+			if(i != devices.end()) {
+				i->second.state = SPB_UNBORN;
+			}
+			pthread_mutex_unlock(&spbLock);
+			return false;
+		}
+	}
+
+	unsigned char* at = payload + msg->len - 2;
+	at[0] = (unsigned char)(0x80 | (seq & 0x7f));
+	at[1] = (unsigned char)(seq >> 7);
+	seq = (seq + 1) % 256;
+	pthread_mutex_unlock(&spbLock);
+
+	return true;
+}
+
+void sparkplug_publish(Group* p, Node* const* nodes, const UA_DataValue* values, size_t count, int ts, int64_t now)
+{
+	char device[64];
+	spb_device_id(p, device, sizeof(device));
+
+	bool birth = false;
+	size_t good = 0;
+	for (size_t r = 0; r < count; r++) {
+		const UA_DataValue* dv = &values[r];
+		if(!dv->hasValue || !dv->value.type || (dv->hasStatus && dv->status != UA_STATUSCODE_GOOD)) {
+			continue;
+		}
+		int t = spb_type(&dv->value);
+		if(!t) {
+			printf("not supported dataType : %s, typeIndex:%d\n", dv->value.type->typeName, dv->value.type->typeIndex);
+			continue;
+		}
+		/* a new datatype is announced by a DBIRTH */
+		birth |= nodes[r]->spbType != t;
+		good++;
+	}
+	if(!good) {
+		return;
+	}
+
+	pthread_mutex_lock(&spbLock);
+	map<string, SpbDevice>::iterator i = devices.find(device);
+	if(i == devices.end()) {
+		SpbDevice dev = { SPB_UNBORN, nextAlias };
+		nextAlias += p->nodes.size();
+		i = devices.insert(pair<string, SpbDevice>(device, dev)).first;
+	}
+	birth |= i->second.state == SPB_UNBORN;
+	if(birth) {
+		i->second.state = SPB_PENDING;
+	}
+	uint64_t base = i->second.base;
+	pthread_mutex_unlock(&spbLock);
+
+	SpbBuf b, m;
+	pb_init(&b, (birth ? 48 : 16) * (birth ? p->nodes.size() : good) + 32);
+	pb_init(&m, 64);
+	pb_uint(&b, SPB_PAYLOAD_TIMESTAMP, (uint64_t)(now / 1000));
+
+	if(birth) {
+		/* every node of the group : the ones without a value in this message
+		 * are null, the ones that never had a value are left out */
+		map<Node*, const UA_DataValue*> sample;
+		for (size_t r = 0; r < count; r++) {
+			sample[nodes[r]] = &values[r];
+		}
+
+		uint64_t alias = base;
+		map<int, Node>::iterator n;
+		for (n = p->nodes.begin(); n != p->nodes.end(); ++n, alias++) {
+			Node* d = (Node*)&n->second;
+			d->spbAlias = alias;
+
+			map<Node*, const UA_DataValue*>::iterator s = sample.find(d);
+			const UA_DataValue* dv = s == sample.end() ? NULL : s->second;
+			int t = 0;
+			if(dv && dv->hasValue && dv->value.type && !(dv->hasStatus && dv->status != UA_STATUSCODE_GOOD)) {
+				t = spb_type(&dv->value);
+			}
+			if(t) {
+				d->spbType = t;
+			} else if(!d->spbType) {
+				continue;
+			}
+
+			pb_bytes(&m, SPB_METRIC_NAME, d->alias, strlen(d->alias));
+			pb_uint(&m, SPB_METRIC_ALIAS, alias);
+			pb_uint(&m, SPB_METRIC_DATATYPE, (uint64_t)d->spbType);
+			if(t) {
+				pb_uint(&m, SPB_METRIC_TIMESTAMP, (uint64_t)(datavalue_time(dv, (enumTimestampSource)ts, now) / 1000));
+				spb_value(&m, t, &dv->value);
+			} else {
+				pb_uint(&m, SPB_METRIC_IS_NULL, 1);
+			}
+			spb_metric_end(&b, &m);
+		}
+	} else {
+		for (size_t r = 0; r < count; r++) {
+			const UA_DataValue* dv = &values[r];
+			Node* d = nodes[r];
+			if(!dv->hasValue || !dv->value.type || (dv->hasStatus && dv->status != UA_STATUSCODE_GOOD) || !d->spbType || spb_type(&dv->value) != d->spbType) {
+				continue;
+			}
+			pb_uint(&m, SPB_METRIC_ALIAS, d->spbAlias);
+			pb_uint(&m, SPB_METRIC_TIMESTAMP, (uint64_t)(datavalue_time(dv, (enumTimestampSource)ts, now) / 1000));
+			spb_value(&m, d->spbType, &dv->value);
+			spb_metric_end(&b, &m);
+		}
+	}
+	free(m.data);
+	spb_seq_room(&b);
+
+	char topic[256];
+	spb_topic(topic, sizeof(topic), birth ? "DBIRTH" : "DDATA", device);
+	sink_publish_buffer(p->sinks, birth ? "DBIRTH" : "DDATA", topic, b.data, b.len, true);
+}
+
+void sparkplug_device_death(Group* p)
+{
+	if(getPayloadFormat(p->format) != enumSparkplug) {
+		return;
+	}
+
+	char device[64];
+	spb_device_id(p, device, sizeof(device));
+
+	pthread_mutex_lock(&spbLock);
+	devices.erase(device);
+	pthread_mutex_unlock(&spbLock);
+
+	SpbBuf b;
+	pb_init(&b, 32);
+	pb_uint(&b, SPB_PAYLOAD_TIMESTAMP, (uint64_t)(epoch() / 1000));
+	spb_seq_room(&b);
+
+	char topic[256];
+	spb_topic(topic, sizeof(topic), "DDEATH", device);
+	sink_publish_buffer(p->sinks, "DDEATH", topic, b.data, b.len, true);
+}
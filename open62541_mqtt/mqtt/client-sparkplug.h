@@ -0,0 +1,68 @@
+#ifndef OPCUA_MQTT_BRIDGE_SPARKPLUG_H_
+#define OPCUA_MQTT_BRIDGE_SPARKPLUG_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+#else
+# include "open62541.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "client-sink.h"
+
+struct Node;
+struct Group;
+
+/* Sparkplug B (Eclipse Tahu payload, protobuf) over the mqtt sink. the bridge
+ * is the edge node '<edgeNodeId>' of '<groupId>', a group of format
+ * "sparkplug" is one device named after its topic :
+ *
+ *   spBv1.0/<groupId>/NBIRTH|NDEATH/<edgeNodeId>
+ *   spBv1.0/<groupId>/DBIRTH|DDATA|DDEATH/<edgeNodeId>/<device>
+ *
+ * a DBIRTH carries the name, alias and datatype of every node, a DDATA only
+ * aliases and values. the seq of a device message is given by the mqtt sink
+ * when it is sent, the encoder leaves SPB_SEQ_ROOM bytes for it at the end. */
+#define SPB_SEQ_ROOM 3
+
+/* mqtt thread, before CONNECT : the NDEATH of the next connection, the Will.
+ * bdSeq moves on, the payload stays valid until the next call */
+void sparkplug_death(const char** topic, const char** payload, int* len);
+
+/* mqtt thread, after CONNACK : the NBIRTH (seq 0) of the connection, every
+ * device is born again with its next message. the buffer is malloc'ed */
+char* sparkplug_node_birth(char* topic, size_t size, size_t* len);
+
+/* NCMD filter of the edge node */
+const char* sparkplug_command_topic(void);
+
+/* an NCMD payload, true when it asks for "Node Control/Rebirth" */
+bool sparkplug_command(const unsigned char* payload, int len);
+
+/* mqtt sink, right before the send : writes the seq of a device message
+ * into payload, the copy of msg->data in the packet (msg may be queued on
+ * other sinks too). false when it is dropped (the DDATA of a device not born
+ * since the NBIRTH, its next message is a DBIRTH). others are left as they are */
+bool sparkplug_sequence(const SinkMessage* msg, unsigned char* payload);
+
+/* the good values of one read or notification of a group, values[r] belongs
+ * to nodes[r]. a DBIRTH when the device is not born or a datatype changed */
+void sparkplug_publish(struct Group* p, struct Node* const* nodes, const UA_DataValue* values, size_t count, int ts, int64_t now);
+
+/* reload : the group is stopped, DDEATH. a restarted group is born again */
+void sparkplug_device_death(struct Group* p);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_SPARKPLUG_H_ */
@@ -0,0 +1,702 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_types_generated.h"
+#else
+# include "open62541.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <map>
+#include <algorithm>
+using namespace std;
+
+#include "client-config.h"
+#include "client-nodemap.h"
+#include "client-segment.h"
+#include "client-record.h"
+#include "client-store.h"
+#include "client-thread.h"
+
+extern int beStop;
+
+extern map<int, Group>* gmap;
+extern UAMQ_Configuration* g_config;
+
+int64_t epoch(void);
+
+/* samples waiting for the writer, the next ones are dropped (and counted) */
+#define STORE_PENDING_MAX (1 << 20)
+
+typedef struct {
+	int node;	/* store id, index of storePaths */
+	uint16_t type;
+	uint32_t status;
+	int64_t t;
+	uint64_t v;	/* float64 bits or int64, see store_value */
+} StoreSample;
+
+/* an open segment file, written by the writer thread only */
+typedef struct {
+	int fd;
+	string file;
+	off_t size;
+	map<int, uint32_t> ids;	/* store id -> node id of the file */
+	uint32_t next;
+	SegmentBuf out;
+} Partition;
+
+typedef struct {
+	SegmentBlock block;
+	int64_t partition;
+	bool open;
+} StoreColumns;
+
+/* nodes by '<group topic>/<node topic>' : a reload gives the same node the same id */
+static map<string, int> storeIds;
+static vector<string> storePaths;
+
+static vector<StoreSample> pending;
+static unsigned long dropped = 0;
+static pthread_mutex_t storeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t storeWake = PTHREAD_COND_INITIALIZER;
+static volatile bool storing = false;
+static bool stopping = false;
+static pthread_t storeThread;
+
+/* writer thread */
+static vector<StoreColumns> columns;
+static map<int64_t, Partition> partitions;
+static unsigned long samplesWritten = 0, blocksWritten = 0, failed = 0;
+static unsigned long long bytesWritten = 0;
+
+static int64_t partition_of(int64_t t)
+{
+	int64_t length = g_config->storePartitionUSec;
+	int64_t start = t - t % length;
+	return (t < 0 && t % length) ? start - length : start;
+}
+
+/* numbers, bool and DateTime (unix us), like the gorilla format */
+static bool store_value(const UA_Variant* val, uint64_t* v)
+{
+	const void* p = val->data;
+	double d = 0;
+	int64_t i = 0;
+
+	switch(val->type->typeIndex) {
+		case UA_TYPES_FLOAT : d = *(const UA_Float*)p; memcpy(v, &d, sizeof(d)); return true;
+		case UA_TYPES_DOUBLE : d = *(const UA_Double*)p; memcpy(v, &d, sizeof(d)); return true;
+		case UA_TYPES_BOOLEAN : i = *(const UA_Boolean*)p ? 1 : 0; break;
+		case UA_TYPES_SBYTE : i = *(const UA_SByte*)p; break;
+		case UA_TYPES_BYTE : i = *(const UA_Byte*)p; break;
+		case UA_TYPES_INT16 : i = *(const UA_Int16*)p; break;
+		case UA_TYPES_UINT16 : i = *(const UA_UInt16*)p; break;
+		case UA_TYPES_INT32 : i = *(const UA_Int32*)p; break;
+		case UA_TYPES_UINT32 : i = *(const UA_UInt32*)p; break;
+		case UA_TYPES_INT64 : i = *(const UA_Int64*)p; break;
+		case UA_TYPES_UINT64 : i = (int64_t)*(const UA_UInt64*)p; break;
+		case UA_TYPES_DATETIME : i = (*(const UA_DateTime*)p - UA_DATETIME_UNIX_EPOCH) / UA_USEC_TO_DATETIME; break;
+		default : return false;
+	}
+	*v = (uint64_t)i;
+	return true;
+}
+
+static int store_kind(uint16_t type)
+{
+	return (type == UA_TYPES_FLOAT || type == UA_TYPES_DOUBLE) ? GORILLA_FLOAT : GORILLA_INT;
+}
+
+/* caller holds storeLock */
+static int store_id(const string& path)
+{
+	map<string, int>::iterator i = storeIds.find(path);
+	if(i != storeIds.end()) {
+		return i->second;
+	}
+	int id = (int)storePaths.size();
+	storeIds[path] = id;
+	storePaths.push_back(path);
+	return id;
+}
+
+void store_update(Node* d, const UA_DataValue* dv, int64_t now)
+{
+	Group* p = d->parent;
+
+	if(!storing || !p->store || !dv->hasValue || !dv->value.type || !UA_Variant_isScalar(&dv->value)) {
+		return;
+	}
+
+	StoreSample s;
+	if(!store_value(&dv->value, &s.v)) {
+		return;
+	}
+	s.type = (uint16_t)dv->value.type->typeIndex;
+	s.status = dv->hasStatus ? dv->status : UA_STATUSCODE_GOOD;
+	s.t = datavalue_time(dv, getTimestampSource(p->timestamp), now);
+
+	pthread_mutex_lock(&storeLock);
+	if(d->store < 0) {
+		d->store = store_id(string(p->topic) + "/" + d->topic);
+	}
+	s.node = d->store;
+	if(pending.size() < STORE_PENDING_MAX) {
+		pending.push_back(s);
+	} else {
+		dropped++;
+	}
+	pthread_mutex_unlock(&storeLock);
+}
+
+static bool write_all(int fd, const char* data, size_t len)
+{
+	while(len) {
+		ssize_t w = write(fd, data, len);
+		if(w < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data += w;
+		len -= (size_t)w;
+	}
+	return true;
+}
+
+static void store_retention(int64_t newest)
+{
+	if(g_config->storeRetentionUSec <= 0) {
+		return;
+	}
+
+	DIR* dir = opendir(g_config->storePath);
+	if(!dir) {
+		return;
+	}
+
+	struct dirent* e;
+	while((e = readdir(dir)) != NULL) {
+		struct tm tm;
+		memset(&tm, 0, sizeof(tm));
+		const char* end = strptime(e->d_name, "%Y%m%dT%H%M%SZ.seg", &tm);
+		if(!end || *end) {
+			continue;
+		}
+		int64_t start = (int64_t)timegm(&tm) * 1000000;
+		if(partitions.count(start) || start + g_config->storePartitionUSec > newest - g_config->storeRetentionUSec) {
+			continue;
+		}
+		string file = string(g_config->storePath) + "/" + e->d_name;
+		if(unlink(file.c_str()) == 0) {
+			printf("[store] %s removed, older than the retention.\n", file.c_str());
+		}
+	}
+	closedir(dir);
+}
+
+/* the file of a partition, opened for append. an existing one gives back its
+ * node ids and loses a record cut by a crash */
+static Partition* partition_get(int64_t start)
+{
+	map<int64_t, Partition>::iterator i = partitions.find(start);
+	if(i != partitions.end()) {
+		return &i->second;
+	}
+
+	char name[64];
+	segment_file_name(start, name, sizeof(name));
+	string file = string(g_config->storePath) + "/" + name;
+
+	SegmentFile f;
+	map<string, uint32_t> found;
+	uint32_t next = 0;
+	off_t end = 0;
+	bool existing = (segment_open(&f, file.c_str()) == 0);
+	if(existing) {
+		SegmentRecord r;
+		while(segment_next(&f, &r)) {
+			if(r.type == SEGMENT_NODE) {
+				found[string(r.path, r.pathLen)] = r.node;
+				next = max(next, r.node + 1);
+			}
+		}
+		end = (off_t)f.at;
+		if(f.at < f.len) {
+			printf("[store] %s : %lu bytes of a cut record removed.\n", file.c_str(), (unsigned long)(f.len - f.at));
+		}
+		segment_close(&f);
+	}
+
+	int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if(fd < 0 || ftruncate(fd, end) < 0 || lseek(fd, end, SEEK_SET) < 0) {
+		printf("[error] store : can't open %s (%s).\n", file.c_str(), strerror(errno));
+		if(fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+
+	Partition* p = &partitions[start];
+	p->fd = fd;
+	p->file = file;
+	p->size = end;
+	p->next = next;
+	segment_buf_init(&p->out);
+
+	if(!existing) {
+		/* not there, or not a segment (created, but nothing written before a crash) */
+		segment_header(&p->out, start, g_config->storePartitionUSec);
+		int dir = open(g_config->storePath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if(dir >= 0) {
+			fsync(dir);
+			close(dir);
+		}
+		printf("[store] %s\n", file.c_str());
+		store_retention(start);
+	} else if(!found.empty()) {
+		pthread_mutex_lock(&storeLock);
+		map<string, uint32_t>::iterator n;
+		for (n = found.begin(); n != found.end(); ++n) {
+			p->ids[store_id(n->first)] = n->second;
+		}
+		pthread_mutex_unlock(&storeLock);
+	}
+
+	return p;
+}
+
+static void partition_close(Partition* p)
+{
+	close(p->fd);
+	segment_buf_free(&p->out);
+}
+
+static void columns_close(int id, const string& path)
+{
+	StoreColumns* c = &columns[id];
+	c->open = false;
+
+	Partition* p = partition_get(c->partition);
+	if(!p) {
+		failed += c->block.count;
+		return;
+	}
+
+	map<int, uint32_t>::iterator n = p->ids.find(id);
+	if(n == p->ids.end()) {
+		n = p->ids.insert(pair<int, uint32_t>(id, p->next++)).first;
+		segment_node(&p->out, n->second, path.c_str());
+	}
+	segment_block_write(&p->out, n->second, &c->block);
+	samplesWritten += c->block.count;
+	blocksWritten++;
+}
+
+/* the samples of one flush : a block per node and partition, then every
+ * touched file is written and synced once */
+static void store_flush(vector<StoreSample>& work)
+{
+	if(work.empty()) {
+		return;
+	}
+
+	vector<string> paths;
+	pthread_mutex_lock(&storeLock);
+	paths = storePaths;
+	pthread_mutex_unlock(&storeLock);
+
+	size_t known = columns.size();
+	if(paths.size() > known) {
+		columns.resize(paths.size());
+		for (size_t k = known; k < columns.size(); k++) {
+			segment_block_init(&columns[k].block);
+			columns[k].open = false;
+		}
+	}
+
+	for (size_t k = 0; k < work.size(); k++) {
+		const StoreSample& s = work[k];
+		StoreColumns* c = &columns[s.node];
+		int64_t part = partition_of(s.t);
+
+		if(c->open && (c->partition != part || c->block.type != s.type)) {
+			columns_close(s.node, paths[s.node]);
+		}
+		if(!c->open) {
+			segment_block_reset(&c->block, s.type, store_kind(s.type));
+			c->partition = part;
+			c->open = true;
+		}
+		segment_block_put(&c->block, s.t, s.v, s.status);
+	}
+
+	for (size_t k = 0; k < columns.size(); k++) {
+		if(columns[k].open) {
+			columns_close((int)k, paths[k]);
+		}
+	}
+
+	/* a file without samples in this flush is done with, a late sample opens it again */
+	map<int64_t, Partition>::iterator i = partitions.begin();
+	while(i != partitions.end()) {
+		Partition* p = &i->second;
+		if(!p->out.len) {
+			partition_close(p);
+			partitions.erase(i++);
+			continue;
+		}
+
+		if(write_all(p->fd, p->out.data, p->out.len) && fdatasync(p->fd) == 0) {
+			p->size += (off_t)p->out.len;
+			bytesWritten += p->out.len;
+		} else {
+			/* nothing half written stays in front of the next records */
+			printf("[error] store : write to %s failed (%s).\n", p->file.c_str(), strerror(errno));
+			if(ftruncate(p->fd, p->size) < 0 || lseek(p->fd, p->size, SEEK_SET) < 0) {
+				printf("[error] store : %s can't be cut back, it ends with a broken record.\n", p->file.c_str());
+			}
+			failed++;
+		}
+		p->out.len = 0;
+		++i;
+	}
+}
+
+static void* store_run(void* param)
+{
+	vector<StoreSample> work;
+
+	thread_apply(enumThreadSink, "store");
+
+	pthread_mutex_lock(&storeLock);
+	while(true) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		int64_t ns = (int64_t)ts.tv_nsec + (int64_t)g_config->storeFlushUSec * 1000;
+		ts.tv_sec += (time_t)(ns / 1000000000);
+		ts.tv_nsec = (long)(ns % 1000000000);
+		while(!stopping && pthread_cond_timedwait(&storeWake, &storeLock, &ts) != ETIMEDOUT) {
+		}
+
+		bool last = stopping;
+		work.swap(pending);
+		pthread_mutex_unlock(&storeLock);
+
+		store_flush(work);
+		work.clear();
+
+		pthread_mutex_lock(&storeLock);
+		if(last) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&storeLock);
+
+	map<int64_t, Partition>::iterator i;
+	for (i = partitions.begin(); i != partitions.end(); ++i) {
+		partition_close(&i->second);
+	}
+	partitions.clear();
+	for (size_t k = 0; k < columns.size(); k++) {
+		segment_block_free(&columns[k].block);
+	}
+	columns.clear();
+
+	return NULL;
+}
+
+int store_open(void)
+{
+	if(mkdir(g_config->storePath, 0755) < 0 && errno != EEXIST) {
+		printf("[error] can't create the store directory %s (%s).\n", g_config->storePath, strerror(errno));
+		return -1;
+	}
+
+	storing = true;
+	if(pthread_create(&storeThread, NULL, store_run, NULL) != 0) {
+		storing = false;
+		printf("[error] store : no writer thread.\n");
+		return -1;
+	}
+
+	printf("[store] %s, partitions of %lld s, flush every %d us\n", g_config->storePath,
+		(long long)(g_config->storePartitionUSec / 1000000), g_config->storeFlushUSec);
+	return 0;
+}
+
+/* after the poll threads : what they queued is written before the bridge stops */
+void store_close(void)
+{
+	if(!storing) {
+		return;
+	}
+	storing = false;
+
+	pthread_mutex_lock(&storeLock);
+	stopping = true;
+	pthread_cond_signal(&storeWake);
+	pthread_mutex_unlock(&storeLock);
+	pthread_join(storeThread, NULL);
+
+	printf("[store] %lu samples in %lu blocks, %llu bytes written, %lu dropped, %lu lost on write errors.\n",
+		samplesWritten, blocksWritten, bytesWritten, dropped, failed);
+}
+
+/* backfill : the stored nodes of one partition, merged into time order */
+typedef struct {
+	Node* node;
+	size_t position;	/* in its group, the slot of the poll read */
+	int order;	/* of its group : the nodes of one read come out together */
+	vector<SegmentRecord> blocks;
+	size_t next;
+	SegmentCursor cursor;
+	uint16_t type;
+	int64_t t;
+	uint64_t v;
+	uint32_t status;
+} BackfillNode;
+
+struct BackfillLater {
+	bool operator()(const BackfillNode* a, const BackfillNode* b) const
+	{
+		if(a->t != b->t) return a->t > b->t;
+		if(a->order != b->order) return a->order > b->order;
+		return a->position > b->position;
+	}
+};
+
+/* the next sample of the range, false when the node has no more */
+static bool backfill_advance(BackfillNode* b, int64_t from, int64_t to)
+{
+	while(true) {
+		while(b->next && segment_cursor_next(&b->cursor, &b->t, &b->v, &b->status)) {
+			if(b->t >= from && b->t <= to) {
+				return true;
+			}
+		}
+		if(b->next >= b->blocks.size()) {
+			return false;
+		}
+		const SegmentRecord* r = &b->blocks[b->next++];
+		segment_cursor(&b->cursor, r);
+		b->type = r->uaType;
+	}
+}
+
+/* the stored sample as the server would have returned it */
+static void backfill_value(const BackfillNode* b, UA_DataValue* dv)
+{
+	union {
+		UA_Boolean b; UA_SByte sb; UA_Byte by; UA_Int16 i16; UA_UInt16 u16; UA_Int32 i32; UA_UInt32 u32;
+		UA_Int64 i64; UA_UInt64 u64; UA_Float f; UA_Double d; UA_DateTime dt;
+	} u;
+	double d;
+	int64_t i = (int64_t)b->v;
+	memcpy(&d, &b->v, sizeof(d));
+
+	UA_DataValue_init(dv);
+	switch(b->type) {
+		case UA_TYPES_FLOAT : u.f = (UA_Float)d; break;
+		case UA_TYPES_DOUBLE : u.d = d; break;
+		case UA_TYPES_BOOLEAN : u.b = i != 0; break;
+		case UA_TYPES_SBYTE : u.sb = (UA_SByte)i; break;
+		case UA_TYPES_BYTE : u.by = (UA_Byte)i; break;
+		case UA_TYPES_INT16 : u.i16 = (UA_Int16)i; break;
+		case UA_TYPES_UINT16 : u.u16 = (UA_UInt16)i; break;
+		case UA_TYPES_INT32 : u.i32 = (UA_Int32)i; break;
+		case UA_TYPES_UINT32 : u.u32 = (UA_UInt32)i; break;
+		case UA_TYPES_INT64 : u.i64 = i; break;
+		case UA_TYPES_UINT64 : u.u64 = (UA_UInt64)i; break;
+		case UA_TYPES_DATETIME : u.dt = i * UA_USEC_TO_DATETIME + UA_DATETIME_UNIX_EPOCH; break;
+		default : return;
+	}
+	UA_Variant_setScalarCopy(&dv->value, &u, &UA_TYPES[b->type]);
+	dv->hasValue = true;
+
+	/* every timestamp setting of the group gives the stored time back */
+	dv->sourceTimestamp = dv->serverTimestamp = b->t * UA_USEC_TO_DATETIME + UA_DATETIME_UNIX_EPOCH;
+	dv->hasSourceTimestamp = dv->hasServerTimestamp = true;
+	if(b->status != UA_STATUSCODE_GOOD) {
+		dv->status = b->status;
+		dv->hasStatus = true;
+	}
+}
+
+/* one partition file through the pipeline, returns the samples published */
+static unsigned long backfill_partition(const string& file, map<string, BackfillNode>& nodes, int64_t from, int64_t to)
+{
+	SegmentFile f;
+	if(segment_open(&f, file.c_str()) < 0) {
+		printf("[backfill] %s can't be read, skipped.\n", file.c_str());
+		return 0;
+	}
+
+	map<uint32_t, BackfillNode*> ids;
+	map<string, BackfillNode>::iterator n;
+	for (n = nodes.begin(); n != nodes.end(); ++n) {
+		n->second.blocks.clear();
+		n->second.next = 0;
+	}
+
+	SegmentRecord r;
+	while(segment_next(&f, &r)) {
+		if(r.type == SEGMENT_NODE) {
+			n = nodes.find(string(r.path, r.pathLen));
+			if(n != nodes.end()) {
+				ids[r.node] = &n->second;
+			}
+		} else if(r.type == SEGMENT_BLOCK && r.last >= from && r.first <= to) {
+			map<uint32_t, BackfillNode*>::iterator b = ids.find(r.node);
+			if(b != ids.end()) {
+				b->second->blocks.push_back(r);
+			}
+		}
+	}
+	if(f.at < f.len) {
+		printf("[backfill] %s : a cut record at %lu, the rest is not read.\n", file.c_str(), (unsigned long)f.at);
+	}
+
+	priority_queue<BackfillNode*, vector<BackfillNode*>, BackfillLater> due;
+	map<uint32_t, BackfillNode*>::iterator b;
+	for (b = ids.begin(); b != ids.end(); ++b) {
+		if(backfill_advance(b->second, from, to)) {
+			due.push(b->second);
+		}
+	}
+
+	unsigned long samples = 0;
+	vector<UA_DataValue> results;
+	while(!due.empty() && !beStop) {
+		BackfillNode* first = due.top();
+		due.pop();
+		Group* p = first->node->parent;
+		int64_t t = first->t;
+		samples++;
+
+		if(getMonitorMode(p->method) == enumEvent) {
+			UA_DataValue dv;
+			backfill_value(first, &dv);
+			event_process(first->node, &dv, t);
+			UA_DataValue_deleteMembers(&dv);
+			if(backfill_advance(first, from, to)) {
+				due.push(first);
+			}
+			continue;
+		}
+
+		/* a poll read : the samples of the group at the same time, the other nodes stay empty */
+		results.resize(p->nodes.size());
+		for (size_t k = 0; k < results.size(); k++) {
+			UA_DataValue_init(&results[k]);
+		}
+		backfill_value(first, &results[first->position]);
+		if(backfill_advance(first, from, to)) {
+			due.push(first);
+		}
+		while(!due.empty() && due.top()->t == t && due.top()->node->parent == p) {
+			BackfillNode* next = due.top();
+			due.pop();
+			UA_DataValue_deleteMembers(&results[next->position]);
+			backfill_value(next, &results[next->position]);
+			if(backfill_advance(next, from, to)) {
+				due.push(next);
+			}
+			samples++;
+		}
+
+		poll_replay(p, &results[0], t);
+		for (size_t k = 0; k < results.size(); k++) {
+			UA_DataValue_deleteMembers(&results[k]);
+		}
+	}
+
+	segment_close(&f);
+	return samples;
+}
+
+void* store_backfill_run(void* param)
+{
+	int64_t from = g_config->backfillFrom, to = g_config->backfillTo;
+
+	/* the nodes of the enabled groups by path, the groups by map order */
+	map<string, BackfillNode> nodes;
+	int order = 0;
+	map<int, Group>::iterator i;
+	for (i = gmap->begin(); i != gmap->end(); ++i) {
+		Group* p = (Group*)&i->second;
+		if(!p->enable) {
+			continue;
+		}
+		size_t position = 0;
+		map<int, Node>::iterator n;
+		for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
+			Node* d = (Node*)&n->second;
+			d->parent = p;
+			BackfillNode* b = &nodes[string(p->topic) + "/" + d->topic];
+			b->node = d;
+			b->position = position++;
+			b->order = order;
+			b->next = 0;
+		}
+		order++;
+	}
+
+	/* the partitions of the range, in time order */
+	vector<pair<int64_t, string> > files;
+	DIR* dir = opendir(g_config->storePath);
+	if(!dir) {
+		printf("[error] can't open the store directory %s.\n", g_config->storePath);
+		beStop = 1;
+		return NULL;
+	}
+	struct dirent* e;
+	while((e = readdir(dir)) != NULL) {
+		SegmentFile f;
+		string file = string(g_config->storePath) + "/" + e->d_name;
+		if(strlen(e->d_name) < 4 || strcmp(e->d_name + strlen(e->d_name) - 4, ".seg") || segment_open(&f, file.c_str()) < 0) {
+			continue;
+		}
+		if(f.start <= to && f.start + f.length > from) {
+			files.push_back(pair<int64_t, string>(f.start, file));
+		}
+		segment_close(&f);
+	}
+	closedir(dir);
+	sort(files.begin(), files.end());
+
+	int64_t start = epoch();
+	unsigned long samples = 0;
+	for (size_t k = 0; k < files.size() && !beStop; k++) {
+		samples += backfill_partition(files[k].second, nodes, from, to);
+	}
+	poll_replay_end();
+
+	double elapsed = (epoch() - start) / 1000000.0;
+	printf("[backfill] %lu samples from %d partitions in %.3f s (%.0f samples/s).\n", samples, (int)files.size(), elapsed,
+		elapsed > 0 ? samples / elapsed : 0.0);
+
+	/* the sinks drain what is queued on the way out */
+	beStop = 1;
+
+	return NULL;
+}
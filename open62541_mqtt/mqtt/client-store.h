@@ -0,0 +1,37 @@
+#ifndef OPCUA_MQTT_BRIDGE_STORE_H_
+#define OPCUA_MQTT_BRIDGE_STORE_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+#else
+# include "open62541.h"
+#endif
+
+#include <stdint.h>
+
+struct Node;
+struct Group;
+
+/* local history of the groups with "store": true, in the segment files of
+ * client-segment.h under server-configuration.store.path. the samples are
+ * queued by the poll threads and callbacks, a writer thread appends them
+ * every flushUSec, one block per node and one fsync per touched file. */
+int store_open(void);
+void store_close(void);
+void store_update(struct Node* d, const UA_DataValue* dv, int64_t now);
+
+/* --backfill from,to : the stored samples of the range go through the
+ * encode/publish pipeline of their groups like a --replay, then the bridge stops */
+void* store_backfill_run(void* param);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_STORE_H_ */
@@ -19,10 +19,12 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <unistd.h>
+#include <sys/socket.h>
 
 #include "MQTTPacket.h"
 #include "client-config.h"
 #include "client-trans-tcp.h"
+#include "client-sink.h"
 
 static int sock = 0;
 
@@ -38,18 +40,38 @@ int tcp_connect(int argc, char *argv[])
 	if(sock < 0) {
 		return sock;
 	}
+	sink_socket(sock);
 
 	return 0;
 }
 
-int tcp_publish(const char* mode, char* topic, const char* value) 
+/* one line per message, the receiver splits the stream on '\n'. with
+ * "framing": "length" a u32 big endian length comes before every message
+ * instead : binary payloads (cbor) may hold any byte. */
+int tcp_publish(const SinkMessage* msg) 
 {
-	printf("[tcp] publish (%s) %s\t%s ", mode, topic, value);
+	if(msg->binary) {
+		printf("[tcp] publish (%s) %s\t(%d bytes) ", msg->mode, msg->topic, (int)msg->len);
+	} else {
+		printf("[tcp] publish (%s) %s\t%s ", msg->mode, msg->topic, msg->data);
+	}
 
-#pragma GCC diagnostic push  // require GCC 4.6
-#pragma GCC diagnostic ignored "-Wcast-qual"
+	size_t head = g_config->tcpLengthFraming ? 4 : 0;
+	size_t tail = g_config->tcpLengthFraming ? 0 : 1;
+	unsigned char* buf = (unsigned char*)malloc(head + msg->len + tail);
+	if(head) {
+		buf[0] = (unsigned char)(msg->len >> 24);
+		buf[1] = (unsigned char)(msg->len >> 16);
+		buf[2] = (unsigned char)(msg->len >> 8);
+		buf[3] = (unsigned char)msg->len;
+	}
+	memcpy(buf + head, msg->data, msg->len);
+	if(tail) {
+		buf[head + msg->len] = '\n';
+	}
 
-	int rc = tcp_sendPacketBuffer(sock, (unsigned char*)value, strlen(value));
+	int rc = tcp_sendPacketBuffer(sock, buf, (int)(head + msg->len + tail));
+	free(buf);
 
 	if(rc < 0) {
 		printf(" ==> FAILED");
@@ -57,37 +79,40 @@ int tcp_publish(const char* mode, char* topic, const char* value)
 	printf("\n");
 
 	return rc;
-
-#pragma GCC diagnostic pop 
 }
 
-int tcp_main(int argc, char *argv[])
+/* sink plugin : the sink thread owns the connection */
+static bool tcp_sink_enabled(void)
 {
-	int rc = 0;
-
-	if(!g_config->tcpEnable) {
-		return 0;
-	}
-
-	printf("\n[tcp] start publisher connection.\n");
+	return g_config->tcpEnable;
+}
 
-	do {
-		rc = tcp_connect(argc, argv);
-	} while(!beStop && rc < 0 );
+static int tcp_sink_open(void)
+{
+	return tcp_connect(0, 0) < 0 ? -1 : 0;
+}
 
-	printf("[tcp] start publisher message loop.\n");
-	while (!beStop)
-	{
-		sleep(5);
-	}
+static int tcp_sink_send(const SinkMessage* msg)
+{
+	return tcp_publish(msg);
+}
 
-exit:
+static void tcp_sink_close(void)
+{
 	tcp_close(sock);
-
-	return 0;
 }
 
-void* tcp_run(void* param)
+static void tcp_sink_abort(void)
 {
-	return (void*)tcp_main(0, 0);
+	shutdown(sock, SHUT_RDWR);
 }
+
+const SinkOps tcpSink = {
+	"tcp",
+	tcp_sink_enabled,
+	tcp_sink_open,
+	tcp_sink_send,
+	NULL,
+	tcp_sink_close,
+	tcp_sink_abort
+};
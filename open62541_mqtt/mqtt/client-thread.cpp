@@ -0,0 +1,221 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "client-thread.h"
+#include "client-config.h"
+#include "json.h"
+
+extern UAMQ_Configuration* g_config;
+
+typedef struct {
+	string name;
+	int cls;
+	pid_t tid;
+} ThreadInfo;
+
+typedef struct {
+	bool alive;
+	double cpuMs;		/* time on a cpu */
+	double waitMs;		/* runnable but waiting for a cpu : preemption, the jitter source */
+	unsigned long voluntary;
+	unsigned long preempted;
+} ThreadStats;
+
+static vector<ThreadInfo> threads;
+static pthread_mutex_t threadsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* classes[] = { "scheduler", "poll", "poll-high", "sink" };
+
+const char* getThreadClassName(int c)
+{
+	return (c >= 0 && c < enumThreadClassCount) ? classes[c] : "";
+}
+
+/* "0,2-3" -> bits 0, 2 and 3 */
+int getCpuMask(const char* list, unsigned long long* mask)
+{
+	const char* s = list;
+	*mask = 0;
+
+	while(*s) {
+		char* end = NULL;
+		long first = strtol(s, &end, 10);
+		long last = first;
+		if(end == s) {
+			return -1;
+		}
+		s = end;
+		if(*s == '-') {
+			last = strtol(s + 1, &end, 10);
+			if(end == s + 1) {
+				return -1;
+			}
+			s = end;
+		}
+		if(first < 0 || last < first || last >= 64) {
+			return -1;
+		}
+		for (long c = first; c <= last; c++) {
+			*mask |= 1ULL << c;
+		}
+		if(*s == ',') {
+			s++;
+		} else if(*s) {
+			return -1;
+		}
+	}
+
+	return *mask ? 0 : -1;
+}
+
+void thread_apply(enum enumThreadClass c, const char* name)
+{
+	const UAMQ_ThreadPolicy* tp = &g_config->threads[c];
+	pid_t tid = (pid_t)syscall(SYS_gettid);
+
+	/* the main thread keeps the process name, ps and pkill go by it */
+	if(tid != getpid()) {
+		char tname[16];
+		snprintf(tname, sizeof(tname), "%s", name);
+		pthread_setname_np(pthread_self(), tname);
+	}
+
+	if(tp->cpus || tp->priority) {
+		printf("[thread] %s : cpus 0x%llx, priority %d.\n", name, tp->cpus, tp->priority);
+	}
+
+	if(tp->cpus) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int i = 0; i < 64; i++) {
+			if(tp->cpus & (1ULL << i)) {
+				CPU_SET(i, &set);
+			}
+		}
+		int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if(r) {
+			printf("[thread] %s : cpu affinity failed (%s).\n", name, strerror(r));
+		}
+	}
+
+	if(tp->priority > 0) {
+		struct sched_param sp;
+		memset(&sp, 0, sizeof(sp));
+		sp.sched_priority = tp->priority;
+		int r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+		if(r) {
+			printf("[thread] %s : SCHED_FIFO %d failed (%s), needs CAP_SYS_NICE.\n", name, tp->priority, strerror(r));
+		}
+	}
+
+	ThreadInfo t;
+	t.name = name;
+	t.cls = c;
+	t.tid = tid;
+
+	pthread_mutex_lock(&threadsLock);
+	threads.push_back(t);
+	pthread_mutex_unlock(&threadsLock);
+}
+
+/* every page, thread stacks included, stays in RAM : no major fault in a poll cycle */
+void thread_lock_memory(void)
+{
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		printf("[thread] mlockall failed (%s), needs CAP_IPC_LOCK or a higher RLIMIT_MEMLOCK.\n", strerror(errno));
+	} else {
+		printf("[thread] memory locked.\n");
+	}
+}
+
+static void thread_read(const ThreadInfo* t, ThreadStats* st)
+{
+	char path[64];
+	memset(st, 0, sizeof(ThreadStats));
+
+	/* run and wait time in ns, see Documentation/scheduler/sched-stats */
+	snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat", (int)t->tid);
+	FILE* f = fopen(path, "r");
+	if(!f) {
+		return;
+	}
+	unsigned long long run = 0, wait = 0;
+	if(fscanf(f, "%llu %llu", &run, &wait) == 2) {
+		st->cpuMs = run / 1e6;
+		st->waitMs = wait / 1e6;
+	}
+	fclose(f);
+	st->alive = true;
+
+	snprintf(path, sizeof(path), "/proc/self/task/%d/status", (int)t->tid);
+	f = fopen(path, "r");
+	if(!f) {
+		return;
+	}
+	char line[128];
+	while(fgets(line, sizeof(line), f)) {
+		sscanf(line, "voluntary_ctxt_switches: %lu", &st->voluntary);
+		sscanf(line, "nonvoluntary_ctxt_switches: %lu", &st->preempted);
+	}
+	fclose(f);
+}
+
+void thread_stats_print(void)
+{
+	pthread_mutex_lock(&threadsLock);
+	for (size_t k = 0; k < threads.size(); k++) {
+		ThreadStats st;
+		thread_read(&threads[k], &st);
+		if(!st.alive) {
+			continue;
+		}
+		printf("[thread] %s (%s) : cpu %.1f ms, waited %.1f ms for a cpu, switches %lu voluntary / %lu preempted.\n",
+			threads[k].name.c_str(), classes[threads[k].cls], st.cpuMs, st.waitMs, st.voluntary, st.preempted);
+	}
+	pthread_mutex_unlock(&threadsLock);
+}
+
+/* [{"name": .., "class": .., "tid": .., "cpuMs": .., "waitMs": .., "voluntary": .., "preempted": ..}], caller frees */
+char* thread_stats_json(void)
+{
+	json_object* jarr = json_object_new_array();
+
+	pthread_mutex_lock(&threadsLock);
+	for (size_t k = 0; k < threads.size(); k++) {
+		ThreadStats st;
+		thread_read(&threads[k], &st);
+		if(!st.alive) {
+			continue;
+		}
+
+		json_object* jt = json_object_new_object();
+		json_object_object_add(jt, "name", json_object_new_string(threads[k].name.c_str()));
+		json_object_object_add(jt, "class", json_object_new_string(classes[threads[k].cls]));
+		json_object_object_add(jt, "tid", json_object_new_int(threads[k].tid));
+		json_object_object_add(jt, "cpuMs", json_object_new_double(st.cpuMs));
+		json_object_object_add(jt, "waitMs", json_object_new_double(st.waitMs));
+		json_object_object_add(jt, "voluntary", json_object_new_int64(st.voluntary));
+		json_object_object_add(jt, "preempted", json_object_new_int64(st.preempted));
+		json_object_array_add(jarr, jt);
+	}
+	pthread_mutex_unlock(&threadsLock);
+
+	char* out = strdup(json_object_to_json_string_ext(jarr, JSON_C_TO_STRING_PLAIN));
+	json_object_put(jarr);
+
+	return out;
+}
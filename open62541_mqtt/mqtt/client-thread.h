@@ -0,0 +1,37 @@
+#ifndef OPCUA_MQTT_BRIDGE_THREAD_H_
+#define OPCUA_MQTT_BRIDGE_THREAD_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* threads configured together under "threads" in server-configuration */
+enum enumThreadClass {
+	enumThreadScheduler,	/* main loop : publish requests and subscription callbacks */
+	enumThreadPoll,		/* one per poll group */
+	enumThreadPollHigh,	/* one per poll group with "priority": "high" */
+	enumThreadSink,		/* one per sink plugin */
+	enumThreadClassCount
+};
+
+typedef struct {
+	unsigned long long cpus;	/* bit i : cpu i, 0 keeps the inherited affinity */
+	int priority;			/* 1..99 : SCHED_FIFO, 0 keeps SCHED_OTHER */
+} UAMQ_ThreadPolicy;
+
+const char* getThreadClassName(int c);
+int getCpuMask(const char* list, unsigned long long* mask);
+
+/* called by a thread on itself once it runs */
+void thread_apply(enum enumThreadClass c, const char* name);
+void thread_lock_memory(void);
+void thread_stats_print(void);
+char* thread_stats_json(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_THREAD_H_ */
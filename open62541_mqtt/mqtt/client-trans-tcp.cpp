@@ -209,6 +209,13 @@ int* sock = &tcpsock;
 	if (tcpsock == INVALID_SOCKET)
 		return rc;
 
+	/* the peer is not listening, report it instead of handing out a dead socket */
+	if (rc != 0) {
+		close(tcpsock);
+		tcpsock = INVALID_SOCKET;
+		return -1;
+	}
+
 	tv.tv_sec = 1;  /* 1 second Timeout */
 	tv.tv_usec = 0;  
 	setsockopt(tcpsock, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv,sizeof(struct timeval));
@@ -216,7 +223,8 @@ int* sock = &tcpsock;
     int flag = 1;
     setsockopt(tcpsock, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(int));
 
-    struct linger solinger = { 1, 0 };
+    /* close sends what is queued and waits for the ack up to 1 s, then resets */
+    struct linger solinger = { 1, 1 };
     if (setsockopt(tcpsock, SOL_SOCKET, SO_LINGER, &solinger, sizeof(struct linger)) == -1) {
         perror("setsockopt(SO_LINGER)");
     }
@@ -0,0 +1,243 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_client.h"
+# include "ua_client_highlevel.h"
+# include "ua_nodeids.h"
+# include "ua_network_tcp.h"
+# include "ua_config_standard.h"
+#else
+# include "open62541.h"
+# include <string.h>
+# include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <string>
+#include <vector>
+#include <map>
+using namespace std;
+
+#include "client-common.h"
+#include "client-nodemap.h"
+#include "client-sink.h"
+#include "client-watchdog.h"
+#include "json.h"
+
+extern int beStop;
+
+extern map<int, Group>* gmap;
+extern pthread_mutex_t gmapLock;
+extern UAMQ_Configuration* g_config;
+
+int64_t epoch(void);
+
+static volatile int64_t schedulerBeat = 0;
+
+typedef struct {
+	const char* stage;	/* scheduler | poll | sink */
+	string name;
+	int64_t age;		/* us without progress */
+	int64_t limit;
+	unsigned long queued;
+	int sink;		/* sink index, -1 for the other stages */
+} Stage;
+
+void watchdog_beat(int64_t now)
+{
+	schedulerBeat = now;
+}
+
+void watchdog_notify(const char* state)
+{
+	const char* path = getenv("NOTIFY_SOCKET");
+	if(!path || !path[0]) {
+		return;
+	}
+
+	struct sockaddr_un addr;
+	size_t len = strlen(path);
+	if(len >= sizeof(addr.sun_path)) {
+		return;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, path, len);
+	/* '@' : linux abstract namespace */
+	if(addr.sun_path[0] == '@') {
+		addr.sun_path[0] = '\0';
+	}
+
+	int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(fd < 0) {
+		return;
+	}
+	sendto(fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr*)&addr, (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len));
+	close(fd);
+}
+
+static int64_t stage_limit(int64_t intervalUSec)
+{
+	int64_t limit = (int64_t)g_config->watchdogIntervals * intervalUSec;
+	return limit > g_config->watchdogMinUSec ? limit : g_config->watchdogMinUSec;
+}
+
+/* the stages running now : a stage that has not started yet has no beat */
+static void stage_collect(vector<Stage>& out, int64_t now)
+{
+	Stage s;
+	s.queued = 0;
+	s.sink = -1;
+
+	if(schedulerBeat) {
+		s.stage = "scheduler";
+		s.name = "scheduler";
+		s.age = now - schedulerBeat;
+		s.limit = stage_limit(g_config->uaPublishIntervalUsecs);
+		out.push_back(s);
+	}
+
+	pthread_mutex_lock(&gmapLock);
+	map<int, Group>::iterator i;
+	for (i = gmap->begin(); i != gmap->end(); ++i) {
+		Group* p = (Group*)&i->second;
+		if(!p->enable || !p->beat) {
+			continue;
+		}
+		/* an OPC UA outage is no stall : the group waits for its endpoint's recovery thread */
+		UAMQ_Endpoint* rs = &g_config->readers[p->ep];
+		if(opcua_session_recovering(&g_config->endpoints[p->ep]) || (rs->client && opcua_session_recovering(rs))) {
+			continue;
+		}
+		s.stage = "poll";
+		s.name = p->name;
+		s.age = now - p->beat;
+		s.limit = stage_limit(p->intervalUSec);
+		out.push_back(s);
+	}
+	pthread_mutex_unlock(&gmapLock);
+
+	for (int k = 0; k < getSinkCount(); k++) {
+		SinkStats st;
+		sink_stats(k, &st);
+		if(!st.progress) {
+			continue;
+		}
+		/* an idle sink is never late */
+		s.stage = "sink";
+		s.name = getSinkName(k);
+		s.age = st.depth ? now - st.progress : 0;
+		s.limit = g_config->watchdogMinUSec;
+		s.queued = st.depth;
+		s.sink = k;
+		out.push_back(s);
+	}
+}
+
+char* watchdog_health_json(void)
+{
+	int64_t now = epoch();
+	vector<Stage> stages;
+	stage_collect(stages, now);
+
+	bool healthy = true;
+	json_object* jarr = json_object_new_array();
+	for (size_t k = 0; k < stages.size(); k++) {
+		bool stalled = stages[k].age > stages[k].limit;
+		healthy = healthy && !stalled;
+
+		json_object* jt = json_object_new_object();
+		json_object_object_add(jt, "stage", json_object_new_string(stages[k].stage));
+		json_object_object_add(jt, "name", json_object_new_string(stages[k].name.c_str()));
+		json_object_object_add(jt, "ageUSec", json_object_new_int64(stages[k].age));
+		json_object_object_add(jt, "limitUSec", json_object_new_int64(stages[k].limit));
+		json_object_object_add(jt, "stalled", json_object_new_boolean(stalled));
+		if(stages[k].sink >= 0) {
+			json_object_object_add(jt, "queued", json_object_new_int64(stages[k].queued));
+		}
+		json_object_array_add(jarr, jt);
+	}
+
+	json_object* jobj = json_object_new_object();
+	json_object_object_add(jobj, "status", json_object_new_string(healthy ? "ok" : "stalled"));
+	json_object_object_add(jobj, "time", json_object_new_int64(now));
+	json_object_object_add(jobj, "stages", jarr);
+
+	char* out = strdup(json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN));
+	json_object_put(jobj);
+
+	return out;
+}
+
+void* watchdog_run(void* param)
+{
+	/* systemd WatchdogSec= : ping twice per period */
+	int64_t period = 1000000;
+	const char* usec = getenv("WATCHDOG_USEC");
+	if(usec && atoll(usec) > 0 && atoll(usec) / 2 < period) {
+		period = atoll(usec) / 2;
+	}
+
+	printf("[watchdog] started : stall after %d intervals (at least %d us)%s.\n", g_config->watchdogIntervals,
+		g_config->watchdogMinUSec, g_config->watchdogRestart ? ", stalled sinks reconnect" : "");
+
+	map<string, int64_t> stalled;	/* stage -> time of the last abort */
+
+	while(!beStop) {
+		int64_t now = epoch();
+		vector<Stage> stages;
+		stage_collect(stages, now);
+
+		bool healthy = true;
+		for (size_t k = 0; k < stages.size(); k++) {
+			Stage* s = &stages[k];
+			string key = s->name == s->stage ? s->name : string(s->stage) + ":" + s->name;
+			map<string, int64_t>::iterator it = stalled.find(key);
+
+			if(s->age <= s->limit) {
+				if(it != stalled.end()) {
+					printf("[watchdog] %s recovered.\n", key.c_str());
+					stalled.erase(it);
+				}
+				continue;
+			}
+
+			healthy = false;
+			if(it == stalled.end()) {
+				printf("[watchdog] %s stalled : no progress for %.1f s (limit %.1f s)", key.c_str(), s->age / 1000000.0, s->limit / 1000000.0);
+				if(s->sink >= 0) {
+					printf(", %lu queued", s->queued);
+				}
+				printf(".\n");
+				it = stalled.insert(pair<string, int64_t>(key, 0)).first;
+			}
+
+			/* restart : only the stuck sink reconnects, again every limit while it stays stuck */
+			if(g_config->watchdogRestart && s->sink >= 0 && now - it->second >= s->limit) {
+				if(sink_abort(s->sink)) {
+					printf("[watchdog] %s : connection aborted, the sink reconnects.\n", key.c_str());
+				}
+				it->second = now;
+			}
+		}
+
+		/* a stalled bridge stops pinging, systemd restarts the whole process */
+		if(healthy) {
+			watchdog_notify("WATCHDOG=1");
+		}
+
+		for (int64_t waited = 0; waited < period && !beStop; waited += 100000) {
+			usleep((useconds_t)(period - waited < 100000 ? period - waited : 100000));
+		}
+	}
+
+	return NULL;
+}
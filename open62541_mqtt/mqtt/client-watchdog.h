@@ -0,0 +1,29 @@
+#ifndef OPCUA_MQTT_BRIDGE_WATCHDOG_H_
+#define OPCUA_MQTT_BRIDGE_WATCHDOG_H_
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* heartbeats of the pipeline : poll groups (Group.beat), sinks
+ * (SinkStats.progress) and the scheduler loop, told here */
+void watchdog_beat(int64_t now);
+
+/* sd_notify without libsystemd, nothing happens when NOTIFY_SOCKET is unset */
+void watchdog_notify(const char* state);
+
+/* {"status": "ok" | "stalled", "time": .., "stages": [..]}, caller frees */
+char* watchdog_health_json(void);
+
+/* logs stalls, aborts stuck sinks ("restart") and pings WATCHDOG=1 while healthy */
+void* watchdog_run(void* param);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* OPCUA_MQTT_BRIDGE_WATCHDOG_H_ */
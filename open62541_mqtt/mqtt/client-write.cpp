@@ -0,0 +1,475 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_client.h"
+# include "ua_client_highlevel.h"
+# include "ua_nodeids.h"
+# include "ua_network_tcp.h"
+# include "ua_config_standard.h"
+#else
+# include "open62541.h"
+# include <string.h>
+# include <stdlib.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+using namespace std;
+
+#include "client-common.h"
+#include "client-nodemap.h"
+#include "client-nodeid.h"
+#include "client-sink.h"
+#include "json.h"
+
+extern int beStop;
+
+extern map<int, Group>* gmap;
+extern UAMQ_Configuration* g_config;
+
+int64_t epoch(void);
+
+/* a writable node, addressed by '<group topic>/<node topic>' under the command topic */
+typedef struct {
+	Node* node;
+	Group* group;
+	UA_NodeId id;
+	const UA_DataType* type;	/* learnt from the first read of the value */
+} WriteTarget;
+
+typedef struct {
+	WriteTarget* target;
+	char* path;
+	char* payload;
+} WriteCommand;
+
+/* a reload replaces the targets of a group, the old ones stay for the commands in flight */
+static map<string, WriteTarget*> targets;
+static pthread_mutex_t targetsLock = PTHREAD_MUTEX_INITIALIZER;
+static bool writeOn = false;
+
+/* commands of the current coalescing window, filled by the mqtt thread */
+static vector<WriteCommand> pending;
+static int64_t pendingSince = 0;
+static pthread_mutex_t pendingLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pendingCond = PTHREAD_COND_INITIALIZER;
+
+/* caller holds targetsLock */
+static void write_add(Group* p)
+{
+	map<int, Node>::iterator n;
+	for (n = p->nodes.begin(); n != p->nodes.end(); ++n) {
+		Node* d = (Node*)&n->second;
+		if(!d->writable) {
+			continue;
+		}
+
+		WriteTarget* t = new WriteTarget;
+		t->node = d;
+		t->group = p;
+		t->type = NULL;
+		getUA_NodeID(d->id, &t->id);
+
+		targets[string(p->topic) + "/" + d->topic] = t;
+	}
+}
+
+int write_init(void)
+{
+	pthread_mutex_lock(&targetsLock);
+
+	map<int, Group>::iterator i;
+	for (i = gmap->begin(); i != gmap->end(); ++i) {
+		Group* p = (Group*)&i->second;
+
+		/* disabled groups belong to another shard or are switched off */
+		if(!p->enable) {
+			continue;
+		}
+		write_add(p);
+	}
+	writeOn = true;
+	printf("[write] %d writable nodes under %s/.\n", (int)targets.size(), g_config->commandTopic);
+
+	pthread_mutex_unlock(&targetsLock);
+
+	return (int)targets.size();
+}
+
+void write_add_group(Group* p)
+{
+	if(!writeOn) {
+		return;
+	}
+
+	pthread_mutex_lock(&targetsLock);
+	write_add(p);
+	pthread_mutex_unlock(&targetsLock);
+}
+
+/* later commands to its paths get BadNodeIdUnknown */
+void write_remove_group(Group* p)
+{
+	if(!writeOn) {
+		return;
+	}
+
+	pthread_mutex_lock(&targetsLock);
+	map<string, WriteTarget*>::iterator t = targets.begin();
+	while(t != targets.end()) {
+		if(t->second->group == p) {
+			targets.erase(t++);
+		} else {
+			++t;
+		}
+	}
+	pthread_mutex_unlock(&targetsLock);
+}
+
+/* builds without statuscode descriptions have no names, fall back to the code */
+static const char* status_name(UA_StatusCode code, char* buf, size_t len)
+{
+	const char* name = UA_StatusCode_name(code);
+	if(name && code != 0xffffffff && UA_StatusCode_description(code)->code == code) {
+		return name;
+	}
+
+	snprintf(buf, len, "0x%08x", code);
+	return buf;
+}
+
+static void write_ack(const char* path, const char* payload, UA_StatusCode code, bool superseded)
+{
+	char topic[256] = {0,};
+	snprintf(topic, sizeof(topic), "%s/%s/%s/%s", g_config->topicBase, g_config->deviceID, g_config->ackTopic, path);
+
+	json_object* jobj = json_object_new_object();
+	json_object* cmd = json_tokener_parse(payload);
+	json_object* id = NULL;
+
+	if(cmd && json_object_get_type(cmd) == json_type_object && json_object_object_get_ex(cmd, "id", &id)) {
+		json_object_object_add(jobj, "id", json_object_get(id));
+	}
+	char name[16];
+	json_object_object_add(jobj, "status", json_object_new_string(status_name(code, name, sizeof(name))));
+	json_object_object_add(jobj, "code", json_object_new_int64(code));
+	if(superseded) {
+		json_object_object_add(jobj, "superseded", json_object_new_boolean(true));
+	}
+	json_object_object_add(jobj, "time", json_object_new_int64(epoch()));
+
+	/* through the mqtt sink queue, a slow broker does not hold the write thread */
+	const char* contents = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
+	sink_publish(1u << getSinkIndex("mqtt"), "ack", topic, contents, strlen(contents));
+
+	json_object_put(jobj);
+	if(cmd) {
+		json_object_put(cmd);
+	}
+}
+
+/* called by the mqtt thread for every message under the command topic */
+void write_command(const char* topic, int topiclen, const char* payload, int payloadlen)
+{
+	char prefix[192] = {0,};
+	int l = snprintf(prefix, sizeof(prefix), "%s/%s/%s/", g_config->topicBase, g_config->deviceID, g_config->commandTopic);
+
+	if(topiclen <= l || strncmp(topic, prefix, l)) {
+		return;
+	}
+
+	string path(topic + l, topiclen - l);
+	char* body = strndup(payload, payloadlen);
+
+	pthread_mutex_lock(&targetsLock);
+	map<string, WriteTarget*>::iterator t = targets.find(path);
+	WriteTarget* target = (t != targets.end()) ? t->second : NULL;
+	pthread_mutex_unlock(&targetsLock);
+
+	if(!target) {
+		printf("[write] no writable node for '%s'.\n", path.c_str());
+		write_ack(path.c_str(), body, UA_STATUSCODE_BADNODEIDUNKNOWN, false);
+		free(body);
+		return;
+	}
+
+	WriteCommand c;
+	c.target = target;
+	c.path = strdup(path.c_str());
+	c.payload = body;
+
+	pthread_mutex_lock(&pendingLock);
+	if(pending.empty()) {
+		pendingSince = epoch();
+		pthread_cond_signal(&pendingCond);
+	}
+	pending.push_back(c);
+	pthread_mutex_unlock(&pendingLock);
+}
+
+/* the command is a bare value ("12.5", "true", "\"text\"", text) or an
+ * object {"value": .., "id": ..} */
+static UA_StatusCode payload_variant(const char* payload, const UA_DataType* type, UA_Variant* out)
+{
+	json_object* root = json_tokener_parse(payload);
+	json_object* v = root;
+	UA_StatusCode rc = UA_STATUSCODE_GOOD;
+
+	if(root && json_object_get_type(root) == json_type_object) {
+		if(!json_object_object_get_ex(root, "value", &v)) {
+			json_object_put(root);
+			return UA_STATUSCODE_BADDECODINGERROR;
+		}
+	}
+
+	bool number = v && (json_object_get_type(v) == json_type_int || json_object_get_type(v) == json_type_double || json_object_get_type(v) == json_type_boolean);
+	int64_t i = 0;
+	double f = 0;
+	/* GOOD : i holds the value for an integer node */
+	UA_StatusCode whole = number ? UA_STATUSCODE_GOOD : UA_STATUSCODE_BADOUTOFRANGE;
+	if(number) {
+		f = json_object_get_double(v);
+		if(json_object_get_type(v) != json_type_double) {
+			i = json_object_get_int64(v);
+		} else if(f != floor(f)) {
+			/* 12.7 is neither cut nor rounded to 12, nan neither */
+			whole = UA_STATUSCODE_BADTYPEMISMATCH;
+		} else if(f < -9223372036854775808.0 || f >= 9223372036854775808.0) {
+			/* the cast is only defined inside int64 */
+			whole = UA_STATUSCODE_BADOUTOFRANGE;
+		} else {
+			i = (int64_t)f;
+		}
+	}
+
+	/* integers have to fit the node type, a silent wrap would write a wrong setpoint */
+	#define WRITE_INT(T, MIN, MAX) { \
+		if(whole != UA_STATUSCODE_GOOD) { rc = whole; break; } \
+		if(i < (int64_t)(MIN) || i > (int64_t)(MAX)) { rc = UA_STATUSCODE_BADOUTOFRANGE; break; } \
+		T x = (T)i; rc = UA_Variant_setScalarCopy(out, &x, type); }
+
+	switch(type->typeIndex) {
+		case UA_TYPES_BOOLEAN : {
+			if(!number) { rc = UA_STATUSCODE_BADTYPEMISMATCH; break; }
+			UA_Boolean x = json_object_get_boolean(v);
+			rc = UA_Variant_setScalarCopy(out, &x, type);
+		}
+		break;
+		case UA_TYPES_SBYTE : WRITE_INT(UA_SByte, SCHAR_MIN, SCHAR_MAX) break;
+		case UA_TYPES_BYTE : WRITE_INT(UA_Byte, 0, UCHAR_MAX) break;
+		case UA_TYPES_INT16 : WRITE_INT(UA_Int16, SHRT_MIN, SHRT_MAX) break;
+		case UA_TYPES_UINT16 : WRITE_INT(UA_UInt16, 0, USHRT_MAX) break;
+		case UA_TYPES_INT32 : WRITE_INT(UA_Int32, INT_MIN, INT_MAX) break;
+		case UA_TYPES_UINT32 : WRITE_INT(UA_UInt32, 0, UINT_MAX) break;
+		case UA_TYPES_INT64 : WRITE_INT(UA_Int64, INT64_MIN, INT64_MAX) break;
+		case UA_TYPES_UINT64 : WRITE_INT(UA_UInt64, 0, INT64_MAX) break;
+		case UA_TYPES_FLOAT : {
+			if(!number) { rc = UA_STATUSCODE_BADTYPEMISMATCH; break; }
+			UA_Float x = (UA_Float)f;
+			rc = UA_Variant_setScalarCopy(out, &x, type);
+		}
+		break;
+		case UA_TYPES_DOUBLE : {
+			if(!number) { rc = UA_STATUSCODE_BADTYPEMISMATCH; break; }
+			UA_Double x = f;
+			rc = UA_Variant_setScalarCopy(out, &x, type);
+		}
+		break;
+		case UA_TYPES_STRING : {
+			/* not valid json : the payload itself is the text */
+			UA_String x = UA_String_fromChars(v ? json_object_get_string(v) : payload);
+			rc = UA_Variant_setScalarCopy(out, &x, type);
+			UA_String_deleteMembers(&x);
+		}
+		break;
+		default : {
+			rc = UA_STATUSCODE_BADTYPEMISMATCH;
+		}
+	}
+	#undef WRITE_INT
+
+	if(root) {
+		json_object_put(root);
+	}
+
+	return rc;
+}
+
+/* the write needs the exact node type, read the value of the nodes not
+ * written yet in one request. caller holds the client lock. */
+static UA_StatusCode learn_types(UA_Client* client, vector<WriteTarget*>& unknown)
+{
+	if(unknown.empty()) {
+		return UA_STATUSCODE_GOOD;
+	}
+
+	UA_ReadRequest request;
+	UA_ReadRequest_init(&request);
+	request.nodesToRead = (UA_ReadValueId*)UA_Array_new(unknown.size(), &UA_TYPES[UA_TYPES_READVALUEID]);
+	request.nodesToReadSize = unknown.size();
+
+	for (size_t k = 0; k < unknown.size(); k++) {
+		UA_NodeId_copy(&unknown[k]->id, &request.nodesToRead[k].nodeId);
+		request.nodesToRead[k].attributeId = UA_ATTRIBUTEID_VALUE;
+	}
+
+	UA_ReadResponse response = UA_Client_Service_read(client, request);
+	UA_StatusCode service = response.responseHeader.serviceResult;
+	if(service == UA_STATUSCODE_GOOD && response.resultsSize == unknown.size()) {
+		for (size_t k = 0; k < unknown.size(); k++) {
+			if(response.results[k].hasValue && UA_Variant_isScalar(&response.results[k].value)) {
+				unknown[k]->type = response.results[k].value.type;
+			}
+		}
+	}
+
+	UA_ReadResponse_deleteMembers(&response);
+	UA_ReadRequest_deleteMembers(&request);
+
+	return service;
+}
+
+/* one WriteRequest for all commands of the window on this endpoint, the
+ * latest command of a node wins and the earlier ones are acked superseded. */
+static void write_batch(int e, vector<WriteCommand>& batch)
+{
+	UAMQ_Endpoint* ep = &g_config->endpoints[e];
+
+	map<WriteTarget*, size_t> latest;
+	for (size_t k = 0; k < batch.size(); k++) {
+		if(batch[k].target->group->ep == e) {
+			latest[batch[k].target] = k;
+		}
+	}
+	if(latest.empty()) {
+		return;
+	}
+
+	vector<WriteTarget*> unknown;
+	map<WriteTarget*, size_t>::iterator w;
+	for (w = latest.begin(); w != latest.end(); ++w) {
+		if(!w->first->type) {
+			unknown.push_back(w->first);
+		}
+	}
+
+	unsigned int generation = opcua_session_generation(ep);
+
+	opcua_client_lock(ep);
+	UA_StatusCode learnt = learn_types(ep->client, unknown);
+	opcua_client_unlock(ep);
+
+	map<WriteTarget*, UA_StatusCode> results;
+	vector<WriteTarget*> written;
+
+	UA_WriteRequest request;
+	UA_WriteRequest_init(&request);
+	request.nodesToWrite = (UA_WriteValue*)UA_Array_new(latest.size(), &UA_TYPES[UA_TYPES_WRITEVALUE]);
+
+	for (w = latest.begin(); w != latest.end(); ++w) {
+		WriteTarget* t = w->first;
+
+		if(!t->type) {
+			results[t] = (learnt != UA_STATUSCODE_GOOD) ? learnt : UA_STATUSCODE_BADNODEIDUNKNOWN;
+			continue;
+		}
+
+		UA_WriteValue* wv = &request.nodesToWrite[request.nodesToWriteSize];
+		UA_StatusCode rc = payload_variant(batch[w->second].payload, t->type, &wv->value.value);
+		if(rc != UA_STATUSCODE_GOOD) {
+			results[t] = rc;
+			continue;
+		}
+
+		UA_NodeId_copy(&t->id, &wv->nodeId);
+		wv->attributeId = UA_ATTRIBUTEID_VALUE;
+		wv->value.hasValue = true;
+		request.nodesToWriteSize++;
+		written.push_back(t);
+	}
+
+	if(request.nodesToWriteSize) {
+		opcua_client_lock(ep);
+		UA_WriteResponse response = UA_Client_Service_write(ep->client, request);
+		opcua_client_unlock(ep);
+
+		UA_StatusCode service = response.responseHeader.serviceResult;
+		if(service == UA_STATUSCODE_GOOD && response.resultsSize != written.size()) {
+			service = UA_STATUSCODE_BADUNEXPECTEDERROR;
+		}
+
+		for (size_t k = 0; k < written.size(); k++) {
+			results[written[k]] = (service != UA_STATUSCODE_GOOD) ? service : response.results[k];
+		}
+
+		char name[16];
+		printf("[write] [%s] %u values in 1 request : %s\n", ep->name, (unsigned int)written.size(), status_name(service, name, sizeof(name)));
+		UA_WriteResponse_deleteMembers(&response);
+
+		if(service != UA_STATUSCODE_GOOD) {
+			opcua_session_recover(ep, generation);
+		}
+	}
+
+	if(learnt != UA_STATUSCODE_GOOD && !request.nodesToWriteSize) {
+		opcua_session_recover(ep, generation);
+	}
+
+	UA_WriteRequest_deleteMembers(&request);
+
+	for (size_t k = 0; k < batch.size(); k++) {
+		WriteTarget* t = batch[k].target;
+		if(t->group->ep != e) {
+			continue;
+		}
+		write_ack(batch[k].path, batch[k].payload, results[t], latest[t] != k);
+	}
+}
+
+void* write_run(void* param)
+{
+	vector<WriteCommand> batch;
+
+	while(!beStop) {
+		pthread_mutex_lock(&pendingLock);
+		while(pending.empty() && !beStop) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += 1;
+			pthread_cond_timedwait(&pendingCond, &pendingLock, &ts);
+		}
+		int64_t wait = pendingSince + g_config->writeCoalesceUSec - epoch();
+		pthread_mutex_unlock(&pendingLock);
+
+		/* let the burst arrive, then take the whole window at once */
+		if(wait > 0) {
+			usleep(wait);
+		}
+
+		pthread_mutex_lock(&pendingLock);
+		batch.swap(pending);
+		pthread_mutex_unlock(&pendingLock);
+
+		for (int e = 0; e < g_config->endpointCount; e++) {
+			write_batch(e, batch);
+		}
+
+		for (size_t k = 0; k < batch.size(); k++) {
+			free(batch[k].path);
+			free(batch[k].payload);
+		}
+		batch.clear();
+	}
+
+	return NULL;
+}
@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+# This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+# See http://creativecommons.org/publicdomain/zero/1.0/ for more information.
+
+"""Reference decoder of the "delta" group format.
+
+    ./delta-decode.py --listen 5555      the tcp sink connects here ("framing": "length")
+    ./delta-decode.py < capture.bin      u32 big endian length + message, one after the other
+
+prints one json line per message with the full state of the group. the
+bridge sends per group, all in CBOR :
+
+    keyframe : {"g": group, "s": seq, "t": time, "k": [alias, ..], "v": [value, ..]}
+    delta    : {"g": group, "s": seq, "t": time, "d": {position: value, ..}}
+
+s counts the messages of a group from 0, a delta applies to the message
+before it only : after a gap (or before the first keyframe) the deltas of
+the group are skipped until the next keyframe. DeltaDecoder is the part
+to reuse, feed it every payload of the mqtt topic or the tcp stream.
+"""
+
+import argparse
+import json
+import socket
+import struct
+import sys
+
+# RFC 8746 typed arrays : tag -> struct item
+TYPED = {
+    64: "B", 65: ">H", 66: ">I", 67: ">Q", 68: "B", 69: "<H", 70: "<I", 71: "<Q",
+    72: "b", 73: ">h", 74: ">i", 75: ">q", 77: "<h", 78: "<i", 79: "<q",
+    80: ">e", 81: ">f", 82: ">d", 84: "<e", 85: "<f", 86: "<d",
+}
+
+
+class Cbor:
+    """the subset of RFC 8949 the bridge writes"""
+
+    def __init__(self, data):
+        self.data = data
+        self.at = 0
+
+    def take(self, n):
+        if self.at + n > len(self.data):
+            raise ValueError("truncated cbor")
+        b = self.data[self.at:self.at + n]
+        self.at += n
+        return b
+
+    def argument(self, info):
+        if info < 24:
+            return info
+        if info == 31:
+            return None
+        size = {24: 1, 25: 2, 26: 4, 27: 8}.get(info)
+        if size is None:
+            raise ValueError("bad cbor argument %d" % info)
+        return int.from_bytes(self.take(size), "big")
+
+    def item(self):
+        head = self.take(1)[0]
+        major, info = head >> 5, head & 31
+
+        if major == 7:
+            if info == 20:
+                return False
+            if info == 21:
+                return True
+            if info in (22, 23):
+                return None
+            if info == 25:
+                return struct.unpack(">e", self.take(2))[0]
+            if info == 26:
+                return struct.unpack(">f", self.take(4))[0]
+            if info == 27:
+                return struct.unpack(">d", self.take(8))[0]
+            if info == 31:
+                return StopIteration
+            raise ValueError("bad cbor simple value %d" % info)
+
+        n = self.argument(info)
+        if major == 0:
+            return n
+        if major == 1:
+            return -1 - n
+        if major in (2, 3):
+            if n is None:
+                raise ValueError("indefinite strings are not written by the bridge")
+            b = self.take(n)
+            return b.decode("utf-8") if major == 3 else b
+        if major == 4:
+            return self.items(n)
+        if major == 5:
+            keys = self.items(None if n is None else 2 * n)
+            return dict(zip(keys[0::2], keys[1::2]))
+
+        # tags
+        value = self.item()
+        if n in TYPED:
+            size = struct.calcsize(TYPED[n])
+            return [struct.unpack_from(TYPED[n], value, k)[0] for k in range(0, len(value), size)]
+        if n == 40:
+            dims, flat = value
+            return reshape(flat, dims)
+        return value
+
+    def items(self, n):
+        out = []
+        while n is None or len(out) < n:
+            v = self.item()
+            if v is StopIteration:
+                break
+            out.append(v)
+        return out
+
+
+def reshape(flat, dims):
+    if len(dims) <= 1:
+        return list(flat)
+    step = len(flat) // dims[0] if dims[0] else 0
+    return [reshape(flat[k * step:(k + 1) * step], dims[1:]) for k in range(dims[0])]
+
+
+class DeltaDecoder:
+    """the state of every group seen, by group name"""
+
+    def __init__(self):
+        self.groups = {}
+
+    def feed(self, payload):
+        """one message : (group, state) with state {"seq", "time", "values", "changed"},
+        state is None while the group waits for a keyframe"""
+        m = Cbor(payload).item()
+        group, seq = m["g"], m["s"]
+        g = self.groups.get(group)
+
+        if "k" in m:
+            g = {"names": m["k"], "values": list(m["v"]), "seq": seq}
+            self.groups[group] = g
+            changed = list(g["names"])
+        elif g is None or seq != g["seq"] + 1:
+            # a lost message, or the bridge restarted the group : its deltas mean nothing here
+            if g is not None:
+                sys.stderr.write("[gap] %s : seq %d after %d, waiting for a keyframe\n" % (group, seq, g["seq"]))
+                del self.groups[group]
+            return group, None
+        else:
+            for position, value in m["d"].items():
+                g["values"][position] = value
+            g["seq"] = seq
+            changed = [g["names"][p] for p in m["d"]]
+
+        return group, {
+            "seq": seq,
+            "time": m["t"],
+            "values": dict(zip(g["names"], g["values"])),
+            "changed": changed,
+        }
+
+
+def frames(read):
+    while True:
+        head = read(4)
+        if len(head) < 4:
+            return
+        n = struct.unpack(">I", head)[0]
+        body = read(n)
+        if len(body) < n:
+            return
+        yield body
+
+
+def show(decoder, payload):
+    group, state = decoder.feed(payload)
+    if state is not None:
+        print(json.dumps({"group": group, **state}, default=repr), flush=True)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--listen", type=int, help="tcp port the bridge's tcp sink connects to")
+    args = ap.parse_args()
+
+    decoder = DeltaDecoder()
+
+    if args.listen is None:
+        for payload in frames(sys.stdin.buffer.read):
+            show(decoder, payload)
+        return
+
+    srv = socket.socket()
+    srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    srv.bind(("0.0.0.0", args.listen))
+    srv.listen(1)
+    while True:
+        conn, peer = srv.accept()
+        sys.stderr.write("[tcp] %s:%d connected\n" % peer)
+        stream = conn.makefile("rb")
+        for payload in frames(stream.read):
+            show(decoder, payload)
+        conn.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,278 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+/* compression ratio and throughput of the "gorilla" format on a --record log :
+ *
+ *     ./gorilla-bench <record log> [window us, 1000000] [runs, 5]
+ *
+ * the numbers, bools and DateTime of every node are cut into batches of one
+ * window like the bridge does (bridge time of the sample), encoded, decoded
+ * and compared sample by sample. raw is 16 bytes a sample (i64 time + 8
+ * bytes value), the frame overhead of the bridge is not counted */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_types_generated.h"
+#else
+# include "open62541.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <vector>
+#include <string>
+using namespace std;
+
+#include "client-gorilla.h"
+
+/* see client-record.cpp */
+#define RECORD_MAGIC   "UAMQREC\1"
+#define RECORD_SOURCE  0x02
+#define RECORD_SERVER  0x04
+#define RECORD_STATUS  0x08
+#define RECORD_VALUE   0x10
+
+struct Sample {
+	int64_t t;
+	uint64_t v;	/* float64 bits or int64 */
+};
+
+struct Batch {
+	uint32_t node;
+	int kind;
+	vector<Sample> samples;
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+template <typename T> static bool get(FILE* f, T* v)
+{
+	return fread(v, sizeof(T), 1, f) == 1;
+}
+
+/* a recorded value as the bridge batches it, false : not a number */
+static bool sample_value(uint16_t type, const char* raw, size_t len, int* kind, uint64_t* v)
+{
+	int64_t i = 0;
+	double d = 0;
+
+	switch(type) {
+		case UA_TYPES_FLOAT : { float x; if(len < sizeof(x)) return false; memcpy(&x, raw, sizeof(x)); d = x; } break;
+		case UA_TYPES_DOUBLE : { if(len < sizeof(d)) return false; memcpy(&d, raw, sizeof(d)); } break;
+		case UA_TYPES_BOOLEAN : i = raw[0] ? 1 : 0; break;
+		case UA_TYPES_SBYTE : i = (int8_t)raw[0]; break;
+		case UA_TYPES_BYTE : i = (uint8_t)raw[0]; break;
+		case UA_TYPES_INT16 : { int16_t x; memcpy(&x, raw, sizeof(x)); i = x; } break;
+		case UA_TYPES_UINT16 : { uint16_t x; memcpy(&x, raw, sizeof(x)); i = x; } break;
+		case UA_TYPES_INT32 : { int32_t x; memcpy(&x, raw, sizeof(x)); i = x; } break;
+		case UA_TYPES_UINT32 : { uint32_t x; memcpy(&x, raw, sizeof(x)); i = x; } break;
+		case UA_TYPES_INT64 :
+		case UA_TYPES_UINT64 : memcpy(&i, raw, sizeof(i)); break;
+		case UA_TYPES_DATETIME : memcpy(&i, raw, sizeof(i)); i = (i - UA_DATETIME_UNIX_EPOCH) / UA_USEC_TO_DATETIME; break;
+		default : return false;
+	}
+
+	if(type == UA_TYPES_FLOAT || type == UA_TYPES_DOUBLE) {
+		*kind = GORILLA_FLOAT;
+		memcpy(v, &d, sizeof(d));
+	} else {
+		*kind = GORILLA_INT;
+		*v = (uint64_t)i;
+	}
+	return true;
+}
+
+/* the batches of the log, in the order they close */
+static bool load(const char* path, int64_t window, vector<Batch>& batches, unsigned long* skipped)
+{
+	FILE* f = fopen(path, "rb");
+	if(!f) {
+		printf("[error] can't open %s.\n", path);
+		return false;
+	}
+	setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+	char magic[8];
+	uint32_t count = 0;
+	if(fread(magic, 1, 8, f) != 8 || memcmp(magic, RECORD_MAGIC, 8) || !get(f, &count)) {
+		printf("[error] %s is not a record log.\n", path);
+		fclose(f);
+		return false;
+	}
+	for (uint32_t k = 0; k < count; k++) {
+		uint16_t len = 0;
+		if(!get(f, &len) || fseek(f, len, SEEK_CUR)) {
+			fclose(f);
+			return false;
+		}
+	}
+
+	/* the open batch of every node, index into batches */
+	vector<long> open(count, -1);
+	vector<int64_t> ends(count, 0);
+	vector<char> raw;
+
+	uint32_t index;
+	uint8_t flags;
+	uint16_t type;
+	int64_t t, ts;
+	uint32_t status;
+	while(get(f, &index) && get(f, &flags) && get(f, &type) && get(f, &t)) {
+		if(((flags & RECORD_SOURCE) && !get(f, &ts)) || ((flags & RECORD_SERVER) && !get(f, &ts)) ||
+				((flags & RECORD_STATUS) && !get(f, &status))) {
+			break;
+		}
+		if(flags & RECORD_VALUE) {
+			uint16_t len = 0;
+			if(!get(f, &len)) {
+				break;
+			}
+			raw.resize(len + 8);
+			if(len && fread(&raw[0], 1, len, f) != len) {
+				break;
+			}
+		}
+		if(index >= count) {
+			printf("[error] node index %u out of %u.\n", index, count);
+			break;
+		}
+
+		int kind;
+		Sample s;
+		s.t = t;
+		if(!(flags & RECORD_VALUE) || ((flags & RECORD_STATUS) && status) ||
+				!sample_value(type, &raw[0], raw.size() - 8, &kind, &s.v)) {
+			(*skipped)++;
+			continue;
+		}
+
+		if(open[index] >= 0 && (t >= ends[index] || batches[open[index]].kind != kind)) {
+			open[index] = -1;
+		}
+		if(open[index] < 0) {
+			Batch b;
+			b.node = index;
+			b.kind = kind;
+			batches.push_back(b);
+			open[index] = (long)batches.size() - 1;
+			ends[index] = (t / window + 1) * window;
+		}
+		batches[open[index]].samples.push_back(s);
+	}
+
+	fclose(f);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 2) {
+		printf("usage : %s <record log> [window us, 1000000] [runs, 5]\n", argv[0]);
+		return 1;
+	}
+	int64_t window = argc > 2 ? atoll(argv[2]) : 1000000;
+	int runs = argc > 3 ? atoi(argv[3]) : 5;
+	if(window <= 0 || runs <= 0) {
+		printf("[error] window and runs must be > 0.\n");
+		return 1;
+	}
+
+	vector<Batch> batches;
+	unsigned long skipped = 0;
+	if(!load(argv[1], window, batches, &skipped)) {
+		return 1;
+	}
+
+	unsigned long samples = 0, floats = 0;
+	for (size_t b = 0; b < batches.size(); b++) {
+		samples += batches[b].samples.size();
+		if(batches[b].kind == GORILLA_FLOAT) {
+			floats += batches[b].samples.size();
+		}
+	}
+	if(!samples) {
+		printf("no numeric sample in %s (%lu skipped).\n", argv[1], skipped);
+		return 1;
+	}
+
+	vector<GorillaSeries> series(batches.size());
+	for (size_t b = 0; b < series.size(); b++) {
+		gorilla_init(&series[b]);
+	}
+
+	double encode = 0, decode = 0;
+	size_t bytes = 0;
+	for (int run = 0; run < runs; run++) {
+		double start = now_sec();
+		for (size_t b = 0; b < batches.size(); b++) {
+			GorillaSeries* s = &series[b];
+			const vector<Sample>& in = batches[b].samples;
+			gorilla_reset(s);
+			for (size_t k = 0; k < in.size(); k++) {
+				if(batches[b].kind == GORILLA_FLOAT) {
+					double d;
+					memcpy(&d, &in[k].v, sizeof(d));
+					gorilla_put_double(s, in[k].t, d);
+				} else {
+					gorilla_put_int(s, in[k].t, (int64_t)in[k].v);
+				}
+			}
+		}
+		double mid = now_sec();
+
+		bytes = 0;
+		for (size_t b = 0; b < batches.size(); b++) {
+			const vector<Sample>& in = batches[b].samples;
+			GorillaReader r;
+			int64_t t;
+			uint64_t v;
+			size_t k = 0;
+			gorilla_reader(&r, series[b].kind, series[b].count, series[b].data, gorilla_bytes(&series[b]));
+			while(gorilla_next(&r, &t, &v)) {
+				if(k >= in.size() || t != in[k].t || v != in[k].v) {
+					printf("[error] node %u, batch sample %lu : decoded %lld/%llx, recorded %lld/%llx.\n", batches[b].node,
+						(unsigned long)k, (long long)t, (unsigned long long)v,
+						k < in.size() ? (long long)in[k].t : 0LL, k < in.size() ? (unsigned long long)in[k].v : 0ULL);
+					return 1;
+				}
+				k++;
+			}
+			if(k != in.size()) {
+				printf("[error] node %u : %lu of %lu samples decoded.\n", batches[b].node, (unsigned long)k, (unsigned long)in.size());
+				return 1;
+			}
+			bytes += gorilla_bytes(&series[b]);
+		}
+		double end = now_sec();
+
+		/* the best run, the others warm the caches */
+		if(!run || mid - start < encode) {
+			encode = mid - start;
+		}
+		if(!run || end - mid < decode) {
+			decode = end - mid;
+		}
+	}
+
+	for (size_t b = 0; b < series.size(); b++) {
+		gorilla_free(&series[b]);
+	}
+
+	size_t raw = samples * 16;
+	printf("%lu samples (%lu float, %lu integer), %lu skipped, %lu batches of %lld us\n", samples, floats, samples - floats,
+		skipped, (unsigned long)batches.size(), (long long)window);
+	printf("raw %lu bytes, gorilla %lu bytes, ratio %.2f, %.2f bits/sample\n", (unsigned long)raw, (unsigned long)bytes,
+		bytes ? (double)raw / bytes : 0.0, 8.0 * bytes / samples);
+	printf("encode %.1f Msamples/s, decode %.1f Msamples/s (best of %d), lossless\n",
+		encode > 0 ? samples / encode / 1e6 : 0.0, decode > 0 ? samples / decode / 1e6 : 0.0, runs);
+
+	return 0;
+}
@@ -0,0 +1,245 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+/* time ranges of the local store :
+ *
+ *     ./store-query <store path> [--from T] [--to T] [--node pattern] [--stats]
+ *
+ * T is unix us or 2026-10-18T21:00:00 (UTC), pattern a shell glob on
+ * '<group topic>/<node topic>'. prints 'time,path,value,status' lines in time
+ * order, or with --stats the samples, time span and bytes per node. the
+ * partitions and blocks outside the range are skipped without decoding. */
+
+#ifdef UA_NO_AMALGAMATION
+# include "ua_types.h"
+# include "ua_types_generated.h"
+#else
+# include "open62541.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <fnmatch.h>
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <map>
+#include <algorithm>
+using namespace std;
+
+#include "client-segment.h"
+
+typedef struct {
+	const string* path;
+	vector<SegmentRecord> blocks;
+	size_t next;
+	SegmentCursor cursor;
+	uint16_t type;
+	int64_t t;
+	uint64_t v;
+	uint32_t status;
+} QueryNode;
+
+struct QueryLater {
+	bool operator()(const QueryNode* a, const QueryNode* b) const
+	{
+		return a->t != b->t ? a->t > b->t : *a->path > *b->path;
+	}
+};
+
+typedef struct {
+	unsigned long samples;
+	unsigned long blocks;
+	unsigned long long bytes;
+	int64_t first;
+	int64_t last;
+} QueryStats;
+
+static int64_t from = INT64_MIN, to = INT64_MAX;
+
+static bool query_advance(QueryNode* q)
+{
+	while(true) {
+		while(q->next && segment_cursor_next(&q->cursor, &q->t, &q->v, &q->status)) {
+			if(q->t >= from && q->t <= to) {
+				return true;
+			}
+		}
+		if(q->next >= q->blocks.size()) {
+			return false;
+		}
+		const SegmentRecord* r = &q->blocks[q->next++];
+		segment_cursor(&q->cursor, r);
+		q->type = r->uaType;
+	}
+}
+
+static void print_sample(const QueryNode* q)
+{
+	double d;
+	int64_t i = (int64_t)q->v;
+	memcpy(&d, &q->v, sizeof(d));
+
+	printf("%lld,%s,", (long long)q->t, q->path->c_str());
+	switch(q->type) {
+		case UA_TYPES_FLOAT : printf("%.9g", d); break;
+		case UA_TYPES_DOUBLE : printf("%.17g", d); break;
+		case UA_TYPES_BOOLEAN : printf("%s", i ? "true" : "false"); break;
+		case UA_TYPES_UINT64 : printf("%llu", (unsigned long long)q->v); break;
+		default : printf("%lld", (long long)i); break;
+	}
+	printf(",0x%08x\n", q->status);
+}
+
+int main(int argc, char** argv)
+{
+	const char* dirPath = NULL;
+	const char* pattern = NULL;
+	bool stats = false;
+
+	for (int a = 1; a < argc; a++) {
+		if(!strcmp(argv[a], "--from") && a + 1 < argc) {
+			if(!segment_parse_time(argv[++a], &from)) {
+				printf("[error] invalid time '%s'.\n", argv[a]);
+				return 1;
+			}
+		} else if(!strcmp(argv[a], "--to") && a + 1 < argc) {
+			if(!segment_parse_time(argv[++a], &to)) {
+				printf("[error] invalid time '%s'.\n", argv[a]);
+				return 1;
+			}
+		} else if(!strcmp(argv[a], "--node") && a + 1 < argc) {
+			pattern = argv[++a];
+		} else if(!strcmp(argv[a], "--stats")) {
+			stats = true;
+		} else if(!dirPath && argv[a][0] != '-') {
+			dirPath = argv[a];
+		} else {
+			dirPath = NULL;
+			break;
+		}
+	}
+	if(!dirPath) {
+		printf("usage : %s <store path> [--from T] [--to T] [--node pattern] [--stats]\n", argv[0]);
+		return 1;
+	}
+
+	/* the partitions of the range, in time order */
+	vector<pair<int64_t, string> > files;
+	DIR* dir = opendir(dirPath);
+	if(!dir) {
+		printf("[error] can't open %s.\n", dirPath);
+		return 1;
+	}
+	struct dirent* e;
+	while((e = readdir(dir)) != NULL) {
+		size_t len = strlen(e->d_name);
+		if(len < 4 || strcmp(e->d_name + len - 4, ".seg")) {
+			continue;
+		}
+		SegmentFile f;
+		string file = string(dirPath) + "/" + e->d_name;
+		if(segment_open(&f, file.c_str()) < 0) {
+			fprintf(stderr, "[warning] %s is not a segment file, skipped.\n", file.c_str());
+			continue;
+		}
+		if(f.start <= to && (f.start > INT64_MAX - f.length || f.start + f.length > from)) {
+			files.push_back(pair<int64_t, string>(f.start, file));
+		}
+		segment_close(&f);
+	}
+	closedir(dir);
+	sort(files.begin(), files.end());
+
+	map<string, QueryStats> summary;
+	unsigned long samples = 0;
+
+	for (size_t k = 0; k < files.size(); k++) {
+		SegmentFile f;
+		if(segment_open(&f, files[k].second.c_str()) < 0) {
+			continue;
+		}
+
+		/* nodes by their id in this file, NULL : not asked for */
+		map<string, QueryNode> nodes;
+		map<uint32_t, QueryNode*> ids;
+		SegmentRecord r;
+		while(segment_next(&f, &r)) {
+			if(r.type == SEGMENT_NODE) {
+				string path(r.path, r.pathLen);
+				if(pattern && fnmatch(pattern, path.c_str(), 0)) {
+					ids[r.node] = NULL;
+					continue;
+				}
+				map<string, QueryNode>::iterator n = nodes.insert(pair<string, QueryNode>(path, QueryNode())).first;
+				n->second.path = &n->first;
+				n->second.next = 0;
+				ids[r.node] = &n->second;
+			} else if(r.type == SEGMENT_BLOCK && r.last >= from && r.first <= to) {
+				map<uint32_t, QueryNode*>::iterator q = ids.find(r.node);
+				if(q == ids.end() || !q->second) {
+					continue;
+				}
+				q->second->blocks.push_back(r);
+				if(stats) {
+					QueryStats* s = &summary[*q->second->path];
+					s->blocks++;
+					s->bytes += 48 + r.bytes[0] + r.bytes[1] + r.bytes[2];
+				}
+			}
+		}
+		if(f.at < f.len) {
+			fprintf(stderr, "[warning] %s : a cut record at %lu, the rest is not read.\n", files[k].second.c_str(), (unsigned long)f.at);
+		}
+
+		priority_queue<QueryNode*, vector<QueryNode*>, QueryLater> due;
+		map<string, QueryNode>::iterator n;
+		for (n = nodes.begin(); n != nodes.end(); ++n) {
+			if(query_advance(&n->second)) {
+				due.push(&n->second);
+			}
+		}
+		while(!due.empty()) {
+			QueryNode* q = due.top();
+			due.pop();
+			samples++;
+			if(stats) {
+				QueryStats* s = &summary[*q->path];
+				if(!s->samples || q->t < s->first) {
+					s->first = q->t;
+				}
+				if(!s->samples || q->t > s->last) {
+					s->last = q->t;
+				}
+				s->samples++;
+			} else {
+				print_sample(q);
+			}
+			if(query_advance(q)) {
+				due.push(q);
+			}
+		}
+
+		segment_close(&f);
+	}
+
+	if(stats) {
+		unsigned long long bytes = 0;
+		printf("node,samples,first,last,bytes,bits/sample\n");
+		map<string, QueryStats>::iterator s;
+		for (s = summary.begin(); s != summary.end(); ++s) {
+			const QueryStats* q = &s->second;
+			printf("%s,%lu,%lld,%lld,%llu,%.2f\n", s->first.c_str(), q->samples, (long long)q->first, (long long)q->last,
+				q->bytes, q->samples ? 8.0 * q->bytes / q->samples : 0.0);
+			bytes += q->bytes;
+		}
+		fprintf(stderr, "%lu samples of %d nodes from %d partitions, %llu bytes of blocks (%.2f bytes/sample)\n", samples,
+			(int)summary.size(), (int)files.size(), bytes, samples ? (double)bytes / samples : 0.0);
+	}
+
+	return 0;
+}
@@ -571,7 +571,10 @@ ServerNetworkLayerTCP_stop(UA_ServerNetworkLayer *nl, UA_Job **jobs) {
     WSACleanup();
 #endif
     *jobs = items;
-    return layer->mappingsSize*2;
+    /* the jobs free the connections, a restarted layer starts without them */
+    size_t count = layer->mappingsSize*2;
+    layer->mappingsSize = 0;
+    return count;
 }
 
 /* run only when the server is stopped */
@@ -644,6 +644,51 @@ UA_StatusCode UA_Client_manuallyRenewSecureChannel(UA_Client *client) {
     return retval;
 }
 
+UA_StatusCode UA_Client_reconnect(UA_Client *client) {
+    if(client->state == UA_CLIENTSTATE_READY || !client->endpointUrl.data ||
+       client->endpointUrl.length > 511 ||
+       UA_NodeId_equal(&client->authenticationToken, &UA_NODEID_NULL))
+        return UA_STATUSCODE_BADNOTCONNECTED;
+
+    char endpointUrl[512];
+    memcpy(endpointUrl, client->endpointUrl.data, client->endpointUrl.length);
+    endpointUrl[client->endpointUrl.length] = 0;
+
+    /* Drop the broken connection and SecureChannel. The session and the
+     * subscriptions are kept and re-activated on the new channel. */
+    if(client->connection.close)
+        client->connection.close(&client->connection);
+    UA_Connection_deleteMembers(&client->connection);
+    UA_SecureChannel_deleteMembersCleanup(&client->channel);
+    memset(&client->channel, 0, sizeof(UA_SecureChannel));
+    client->channel.connection = &client->connection;
+    client->nextChannelRenewal = 0;
+
+    client->connection =
+        client->config.connectionFunc(UA_ConnectionConfig_standard,
+                                      endpointUrl, client->config.logger);
+    if(client->connection.state != UA_CONNECTION_OPENING) {
+        client->state = UA_CLIENTSTATE_ERRORED;
+        return UA_STATUSCODE_BADCONNECTIONCLOSED;
+    }
+
+    client->connection.localConf = client->config.localConnectionConfig;
+    UA_StatusCode retval = HelAckHandshake(client);
+    if(retval == UA_STATUSCODE_GOOD)
+        retval = SecureChannelHandshake(client, false);
+    if(retval == UA_STATUSCODE_GOOD)
+        retval = ActivateSession(client);
+    if(retval != UA_STATUSCODE_GOOD) {
+        client->connection.close(&client->connection);
+        client->state = UA_CLIENTSTATE_ERRORED;
+        return retval;
+    }
+
+    client->connection.state = UA_CONNECTION_ESTABLISHED;
+    client->state = UA_CLIENTSTATE_CONNECTED;
+    return UA_STATUSCODE_GOOD;
+}
+
 /****************/
 /* Raw Services */
 /****************/
@@ -9,6 +9,8 @@
 #include "ua_types.h"
 #include "ua_server.h"
 #include "ua_client.h"
+#include "ua_client_highlevel.h"
+#include "client/ua_client_internal.h"
 #include "ua_config_standard.h"
 #include "ua_network_tcp.h"
 #include "check.h"
@@ -45,6 +47,26 @@ static void teardown(void) {
     nl.deleteMembers(&nl);
 }
 
+/* The listener and its connections go down and come back. The sessions stay
+ * in the server, as when the network between client and server is cut. */
+static void restartListener(void) {
+    *running = false;
+    pthread_join(server_thread, NULL);
+    UA_Server_run_shutdown(server);
+    UA_Server_run_startup(server);
+    *running = true;
+    pthread_create(&server_thread, NULL, serverloop, NULL);
+}
+
+static UA_StatusCode readServerTime(UA_Client *client) {
+    UA_Variant value;
+    UA_Variant_init(&value);
+    UA_StatusCode retval =
+        UA_Client_readValueAttribute(client, UA_NODEID_NUMERIC(0, UA_NS0ID_SERVER_SERVERSTATUS_CURRENTTIME), &value);
+    UA_Variant_deleteMembers(&value);
+    return retval;
+}
+
 START_TEST(Client_connect) {
     UA_Client *client = UA_Client_new(UA_ClientConfig_standard);
     UA_StatusCode retval = UA_Client_connect(client, "opc.tcp://localhost:16664");
@@ -56,12 +78,71 @@ START_TEST(Client_connect) {
 }
 END_TEST
 
+START_TEST(Client_reconnect) {
+    UA_Client *client = UA_Client_new(UA_ClientConfig_standard);
+    UA_StatusCode retval = UA_Client_connect(client, "opc.tcp://localhost:16664");
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(readServerTime(client), UA_STATUSCODE_GOOD);
+
+    UA_NodeId token;
+    UA_NodeId_copy(&client->authenticationToken, &token);
+
+    restartListener();
+
+    /* The connection is gone */
+    ck_assert_uint_ne(readServerTime(client), UA_STATUSCODE_GOOD);
+
+    /* New connection and SecureChannel, the same session */
+    retval = UA_Client_reconnect(client);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    ck_assert(UA_NodeId_equal(&client->authenticationToken, &token));
+    ck_assert_uint_eq(readServerTime(client), UA_STATUSCODE_GOOD);
+
+    UA_NodeId_deleteMembers(&token);
+    UA_Client_disconnect(client);
+    UA_Client_delete(client);
+}
+END_TEST
+
+START_TEST(Client_reconnect_failed) {
+    UA_Client *client = UA_Client_new(UA_ClientConfig_standard);
+
+    /* No session to re-activate */
+    ck_assert_uint_eq(UA_Client_reconnect(client), UA_STATUSCODE_BADNOTCONNECTED);
+
+    UA_StatusCode retval = UA_Client_connect(client, "opc.tcp://localhost:16664");
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    /* The server is down */
+    teardown();
+    ck_assert_uint_ne(UA_Client_reconnect(client), UA_STATUSCODE_GOOD);
+
+    /* A new server does not know the session */
+    setup();
+    ck_assert_uint_ne(UA_Client_reconnect(client), UA_STATUSCODE_GOOD);
+
+    /* A new session works */
+    UA_Client_reset(client);
+    retval = UA_Client_connect(client, "opc.tcp://localhost:16664");
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(readServerTime(client), UA_STATUSCODE_GOOD);
+
+    UA_Client_disconnect(client);
+    UA_Client_delete(client);
+}
+END_TEST
+
 static Suite* testSuite_Client(void) {
     Suite *s = suite_create("Client");
     TCase *tc_client = tcase_create("Client Basic");
     tcase_add_checked_fixture(tc_client, setup, teardown);
     tcase_add_test(tc_client, Client_connect);
     suite_add_tcase(s,tc_client);
+    TCase *tc_client_reconnect = tcase_create("Client Reconnect");
+    tcase_add_checked_fixture(tc_client_reconnect, setup, teardown);
+    tcase_add_test(tc_client_reconnect, Client_reconnect);
+    tcase_add_test(tc_client_reconnect, Client_reconnect_failed);
+    suite_add_tcase(s,tc_client_reconnect);
     return s;
 }
 
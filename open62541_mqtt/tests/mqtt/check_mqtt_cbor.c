@@ -0,0 +1,421 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ua_types.h"
+#include "ua_types_generated_handling.h"
+#include "client-cbor.h"
+#include "check.h"
+#include "check_mqtt_helpers.h"
+
+/* typed arrays are tagged in the byte order of the host (RFC 8746) */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+# define HOST(be, le) be
+#else
+# define HOST(be, le) le
+#endif
+
+/* the buffer starts with one byte, every vector makes it grow */
+#define ENCODES(call, expected) do {                    \
+        CborBuf b;                                      \
+        cbor_init(&b, 1);                               \
+        call;                                           \
+        ck_assert_str_eq(hex(b.data, b.len), expected); \
+        cbor_free(&b);                                  \
+    } while(0)
+
+#define VARIANT(v, expected) ENCODES(ck_assert(cbor_variant(&b, v)), expected)
+
+/* the reader of the round trips : one head, its major type and argument */
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+} Reader;
+
+static void reader(Reader *r, const CborBuf *b) {
+    r->p = (const unsigned char*)b->data;
+    r->end = r->p + b->len;
+}
+
+static int next_head(Reader *r, uint64_t *arg) {
+    if(r->p >= r->end)
+        return -1;
+    unsigned char h = *r->p++;
+    int ai = h & 0x1f;
+    *arg = 0;
+    if(ai < 24) {
+        *arg = (uint64_t)ai;
+        return h >> 5;
+    }
+    if(ai == 31)
+        return h >> 5;
+    if(ai > 27)
+        return -1;
+    int bytes = 1 << (ai - 24);
+    if(r->end - r->p < bytes)
+        return -1;
+    for(int k = 0; k < bytes; k++)
+        *arg = *arg << 8 | *r->p++;
+    return h >> 5;
+}
+
+static int64_t next_int(Reader *r) {
+    uint64_t arg;
+    int major = next_head(r, &arg);
+    ck_assert(major == 0 || major == 1);
+    return major == 0 ? (int64_t)arg : -1 - (int64_t)arg;
+}
+
+static const unsigned char *next_string(Reader *r, int major, size_t *len) {
+    uint64_t arg;
+    ck_assert_int_eq(next_head(r, &arg), major);
+    ck_assert(arg <= (uint64_t)(r->end - r->p));
+    const unsigned char *s = r->p;
+    r->p += arg;
+    *len = (size_t)arg;
+    return s;
+}
+
+/* RFC 8949 appendix A */
+START_TEST(knownIntegers) {
+    ENCODES(cbor_uint(&b, 0), "00");
+    ENCODES(cbor_uint(&b, 1), "01");
+    ENCODES(cbor_uint(&b, 10), "0a");
+    ENCODES(cbor_uint(&b, 23), "17");
+    ENCODES(cbor_uint(&b, 24), "1818");
+    ENCODES(cbor_uint(&b, 25), "1819");
+    ENCODES(cbor_uint(&b, 100), "1864");
+    ENCODES(cbor_uint(&b, 1000), "1903e8");
+    ENCODES(cbor_uint(&b, 1000000), "1a000f4240");
+    ENCODES(cbor_uint(&b, 1000000000000ULL), "1b000000e8d4a51000");
+    ENCODES(cbor_uint(&b, UINT64_MAX), "1bffffffffffffffff");
+    ENCODES(cbor_int(&b, 0), "00");
+    ENCODES(cbor_int(&b, -1), "20");
+    ENCODES(cbor_int(&b, -10), "29");
+    ENCODES(cbor_int(&b, -100), "3863");
+    ENCODES(cbor_int(&b, -1000), "3903e7");
+    ENCODES(cbor_int(&b, INT64_MAX), "1b7fffffffffffffff");
+    ENCODES(cbor_int(&b, INT64_MIN), "3b7fffffffffffffff");
+}
+END_TEST
+
+START_TEST(knownSimpleValues) {
+    ENCODES(cbor_bool(&b, false), "f4");
+    ENCODES(cbor_bool(&b, true), "f5");
+    ENCODES(cbor_null(&b), "f6");
+    /* floats keep their width, no half precision */
+    ENCODES(cbor_float(&b, 1.5f), "fa3fc00000");
+    ENCODES(cbor_float(&b, 100000.0f), "fa47c35000");
+    ENCODES(cbor_float(&b, 3.4028234663852886e+38f), "fa7f7fffff");
+    ENCODES(cbor_float(&b, INFINITY), "fa7f800000");
+    ENCODES(cbor_double(&b, 1.1), "fb3ff199999999999a");
+    ENCODES(cbor_double(&b, 1.0e+300), "fb7e37e43c8800759c");
+    ENCODES(cbor_double(&b, -4.1), "fbc010666666666666");
+    ENCODES(cbor_double(&b, -INFINITY), "fbfff0000000000000");
+}
+END_TEST
+
+START_TEST(knownStringsAndContainers) {
+    ENCODES(cbor_text(&b, "", 0), "60");
+    ENCODES(cbor_text(&b, "a", 1), "6161");
+    ENCODES(cbor_key(&b, "IETF"), "6449455446");
+    ENCODES(cbor_text(&b, "\xc3\xbc", 2), "62c3bc");
+    ENCODES(cbor_bytes(&b, NULL, 0), "40");
+    ENCODES(cbor_bytes(&b, "\x01\x02\x03\x04", 4), "4401020304");
+    ENCODES(cbor_array(&b, 0), "80");
+    ENCODES((cbor_array(&b, 3), cbor_uint(&b, 1), cbor_uint(&b, 2), cbor_uint(&b, 3)), "83010203");
+    ENCODES(cbor_map(&b, 0), "a0");
+    ENCODES((cbor_map(&b, 2), cbor_key(&b, "a"), cbor_uint(&b, 1),
+             cbor_key(&b, "b"), cbor_array(&b, 2), cbor_uint(&b, 2), cbor_uint(&b, 3)),
+            "a26161016162820203");
+    ENCODES((cbor_map_open(&b), cbor_key(&b, "a"), cbor_uint(&b, 1), cbor_end(&b)), "bf616101ff");
+}
+END_TEST
+
+START_TEST(variantScalars) {
+    UA_Variant v;
+    UA_Int32 i32 = -5;
+    UA_Variant_setScalar(&v, &i32, &UA_TYPES[UA_TYPES_INT32]);
+    VARIANT(&v, "24");
+    UA_UInt64 u64 = UINT64_MAX;
+    UA_Variant_setScalar(&v, &u64, &UA_TYPES[UA_TYPES_UINT64]);
+    VARIANT(&v, "1bffffffffffffffff");
+    UA_SByte i8 = -128;
+    UA_Variant_setScalar(&v, &i8, &UA_TYPES[UA_TYPES_SBYTE]);
+    VARIANT(&v, "387f");
+    UA_Boolean t = true;
+    UA_Variant_setScalar(&v, &t, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    VARIANT(&v, "f5");
+    UA_Float f = 1.5f;
+    UA_Variant_setScalar(&v, &f, &UA_TYPES[UA_TYPES_FLOAT]);
+    VARIANT(&v, "fa3fc00000");
+    UA_Double d = 1.1;
+    UA_Variant_setScalar(&v, &d, &UA_TYPES[UA_TYPES_DOUBLE]);
+    VARIANT(&v, "fb3ff199999999999a");
+    /* unix us */
+    UA_DateTime dt = UA_DATETIME_UNIX_EPOCH + 1500000 * UA_USEC_TO_DATETIME;
+    UA_Variant_setScalar(&v, &dt, &UA_TYPES[UA_TYPES_DATETIME]);
+    VARIANT(&v, "1a0016e360");
+    UA_String s = UA_STRING("IETF");
+    UA_Variant_setScalar(&v, &s, &UA_TYPES[UA_TYPES_STRING]);
+    VARIANT(&v, "6449455446");
+    UA_ByteString bs = UA_BYTESTRING("\x01\x02");
+    UA_Variant_setScalar(&v, &bs, &UA_TYPES[UA_TYPES_BYTESTRING]);
+    VARIANT(&v, "420102");
+}
+END_TEST
+
+START_TEST(variantNotSupported) {
+    CborBuf b;
+    cbor_init(&b, 16);
+    UA_Variant v;
+    UA_Variant_init(&v);
+    ck_assert(!cbor_variant(&b, &v));
+    UA_NodeId id = UA_NODEID_NUMERIC(0, 85);
+    UA_Variant_setScalar(&v, &id, &UA_TYPES[UA_TYPES_NODEID]);
+    ck_assert(!cbor_variant(&b, &v));
+    UA_Variant_setArray(&v, &id, 1, &UA_TYPES[UA_TYPES_NODEID]);
+    ck_assert(!cbor_variant(&b, &v));
+    /* nothing written : a key before the value can be taken back */
+    ck_assert_uint_eq(b.len, 0);
+    cbor_free(&b);
+}
+END_TEST
+
+/* RFC 8746 section 2 */
+START_TEST(typedArrays) {
+    UA_Variant v;
+    UA_Byte u8[3] = {1, 2, 3};
+    UA_Variant_setArray(&v, u8, 3, &UA_TYPES[UA_TYPES_BYTE]);
+    VARIANT(&v, "d84043010203");
+    UA_SByte i8[1] = {-1};
+    UA_Variant_setArray(&v, i8, 1, &UA_TYPES[UA_TYPES_SBYTE]);
+    VARIANT(&v, "d84841ff");
+    UA_UInt16 u16[2] = {1, 2};
+    UA_Variant_setArray(&v, u16, 2, &UA_TYPES[UA_TYPES_UINT16]);
+    VARIANT(&v, HOST("d8414400010002", "d8454401000200"));
+    UA_Int32 i32[2] = {1, -1};
+    UA_Variant_setArray(&v, i32, 2, &UA_TYPES[UA_TYPES_INT32]);
+    VARIANT(&v, HOST("d84a4800000001ffffffff", "d84e4801000000ffffffff"));
+    UA_UInt64 u64[1] = {1};
+    UA_Variant_setArray(&v, u64, 1, &UA_TYPES[UA_TYPES_UINT64]);
+    VARIANT(&v, HOST("d843480000000000000001", "d847480100000000000000"));
+    UA_Float f[1] = {1.5f};
+    UA_Variant_setArray(&v, f, 1, &UA_TYPES[UA_TYPES_FLOAT]);
+    VARIANT(&v, HOST("d851443fc00000", "d855440000c03f"));
+    UA_Double d[1] = {1.5};
+    UA_Variant_setArray(&v, d, 1, &UA_TYPES[UA_TYPES_DOUBLE]);
+    VARIANT(&v, HOST("d852483ff8000000000000", "d85648000000000000f83f"));
+    UA_Variant_setArray(&v, UA_EMPTY_ARRAY_SENTINEL, 0, &UA_TYPES[UA_TYPES_INT32]);
+    VARIANT(&v, HOST("d84a40", "d84e40"));
+}
+END_TEST
+
+START_TEST(plainArrays) {
+    UA_Variant v;
+    UA_Boolean t[2] = {true, false};
+    UA_Variant_setArray(&v, t, 2, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    VARIANT(&v, "82f5f4");
+    UA_String s[2] = {UA_STRING("a"), UA_STRING("")};
+    UA_Variant_setArray(&v, s, 2, &UA_TYPES[UA_TYPES_STRING]);
+    VARIANT(&v, "82616160");
+    UA_DateTime dt[1] = {UA_DATETIME_UNIX_EPOCH - UA_USEC_TO_DATETIME};
+    UA_Variant_setArray(&v, dt, 1, &UA_TYPES[UA_TYPES_DATETIME]);
+    VARIANT(&v, "8120");
+}
+END_TEST
+
+/* RFC 8746 section 3.1 : [dimensions, typed array] in row-major order */
+START_TEST(multiDimArrays) {
+    UA_Variant v;
+    UA_Int16 i16[6] = {1, 2, 3, 4, 5, 6};
+    UA_UInt32 dims[2] = {2, 3};
+    UA_Variant_setArray(&v, i16, 6, &UA_TYPES[UA_TYPES_INT16]);
+    v.arrayDimensions = dims;
+    v.arrayDimensionsSize = 2;
+    VARIANT(&v, HOST("d82882820203d8494c000100020003000400050006",
+                     "d82882820203d84d4c010002000300040005000600"));
+    UA_Boolean t[2] = {true, true};
+    UA_UInt32 col[2] = {2, 1};
+    UA_Variant_setArray(&v, t, 2, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    v.arrayDimensions = col;
+    v.arrayDimensionsSize = 2;
+    VARIANT(&v, "d8288282020182f5f5");
+}
+END_TEST
+
+START_TEST(roundTripIntegers) {
+    static const int64_t values[] = {
+        0, 1, 23, 24, 255, 256, 65535, 65536, 4294967295LL, 4294967296LL, INT64_MAX,
+        -1, -24, -25, -256, -257, -65536, -65537, -4294967296LL, -4294967297LL, INT64_MIN};
+    static const size_t sizes[] = {
+        1, 1, 1, 2, 2, 3, 3, 5, 5, 9, 9,
+        1, 1, 2, 2, 3, 3, 5, 5, 9, 9};
+    const size_t count = sizeof(values) / sizeof(values[0]);
+
+    CborBuf b;
+    cbor_init(&b, 1);
+    for(size_t k = 0; k < count; k++) {
+        size_t at = b.len;
+        cbor_int(&b, values[k]);
+        /* the fewest bytes */
+        ck_assert_uint_eq(b.len - at, sizes[k]);
+    }
+    cbor_uint(&b, UINT64_MAX);
+
+    Reader r;
+    reader(&r, &b);
+    for(size_t k = 0; k < count; k++)
+        ck_assert(next_int(&r) == values[k]);
+    uint64_t arg;
+    ck_assert_int_eq(next_head(&r, &arg), 0);
+    ck_assert(arg == UINT64_MAX);
+    ck_assert(r.p == r.end);
+    cbor_free(&b);
+}
+END_TEST
+
+START_TEST(roundTripFloats) {
+    static const double doubles[] = {0.0, -0.0, 1.1, -4.1, 1.0e-300, 1.0e+300, 5e-324};
+    static const float floats[] = {0.0f, -0.0f, 1.1f, -4.1f, 1.0e-38f, 1.0e+38f, 1e-45f};
+    const size_t count = sizeof(doubles) / sizeof(doubles[0]);
+
+    CborBuf b;
+    cbor_init(&b, 1);
+    for(size_t k = 0; k < count; k++) {
+        cbor_double(&b, doubles[k]);
+        cbor_float(&b, floats[k]);
+    }
+    cbor_double(&b, NAN);
+
+    /* bit for bit */
+    Reader r;
+    reader(&r, &b);
+    uint64_t arg;
+    for(size_t k = 0; k < count; k++) {
+        ck_assert_uint_eq(*r.p, 0xfb);
+        ck_assert_int_eq(next_head(&r, &arg), 7);
+        double d;
+        memcpy(&d, &arg, sizeof(d));
+        ck_assert(memcmp(&d, &doubles[k], sizeof(d)) == 0);
+
+        ck_assert_uint_eq(*r.p, 0xfa);
+        ck_assert_int_eq(next_head(&r, &arg), 7);
+        uint32_t u = (uint32_t)arg;
+        float f;
+        memcpy(&f, &u, sizeof(f));
+        ck_assert(memcmp(&f, &floats[k], sizeof(f)) == 0);
+    }
+    ck_assert_int_eq(next_head(&r, &arg), 7);
+    double d;
+    memcpy(&d, &arg, sizeof(d));
+    ck_assert(isnan(d));
+    ck_assert(r.p == r.end);
+    cbor_free(&b);
+}
+END_TEST
+
+START_TEST(roundTripStrings) {
+    /* the length heads around 24, 256 and 65536 */
+    static const size_t lengths[] = {0, 23, 24, 255, 256, 65535, 65536};
+    const size_t count = sizeof(lengths) / sizeof(lengths[0]);
+    char *s = (char*)malloc(65536);
+    for(size_t k = 0; k < 65536; k++)
+        s[k] = (char)('a' + k % 26);
+
+    CborBuf b;
+    cbor_init(&b, 1);
+    for(size_t k = 0; k < count; k++) {
+        cbor_text(&b, s, lengths[k]);
+        cbor_bytes(&b, s, lengths[k]);
+    }
+
+    Reader r;
+    reader(&r, &b);
+    for(size_t k = 0; k < count; k++) {
+        size_t len;
+        const unsigned char *t = next_string(&r, 3, &len);
+        ck_assert_uint_eq(len, lengths[k]);
+        ck_assert(memcmp(t, s, len) == 0);
+        t = next_string(&r, 2, &len);
+        ck_assert_uint_eq(len, lengths[k]);
+        ck_assert(memcmp(t, s, len) == 0);
+    }
+    ck_assert(r.p == r.end);
+    cbor_free(&b);
+    free(s);
+}
+END_TEST
+
+START_TEST(roundTripTypedArray) {
+    UA_Double d[100];
+    for(size_t k = 0; k < 100; k++)
+        d[k] = (double)k * 0.25 - 12.5;
+    UA_UInt32 dims[2] = {10, 10};
+    UA_Variant v;
+    UA_Variant_setArray(&v, d, 100, &UA_TYPES[UA_TYPES_DOUBLE]);
+    v.arrayDimensions = dims;
+    v.arrayDimensionsSize = 2;
+
+    CborBuf b;
+    cbor_init(&b, 1);
+    ck_assert(cbor_variant(&b, &v));
+
+    Reader r;
+    reader(&r, &b);
+    uint64_t arg;
+    ck_assert_int_eq(next_head(&r, &arg), 6);
+    ck_assert_uint_eq(arg, 40);
+    ck_assert_int_eq(next_head(&r, &arg), 4);
+    ck_assert_uint_eq(arg, 2);
+    ck_assert_int_eq(next_head(&r, &arg), 4);
+    ck_assert_uint_eq(arg, 2);
+    ck_assert(next_int(&r) == 10);
+    ck_assert(next_int(&r) == 10);
+    ck_assert_int_eq(next_head(&r, &arg), 6);
+    ck_assert_uint_eq(arg, HOST(82, 86));
+    size_t len;
+    const unsigned char *raw = next_string(&r, 2, &len);
+    ck_assert_uint_eq(len, sizeof(d));
+    ck_assert(memcmp(raw, d, len) == 0);
+    ck_assert(r.p == r.end);
+    cbor_free(&b);
+}
+END_TEST
+
+static Suite *testSuite_cbor(void) {
+    Suite *s = suite_create("MQTT CBOR");
+    TCase *tc_known = tcase_create("Known vectors");
+    tcase_add_test(tc_known, knownIntegers);
+    tcase_add_test(tc_known, knownSimpleValues);
+    tcase_add_test(tc_known, knownStringsAndContainers);
+    tcase_add_test(tc_known, variantScalars);
+    tcase_add_test(tc_known, variantNotSupported);
+    tcase_add_test(tc_known, typedArrays);
+    tcase_add_test(tc_known, plainArrays);
+    tcase_add_test(tc_known, multiDimArrays);
+    suite_add_tcase(s, tc_known);
+
+    TCase *tc_roundtrip = tcase_create("Round trips");
+    tcase_add_test(tc_roundtrip, roundTripIntegers);
+    tcase_add_test(tc_roundtrip, roundTripFloats);
+    tcase_add_test(tc_roundtrip, roundTripStrings);
+    tcase_add_test(tc_roundtrip, roundTripTypedArray);
+    suite_add_tcase(s, tc_roundtrip);
+    return s;
+}
+
+int main(void) {
+    Suite *s = testSuite_cbor();
+    SRunner *sr = srunner_create(s);
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
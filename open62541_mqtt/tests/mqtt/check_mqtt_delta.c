@@ -0,0 +1,277 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ua_types.h"
+#include "ua_types_generated_handling.h"
+#include "client-delta.h"
+#include "check.h"
+#include "check_mqtt_helpers.h"
+
+static const char *aliases[] = {"a", "b", "c", "d", "e"};
+#define NODES 5
+
+static void set_int(DeltaState *d, size_t r, UA_Int32 i) {
+    UA_Variant v;
+    UA_Variant_setScalar(&v, &i, &UA_TYPES[UA_TYPES_INT32]);
+    delta_set(d, r, &v);
+}
+
+/* the next message is expected as hex, "" : none */
+static void expect(DeltaState *d, int64_t t, int64_t now, const char *expected) {
+    CborBuf b;
+    bool sent = delta_message(d, &b, "g", t, now);
+    ck_assert_int_eq(sent, expected[0] != 0);
+    if(sent) {
+        ck_assert_str_eq(hex(b.data, b.len), expected);
+        cbor_free(&b);
+    }
+}
+
+START_TEST(knownMessages) {
+    DeltaState d;
+    delta_init(&d, aliases, 2, 100, 1000000);
+    set_int(&d, 0, 1);
+    /* {"g": "g", "s": 0, "t": 1000, "k": ["a", "b"], "v": [1, null]} */
+    expect(&d, 1000, 0, "a5" "61676167" "617300" "61741903e8" "616b8261616162" "61768201f6");
+
+    /* {"g": "g", "s": 1, "t": 1001, "d": {1: 1.5}} */
+    UA_Double x = 1.5;
+    UA_Variant v;
+    UA_Variant_setScalar(&v, &x, &UA_TYPES[UA_TYPES_DOUBLE]);
+    delta_set(&d, 1, &v);
+    expect(&d, 1001, 1, "a4" "61676167" "617301" "61741903e9" "6164a101fb3ff8000000000000");
+
+    /* nothing changed : nothing sent, s stays */
+    expect(&d, 1002, 2, "");
+    set_int(&d, 0, -2);
+    set_int(&d, 1, 3);
+    expect(&d, 1003, 3, "a4" "61676167" "617302" "61741903eb" "6164a200210103");
+
+    /* a keyframe holds the last value of every node */
+    d.every = 1;
+    expect(&d, -1, 4, "a5" "61676167" "617303" "6174" "20" "616b8261616162" "6176822103");
+    delta_free(&d);
+}
+END_TEST
+
+/* a type cbor does not write is null, in a keyframe and a delta */
+START_TEST(unsupportedType) {
+    DeltaState d;
+    delta_init(&d, aliases, 1, 100, 1000000);
+    UA_NodeId id = UA_NODEID_NUMERIC(0, 85);
+    UA_Variant v;
+    UA_Variant_setScalar(&v, &id, &UA_TYPES[UA_TYPES_NODEID]);
+    delta_set(&d, 0, &v);
+    expect(&d, 0, 0, "a5" "61676167" "617300" "617400" "616b816161" "617681f6");
+    delta_set(&d, 0, &v);
+    expect(&d, 0, 0, "a4" "61676167" "617301" "617400" "6164a100f6");
+    delta_free(&d);
+}
+END_TEST
+
+/* keyframes after every - 1 deltas */
+START_TEST(keyframeEvery) {
+    DeltaState d;
+    delta_init(&d, aliases, NODES, 3, 1000000);
+    for(int k = 0; k < 10; k++) {
+        set_int(&d, (size_t)k % NODES, k);
+        CborBuf b;
+        ck_assert(delta_message(&d, &b, "g", k, k));
+        /* a map of 5 or 4 */
+        ck_assert_uint_eq((unsigned char)b.data[0], k % 3 == 0 ? 0xa5 : 0xa4);
+        cbor_free(&b);
+    }
+    ck_assert_uint_eq(d.seq, 10);
+    delta_free(&d);
+}
+END_TEST
+
+/* a keyframe after keyUSec, even when nothing changed */
+START_TEST(keyframeTime) {
+    DeltaState d;
+    delta_init(&d, aliases, NODES, 100, 1000);
+    CborBuf b;
+    ck_assert(delta_message(&d, &b, "g", 0, 5000));
+    ck_assert_uint_eq((unsigned char)b.data[0], 0xa5);
+    cbor_free(&b);
+
+    ck_assert(!delta_message(&d, &b, "g", 0, 5999));
+    set_int(&d, 2, 7);
+    ck_assert(delta_message(&d, &b, "g", 0, 5999));
+    ck_assert_uint_eq((unsigned char)b.data[0], 0xa4);
+    cbor_free(&b);
+
+    ck_assert(delta_message(&d, &b, "g", 0, 6000));
+    ck_assert_uint_eq((unsigned char)b.data[0], 0xa5);
+    cbor_free(&b);
+    ck_assert(!delta_message(&d, &b, "g", 0, 6999));
+    ck_assert_uint_eq(d.seq, 3);
+    delta_free(&d);
+}
+END_TEST
+
+/* the consumer of the round trip : decodes every message and applies it the
+ * way delta-decode.py does */
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+} Reader;
+
+static int next_head(Reader *r, uint64_t *arg) {
+    ck_assert(r->p < r->end);
+    unsigned char h = *r->p++;
+    int ai = h & 0x1f;
+    *arg = (uint64_t)ai;
+    if(ai >= 24) {
+        ck_assert(ai <= 27);
+        int bytes = 1 << (ai - 24);
+        ck_assert(r->end - r->p >= bytes);
+        *arg = 0;
+        for(int k = 0; k < bytes; k++)
+            *arg = *arg << 8 | *r->p++;
+    }
+    return h >> 5;
+}
+
+static int64_t next_int(Reader *r) {
+    uint64_t arg;
+    int major = next_head(r, &arg);
+    ck_assert(major == 0 || major == 1);
+    return major == 0 ? (int64_t)arg : -1 - (int64_t)arg;
+}
+
+static char next_key(Reader *r) {
+    uint64_t arg;
+    ck_assert_int_eq(next_head(r, &arg), 3);
+    ck_assert_uint_eq(arg, 1);
+    return (char)*r->p++;
+}
+
+static void skip_text(Reader *r, const char *expected) {
+    uint64_t arg;
+    ck_assert_int_eq(next_head(r, &arg), 3);
+    ck_assert_uint_eq(arg, strlen(expected));
+    ck_assert(memcmp(r->p, expected, arg) == 0);
+    r->p += arg;
+}
+
+typedef struct {
+    bool synced;
+    uint64_t seq;
+    int64_t t;
+    int64_t values[NODES];
+} Consumer;
+
+static void consume(Consumer *c, const CborBuf *b) {
+    Reader r = {(const unsigned char*)b->data, (const unsigned char*)b->data + b->len};
+    uint64_t fields;
+    ck_assert_int_eq(next_head(&r, &fields), 5);
+    ck_assert_int_eq(next_key(&r), 'g');
+    skip_text(&r, "group");
+    ck_assert_int_eq(next_key(&r), 's');
+    uint64_t seq = (uint64_t)next_int(&r);
+    ck_assert_int_eq(next_key(&r), 't');
+    c->t = next_int(&r);
+
+    char kind = next_key(&r);
+    uint64_t n;
+    if(kind == 'k') {
+        ck_assert_uint_eq(fields, 5);
+        ck_assert_int_eq(next_head(&r, &n), 4);
+        ck_assert_uint_eq(n, NODES);
+        for(size_t k = 0; k < NODES; k++)
+            skip_text(&r, aliases[k]);
+        ck_assert_int_eq(next_key(&r), 'v');
+        ck_assert_int_eq(next_head(&r, &n), 4);
+        ck_assert_uint_eq(n, NODES);
+        for(size_t k = 0; k < NODES; k++)
+            c->values[k] = next_int(&r);
+        c->synced = true;
+    } else {
+        ck_assert_int_eq(kind, 'd');
+        ck_assert_uint_eq(fields, 4);
+        ck_assert_int_eq(next_head(&r, &n), 5);
+        /* after a gap the deltas are skipped until the next keyframe */
+        if(c->synced && seq != c->seq + 1)
+            c->synced = false;
+        for(size_t k = 0; k < n; k++) {
+            int64_t position = next_int(&r);
+            ck_assert(position >= 0 && position < NODES);
+            c->values[position] = next_int(&r);
+        }
+    }
+    ck_assert(r.p == r.end);
+    c->seq = seq;
+}
+
+START_TEST(roundTrip) {
+    DeltaState d;
+    delta_init(&d, aliases, NODES, 7, 1000000);
+    int64_t truth[NODES];
+    for(size_t k = 0; k < NODES; k++) {
+        truth[k] = (int64_t)k;
+        set_int(&d, k, (UA_Int32)k);
+    }
+
+    Consumer c;
+    memset(&c, 0, sizeof(c));
+    int checked = 0;
+    srand(1);
+    for(int64_t now = 0; now < 500; now++) {
+        /* a few nodes change at each read, sometimes none */
+        for(size_t k = 0; k < NODES; k++) {
+            if(rand() % 3)
+                continue;
+            truth[k] = rand() - RAND_MAX / 2;
+            set_int(&d, k, (UA_Int32)truth[k]);
+        }
+        CborBuf b;
+        if(!delta_message(&d, &b, "group", now * 10, now))
+            continue;
+        /* a message lost now and then, the consumer sees the gap in s */
+        if(now % 97 != 50) {
+            consume(&c, &b);
+            if(c.synced) {
+                ck_assert(c.t == now * 10);
+                for(size_t k = 0; k < NODES; k++)
+                    ck_assert(c.values[k] == truth[k]);
+                checked++;
+            }
+        }
+        cbor_free(&b);
+    }
+    ck_assert(c.synced);
+    ck_assert_int_gt(checked, 400);
+    delta_free(&d);
+}
+END_TEST
+
+static Suite *testSuite_delta(void) {
+    Suite *s = suite_create("MQTT delta");
+    TCase *tc_known = tcase_create("Known vectors");
+    tcase_add_test(tc_known, knownMessages);
+    tcase_add_test(tc_known, unsupportedType);
+    suite_add_tcase(s, tc_known);
+
+    TCase *tc_keyframes = tcase_create("Keyframes");
+    tcase_add_test(tc_keyframes, keyframeEvery);
+    tcase_add_test(tc_keyframes, keyframeTime);
+    tcase_add_test(tc_keyframes, roundTrip);
+    suite_add_tcase(s, tc_keyframes);
+    return s;
+}
+
+int main(void) {
+    Suite *s = testSuite_delta();
+    SRunner *sr = srunner_create(s);
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
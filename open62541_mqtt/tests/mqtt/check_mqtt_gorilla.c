@@ -0,0 +1,334 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "client-gorilla.h"
+#include "check.h"
+#include "check_mqtt_helpers.h"
+
+/* every sample of s read back equals times[k] (when timed) and values[k] */
+static void read_back(const GorillaSeries *s, const int64_t *times, const uint64_t *values, uint32_t count) {
+    ck_assert_uint_eq(s->count, count);
+    GorillaReader r;
+    gorilla_reader(&r, s->kind, s->count, s->data, gorilla_bytes(s));
+    int64_t t;
+    uint64_t v;
+    for(uint32_t k = 0; k < count; k++) {
+        ck_assert(gorilla_next(&r, &t, &v));
+        if(times)
+            ck_assert(t == times[k]);
+        if(values)
+            ck_assert(v == values[k]);
+    }
+    ck_assert(!gorilla_next(&r, &t, &v));
+    /* padding only, less than a byte */
+    ck_assert_uint_le(r.bits - r.at, 7);
+}
+
+/* the bit streams of client-gorilla.h, computed from the format description */
+START_TEST(knownInt) {
+    GorillaSeries s;
+    gorilla_init(&s);
+    /* dod 60, 0, 10 : '10' + 7 bits, '0'. zigzag 2, 0, 5 : '10' + 8 bits, '0' */
+    ck_assert(gorilla_put_int(&s, 1000, 5));
+    ck_assert(gorilla_put_int(&s, 1060, 6));
+    ck_assert(gorilla_put_int(&s, 1120, 6));
+    ck_assert(gorilla_put_int(&s, 1190, 3));
+    ck_assert_int_eq(s.kind, GORILLA_INT);
+    ck_assert_uint_eq(s.bits, 168);
+    ck_assert_str_eq(hex(s.data, gorilla_bytes(&s)), "00000000000003e8" "0000000000000005" "9e40442a05");
+    gorilla_free(&s);
+}
+END_TEST
+
+START_TEST(knownFloat) {
+    GorillaSeries s;
+    gorilla_init(&s);
+    /* xor 0 : '0', a new window : '11', the window of the previous value : '10' */
+    ck_assert(gorilla_put_double(&s, 1000, 12.0));
+    ck_assert(gorilla_put_double(&s, 1060, 12.0));
+    ck_assert(gorilla_put_double(&s, 1120, 24.0));
+    ck_assert(gorilla_put_double(&s, 1190, 15.5));
+    ck_assert(gorilla_put_double(&s, 1250, 14.0));
+    ck_assert_int_eq(s.kind, GORILLA_FLOAT);
+    ck_assert_uint_eq(s.bits, 196);
+    ck_assert_str_eq(hex(s.data, gorilla_bytes(&s)), "00000000000003e8" "4028000000000000" "9e1ac0c2b5897bb430");
+    gorilla_free(&s);
+}
+END_TEST
+
+START_TEST(knownTime) {
+    GorillaSeries s;
+    gorilla_init(&s);
+    /* dod 10, 0, 0, 1990, 998000, 2^40 - 2002030 : 7, 0, 0, 12, 64 and 64 bits */
+    static const int64_t t[] = {0, 10, 20, 30, 2030, 1002030, 1LL << 40};
+    for(size_t k = 0; k < 7; k++)
+        ck_assert(gorilla_put_time(&s, t[k]));
+    ck_assert_int_eq(s.kind, GORILLA_TIME);
+    ck_assert_uint_eq(s.bits, 226);
+    ck_assert_str_eq(hex(s.data, gorilla_bytes(&s)),
+                     "0000000000000000" "8519f1bc00000000003ce9c3c000003ffff85ce480");
+    read_back(&s, t, NULL, 7);
+    gorilla_free(&s);
+}
+END_TEST
+
+START_TEST(knownValuesOnly) {
+    GorillaSeries s;
+    gorilla_init(&s);
+    gorilla_values_only(&s);
+    /* zigzag 0, 586, 140600 : '0', '110' + 16 bits, '1110' + 32 bits */
+    ck_assert(gorilla_put_int(&s, 1, 7));
+    ck_assert(gorilla_put_int(&s, 2, 7));
+    ck_assert(gorilla_put_int(&s, 3, 300));
+    ck_assert(gorilla_put_int(&s, 4, -70000));
+    ck_assert_int_eq(s.kind, GORILLA_INT | GORILLA_VALUES);
+    ck_assert_str_eq(hex(s.data, gorilla_bytes(&s)), "0000000000000007" "6024ae00022537");
+    static const uint64_t v[] = {7, 7, 300, (uint64_t)-70000};
+    read_back(&s, NULL, v, 4);
+
+    /* reset keeps the series values only, the bytes are the same again */
+    gorilla_reset(&s);
+    ck_assert_int_eq(s.kind, GORILLA_VALUES);
+    ck_assert(gorilla_put_double(&s, 9, 1.0));
+    ck_assert(gorilla_put_double(&s, 9, 1.0));
+    ck_assert(gorilla_put_double(&s, 9, -2.0));
+    ck_assert_int_eq(s.kind, GORILLA_FLOAT | GORILLA_VALUES);
+    ck_assert_str_eq(hex(s.data, gorilla_bytes(&s)), "3ff0000000000000" "602fffc0");
+    gorilla_free(&s);
+}
+END_TEST
+
+/* the kind of a batch is the one of its first sample */
+START_TEST(kindMismatch) {
+    GorillaSeries s;
+    gorilla_init(&s);
+    ck_assert(gorilla_put_int(&s, 1, 1));
+    size_t bits = s.bits;
+    ck_assert(!gorilla_put_double(&s, 2, 1.0));
+    ck_assert(!gorilla_put_time(&s, 2));
+    ck_assert_uint_eq(s.bits, bits);
+    ck_assert_uint_eq(s.count, 1);
+
+    gorilla_reset(&s);
+    ck_assert_int_eq(s.kind, GORILLA_NONE);
+    ck_assert(gorilla_put_double(&s, 1, 1.0));
+    ck_assert(!gorilla_put_int(&s, 2, 1));
+    gorilla_reset(&s);
+    ck_assert(gorilla_put_time(&s, 1));
+    ck_assert(!gorilla_put_int(&s, 2, 1));
+    ck_assert(!gorilla_put_double(&s, 2, 1.0));
+    gorilla_free(&s);
+}
+END_TEST
+
+static uint64_t next_random(uint64_t *x) {
+    /* xorshift64 */
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+#define SAMPLES 20000
+
+/* steps of every size of the prefixes, jitter, and wrapping */
+START_TEST(roundTripInt) {
+    int64_t *t = (int64_t*)malloc(SAMPLES * sizeof(int64_t));
+    uint64_t *v = (uint64_t*)malloc(SAMPLES * sizeof(uint64_t));
+    uint64_t x = 88172645463325252ULL;
+    t[0] = -5;
+    v[0] = (uint64_t)INT64_MIN;
+    for(size_t k = 1; k < SAMPLES; k++) {
+        uint64_t r = next_random(&x);
+        int shift = (int)(r % 64);
+        uint64_t last = (uint64_t)t[k - 1];
+        switch(k % 5) {
+            case 0: t[k] = (int64_t)(last + 1000); break;
+            case 1: t[k] = (int64_t)(last + 950 + r % 100); break;
+            case 2: t[k] = (int64_t)(last + (next_random(&x) >> shift)); break;
+            default: t[k] = (int64_t)(last - r % 5000); break;
+        }
+        switch(k % 4) {
+            case 0: v[k] = v[k - 1]; break;
+            case 1: v[k] = v[k - 1] + (next_random(&x) >> shift); break;
+            case 2: v[k] = v[k - 1] - (r % 300); break;
+            default: v[k] = next_random(&x); break;
+        }
+    }
+
+    GorillaSeries s;
+    gorilla_init(&s);
+    for(size_t k = 0; k < SAMPLES; k++)
+        ck_assert(gorilla_put_int(&s, t[k], (int64_t)v[k]));
+    read_back(&s, t, v, SAMPLES);
+
+    /* reset : the same samples, the same bytes */
+    size_t bytes = gorilla_bytes(&s);
+    uint8_t *first = (uint8_t*)malloc(bytes);
+    memcpy(first, s.data, bytes);
+    gorilla_reset(&s);
+    for(size_t k = 0; k < SAMPLES; k++)
+        ck_assert(gorilla_put_int(&s, t[k], (int64_t)v[k]));
+    ck_assert_uint_eq(gorilla_bytes(&s), bytes);
+    ck_assert(memcmp(first, s.data, bytes) == 0);
+
+    free(first);
+    gorilla_free(&s);
+    free(t);
+    free(v);
+}
+END_TEST
+
+START_TEST(roundTripFloat) {
+    static const double special[] = {0.0, -0.0, INFINITY, -INFINITY, NAN, 5e-324, 1.7976931348623157e308, -1.0};
+    int64_t *t = (int64_t*)malloc(SAMPLES * sizeof(int64_t));
+    uint64_t *v = (uint64_t*)malloc(SAMPLES * sizeof(uint64_t));
+    uint64_t x = 2463534242ULL;
+    double level = 20.0;
+    for(size_t k = 0; k < SAMPLES; k++) {
+        t[k] = 1792359871029254LL + (int64_t)k * 100000;
+        uint64_t r = next_random(&x);
+        switch(k % 6) {
+            case 0: v[k] = k ? v[k - 1] : bits_of(level); break;
+            case 1: level += (double)(r % 1000) / 1000.0 - 0.5; v[k] = bits_of(level); break;
+            case 2: v[k] = bits_of(special[r % 8]); break;
+            case 3: v[k] = next_random(&x); break;
+            case 4: v[k] = v[k - 1] ^ (1ULL << (r % 64)); break;
+            default: v[k] = bits_of((double)(int)(r % 100)); break;
+        }
+    }
+
+    GorillaSeries s;
+    gorilla_init(&s);
+    for(size_t k = 0; k < SAMPLES; k++) {
+        double d;
+        memcpy(&d, &v[k], sizeof(d));
+        ck_assert(gorilla_put_double(&s, t[k], d));
+    }
+    /* bit for bit, NaN payloads too */
+    read_back(&s, t, v, SAMPLES);
+    gorilla_free(&s);
+    free(t);
+    free(v);
+}
+END_TEST
+
+/* a cut stream ends early instead of reading past its end */
+START_TEST(truncated) {
+    GorillaSeries s;
+    gorilla_init(&s);
+    for(int k = 0; k < 100; k++)
+        ck_assert(gorilla_put_double(&s, k * 1000 + (k % 3), (double)(k % 7) * 1.25));
+    size_t bytes = gorilla_bytes(&s);
+    for(size_t len = 0; len < bytes; len++) {
+        uint8_t *cut = (uint8_t*)malloc(len ? len : 1);
+        memcpy(cut, s.data, len);
+        GorillaReader r;
+        gorilla_reader(&r, s.kind, s.count, cut, len);
+        int64_t t;
+        uint64_t v;
+        uint32_t read = 0;
+        while(gorilla_next(&r, &t, &v))
+            read++;
+        ck_assert_uint_lt(read, s.count);
+        free(cut);
+    }
+    gorilla_free(&s);
+}
+END_TEST
+
+START_TEST(knownFrame) {
+    GorillaSeries a, b;
+    gorilla_init(&a);
+    gorilla_init(&b);
+    ck_assert(gorilla_put_int(&a, 1000, 5));
+    ck_assert(gorilla_put_int(&a, 1060, 6));
+    ck_assert(gorilla_put_int(&a, 1120, 6));
+    ck_assert(gorilla_put_int(&a, 1190, 3));
+
+    GorillaFrame f;
+    gorilla_frame_begin(&f, "g", 2);
+    gorilla_frame_series(&f, "a", &a);
+    gorilla_frame_series(&f, "empty", &b);
+    /* "GRL" 1, group, u16 series, per series : name, u8 kind, u32 samples, u32 bytes, the stream */
+    ck_assert_str_eq(hex(f.data, f.len),
+                     "47524c01" "0167" "0002"
+                     "0161" "02" "00000004" "00000015" "00000000000003e8" "0000000000000005" "9e40442a05"
+                     "05656d707479" "00" "00000000" "00000000");
+
+    const char *name;
+    size_t len;
+    GorillaFrameReader fr;
+    ck_assert(gorilla_frame_open(&fr, f.data, f.len, &name, &len));
+    ck_assert_uint_eq(len, 1);
+    ck_assert(!memcmp(name, "g", 1));
+    ck_assert_uint_eq(fr.series, 2);
+
+    GorillaReader r;
+    ck_assert(gorilla_frame_next(&fr, &name, &len, &r));
+    ck_assert_uint_eq(len, 1);
+    ck_assert(!memcmp(name, "a", 1));
+    static const int64_t t[] = {1000, 1060, 1120, 1190};
+    static const uint64_t v[] = {5, 6, 6, 3};
+    int64_t rt;
+    uint64_t rv;
+    for(size_t k = 0; k < 4; k++) {
+        ck_assert(gorilla_next(&r, &rt, &rv));
+        ck_assert(rt == t[k] && rv == v[k]);
+    }
+    ck_assert(!gorilla_next(&r, &rt, &rv));
+
+    ck_assert(gorilla_frame_next(&fr, &name, &len, &r));
+    ck_assert_uint_eq(len, 5);
+    ck_assert(!gorilla_next(&r, &rt, &rv));
+    ck_assert(!gorilla_frame_next(&fr, &name, &len, &r));
+    ck_assert_uint_eq(fr.at, f.len);
+
+    /* not a frame, or a cut one */
+    ck_assert(!gorilla_frame_open(&fr, "GRL\2", 4, &name, &len));
+    for(size_t cut = 0; cut < f.len; cut++) {
+        bool whole = gorilla_frame_open(&fr, f.data, cut, &name, &len) &&
+            gorilla_frame_next(&fr, &name, &len, &r) && gorilla_frame_next(&fr, &name, &len, &r);
+        ck_assert(!whole);
+    }
+
+    free(f.data);
+    gorilla_free(&a);
+    gorilla_free(&b);
+}
+END_TEST
+
+static Suite *testSuite_gorilla(void) {
+    Suite *s = suite_create("MQTT Gorilla");
+    TCase *tc_known = tcase_create("Known vectors");
+    tcase_add_test(tc_known, knownInt);
+    tcase_add_test(tc_known, knownFloat);
+    tcase_add_test(tc_known, knownTime);
+    tcase_add_test(tc_known, knownValuesOnly);
+    tcase_add_test(tc_known, kindMismatch);
+    tcase_add_test(tc_known, knownFrame);
+    suite_add_tcase(s, tc_known);
+
+    TCase *tc_roundtrip = tcase_create("Round trips");
+    tcase_add_test(tc_roundtrip, roundTripInt);
+    tcase_add_test(tc_roundtrip, roundTripFloat);
+    tcase_add_test(tc_roundtrip, truncated);
+    suite_add_tcase(s, tc_roundtrip);
+    return s;
+}
+
+int main(void) {
+    Suite *s = testSuite_gorilla();
+    SRunner *sr = srunner_create(s);
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
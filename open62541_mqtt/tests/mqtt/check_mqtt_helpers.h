@@ -0,0 +1,29 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef CHECK_MQTT_HELPERS_H_
+#define CHECK_MQTT_HELPERS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/* the bytes as lowercase hex, in a static buffer overwritten by the next call */
+static inline const char *hex(const void *data, size_t len) {
+    static char out[1024];
+    const uint8_t *p = (const uint8_t*)data;
+    size_t n = 0;
+    for(size_t k = 0; k < len && n + 3 < sizeof(out); k++)
+        n += (size_t)snprintf(out + n, sizeof(out) - n, "%02x", p[k]);
+    out[n] = 0;
+    return out;
+}
+
+static inline uint64_t bits_of(double d) {
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    return u;
+}
+
+#endif /* CHECK_MQTT_HELPERS_H_ */
@@ -0,0 +1,403 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "client-segment.h"
+#include "check.h"
+#include "check_mqtt_helpers.h"
+
+/* 2026-10-18T21:00:00Z */
+#define START 1792357200000000LL
+#define HOUR 3600000000LL
+
+static char path[64];
+
+/* b written to a new temporary file, opened as f */
+static void open_written(SegmentFile *f, const void *data, size_t len, int expected) {
+    strcpy(path, "/tmp/check_mqtt_segment_XXXXXX");
+    int fd = mkstemp(path);
+    ck_assert_int_ge(fd, 0);
+    ck_assert(write(fd, data, len) == (ssize_t)len);
+    close(fd);
+    ck_assert_int_eq(segment_open(f, path), expected);
+}
+
+static void close_written(SegmentFile *f) {
+    segment_close(f);
+    unlink(path);
+}
+
+/* ints at 1000, 1060, 1120, 1190, the third one bad */
+static void put_known(SegmentBlock *k) {
+    segment_block_reset(k, 5 /* UA_TYPES_INT32 */, GORILLA_INT);
+    segment_block_put(k, 1000, 5, 0);
+    segment_block_put(k, 1060, 6, 0);
+    segment_block_put(k, 1120, 6, 0x80000000);
+    segment_block_put(k, 1190, 3, 0);
+}
+
+/* the layout of client-segment.h, the crc32 those of zlib */
+START_TEST(knownRecords) {
+    SegmentBuf b;
+    segment_buf_init(&b);
+    segment_header(&b, START, HOUR);
+    ck_assert_uint_eq(b.len, SEGMENT_HEADER);
+    ck_assert_str_eq(hex(b.data, b.len), "5541534547000001" "00065e23ae377400" "00000000d693a400");
+
+    b.len = 0;
+    segment_node(&b, 7, "plant/temp");
+    ck_assert_str_eq(hex(b.data, b.len), "4e" "00000010" "0184d8e8" "00000007" "000a" "706c616e742f74656d70");
+
+    SegmentBlock k;
+    segment_block_init(&k);
+    put_known(&k);
+    b.len = 0;
+    segment_block_write(&b, 7, &k);
+    ck_assert_str_eq(hex(b.data, b.len),
+                     "42" "00000055" "17cef846"
+                     "00000007" "0005" "02" "00000004" "00000000000003e8" "00000000000004a6"
+                     "0000000b" "0000000b" "00000018"
+                     /* GORILLA_TIME, GORILLA_INT | GORILLA_VALUES */
+                     "00000000000003e89e2140" "0000000000000005809028"
+                     /* status runs 0 x 2, 0x80000000 x 1, 0 x 1 */
+                     "0000000000000002" "8000000000000001" "0000000000000001");
+
+    /* a reset block starts over, the runs too */
+    put_known(&k);
+    SegmentBuf again;
+    segment_buf_init(&again);
+    segment_block_write(&again, 7, &k);
+    ck_assert_uint_eq(again.len, b.len);
+    ck_assert(memcmp(again.data, b.data, b.len) == 0);
+    segment_buf_free(&again);
+    segment_block_free(&k);
+    segment_buf_free(&b);
+}
+END_TEST
+
+START_TEST(knownRead) {
+    SegmentBuf b;
+    segment_buf_init(&b);
+    segment_header(&b, START, HOUR);
+    segment_node(&b, 7, "plant/temp");
+    SegmentBlock k;
+    segment_block_init(&k);
+    put_known(&k);
+    segment_block_write(&b, 7, &k);
+    segment_block_free(&k);
+
+    SegmentFile f;
+    open_written(&f, b.data, b.len, 0);
+    ck_assert(f.start == START);
+    ck_assert(f.length == HOUR);
+    ck_assert_uint_eq(f.at, SEGMENT_HEADER);
+
+    SegmentRecord r;
+    ck_assert(segment_next(&f, &r));
+    ck_assert_int_eq(r.type, SEGMENT_NODE);
+    ck_assert_uint_eq(r.node, 7);
+    ck_assert_uint_eq(r.pathLen, 10);
+    ck_assert(memcmp(r.path, "plant/temp", 10) == 0);
+
+    ck_assert(segment_next(&f, &r));
+    ck_assert_int_eq(r.type, SEGMENT_BLOCK);
+    ck_assert_uint_eq(r.node, 7);
+    ck_assert_uint_eq(r.uaType, 5);
+    ck_assert_int_eq(r.kind, GORILLA_INT);
+    ck_assert_uint_eq(r.count, 4);
+    ck_assert(r.first == 1000 && r.last == 1190);
+
+    const int64_t times[] = {1000, 1060, 1120, 1190};
+    const uint64_t values[] = {5, 6, 6, 3};
+    const uint32_t status[] = {0, 0, 0x80000000, 0};
+    SegmentCursor c;
+    segment_cursor(&c, &r);
+    int64_t t;
+    uint64_t v;
+    uint32_t s;
+    for(size_t n = 0; n < 4; n++) {
+        ck_assert(segment_cursor_next(&c, &t, &v, &s));
+        ck_assert(t == times[n] && v == values[n]);
+        ck_assert_uint_eq(s, status[n]);
+    }
+    ck_assert(!segment_cursor_next(&c, &t, &v, &s));
+
+    ck_assert(!segment_next(&f, &r));
+    ck_assert_uint_eq(f.at, b.len);
+    close_written(&f);
+    segment_buf_free(&b);
+}
+END_TEST
+
+/* a type this version does not know is skipped */
+START_TEST(unknownType) {
+    SegmentBuf b;
+    segment_buf_init(&b);
+    segment_header(&b, START, HOUR);
+    const uint8_t unknown[] = {'X', 0, 0, 0, 3, 0x55, 0xbc, 0x80, 0x1d, 1, 2, 3};
+    uint8_t file[64];
+    memcpy(file, b.data, b.len);
+    memcpy(file + b.len, unknown, sizeof(unknown));
+    size_t len = b.len + sizeof(unknown);
+    b.len = 0;
+    segment_node(&b, 1, "g/n");
+    ck_assert_uint_le(len + b.len, sizeof(file));
+    memcpy(file + len, b.data, b.len);
+    len += b.len;
+
+    SegmentFile f;
+    open_written(&f, file, len, 0);
+    SegmentRecord r;
+    ck_assert(segment_next(&f, &r));
+    ck_assert_int_eq(r.type, 'X');
+    ck_assert(segment_next(&f, &r));
+    ck_assert_int_eq(r.type, SEGMENT_NODE);
+    ck_assert(!segment_next(&f, &r));
+    close_written(&f);
+    segment_buf_free(&b);
+}
+END_TEST
+
+START_TEST(notSegment) {
+    SegmentFile f;
+    ck_assert_int_eq(segment_open(&f, "/nonexistent/20261018T210000Z.seg"), -1);
+
+    SegmentBuf b;
+    segment_buf_init(&b);
+    segment_header(&b, START, HOUR);
+    open_written(&f, b.data, SEGMENT_HEADER - 1, -2);
+    close_written(&f);
+
+    b.data[7] = 2;
+    open_written(&f, b.data, b.len, -2);
+    close_written(&f);
+    segment_buf_free(&b);
+}
+END_TEST
+
+/* float and int blocks of many nodes, written to a file and read back */
+#define NODES 4
+#define BLOCKS 6
+#define SAMPLES 500
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+typedef struct {
+    int64_t t[SAMPLES];
+    uint64_t v[SAMPLES];
+    uint32_t s[SAMPLES];
+} Samples;
+
+static Samples written[NODES][BLOCKS];
+
+static int node_kind(uint32_t node) {
+    return node % 2 ? GORILLA_FLOAT : GORILLA_INT;
+}
+
+START_TEST(roundTrip) {
+    SegmentBuf b;
+    segment_buf_init(&b);
+    segment_header(&b, START, HOUR);
+    char name[32];
+    for(uint32_t n = 0; n < NODES; n++) {
+        snprintf(name, sizeof(name), "group/node%u", n);
+        segment_node(&b, n, name);
+    }
+
+    SegmentBlock k;
+    segment_block_init(&k);
+    int64_t now = START;
+    for(int block = 0; block < BLOCKS; block++) {
+        for(uint32_t n = 0; n < NODES; n++) {
+            Samples *w = &written[n][block];
+            segment_block_reset(&k, (uint16_t)(10 + n), node_kind(n));
+            double x = (double)n;
+            int64_t i = 0;
+            for(int m = 0; m < SAMPLES; m++) {
+                /* jittered reads, slow changes and the odd jump, short bad runs */
+                now += 100000 + (int64_t)(next_random() % 2000);
+                uint64_t r = next_random();
+                if(node_kind(n) == GORILLA_FLOAT) {
+                    x += r % 5 ? 0.0 : (double)(r % 1000) / 64.0 - 7.8;
+                    w->v[m] = bits_of(x);
+                } else {
+                    i += r % 7 ? (int64_t)(r % 3) - 1 : (int64_t)(r >> 20) - (int64_t)(1ULL << 43);
+                    w->v[m] = (uint64_t)i;
+                }
+                w->t[m] = now;
+                w->s[m] = r % 50 ? 0 : 0x80320000;
+                segment_block_put(&k, w->t[m], w->v[m], w->s[m]);
+            }
+            segment_block_write(&b, n, &k);
+        }
+    }
+    segment_block_free(&k);
+
+    SegmentFile f;
+    open_written(&f, b.data, b.len, 0);
+    SegmentRecord r;
+    for(uint32_t n = 0; n < NODES; n++) {
+        ck_assert(segment_next(&f, &r));
+        ck_assert_int_eq(r.type, SEGMENT_NODE);
+        ck_assert_uint_eq(r.node, n);
+        snprintf(name, sizeof(name), "group/node%u", n);
+        ck_assert_uint_eq(r.pathLen, strlen(name));
+        ck_assert(memcmp(r.path, name, r.pathLen) == 0);
+    }
+    for(int block = 0; block < BLOCKS; block++) {
+        for(uint32_t n = 0; n < NODES; n++) {
+            const Samples *w = &written[n][block];
+            ck_assert(segment_next(&f, &r));
+            ck_assert_int_eq(r.type, SEGMENT_BLOCK);
+            ck_assert_uint_eq(r.node, n);
+            ck_assert_uint_eq(r.uaType, 10 + n);
+            ck_assert_int_eq(r.kind, node_kind(n));
+            ck_assert_uint_eq(r.count, SAMPLES);
+            ck_assert(r.first == w->t[0] && r.last == w->t[SAMPLES - 1]);
+
+            SegmentCursor c;
+            segment_cursor(&c, &r);
+            int64_t t;
+            uint64_t v;
+            uint32_t s;
+            for(int m = 0; m < SAMPLES; m++) {
+                ck_assert(segment_cursor_next(&c, &t, &v, &s));
+                ck_assert(t == w->t[m] && v == w->v[m]);
+                ck_assert_uint_eq(s, w->s[m]);
+            }
+            ck_assert(!segment_cursor_next(&c, &t, &v, &s));
+        }
+    }
+    ck_assert(!segment_next(&f, &r));
+    ck_assert_uint_eq(f.at, b.len);
+    close_written(&f);
+    segment_buf_free(&b);
+}
+END_TEST
+
+/* the records of a file and where the last one starts */
+static size_t count_records(const SegmentBuf *b, size_t len, size_t *at) {
+    SegmentFile f;
+    open_written(&f, b->data, len, 0);
+    SegmentRecord r;
+    size_t n = 0;
+    while(segment_next(&f, &r))
+        n++;
+    *at = f.at;
+    close_written(&f);
+    return n;
+}
+
+/* a record cut by a crash or broken : the reader stops before it */
+START_TEST(cutRecord) {
+    SegmentBuf b;
+    segment_buf_init(&b);
+    segment_header(&b, START, HOUR);
+    segment_node(&b, 7, "plant/temp");
+    size_t whole = b.len;
+    SegmentBlock k;
+    segment_block_init(&k);
+    put_known(&k);
+    segment_block_write(&b, 7, &k);
+    segment_block_free(&k);
+
+    size_t at;
+    ck_assert_uint_eq(count_records(&b, b.len, &at), 2);
+    ck_assert_uint_eq(at, b.len);
+
+    /* cut anywhere in the block */
+    for(size_t len = whole; len < b.len; len++) {
+        ck_assert_uint_eq(count_records(&b, len, &at), 1);
+        ck_assert_uint_eq(at, whole);
+    }
+
+    /* a flipped bit in the body fails the crc */
+    b.data[b.len - 5] ^= 0x10;
+    ck_assert_uint_eq(count_records(&b, b.len, &at), 1);
+    ck_assert_uint_eq(at, whole);
+    segment_buf_free(&b);
+}
+END_TEST
+
+START_TEST(parseTime) {
+    int64_t us;
+    ck_assert(segment_parse_time("1792357200123450", &us));
+    ck_assert(us == START + 123450);
+    ck_assert(segment_parse_time("2026-10-18T21:00:00", &us));
+    ck_assert(us == START);
+    ck_assert(segment_parse_time("2026-10-18T21:00:00Z", &us));
+    ck_assert(us == START);
+    ck_assert(segment_parse_time("2026-10-18T21:00:00.12345", &us));
+    ck_assert(us == START + 123450);
+    /* beyond microseconds the digits are dropped */
+    ck_assert(segment_parse_time("2026-10-18T21:00:00.1234567Z", &us));
+    ck_assert(us == START + 123456);
+    ck_assert(segment_parse_time("1970-01-01T00:00:00", &us));
+    ck_assert(us == 0);
+
+    ck_assert(!segment_parse_time("", &us));
+    ck_assert(!segment_parse_time("-5", &us));
+    ck_assert(!segment_parse_time("2026-10-18", &us));
+    ck_assert(!segment_parse_time("2026-10-18T21:00:00+02:00", &us));
+}
+END_TEST
+
+START_TEST(fileName) {
+    char name[32];
+    segment_file_name(START, name, sizeof(name));
+    ck_assert_str_eq(name, "20261018T210000Z.seg");
+    /* whole seconds */
+    segment_file_name(START + 999999, name, sizeof(name));
+    ck_assert_str_eq(name, "20261018T210000Z.seg");
+    segment_file_name(0, name, sizeof(name));
+    ck_assert_str_eq(name, "19700101T000000Z.seg");
+
+    int64_t us;
+    ck_assert(segment_parse_time("2026-10-18T21:00:00", &us));
+    segment_file_name(us + HOUR, name, sizeof(name));
+    ck_assert_str_eq(name, "20261018T220000Z.seg");
+}
+END_TEST
+
+static Suite *testSuite_segment(void) {
+    Suite *s = suite_create("MQTT segment store");
+    TCase *tc_known = tcase_create("Known vectors");
+    tcase_add_test(tc_known, knownRecords);
+    tcase_add_test(tc_known, knownRead);
+    tcase_add_test(tc_known, unknownType);
+    tcase_add_test(tc_known, notSegment);
+    suite_add_tcase(s, tc_known);
+
+    TCase *tc_roundtrip = tcase_create("Round trips");
+    tcase_add_test(tc_roundtrip, roundTrip);
+    tcase_add_test(tc_roundtrip, cutRecord);
+    suite_add_tcase(s, tc_roundtrip);
+
+    TCase *tc_names = tcase_create("Times and names");
+    tcase_add_test(tc_names, parseTime);
+    tcase_add_test(tc_names, fileName);
+    suite_add_tcase(s, tc_names);
+    return s;
+}
+
+int main(void) {
+    Suite *s = testSuite_segment();
+    SRunner *sr = srunner_create(s);
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,522 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ua_types.h"
+#include "ua_types_generated_handling.h"
+
+using namespace std;
+
+#include "client-nodemap.h"
+#include "client-config.h"
+#include "client-sparkplug.h"
+#include "check.h"
+
+/* what client-sparkplug.cpp takes from the rest of the bridge */
+static UAMQ_Configuration configuration;
+UAMQ_Configuration* g_config = &configuration;
+
+#define NOW 1700000000000000LL	/* unix us */
+
+int64_t epoch(void) {
+    return NOW;
+}
+
+enumPayloadFormat getPayloadFormat(char* format) {
+    return strcmp(format, "sparkplug") ? enumJSON : enumSparkplug;
+}
+
+int64_t datavalue_time(const UA_DataValue* dv, enumTimestampSource ts, int64_t now) {
+    return now;
+}
+
+/* the last message of the encoder, as a sink would get it */
+static string sentMode;
+static string sentTopic;
+static vector<unsigned char> sent;
+
+void sink_publish_buffer(unsigned int sinks, const char* mode, const char* topic, char* data, size_t len, bool binary) {
+    ck_assert(binary);
+    sentMode = mode;
+    sentTopic = topic;
+    sent.assign((unsigned char*)data, (unsigned char*)data + len);
+    free(data);
+}
+
+/* valid until the next call */
+static const char* hex(const unsigned char* data, size_t len) {
+    static string s;
+    char x[3];
+    s.clear();
+    for(size_t k = 0; k < len; k++) {
+        snprintf(x, sizeof(x), "%02x", data[k]);
+        s += x;
+    }
+    return s.c_str();
+}
+
+/* the reader of the test : the fields of sparkplug_b.proto the bridge writes */
+typedef struct {
+    string name;
+    bool hasAlias;
+    uint64_t alias;
+    uint64_t timestamp;
+    uint64_t datatype;
+    bool isNull;
+    int field;	/* of the value, 0 : none */
+    uint64_t value;	/* varint, fixed32 or fixed64 */
+    string bytes;
+} Metric;
+
+typedef struct {
+    uint64_t timestamp;
+    bool hasSeq;
+    uint64_t seq;
+    vector<Metric> metrics;
+} Payload;
+
+static uint64_t read_varint(const unsigned char** p, const unsigned char* end) {
+    uint64_t v = 0;
+    for(int shift = 0; ; shift += 7) {
+        ck_assert(*p < end && shift < 64);
+        unsigned char c = *(*p)++;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if(!(c & 0x80))
+            return v;
+    }
+}
+
+static uint64_t read_le(const unsigned char** p, const unsigned char* end, int bytes) {
+    ck_assert(end - *p >= bytes);
+    uint64_t v = 0;
+    for(int k = bytes - 1; k >= 0; k--)
+        v = v << 8 | (*p)[k];
+    *p += bytes;
+    return v;
+}
+
+static string read_bytes(const unsigned char** p, const unsigned char* end) {
+    uint64_t len = read_varint(p, end);
+    ck_assert(len <= (uint64_t)(end - *p));
+    string s((const char*)*p, (size_t)len);
+    *p += len;
+    return s;
+}
+
+static Metric read_metric(const string& m) {
+    Metric r;
+    r.hasAlias = false;
+    r.alias = r.timestamp = r.datatype = r.value = 0;
+    r.isNull = false;
+    r.field = 0;
+
+    const unsigned char* p = (const unsigned char*)m.data();
+    const unsigned char* end = p + m.size();
+    while(p < end) {
+        uint64_t tag = read_varint(&p, end);
+        int field = (int)(tag >> 3);
+        int wire = (int)(tag & 7);
+        if(field == 1) {
+            ck_assert_int_eq(wire, 2);
+            r.name = read_bytes(&p, end);
+        } else if(field == 2) {
+            ck_assert_int_eq(wire, 0);
+            r.hasAlias = true;
+            r.alias = read_varint(&p, end);
+        } else if(field == 3) {
+            ck_assert_int_eq(wire, 0);
+            r.timestamp = read_varint(&p, end);
+        } else if(field == 4) {
+            ck_assert_int_eq(wire, 0);
+            r.datatype = read_varint(&p, end);
+        } else if(field == 7) {
+            ck_assert_int_eq(wire, 0);
+            r.isNull = read_varint(&p, end) != 0;
+        } else {
+            /* one value of the oneof */
+            ck_assert(field >= 10 && field <= 16);
+            ck_assert_int_eq(r.field, 0);
+            r.field = field;
+            if(field == 12) {
+                ck_assert_int_eq(wire, 5);
+                r.value = read_le(&p, end, 4);
+            } else if(field == 13) {
+                ck_assert_int_eq(wire, 1);
+                r.value = read_le(&p, end, 8);
+            } else if(field >= 15) {
+                ck_assert_int_eq(wire, 2);
+                r.bytes = read_bytes(&p, end);
+            } else {
+                ck_assert_int_eq(wire, 0);
+                r.value = read_varint(&p, end);
+            }
+        }
+    }
+    return r;
+}
+
+static Payload read_payload(const unsigned char* data, size_t len) {
+    Payload r;
+    r.timestamp = 0;
+    r.hasSeq = false;
+    r.seq = 0;
+
+    const unsigned char* p = data;
+    const unsigned char* end = data + len;
+    while(p < end) {
+        uint64_t tag = read_varint(&p, end);
+        int field = (int)(tag >> 3);
+        int wire = (int)(tag & 7);
+        if(field == 1) {
+            ck_assert_int_eq(wire, 0);
+            r.timestamp = read_varint(&p, end);
+        } else if(field == 2) {
+            ck_assert_int_eq(wire, 2);
+            r.metrics.push_back(read_metric(read_bytes(&p, end)));
+        } else {
+            ck_assert_int_eq(field, 3);
+            ck_assert_int_eq(wire, 0);
+            r.hasSeq = true;
+            r.seq = read_varint(&p, end);
+        }
+    }
+    return r;
+}
+
+/* the mqtt sink : the seq goes into the copy that is sent */
+static bool send_copy(vector<unsigned char>& packet) {
+    char topic[256];
+    snprintf(topic, sizeof(topic), "%s", sentTopic.c_str());
+    SinkMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.mode = sentMode.c_str();
+    msg.topic = topic;
+    msg.data = (char*)&sent[0];
+    msg.len = sent.size();
+    packet = sent;
+    return sparkplug_sequence(&msg, &packet[0]);
+}
+
+static void setup(void) {
+    memset(&configuration, 0, sizeof(configuration));
+    configuration.sparkplug = true;
+    snprintf(configuration.spbGroupId, sizeof(configuration.spbGroupId), "Plant");
+    snprintf(configuration.spbEdgeNodeId, sizeof(configuration.spbEdgeNodeId), "Bridge");
+    sentMode.clear();
+    sentTopic.clear();
+    sent.clear();
+}
+
+START_TEST(commandTopic) {
+    ck_assert_str_eq(sparkplug_command_topic(), "spBv1.0/Plant/NCMD/Bridge");
+}
+END_TEST
+
+/* payload { timestamp, metrics { name "bdSeq", datatype UInt64, long_value bdSeq } } */
+START_TEST(deathCertificate) {
+    const char* topic;
+    const char* payload;
+    int len;
+    sparkplug_death(&topic, &payload, &len);
+    ck_assert_str_eq(topic, "spBv1.0/Plant/NDEATH/Bridge");
+    Payload d = read_payload((const unsigned char*)payload, (size_t)len);
+    ck_assert_uint_eq(d.metrics.size(), 1);
+    uint64_t bd = d.metrics[0].value;
+    ck_assert(bd < 128);
+
+    char expected[64];
+    snprintf(expected, sizeof(expected), "0880d095ffbc31" "120b" "0a056264536571" "2008" "58%02x", (unsigned)bd);
+    ck_assert_str_eq(hex((const unsigned char*)payload, (size_t)len), expected);
+
+    /* the next connection has the next bdSeq, the birth tells which one */
+    sparkplug_death(&topic, &payload, &len);
+    d = read_payload((const unsigned char*)payload, (size_t)len);
+    ck_assert_uint_eq(d.metrics[0].value, (bd + 1) % 256);
+
+    char birthTopic[128];
+    size_t birthLen;
+    char* birth = sparkplug_node_birth(birthTopic, sizeof(birthTopic), &birthLen);
+    ck_assert_str_eq(birthTopic, "spBv1.0/Plant/NBIRTH/Bridge");
+    Payload b = read_payload((const unsigned char*)birth, birthLen);
+    ck_assert_uint_eq(b.timestamp, NOW / 1000);
+    ck_assert(b.hasSeq);
+    ck_assert_uint_eq(b.seq, 0);
+    ck_assert_uint_eq(b.metrics.size(), 2);
+    ck_assert_str_eq(b.metrics[0].name.c_str(), "bdSeq");
+    ck_assert_uint_eq(b.metrics[0].datatype, 8);
+    ck_assert_uint_eq(b.metrics[0].value, (bd + 1) % 256);
+    ck_assert_str_eq(b.metrics[1].name.c_str(), "Node Control/Rebirth");
+    ck_assert_uint_eq(b.metrics[1].datatype, 11);
+    ck_assert_int_eq(b.metrics[1].field, 14);
+    ck_assert_uint_eq(b.metrics[1].value, 0);
+    free(birth);
+}
+END_TEST
+
+START_TEST(rebirthCommand) {
+    /* { timestamp, metrics { name "Node Control/Rebirth", datatype Boolean, boolean_value } } */
+    const unsigned char rebirth[] = {
+        0x08, 0x01, 0x12, 0x1a, 0x0a, 0x14, 'N', 'o', 'd', 'e', ' ', 'C', 'o', 'n', 't', 'r', 'o', 'l',
+        '/', 'R', 'e', 'b', 'i', 'r', 't', 'h', 0x20, 0x0b, 0x70, 0x01};
+    ck_assert(sparkplug_command(rebirth, sizeof(rebirth)));
+
+    unsigned char no[sizeof(rebirth)];
+    memcpy(no, rebirth, sizeof(no));
+    no[sizeof(no) - 1] = 0;
+    ck_assert(!sparkplug_command(no, sizeof(no)));
+
+    /* the value before the name, a double before the metric */
+    const unsigned char reordered[] = {
+        0x69, 0, 0, 0, 0, 0, 0, 0xf0, 0x3f, 0x12, 0x18, 0x70, 0x01, 0x0a, 0x14, 'N', 'o', 'd', 'e', ' ',
+        'C', 'o', 'n', 't', 'r', 'o', 'l', '/', 'R', 'e', 'b', 'i', 'r', 't', 'h'};
+    ck_assert(sparkplug_command(reordered, sizeof(reordered)));
+
+    unsigned char other[sizeof(rebirth)];
+    memcpy(other, rebirth, sizeof(other));
+    other[6] = 'X';
+    ck_assert(!sparkplug_command(other, sizeof(other)));
+
+    /* cut anywhere : false, nothing read past the end */
+    for(size_t len = 0; len < sizeof(rebirth); len++) {
+        unsigned char* cut = (unsigned char*)malloc(len ? len : 1);
+        memcpy(cut, rebirth, len);
+        ck_assert(!sparkplug_command(cut, (int)len));
+        free(cut);
+    }
+}
+END_TEST
+
+static char groupName[] = "line";
+static char groupTopic[] = "line/1";
+static char groupFormat[] = "sparkplug";
+static char aliases[][8] = {"i32", "i16", "u64", "f32", "f64", "bool", "str", "time", "a32", "astr", "bad"};
+#define NODES 11
+
+START_TEST(deviceBirthAndData) {
+    Group g;
+    g.name = groupName;
+    g.topic = groupTopic;
+    g.format = groupFormat;
+    g.sinks = 1;
+    Node* nodes[NODES];
+    for(int k = 0; k < NODES; k++) {
+        Node n;
+        memset(&n, 0, sizeof(n));
+        n.alias = aliases[k];
+        n.parent = &g;
+        g.nodes[k] = n;
+        nodes[k] = &g.nodes[k];
+    }
+
+    UA_Int32 i32 = -5;
+    UA_Int16 i16 = -2;
+    UA_UInt64 u64 = UINT64_MAX;
+    UA_Float f32 = 1.5f;
+    UA_Double f64 = 2.5;
+    UA_Boolean t = true;
+    char abc[] = "abc", a[] = "a", bc[] = "bc";
+    UA_String str = UA_STRING(abc);
+    UA_DateTime time = UA_DATETIME_UNIX_EPOCH + 1234 * UA_MSEC_TO_DATETIME;
+    UA_Int32 a32[2] = {1, -1};
+    UA_String astr[2] = {UA_STRING(a), UA_STRING(bc)};
+
+    UA_DataValue values[NODES];
+    for(int k = 0; k < NODES; k++) {
+        UA_DataValue_init(&values[k]);
+        values[k].hasValue = true;
+    }
+    UA_Variant_setScalar(&values[0].value, &i32, &UA_TYPES[UA_TYPES_INT32]);
+    UA_Variant_setScalar(&values[1].value, &i16, &UA_TYPES[UA_TYPES_INT16]);
+    UA_Variant_setScalar(&values[2].value, &u64, &UA_TYPES[UA_TYPES_UINT64]);
+    UA_Variant_setScalar(&values[3].value, &f32, &UA_TYPES[UA_TYPES_FLOAT]);
+    UA_Variant_setScalar(&values[4].value, &f64, &UA_TYPES[UA_TYPES_DOUBLE]);
+    UA_Variant_setScalar(&values[5].value, &t, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    UA_Variant_setScalar(&values[6].value, &str, &UA_TYPES[UA_TYPES_STRING]);
+    UA_Variant_setScalar(&values[7].value, &time, &UA_TYPES[UA_TYPES_DATETIME]);
+    UA_Variant_setArray(&values[8].value, a32, 2, &UA_TYPES[UA_TYPES_INT32]);
+    UA_Variant_setArray(&values[9].value, astr, 2, &UA_TYPES[UA_TYPES_STRING]);
+    values[10].hasValue = false;
+    values[10].hasStatus = true;
+    values[10].status = UA_STATUSCODE_BADNODEIDUNKNOWN;
+
+    /* a new connection : every device is born again */
+    char birthTopic[128];
+    size_t birthLen;
+    free(sparkplug_node_birth(birthTopic, sizeof(birthTopic), &birthLen));
+
+    sparkplug_publish(&g, nodes, values, NODES, enumTsBridge, NOW);
+    ck_assert_str_eq(sentMode.c_str(), "DBIRTH");
+    ck_assert_str_eq(sentTopic.c_str(), "spBv1.0/Plant/DBIRTH/Bridge/line_1");
+    /* the room of the seq, a two byte varint of field 3 */
+    ck_assert_str_eq(hex(&sent[sent.size() - 3], 3), "188000");
+
+    vector<unsigned char> packet;
+    ck_assert(send_copy(packet));
+    Payload b = read_payload(&packet[0], packet.size());
+    ck_assert_uint_eq(b.timestamp, NOW / 1000);
+    ck_assert(b.hasSeq);
+    ck_assert_uint_eq(b.seq, 1);
+
+    /* the node without a value is left out */
+    static const uint64_t types[] = {3, 2, 8, 9, 10, 11, 12, 13, 24, 33};
+    ck_assert_uint_eq(b.metrics.size(), NODES - 1);
+    uint64_t base = b.metrics[0].alias;
+    for(size_t k = 0; k < b.metrics.size(); k++) {
+        const Metric& m = b.metrics[k];
+        ck_assert_str_eq(m.name.c_str(), aliases[k]);
+        ck_assert(m.hasAlias);
+        ck_assert_uint_eq(m.alias, base + k);
+        ck_assert_uint_eq(m.datatype, types[k]);
+        ck_assert_uint_eq(m.timestamp, NOW / 1000);
+        ck_assert(!m.isNull);
+    }
+    ck_assert_int_eq(b.metrics[0].field, 10);
+    ck_assert_uint_eq(b.metrics[0].value, 0xfffffffbU);
+    ck_assert_int_eq(b.metrics[1].field, 10);
+    ck_assert_uint_eq(b.metrics[1].value, 0xfffffffeU);
+    ck_assert_int_eq(b.metrics[2].field, 11);
+    ck_assert(b.metrics[2].value == UINT64_MAX);
+    ck_assert_int_eq(b.metrics[3].field, 12);
+    ck_assert_uint_eq(b.metrics[3].value, 0x3fc00000U);
+    ck_assert_int_eq(b.metrics[4].field, 13);
+    ck_assert(b.metrics[4].value == 0x4004000000000000ULL);
+    ck_assert_int_eq(b.metrics[5].field, 14);
+    ck_assert_uint_eq(b.metrics[5].value, 1);
+    ck_assert_int_eq(b.metrics[6].field, 15);
+    ck_assert_str_eq(b.metrics[6].bytes.c_str(), "abc");
+    ck_assert_int_eq(b.metrics[7].field, 11);
+    ck_assert_uint_eq(b.metrics[7].value, 1234);
+    /* arrays : packed little endian, strings null terminated */
+    ck_assert_int_eq(b.metrics[8].field, 16);
+    ck_assert_str_eq(hex((const unsigned char*)b.metrics[8].bytes.data(), b.metrics[8].bytes.size()),
+                     "01000000ffffffff");
+    ck_assert_int_eq(b.metrics[9].field, 16);
+    ck_assert(b.metrics[9].bytes == string("a\0bc\0", 5));
+
+    /* born : the changed values by alias */
+    i32 = 7;
+    f64 = -0.5;
+    UA_DataValue changed[2] = {values[0], values[4]};
+    Node* changedNodes[2] = {nodes[0], nodes[4]};
+    sparkplug_publish(&g, changedNodes, changed, 2, enumTsBridge, NOW + 1000);
+    ck_assert_str_eq(sentMode.c_str(), "DDATA");
+    ck_assert_str_eq(sentTopic.c_str(), "spBv1.0/Plant/DDATA/Bridge/line_1");
+    ck_assert(send_copy(packet));
+    Payload d = read_payload(&packet[0], packet.size());
+    ck_assert_uint_eq(d.timestamp, NOW / 1000 + 1);
+    ck_assert_uint_eq(d.seq, 2);
+    ck_assert_uint_eq(d.metrics.size(), 2);
+    ck_assert(d.metrics[0].name.empty());
+    ck_assert_uint_eq(d.metrics[0].alias, base);
+    ck_assert_uint_eq(d.metrics[0].datatype, 0);
+    ck_assert_uint_eq(d.metrics[0].value, 7);
+    ck_assert_uint_eq(d.metrics[1].alias, base + 4);
+    ck_assert(d.metrics[1].value == 0xbfe0000000000000ULL);
+
+    /* another datatype : born again, with the same aliases */
+    UA_Double f = 3.0;
+    UA_Variant_setScalar(&changed[0].value, &f, &UA_TYPES[UA_TYPES_DOUBLE]);
+    sparkplug_publish(&g, changedNodes, changed, 1, enumTsBridge, NOW);
+    ck_assert_str_eq(sentMode.c_str(), "DBIRTH");
+    ck_assert(send_copy(packet));
+    b = read_payload(&packet[0], packet.size());
+    ck_assert_uint_eq(b.seq, 3);
+    ck_assert_uint_eq(b.metrics.size(), NODES - 1);
+    ck_assert_uint_eq(b.metrics[0].alias, base);
+    ck_assert_uint_eq(b.metrics[0].datatype, 10);
+    /* the nodes without a value in this read are null */
+    ck_assert(b.metrics[1].isNull);
+    ck_assert_uint_eq(b.metrics[1].datatype, 2);
+    ck_assert_int_eq(b.metrics[1].field, 0);
+
+    /* the DBIRTH is lost : no DDATA until the next one */
+    sparkplug_publish(&g, changedNodes, changed, 1, enumTsBridge, NOW);
+    ck_assert_str_eq(sentMode.c_str(), "DDATA");
+    free(sparkplug_node_birth(birthTopic, sizeof(birthTopic), &birthLen));
+    ck_assert(!send_copy(packet));
+    sparkplug_publish(&g, changedNodes, changed, 1, enumTsBridge, NOW);
+    ck_assert_str_eq(sentMode.c_str(), "DBIRTH");
+    ck_assert(send_copy(packet));
+    ck_assert_uint_eq(read_payload(&packet[0], packet.size()).seq, 1);
+
+    sparkplug_device_death(&g);
+    ck_assert_str_eq(sentMode.c_str(), "DDEATH");
+    ck_assert_str_eq(sentTopic.c_str(), "spBv1.0/Plant/DDEATH/Bridge/line_1");
+    ck_assert(send_copy(packet));
+    d = read_payload(&packet[0], packet.size());
+    ck_assert_uint_eq(d.seq, 2);
+    ck_assert_uint_eq(d.metrics.size(), 0);
+}
+END_TEST
+
+/* seq runs 0..255, in the two bytes left for it */
+START_TEST(sequenceWraps) {
+    char birthTopic[128];
+    size_t birthLen;
+    free(sparkplug_node_birth(birthTopic, sizeof(birthTopic), &birthLen));
+
+    char topic[] = "spBv1.0/Plant/DDEATH/Bridge/line_1";
+    unsigned char data[] = {0x08, 0x01, 0x18, 0x80, 0x00};
+    SinkMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.mode = "DDEATH";
+    msg.topic = topic;
+    msg.data = (char*)data;
+    msg.len = sizeof(data);
+
+    for(unsigned int k = 1; k < 300; k++) {
+        unsigned char packet[sizeof(data)];
+        memcpy(packet, data, sizeof(packet));
+        ck_assert(sparkplug_sequence(&msg, packet));
+        ck_assert_uint_eq(read_payload(packet, sizeof(packet)).seq, k % 256);
+        if(k == 127)
+            ck_assert_str_eq(hex(packet + 3, 2), "ff00");
+        if(k == 128)
+            ck_assert_str_eq(hex(packet + 3, 2), "8001");
+    }
+    /* the message itself is shared with the other sinks */
+    ck_assert_str_eq(hex(data, sizeof(data)), "0801188000");
+
+    /* not sparkplug : left as it is */
+    char other[] = "bridge/line/1";
+    msg.topic = other;
+    msg.mode = "DDATA";
+    ck_assert(sparkplug_sequence(&msg, data));
+    ck_assert_str_eq(hex(data, sizeof(data)), "0801188000");
+}
+END_TEST
+
+static Suite* testSuite_sparkplug(void) {
+    Suite* s = suite_create("MQTT Sparkplug B");
+    TCase* tc_node = tcase_create("Edge node");
+    tcase_add_checked_fixture(tc_node, setup, NULL);
+    tcase_add_test(tc_node, commandTopic);
+    tcase_add_test(tc_node, deathCertificate);
+    tcase_add_test(tc_node, rebirthCommand);
+    suite_add_tcase(s, tc_node);
+
+    TCase* tc_device = tcase_create("Devices");
+    tcase_add_checked_fixture(tc_device, setup, NULL);
+    tcase_add_test(tc_device, deviceBirthAndData);
+    tcase_add_test(tc_device, sequenceWraps);
+    suite_add_tcase(s, tc_device);
+    return s;
+}
+
+int main(void) {
+    Suite* s = testSuite_sparkplug();
+    SRunner* sr = srunner_create(s);
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}